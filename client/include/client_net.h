@@ -28,6 +28,9 @@
 #define REMOTE_INTERP_MIDL 0.004
 #define REMOTE_INTERP_LOW  0.005
 
+#define NET_MAP_CACHE_DIR "res/mapcache"
+#define NET_MAP_CACHE_PATH_MAX 64
+
 typedef struct waapp waapp_t;
 typedef struct fdevent fdevent_t;
 
@@ -86,6 +89,11 @@ typedef struct
 	const char* ipaddr;
 	u16 port;
 
+	/* Received snapshots, kept as baselines for the server's deltas. */
+	net_snapshot_ring_t snapshots;
+	u32 snapshot_seq;	// Last applied
+	u32 shared_tick;	// Last server shared block applied
+
 	fdevent_t* fdev;
 } client_udp_t;
 
@@ -98,6 +106,7 @@ typedef struct
 	u32 player_id;
 
 	netdef_t def;
+	net_codec_t codec;
 
 	struct {
 		ssp_tcp_sock_t	sock;
@@ -107,6 +116,12 @@ typedef struct
 
 	client_udp_t udp;
 
+	/* NET_TCP_CG_MAP_INFO, checked against the blob before it gets cached. */
+	struct {
+		u64 hash;
+		u32 size;
+	} map;
+
 	array_t events;
 	server_stats_t server_stats;
 
@@ -123,6 +138,7 @@ void client_net_poll(waapp_t* app);
 // void client_net_poll(waapp_t* app, i32 timeout);
 void client_net_try_udp_flush(waapp_t* app);
 void client_net_get_stats(waapp_t* app);
+void client_net_map_cache_path(char* path, u32 size, u64 hash);
 void client_net_set_tickrate(waapp_t* app, f64 tickrate);
 fdevent_t* client_net_add_fdevent(waapp_t* app, sock_t fd, 
 							fdevent_callback_t read, 
@@ -4,5 +4,6 @@
 #include "array.h"
 
 array_t* dir_files(const char* dir_path);
+bool make_dir(const char* dir_path);
 
 #endif // _WA_OPENGL_FILE_H_
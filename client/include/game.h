@@ -63,6 +63,7 @@ typedef struct client_game
 	progress_bar_t guncharge_bar;
 
 	u8 prev_input;
+	vec2f_t sent_view;
 
 	char ui_label[UI_LABEL_SIZE];
 
@@ -22,6 +22,9 @@ void game_player_reload(const ssp_segment_t* segment, waapp_t* app, UNUSED void*
 void game_player_gun_state(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _);
 void game_username_change(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _);
 void game_rewind_bullet(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _);
+void game_player_enter(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _);
+void game_player_leave(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _);
+void game_snapshot(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _);
 void udp_test(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _);
 void game_bullet(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _);
 void game_player_gun_state(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _);
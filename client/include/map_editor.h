@@ -13,6 +13,7 @@ typedef struct
 {
 	u32 id;
 	cg_map_header_t header;
+	u32 version;	// cg_map_header_version(), 0 until saved
 	char path[MAP_PATH_MAX];
 	char name[MAP_NAME_MAX];
 	i32 selected;
@@ -135,6 +135,47 @@ session_id(const ssp_segment_t* segment, waapp_t* app, UNUSED void* source_data)
 		sessionid->session_id, sessionid->player_id);
 }
 
+void
+client_net_map_cache_path(char* path, u32 size, u64 hash)
+{
+	snprintf(path, size, "%s/%016llx.cgmapc", NET_MAP_CACHE_DIR, (unsigned long long)hash);
+}
+
+/**
+ *	The server's map by hash. On a cache hit the map loads from the cache
+ *	and the server skips sending it. Either way the answer is what makes
+ *	the server add our player, bot mode goes along with it.
+ */
+static void
+cg_map_info(const ssp_segment_t* segment, waapp_t* app, UNUSED void* source_data)
+{
+	const net_tcp_cg_map_info_t* info = (const net_tcp_cg_map_info_t*)segment->data;
+	client_net_t* net = &app->net;
+	net_tcp_cg_map_request_t request;
+	net_tcp_bot_mode_t bot_mode;
+	char path[NET_MAP_CACHE_PATH_MAX];
+
+	net->map.hash = info->hash;
+	net->map.size = info->size;
+
+	client_net_map_cache_path(path, NET_MAP_CACHE_PATH_MAX, info->hash);
+	app->map_from_server = cg_map_load_cache(path, info->hash);
+	if (app->map_from_server)
+	{
+		net_codec_set_world(&app->net.codec, app->map_from_server);
+		debug("Map %016llx (%u bytes) loaded from cache.\n", (unsigned long long)info->hash, info->size);
+	}
+
+	request.want_map = (app->map_from_server == NULL);
+	ssp_io_push_ref(&net->tcp.io, NET_TCP_CG_MAP_REQUEST, sizeof(net_tcp_cg_map_request_t), &request);
+	if (app->bot)
+	{
+		bot_mode.is_bot = app->bot;
+		ssp_io_push_ref(&net->tcp.io, NET_TCP_BOT_MODE, sizeof(net_tcp_bot_mode_t), &bot_mode);
+	}
+	ssp_tcp_send_io(&net->tcp.sock, &net->tcp.io);
+}
+
 static void
 client_net_on_connect(waapp_t* app)
 {
@@ -151,14 +192,8 @@ client_net_on_connect(waapp_t* app)
 	net_tcp_connect_t connect;
 	memset(&connect, 9, sizeof(net_tcp_connect_t));
 	strncpy(connect.username, username, PLAYER_NAME_MAX);
-	net_tcp_bot_mode_t bot_mode;
 
 	ssp_io_push_ref(&net->tcp.io, NET_TCP_CONNECT, sizeof(net_tcp_connect_t), &connect);
-	if (app->bot)
-	{
-		bot_mode.is_bot = app->bot;
-		ssp_io_push_ref(&net->tcp.io, NET_TCP_BOT_MODE, sizeof(net_tcp_bot_mode_t), &bot_mode);
-	}
 	ssp_tcp_send_io(&net->tcp.sock, &net->tcp.io);
 
 	client_net_udp_init(app);
@@ -376,6 +411,12 @@ udp_read(waapp_t* app, fdevent_t* fdev)
 	net->udp.in.count++;
 	net->def.ssp_ctx.current_time = app->timer.start_time_s;
 
+	if (netdef_shared_process(&net->def, buf, bytes_read, net->session_id, &net->udp.shared_tick, &addr))
+	{
+		free(buf);
+		return;
+	}
+
 	ssp_io_process_params_t params = {
 		.ctx = NULL,
 		.io = &net->udp.io,
@@ -406,6 +447,7 @@ udp_close(waapp_t* app)
 #elif _WIN32
 	closesocket(net->udp.fd);
 #endif
+	net_snapshot_ring_destroy(&net->udp.snapshots);
 	memset(&net->udp, 0, sizeof(client_udp_t));
 }
 
@@ -453,6 +495,7 @@ udp_info(const ssp_segment_t* segment, waapp_t* app, UNUSED void* source_data)
 	app->net.udp.port = info->port;
 
 	ssp_io_init(&app->net.udp.io, &app->net.def.ssp_ctx, info->ssp_flags);
+	app->net.udp.snapshot_seq = NET_SNAPSHOT_NONE;
 
 	waapp_state_switch(app, &app->sm.states.game);
 }
@@ -488,7 +531,7 @@ udp_pong(const ssp_segment_t* segment, waapp_t* app, UNUSED void* data)
 
 	ssp_io_set_rtt(&net->udp.io, player_ping->ms);
 
-	ssp_io_push_ref(&net->udp.io, NET_UDP_PLAYER_PING, sizeof(net_udp_player_ping_t), player_ping);
+	netdef_push_ref(&net->codec, &net->udp.io, NET_UDP_PLAYER_PING, sizeof(net_udp_player_ping_t), player_ping);
 	if (app->game->ignore_auto_interp)
 		return;
 
@@ -608,6 +651,12 @@ net_verify_session(u32 session_id, waapp_t* app,
 	return session_id == app->net.session_id;
 }
 
+static const net_codec_t*
+client_net_codec(waapp_t* app, UNUSED void* source_data)
+{
+	return &app->net.codec;
+}
+
 i32 
 client_net_init(waapp_t* app)
 {
@@ -626,6 +675,7 @@ client_net_init(waapp_t* app)
 	callbacks[NET_UDP_PLAYER_STATS] = (ssp_segment_callback_t)game_player_stats;
 	callbacks[NET_UDP_PLAYER_PING] = (ssp_segment_callback_t)game_player_ping;
 	callbacks[NET_TCP_CG_MAP] = (ssp_segment_callback_t)game_cg_map;
+	callbacks[NET_TCP_CG_MAP_INFO] = (ssp_segment_callback_t)cg_map_info;
 	callbacks[NET_TCP_SERVER_SHUTDOWN] = (ssp_segment_callback_t)game_server_shutdown;
 	callbacks[NET_UDP_SERVER_STATS] = (ssp_segment_callback_t)server_stats;
 	callbacks[NET_TCP_CHAT_MSG] = (ssp_segment_callback_t)game_chat_msg;
@@ -637,10 +687,15 @@ client_net_init(waapp_t* app)
 	callbacks[NET_UDP_PLAYER_GUN_STATE] = (ssp_segment_callback_t)game_player_gun_state;
 	callbacks[NET_TCP_USERNAME_CHANGE] = (ssp_segment_callback_t)game_username_change;
 	callbacks[NET_UDP_BULLET] = (ssp_segment_callback_t)game_rewind_bullet;
+	callbacks[NET_UDP_SNAPSHOT] = (ssp_segment_callback_t)game_snapshot;
+	callbacks[NET_UDP_PLAYER_ENTER] = (ssp_segment_callback_t)game_player_enter;
+	callbacks[NET_UDP_PLAYER_LEAVE] = (ssp_segment_callback_t)game_player_leave;
 
 	netdef_init(&net->def, NULL, callbacks);
 	net->def.ssp_ctx.user_data = app;
 	net->def.ssp_ctx.verify_session = (ssp_session_verify_callback_t)net_verify_session;
+	net->def.codec_of = (netdef_codec_func_t)client_net_codec;
+	net_codec_init(&net->codec, &app->mmf);
 
 	array_init(&net->events, sizeof(fdevent_t), 4);
 
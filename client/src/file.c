@@ -6,6 +6,8 @@
 #include <windows.h>
 #elif __linux__
 #include <dirent.h>
+#include <sys/stat.h>
+#include <errno.h>
 #endif
 
 #define PATH_SIZE 512
@@ -41,6 +43,18 @@ dir_files(const char* dir_path)
     closedir(dir);
     return array;
 }
+
+/* True if `dir_path` exists as a directory afterwards. */
+bool
+make_dir(const char* dir_path)
+{
+    if (mkdir(dir_path, 0755) == -1 && errno != EEXIST)
+    {
+        perror("mkdir");
+        return false;
+    }
+    return true;
+}
 #endif // __linux__
 
 #ifdef _WIN32
@@ -79,4 +93,16 @@ dir_files(const char* _dir_path)
     FindClose(hfind);
     return array;
 }
+
+bool
+make_dir(const char* dir_path)
+{
+    if (CreateDirectory(dir_path, NULL) == 0 && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        fprintf(stderr, "make_dir: CreateDirectory(%s) failed: %lX\n", 
+                dir_path, GetLastError());
+        return false;
+    }
+    return true;
+}
 #endif // _WIN32
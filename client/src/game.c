@@ -38,13 +38,23 @@ game_clamp_cam(vec3f_t* cam, const cg_runtime_map_t* map, const ren_t* ren)
 	cam->y = clampf(cam->y, -max_y, offset);
 }
 
+static void
+game_push_cursor(client_game_t* game)
+{
+	net_udp_player_cursor_t* cursor = mmframes_alloc(&game->app->mmf, sizeof(net_udp_player_cursor_t));
+	cursor->cursor_pos = game->player->core->cursor;
+	cursor->player_id = game->player->core->id;
+
+	netdef_push_ref(&game->net->codec, &game->net->udp.io, NET_UDP_PLAYER_CURSOR, sizeof(net_udp_player_cursor_t), cursor);
+}
+
 void
 game_lock_cam(client_game_t* game)
 {
 	player_t* player = game->player;
 	vec2f_t origin = vec2f(
-		player->core->pos.x + (player->core->size.x / 2),
-		player->core->pos.y + (player->core->size.y / 2)
+		CG_PLAYER_POS(player->core).x + (player->core->size.x / 2),
+		CG_PLAYER_POS(player->core).y + (player->core->size.y / 2)
 	);
 
 	const vec2f_t* viewport = &game->ren->viewport;
@@ -56,7 +66,7 @@ game_lock_cam(client_game_t* game)
 	ren_set_view(game->ren, &game->app->cam);
 
 	player->core->cursor = screen_to_world(game->ren, &game->app->mouse);
-	ssp_io_push_ref(&game->net->udp.io, NET_UDP_PLAYER_CURSOR, sizeof(vec2f_t), &player->core->cursor);
+	game_push_cursor(game);
 }
 
 static void
@@ -78,9 +88,10 @@ game_handle_num_keys(client_game_t* game, const wa_event_key_t* ev)
 	
 	if (coregame_player_change_gun(&game->cg, game->player->core, gun_id))
 	{
-		u32* udp_gun_id = mmframes_alloc(&game->app->mmf, sizeof(u32));
-		*udp_gun_id = gun_id;
-		ssp_io_push_ref_i(&game->net->udp.io, NET_UDP_PLAYER_GUN_ID, sizeof(u32), udp_gun_id);
+		net_udp_player_gun_id_t* udp_gun_id = mmframes_alloc(&game->app->mmf, sizeof(net_udp_player_gun_id_t));
+		udp_gun_id->gun_id = gun_id;
+		udp_gun_id->player_id = game->player->core->id;
+		netdef_push_ref_i(&game->net->codec, &game->net->udp.io, NET_UDP_PLAYER_GUN_ID, sizeof(net_udp_player_gun_id_t), udp_gun_id);
 	}
 }
 
@@ -90,7 +101,7 @@ game_move_bots(client_game_t* game)
 	net_udp_move_bot_t* move_bot = mmframes_alloc(&game->app->mmf, sizeof(net_udp_move_bot_t));
 	move_bot->pos = game->player->core->cursor;
 
-	ssp_io_push_ref_i(&game->net->udp.io, NET_UDP_MOVE_BOT, sizeof(net_udp_move_bot_t), move_bot);
+	netdef_push_ref_i(&game->net->codec, &game->net->udp.io, NET_UDP_MOVE_BOT, sizeof(net_udp_move_bot_t), move_bot);
 }
 
 static void
@@ -183,7 +194,7 @@ game_handle_pointer(client_game_t* game, UNUSED const wa_event_pointer_t* ev)
 	if (game->player)
 	{
 		game->player->core->cursor = screen_to_world(game->ren, &game->app->mouse);
-		ssp_io_push_ref(&game->net->udp.io, NET_UDP_PLAYER_CURSOR, sizeof(vec2f_t), &game->player->core->cursor);
+		game_push_cursor(game);
 	}
 }
 
@@ -253,13 +264,37 @@ on_player_free(cg_player_t* player)
 }
 
 static void
-game_serialize_player_input(net_udp_player_input_t* out_input, client_game_t* game, UNUSED u16 size)
+game_serialize_player_input(void* dst, client_game_t* game, UNUSED u16 size)
 {
+	net_udp_player_input_t input = {0};
+
 	nano_gettime(&game->app->timer.start_time);
 	game->app->timer.start_time_s = nano_time_s(&game->app->timer.start_time);
-	out_input->timestamp = (sec_to_ms(game->app->timer.start_time_s) + game->net->udp.time_offset) - ((game->net->udp.latency + game->net->udp.jitter) / 2);
-	out_input->timestamp += sec_to_ms(game->net->udp.interval);
-	out_input->flags = game->player->input;
+	input.timestamp = (sec_to_ms(game->app->timer.start_time_s) + game->net->udp.time_offset) - ((game->net->udp.latency + game->net->udp.jitter) / 2);
+	input.timestamp += sec_to_ms(game->net->udp.interval);
+	input.flags = game->player->input;
+
+	netdef_encode(&game->net->codec, NET_UDP_PLAYER_INPUT, dst, &input);
+}
+
+/* Lets the server size our area of interest to what the camera covers. */
+static void
+game_push_view(client_game_t* game)
+{
+	const vec2f_t view = {
+		game->ren->viewport.x / game->ren->scale.x,
+		game->ren->viewport.y / game->ren->scale.y,
+	};
+	net_udp_player_view_t* player_view;
+
+	if (view.x <= 0 || view.y <= 0 || 
+		(view.x == game->sent_view.x && view.y == game->sent_view.y))
+		return;
+
+	player_view = mmframes_alloc(&game->app->mmf, sizeof(net_udp_player_view_t));
+	player_view->size = view;
+	ssp_io_push_ref_i(&game->net->udp.io, NET_UDP_PLAYER_VIEW, sizeof(net_udp_player_view_t), player_view);
+	game->sent_view = view;
 }
 
 static void 
@@ -270,24 +305,27 @@ game_update_logic(client_game_t* game)
 		return;
 
 	coregame_update(&game->cg);
-	progress_bar_update(&game->health_bar);
+	coregame_dispatch_events(&game->cg);
+	progress_bar_update_valmax(&game->health_bar, CG_PLAYER_HEALTH(player->core), player->core->max_health);
 	player_update_guncharge(game->player, &game->guncharge_bar);
 
-	if (game->prev_pos.x != player->core->pos.x || game->prev_pos.y != player->core->pos.y)
+	if (game->prev_pos.x != CG_PLAYER_POS(player->core).x || game->prev_pos.y != CG_PLAYER_POS(player->core).y)
 	{
 		if (game->lock_cam)
 			game_lock_cam(game);
-		game->prev_pos = player->core->pos;
+		game->prev_pos = CG_PLAYER_POS(player->core);
 	}
 	if (game->player->input != game->prev_input)
 	{
 		coregame_set_player_input(player->core, player->input);
 		game->ignore_server_pos = true;
 
-		ssp_io_push_hook_ref_i(&game->net->udp.io, NET_UDP_PLAYER_INPUT, sizeof(net_udp_player_input_t), game, 
+		ssp_io_push_hook_ref_i(&game->net->udp.io, NET_UDP_PLAYER_INPUT, 
+						netdef_packed_size(NET_UDP_PLAYER_INPUT, sizeof(net_udp_player_input_t)), game, 
 						(ssp_copy_hook_t)game_serialize_player_input);
 		game->prev_input = player->input;
 	}
+	game_push_view(game);
 
 	client_net_try_udp_flush(game->app);
 
@@ -448,6 +486,7 @@ game_init(waapp_t* app)
 	game->nk_ctx = app->nk_ctx;
 
 	coregame_init(&game->cg, app->map_from_server);
+	coregame_set_fixed_step(&game->cg, game->net->udp.interval, CG_MAX_SUBSTEPS);
 
 	game_init_add_gun_specs(app, game);
 	game->cg.user_data = game;
@@ -20,11 +20,11 @@ game_render_player_body(ren_t* ren, player_t* player)
 }
 
 static void 
-game_render_player(ren_t* ren, player_t* player)
+game_render_player(ren_t* ren, const coregame_t* cg, player_t* player)
 {
 	progress_bar_t* hpbar = &player->hpbar;
 
-	player->rect.pos = player->core->pos;
+	player->rect.pos = coregame_lerp_pos(cg, &player->core->step_prev_pos, &CG_PLAYER_POS(player->core));
 	player->gun_rect.pos = vec2f(
 		player->rect.pos.x - ((player->gun_rect.size.x - player->rect.size.x) / 2),
 		player->rect.pos.y - ((player->gun_rect.size.y - player->rect.size.y) / 2)
@@ -86,12 +86,12 @@ game_render_bullet_debug(client_game_t* game, const cg_bullet_t* bullet)
 static void
 game_render_bullets(client_game_t* game)
 {
-	ght_t* bullets = &game->cg.bullets;
-	GHT_FOREACH(const cg_bullet_t* bullet, bullets, 
+	cg_registry_t* bullets = &game->cg.bullets;
+	CG_REGISTRY_FOREACH(const cg_bullet_t* bullet, bullets, 
 	{
 		const laser_bullet_t* bullet_data = bullet->data;
 		laser_draw_data_t draw_data;
-		draw_data.v.pos_a = bullet->r.pos;
+		draw_data.v.pos_a = coregame_lerp_pos(&game->cg, &bullet->step_prev_pos, &bullet->r.pos);
 		draw_data.laser_data = bullet_data;
 		draw_data.v.pos_b.x = draw_data.v.pos_a.x + bullet_data->len * -bullet->dir.x;
 		draw_data.v.pos_b.y = draw_data.v.pos_a.y + bullet_data->len * -bullet->dir.y;
@@ -121,11 +121,13 @@ static void
 game_render_players(client_game_t* game)
 {
 	ren_bind_bro(game->ren, game->ren->default_bro);
-	const ght_t* players = &game->cg.players;
-	GHT_FOREACH(cg_player_t* cg_player, players, {
+	const cg_registry_t* players = &game->cg.players;
+	CG_REGISTRY_FOREACH(cg_player_t* cg_player, players, {
 		player_t* player = cg_player->user_data;
-		if (cg_player->dir.x || cg_player->dir.y)
-			player->rect.rotation = atan2(cg_player->dir.y, cg_player->dir.x) + M_PI / 2;
+		if (cg_player->out_of_view)
+			continue;
+		if (CG_PLAYER_DIR(cg_player).x || CG_PLAYER_DIR(cg_player).y)
+			player->rect.rotation = atan2(CG_PLAYER_DIR(cg_player).y, CG_PLAYER_DIR(cg_player).x) + M_PI / 2;
 
 		const vec2f_t origin = rect_origin(&player->rect);
 		player->gun_rect.rotation = angle(&origin, &player->core->cursor);
@@ -162,19 +164,18 @@ game_render_players(client_game_t* game)
 		if (game->game_netdebug)
 			game_render_player_server_pos(game, cg_player);
 
-		game_render_player(game->ren, player);
+		game_render_player(game->ren, &game->cg, player);
 	});
 }
 
 UNUSED static void 
-game_render_cell_debug(ren_t* ren, rect_t* cell_rect, const cg_runtime_cell_t* cell)
+game_render_cell_debug(ren_t* ren, rect_t* cell_rect, const cg_runtime_map_t* map, const cg_runtime_cell_t* cell)
 {
 	if (cell->type != CG_CELL_BLOCK)
 	{
-		const cg_empty_cell_data_t* data = cell->data;
+		const cg_empty_cell_data_t* data = cg_map_occupancy(map, cell);
 		vec4f_t new_color = rgba(0xFFFFFF00);
-		for (u32 i = 0; i < data->contents.count; i++)
-			new_color.w += 0.3;
+		new_color.w += 0.3 * ((data) ? data->count : 0);
 
 		cell_rect->texture = NULL;
 		cell_rect->color = new_color;
@@ -205,7 +206,7 @@ game_render_cell(waapp_t* app, const cg_runtime_map_t* map, const cg_runtime_cel
 	ren_draw_rect(ren, &cell_rect);
 
 	// if (app->game && app->game->game_debug)
-	// 	game_render_cell_debug(ren, &cell_rect, cell);
+	// 	game_render_cell_debug(ren, &cell_rect, map, cell);
 }
 
 static void
@@ -1,6 +1,7 @@
 #define _GNU_SOURCE
 #include "game_net_events.h"
 #include "main_menu.h"
+#include "file.h"
 
 void 
 game_new_player(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
@@ -10,15 +11,24 @@ game_new_player(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 
 	cg_player_t* cg_player = calloc(1, sizeof(cg_player_t));
 	cg_player->id = new_player->id;
-	cg_player->server_pos = cg_player->pos = new_player->pos;
 	cg_player->size = new_player->size;
-	cg_player->dir = new_player->dir;
 	cg_player->cursor = new_player->cursor;
-	cg_player->health = new_player->health;
 	cg_player->max_health = new_player->max_health;
 	cg_player->shoot = new_player->shoot;
+	/* Hidden until the server says it's in our area of interest. */
+	cg_player->out_of_view = (cg_player->id != app->net.player_id);
 	strncpy(cg_player->username, new_player->username, PLAYER_NAME_MAX);
 
+	if (coregame_add_player_from(&game->cg, cg_player) == false)
+	{
+		free(cg_player);
+		return;
+	}
+	coregame_set_player_pos(&game->cg, cg_player, new_player->pos);
+	cg_player->server_pos = new_player->pos;
+	CG_PLAYER_DIR(cg_player) = new_player->dir;
+	CG_PLAYER_HEALTH(cg_player) = new_player->health;
+
 	coregame_create_gun(&app->game->cg, new_player->gun_id, cg_player);
 
 	player_t* player = player_new_from(app->game, cg_player);
@@ -35,7 +45,8 @@ game_new_player(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 		player->hpbar.fill.color = rgba(0x00FF00FF);
 
 		progress_bar_init(&game->health_bar, vec2f(0, 0), vec2f(250, 30), 
-							&cg_player->max_health, &cg_player->health, 0);
+							NULL, NULL, 0);
+		progress_bar_update_valmax(&game->health_bar, CG_PLAYER_HEALTH(cg_player), cg_player->max_health);
 		game->health_bar.fill.color = player->hpbar.fill.color;
 
 		progress_bar_init(&game->guncharge_bar, vec2f(0, 0), vec2f(250, 20), 
@@ -46,8 +57,6 @@ game_new_player(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 
 		game->cg.local_player = cg_player;
 	}
-
-	coregame_add_player_from(&app->game->cg, cg_player);
 }
 
 void 
@@ -55,7 +64,7 @@ game_delete_player(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 {
 	const net_tcp_delete_player_t* del_player = (const net_tcp_delete_player_t*)segment->data;
 
-	cg_player_t* player = ght_get(&app->game->cg.players, del_player->player_id);
+	cg_player_t* player = cg_registry_get(&app->game->cg.players, del_player->player_id);
 	if (player == NULL)
 		return;
 
@@ -66,20 +75,32 @@ game_delete_player(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 	coregame_free_player(&app->game->cg, player);
 }
 
+static void
+game_set_server_pos(waapp_t* app, cg_player_t* player, vec2f_t server_pos)
+{
+	const vec2f_t* client_pos = &CG_PLAYER_POS(player);
+	f32 dist = coregame_dist(client_pos, &server_pos);
+
+	player->server_pos = server_pos;
+
+	if (dist > app->game->cg.interp_threshold_dist)
+		player->interpolate = true;
+	else
+		CG_PLAYER_POS(player) = server_pos;
+}
+
 void 
 game_player_move(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 {
 	const net_udp_player_move_t* move = (net_udp_player_move_t*)segment->data;
-	const vec2f_t server_pos = move->pos;
-	const vec2f_t* client_pos;
-	cg_player_t* player = ght_get(&app->game->cg.players, move->player_id);
+	cg_player_t* player = cg_registry_get(&app->game->cg.players, move->player_id);
 	// client_game_t* game = app->game;
 
 	if (player)
 	{
 		if (move->absolute)
 		{
-			player->pos = player->server_pos = move->pos;
+			player->step_prev_pos = CG_PLAYER_POS(player) = player->server_pos = move->pos;
 			return;
 		}
 
@@ -88,10 +109,6 @@ game_player_move(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 		// else
 		// 	game->ignore_server_pos = false;
 
-		client_pos = &player->pos;
-
-		f32 dist = coregame_dist(client_pos, &server_pos);
-
 		// if (player->input != move->input && player->ignore_count < 3)
 		// {
 		// 	// player->ignore_count++;
@@ -100,12 +117,7 @@ game_player_move(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 		// else
 		// 	player->ignore_count = 0;
 
-		player->server_pos = server_pos;
-
-		if (dist > app->game->cg.interp_threshold_dist)
-			player->interpolate = true;
-		else
-			player->pos = server_pos;
+		game_set_server_pos(app, player, move->pos);
 		
 		// if (player->id == game->player->core->id)
 		// {
@@ -122,27 +134,32 @@ void
 game_player_cursor(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 {
 	const net_udp_player_cursor_t* cursor = (net_udp_player_cursor_t*)segment->data;
-	cg_player_t* player = ght_get(&app->game->cg.players, cursor->player_id);
+	cg_player_t* player = cg_registry_get(&app->game->cg.players, cursor->player_id);
 	if (player)
 	{
 		player->cursor = cursor->cursor_pos;
 	}
 }
 
+static void
+game_set_player_health(waapp_t* app, cg_player_t* cg_player, f32 health)
+{
+	player_t* player = cg_player->user_data;
+
+	CG_PLAYER_HEALTH(cg_player) = health;
+	progress_bar_update_valmax(&player->hpbar, health, cg_player->max_health);
+
+	if (cg_player->id == app->game->player->core->id)
+		progress_bar_update_valmax(&app->game->health_bar, health, cg_player->max_health);
+}
+
 void 
 game_player_health(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 {
 	const net_udp_player_health_t* health = (net_udp_player_health_t*)segment->data;
-	cg_player_t* cg_player = ght_get(&app->game->cg.players, health->player_id);
+	cg_player_t* cg_player = cg_registry_get(&app->game->cg.players, health->player_id);
 	if (cg_player)		
-	{
-		cg_player->health = health->health;
-		player_t* player = cg_player->user_data;
-		progress_bar_update(&player->hpbar);
-
-		if (cg_player->id == app->game->player->core->id)
-			progress_bar_update(&app->game->health_bar);
-	}
+		game_set_player_health(app, cg_player, health->health);
 }
 
 void 
@@ -153,14 +170,14 @@ game_player_died(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 	cg_player_t* attacker;
 	player_kill_t* kill;
 
-	target = ght_get(&app->game->cg.players, died->target_player_id);
+	target = cg_registry_get(&app->game->cg.players, died->target_player_id);
 	if (target == NULL)
 	{
 		errorf("player_died: target player %u not found.\n",
 			died->target_player_id);
 		return;
 	}
-	attacker = ght_get(&app->game->cg.players, died->attacker_player_id);
+	attacker = cg_registry_get(&app->game->cg.players, died->attacker_player_id);
 	if (attacker == NULL)
 	{
 		errorf("player_died: attacker player %u not found.\n",
@@ -180,7 +197,7 @@ game_player_stats(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 	const net_udp_player_stats_t* stats = (const net_udp_player_stats_t*)segment->data;
 	cg_player_t* player;
 
-	player = ght_get(&app->game->cg.players, stats->player_id);
+	player = cg_registry_get(&app->game->cg.players, stats->player_id);
 	if (player)
 	{
 		player->stats.kills = stats->kills;
@@ -194,16 +211,30 @@ game_player_ping(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 	const net_udp_player_ping_t* ping = (const net_udp_player_ping_t*)segment->data;
 	cg_player_t* player;
 
-	if ((player = ght_get(&app->game->cg.players, ping->player_id)))
+	if ((player = cg_registry_get(&app->game->cg.players, ping->player_id)))
 		player->stats.ping = ping->ms;
 }
 
+/* Only sent on a map cache miss, cached for next time if it's what NET_TCP_CG_MAP_INFO said. */
 void 
 game_cg_map(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 {
 	const net_tcp_cg_map_t* tcp_map = (const net_tcp_cg_map_t*)segment->data;
+	char path[NET_MAP_CACHE_PATH_MAX];
 
 	app->map_from_server = cg_map_load_disk(tcp_map, segment->size);
+	if (app->map_from_server == NULL)
+		return;
+	net_codec_set_world(&app->net.codec, app->map_from_server);
+
+	if (segment->size != app->net.map.size || cg_map_hash(tcp_map, segment->size) != app->net.map.hash)
+	{
+		errorf("Map from server doesn't match its hash, not caching it.\n");
+		return;
+	}
+	client_net_map_cache_path(path, NET_MAP_CACHE_PATH_MAX, app->net.map.hash);
+	if (make_dir(NET_MAP_CACHE_DIR))
+		cg_map_save_cache(app->map_from_server, app->net.map.hash, path);
 }
 
 void 
@@ -223,7 +254,7 @@ game_chat_msg(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 
 	if (chatmsg->player_id == 0)
 		name = NULL;
-	else if ((player = ght_get(&app->game->cg.players, chatmsg->player_id)))
+	else if ((player = cg_registry_get(&app->game->cg.players, chatmsg->player_id)))
 		name = player->username;
 
 	game_add_chatmsg(app->game, name, chatmsg->msg);
@@ -257,7 +288,7 @@ void
 game_player_gun_id(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 {
 	const net_udp_player_gun_id_t* player_gun_id = (const net_udp_player_gun_id_t*)segment->data;
-	cg_player_t* player = ght_get(&app->game->cg.players, player_gun_id->player_id);
+	cg_player_t* player = cg_registry_get(&app->game->cg.players, player_gun_id->player_id);
 
 	if (player)
 		coregame_player_change_gun_force(&app->game->cg, player, player_gun_id->gun_id);
@@ -267,51 +298,92 @@ void
 game_player_input(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 {
 	const net_udp_player_input_t* input = (const net_udp_player_input_t*)segment->data;
-	cg_player_t* player = ght_get(&app->game->cg.players, input->player_id);
+	cg_player_t* player = cg_registry_get(&app->game->cg.players, input->player_id);
 
 	if (player)
 		coregame_set_player_input(player, input->flags);
 		// coregame_set_player_input_t(&app->game->cg, player, input->flags, input->timestamp);
 }
 
+void 
+game_player_enter(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
+{
+	const net_udp_player_enter_t* enter = (const net_udp_player_enter_t*)segment->data;
+	cg_player_t* player = cg_registry_get(&app->game->cg.players, enter->player_id);
+
+	if (player == NULL)
+		return;
+
+	player->step_prev_pos = CG_PLAYER_POS(player) = player->server_pos = enter->pos;
+	player->interpolate = false;
+	player->cursor = enter->cursor;
+	game_set_player_health(app, player, enter->health);
+	coregame_set_player_input(player, enter->input);
+
+	if (player->gun == NULL || player->gun->spec->id != enter->gun_id)
+		coregame_player_change_gun_force(&app->game->cg, player, enter->gun_id);
+	if (player->gun)
+		player->gun->ammo = enter->ammo;
+
+	player->out_of_view = false;
+}
+
+void 
+game_player_leave(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
+{
+	const net_udp_player_leave_t* leave = (const net_udp_player_leave_t*)segment->data;
+	cg_player_t* player = cg_registry_get(&app->game->cg.players, leave->player_id);
+
+	/* Server stops telling us about it, so don't keep simulating stale input. */
+	if (player && player != app->game->cg.local_player)
+	{
+		player->out_of_view = true;
+		coregame_set_player_input(player, 0);
+	}
+}
+
 void 
 game_player_reload(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 {
 	const net_udp_player_reload_t* reload = (const net_udp_player_reload_t*)segment->data;
-	cg_player_t* player = ght_get(&app->game->cg.players, reload->player_id);
+	cg_player_t* player = cg_registry_get(&app->game->cg.players, reload->player_id);
 
 	if (player)
 		coregame_player_reload(&app->game->cg, player);
 }
 
+static void
+game_set_player_gun_state(coregame_t* cg, cg_player_t* player, const net_udp_player_gun_state_t* gun_state)
+{
+	if (player->gun->spec->id != gun_state->gun_id)
+		coregame_player_change_gun_force(cg, player, gun_state->gun_id);
+
+	player->gun->ammo = gun_state->ammo;
+	player->gun->reload_time = gun_state->reload_timer;
+
+	if (player->shoot == false)
+	{
+		player->gun->bullet_timer = gun_state->bullet_timer;
+		player->gun->charge_time = gun_state->charge_timer;
+	}
+}
+
 void 
 game_player_gun_state(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 {
 	coregame_t* cg = &app->game->cg;
 	const net_udp_player_gun_state_t* gun_state = (const void*)segment->data;
-	cg_player_t* player = ght_get(&cg->players, gun_state->player_id);
+	cg_player_t* player = cg_registry_get(&cg->players, gun_state->player_id);
 
 	if (player)
-	{
-		if (player->gun->spec->id != gun_state->gun_id)
-			coregame_player_change_gun_force(cg, player, gun_state->gun_id);
-
-		player->gun->ammo = gun_state->ammo;
-		player->gun->reload_time = gun_state->reload_timer;
-
-		if (player->shoot == false)
-		{
-			player->gun->bullet_timer = gun_state->bullet_timer;
-			player->gun->charge_time = gun_state->charge_timer;
-		}
-	}
+		game_set_player_gun_state(cg, player, gun_state);
 }
 
 void 
 game_username_change(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 {
 	const net_tcp_username_change_t* change = (const void*)segment->data;
-	cg_player_t* player = ght_get(&app->game->cg.players, change->player_id);
+	cg_player_t* player = cg_registry_get(&app->game->cg.players, change->player_id);
 
 	if (player)
 	{
@@ -333,7 +405,7 @@ game_rewind_bullet(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 	client_game_t* game = app->game;
 	const net_udp_bullet_t* bullet_in = (const void*)segment->data;
 
-	cg_player_t* player = ght_get(&game->cg.players, bullet_in->owner_id);
+	cg_player_t* player = cg_registry_get(&game->cg.players, bullet_in->owner_id);
 	if (player == NULL)
 		return;
 
@@ -344,3 +416,90 @@ game_rewind_bullet(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
 	new_bullet->velocity.x = new_bullet->dir.x * player->gun->spec->bullet_speed;
 	new_bullet->velocity.y = new_bullet->dir.y * player->gun->spec->bullet_speed;
 }
+
+static void
+game_apply_player_state(waapp_t* app, const net_player_state_t* state, u8 fields)
+{
+	coregame_t* cg = &app->game->cg;
+	cg_player_t* player = cg_registry_get(&cg->players, state->player_id);
+
+	if (player == NULL)
+		return;
+
+	if (fields & NET_DELTA_POS)
+		game_set_server_pos(app, player, state->pos);
+	if (fields & NET_DELTA_HEALTH)
+		game_set_player_health(app, player, state->health);
+
+	/* Our own input and cursor are client side, same as with pushed events. */
+	if (player->id != app->net.player_id)
+	{
+		if (fields & NET_DELTA_INPUT)
+			coregame_set_player_input(player, state->input);
+		if (fields & NET_DELTA_CURSOR)
+			player->cursor = state->cursor;
+	}
+
+	if (fields & NET_DELTA_GUN)
+	{
+		const net_udp_player_gun_state_t gun_state = {
+			.player_id = state->player_id,
+			.gun_id = state->gun_id,
+			.ammo = state->ammo,
+			.bullet_timer = state->bullet_timer,
+			.charge_timer = state->charge_timer,
+			.reload_timer = state->reload_timer,
+		};
+		game_set_player_gun_state(cg, player, &gun_state);
+	}
+}
+
+/**
+ *	Rebuilds the snapshot on top of its baseline, applies whatever differs
+ *	from the last applied one and acks it so the server can delta against it.
+ */
+void 
+game_snapshot(const ssp_segment_t* segment, waapp_t* app, UNUSED void* _)
+{
+	client_udp_t* udp = &app->net.udp;
+	const net_udp_snapshot_t* snapshot = (const void*)segment->data;
+	const net_player_state_t* base = NULL;
+	const net_player_state_t* prev;
+	net_player_state_t* cur;
+	net_udp_snapshot_ack_t* ack;
+
+	/* Arrived late, it could only take state backwards. */
+	if (udp->snapshot_seq != NET_SNAPSHOT_NONE && snapshot->seq <= udp->snapshot_seq)
+		return;
+
+	net_snapshot_ring_reserve(&udp->snapshots, snapshot->slots);
+
+	if (snapshot->baseline != NET_SNAPSHOT_NONE &&
+		(base = net_snapshot_ring_get(&udp->snapshots, snapshot->baseline)) == NULL)
+		return;
+
+	prev = net_snapshot_ring_get(&udp->snapshots, udp->snapshot_seq);
+	cur = net_snapshot_ring_put(&udp->snapshots, snapshot->seq);
+	if (prev == cur)
+		prev = NULL;
+
+	if (net_snapshot_read(snapshot, segment->size, base, cur, udp->snapshots.slots) == false)
+	{
+		errorf("snapshot: malformed snapshot %u.\n", snapshot->seq);
+		udp->snapshots.seq[snapshot->seq % NET_SNAPSHOT_FRAMES] = NET_SNAPSHOT_NONE;
+		return;
+	}
+
+	for (u32 i = 0; i < udp->snapshots.slots; i++)
+	{
+		const u8 fields = (prev) ? net_player_state_diff(prev + i, cur + i) : NET_DELTA_ALL;
+
+		if (cur[i].player_id && (fields & NET_DELTA_ALL))
+			game_apply_player_state(app, cur + i, fields);
+	}
+	udp->snapshot_seq = snapshot->seq;
+
+	ack = mmframes_alloc(&app->mmf, sizeof(net_udp_snapshot_ack_t));
+	ack->seq = snapshot->seq;
+	ssp_io_push_ref(&udp->io, NET_UDP_SNAPSHOT_ACK, sizeof(net_udp_snapshot_ack_t), ack);
+}
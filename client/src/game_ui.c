@@ -98,7 +98,7 @@ game_ui_tab_window(client_game_t* game, struct nk_context* ctx)
 	};
 	rect.w = percent(70, game->ren->viewport.x) - rect.x / 2;
 	rect.h = percent(70, game->ren->viewport.y) - rect.y / 2;
-	const ght_t* players = &game->cg.players;
+	const cg_registry_t* players = &game->cg.players;
 
 	if (nk_begin(ctx, "Scoreboard", rect, NK_WINDOW_TITLE))
 	{
@@ -113,7 +113,7 @@ game_ui_tab_window(client_game_t* game, struct nk_context* ctx)
 
 		game_ui_tab_display_player(ctx, game->player->core);
 
-		GHT_FOREACH(cg_player_t* player, players, {
+		CG_REGISTRY_FOREACH(cg_player_t* player, players, {
 			if (player->id != game->player->core->id)
 				game_ui_tab_display_player(ctx, player);
 		});
@@ -182,6 +182,20 @@ game_ui_server_stats(client_game_t* game, struct nk_context* ctx)
 		format_ns(label, UI_LABEL_SIZE, stats->tick_time_highest);
 		nk_label(ctx, label, col1);
 
+		nk_label(ctx, "Tick late p50/p99:", col0);
+		snprintf(label, UI_LABEL_SIZE, "%.1f/%.1f us",
+			stats->tick_lateness.p50 / 1e3, stats->tick_lateness.p99 / 1e3);
+		nk_label(ctx, label, col1);
+
+		nk_label(ctx, "Tick late p99.9 (max):", col0);
+		snprintf(label, UI_LABEL_SIZE, "%.1f (%.1f) us",
+			stats->tick_lateness.p999 / 1e3, stats->tick_lateness.max / 1e3);
+		nk_label(ctx, label, col1);
+
+		nk_label(ctx, "Room:", col0);
+		snprintf(label, UI_LABEL_SIZE, "%u/%u", stats->room_id + 1, stats->rooms);
+		nk_label(ctx, label, col1);
+
 		nk_label(ctx, "TCP connections:", col0);
 		snprintf(label, UI_LABEL_SIZE, "%u", stats->tcp_connections);
 		nk_label(ctx, label, col1);
@@ -190,6 +204,18 @@ game_ui_server_stats(client_game_t* game, struct nk_context* ctx)
 		snprintf(label, UI_LABEL_SIZE, "%u", stats->players);
 		nk_label(ctx, label, col1);
 
+		nk_label(ctx, "Bullets (high/cap):", col0);
+		snprintf(label, UI_LABEL_SIZE, "%u (%u/%u)", 
+			stats->bullet_pool.in_use, stats->bullet_pool.highest, stats->bullet_pool.capacity);
+		nk_label(ctx, label, col1);
+
+		nk_label(ctx, "Rollbacks (resim/skip):", col0);
+		snprintf(label, UI_LABEL_SIZE, "%llu (%llu/%llu)", 
+			(unsigned long long)stats->rollback.rollbacks, 
+			(unsigned long long)stats->rollback.resimulated, 
+			(unsigned long long)stats->rollback.skipped);
+		nk_label(ctx, label, col1);
+
 		nk_layout_row_dynamic(ctx, 20, 1);
 		nk_label(ctx, "", col0);
 		nk_label(ctx, "SERVER RX", NK_TEXT_CENTERED);
@@ -203,6 +229,12 @@ game_ui_server_stats(client_game_t* game, struct nk_context* ctx)
 		game_ui_format_bytes(label, UI_LABEL_SIZE, stats->udp_pps_in_bytes_highest);
 		nk_label(ctx, label, col1);
 
+		nk_label(ctx, "Packets/syscall (allocs):", col0);
+		snprintf(label, UI_LABEL_SIZE, "%.1f (%u)", 
+			(stats->udp_rx.syscalls) ? (f32)stats->udp_pps_in / stats->udp_rx.syscalls : 0.0, 
+			stats->udp_rx.allocs);
+		nk_label(ctx, label, col1);
+
 		nk_layout_row_dynamic(ctx, 20, 1);
 		nk_label(ctx, "SERVER TX", NK_TEXT_CENTERED);
 		nk_layout_row_dynamic(ctx, 20, 2);
@@ -657,7 +689,7 @@ game_ui_healthbar_window(client_game_t* game, struct nk_context* ctx)
 			  NK_WINDOW_NO_INPUT | NK_WINDOW_NOT_INTERACTIVE | NK_WINDOW_NO_SCROLLBAR))
 	{
 		nk_layout_row_dynamic(ctx, r->size.y, 1);
-		f32 health = game->player->core->health;
+		f32 health = CG_PLAYER_HEALTH(game->player->core);
 		if (health == game->player->core->max_health)
 			snprintf(label, UI_LABEL_SIZE, "%.0f HP", health);
 		else if (health <= 0)
@@ -32,7 +32,7 @@ map_editor_read_header(waapp_map_editor_t* editor, const char* path)
 	if (fread(&map_header->header, 1, sizeof(cg_map_header_t), f) != sizeof(cg_map_header_t))
 		goto err;
 
-	if (memcmp(map_header->header.magic, CG_MAP_MAGIC, CG_MAP_MAGIC_LEN))
+	if ((map_header->version = cg_map_header_version(&map_header->header)) == 0)
 		goto err;
 
 	strncpy(map_header->path, path, MAP_PATH_MAX - 1);
@@ -100,31 +100,10 @@ map_editor_set_cell(cg_runtime_cell_t* cell, u8 new_type)
 {
 	if (cell && cell->type != new_type)
 	{
-		if (cell->type == CG_CELL_BLOCK)
-		{
-			free(cell->data);
-		}
-		else
-		{
-			cg_empty_cell_data_t* data = cell->data;
-			if (data)
-			{
-				array_del(&data->contents);
-				free(cell->data);
-			}
-		}
-		cell->data = NULL;
+		/* A rect index means nothing to a non-block cell and vice versa. */
+		if (cell->type == CG_CELL_BLOCK || new_type == CG_CELL_BLOCK)
+			cell->idx = CG_CELL_IDX_NONE;
 		cell->type = new_type;
-
-		// if (cell->type == CG_CELL_BLOCK)
-		// 	cell->data = calloc(1, sizeof(cg_block_cell_data_t));
-		// else
-		if (cell->type != CG_CELL_BLOCK)
-		{
-			cell->data = calloc(1, sizeof(cg_empty_cell_data_t));
-			cg_empty_cell_data_t* data = cell->data;
-			array_init(&data->contents, sizeof(cg_player_t**), 2);
-		}
 	}
 }
 
@@ -175,6 +154,8 @@ map_editor_save_current(waapp_map_editor_t* editor)
 	selected->header.grid_size = selected->map->grid_size;
 	snprintf(selected->path, MAP_PATH_MAX - 1, MAP_PATH"/%s.cgmap", editor->map_selected->name);
 	ret = cg_map_save(editor->map, selected->path);
+	if (ret)
+		selected->version = CG_MAP_VERSION;
 
 	if (first_save)
 	{
@@ -187,6 +168,30 @@ map_editor_save_current(waapp_map_editor_t* editor)
 	return ret;
 }
 
+/* Re-saves every v1 map on disk, which writes it as v2. */
+static u32
+map_editor_convert_v1(waapp_map_editor_t* editor)
+{
+	ght_t* maps = &editor->maps;
+	cg_runtime_map_t* map;
+	u32 converted = 0;
+
+	GHT_FOREACH(editor_map_header_t* map_header, maps, {
+		map = NULL;
+		if (map_header->version == 1 && *map_header->path)
+			map = (map_header->map) ? map_header->map : cg_map_load(map_header->path, NULL, NULL);
+
+		if (map && cg_map_save(map, map_header->path))
+		{
+			map_header->version = CG_MAP_VERSION;
+			converted++;
+		}
+		if (map && map != map_header->map)
+			cg_runtime_map_free(map);
+	});
+	return converted;
+}
+
 static void
 map_editor_ui(waapp_t* app, waapp_map_editor_t* editor)
 {
@@ -334,6 +339,10 @@ map_editor_update(waapp_t* app, waapp_map_editor_t* editor)
 				ght_insert(&editor->maps, editor->map_selected->id, editor->map_selected);
 			}
 
+			nk_layout_row_template_push_static(ctx, 150);
+			if (nk_button_label(ctx, "Convert v1 maps"))
+				printf("Converted %u v1 maps to v%u.\n", map_editor_convert_v1(editor), CG_MAP_VERSION);
+
 			if (editor->map_selected)
 			{
 				nk_layout_row_template_push_static(ctx, 300);
@@ -381,7 +390,7 @@ map_editor_update(waapp_t* app, waapp_map_editor_t* editor)
 					if (nk_selectable_label(ctx, header_path, NK_TEXT_CENTERED, &map_header->selected))
 						pressed = true;
 					
-					snprintf(mapinfo, 32, "%ux%u", map_header->header.w, map_header->header.h);
+					snprintf(mapinfo, 32, "%ux%u v%u", map_header->header.w, map_header->header.h, map_header->version);
 					if (nk_selectable_label(ctx, mapinfo, NK_TEXT_CENTERED, &map_header->selected))
 						pressed = true;
 
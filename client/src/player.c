@@ -11,16 +11,17 @@ player_new_from(client_game_t* game, cg_player_t* cg_player)
 	vec2f_t gun_size = vec2f(250, 250);
 
 	player->core = cg_player;
-	rect_init(&player->rect, player->core->pos, 
+	rect_init(&player->rect, CG_PLAYER_POS(player->core), 
 			player->core->size, 0x000000FF, 
 			game->tank_bottom_tex);
 	rect_init(&player->gun_rect, player->rect.pos, gun_size, 0, NULL);
 
+	/* Not pointing into cg_player, its hot components move around in the registry. */
 	progress_bar_init(&player->hpbar, player->rect.pos, vec2f(150, 15), 
-				   &cg_player->max_health, &cg_player->health, 
-				   0xFF0000CC);
+				   NULL, NULL, 0xFF0000CC);
+	progress_bar_update_valmax(&player->hpbar, CG_PLAYER_HEALTH(cg_player), cg_player->max_health);
 
-	player->hpbar.parent_pos = &cg_player->pos;
+	player->hpbar.parent_pos = &player->rect.pos;
 	player->hpbar.offset = vec2f(
 		(player->rect.size.x - player->hpbar.background.size.x) / 2,
 		-30
@@ -29,7 +30,7 @@ player_new_from(client_game_t* game, cg_player_t* cg_player)
 	progress_bar_init(&player->guncharge, player->rect.pos, vec2f(150, 15), 
 				   NULL, NULL, GUNCHARGE_COLOR);
 
-	player->guncharge.parent_pos = &cg_player->pos;	
+	player->guncharge.parent_pos = &player->rect.pos;
 	player->guncharge.offset = vec2f(
 		player->hpbar.offset.x,
 		player->hpbar.offset.y - (player->hpbar.background.size.y + 3)
@@ -0,0 +1,41 @@
+#ifndef _CG_BULLET_POOL_H_
+#define _CG_BULLET_POOL_H_
+
+/**
+ *	Bullet Pool - Slab allocator with a free-list for cg_bullet_t.
+ *
+ *	Bullets are carved out of fixed-size slabs which are only released
+ *	on `cg_bullet_pool_destroy()`. A freed bullet keeps its `cells` buffer,
+ *	so a recycled bullet doesn't need to re-allocate it.
+ */
+
+#include <int.h>
+
+#define CG_BULLET_POOL_SLAB_SIZE 256
+
+typedef struct cg_bullet cg_bullet_t;
+
+typedef struct
+{
+	u32 in_use;
+	u32 highest;	// High-water mark of `in_use`
+	u32 capacity;	// Total bullets across all slabs
+	u32 slabs;
+} cg_bullet_pool_stats_t;
+
+typedef struct
+{
+	cg_bullet_t**	slabs;
+	u32				slab_size;
+	cg_bullet_t*	free_list;
+
+	cg_bullet_pool_stats_t stats;
+} cg_bullet_pool_t;
+
+void			cg_bullet_pool_init(cg_bullet_pool_t* pool, u32 slab_size);
+void			cg_bullet_pool_reserve(cg_bullet_pool_t* pool, u32 count);
+cg_bullet_t*	cg_bullet_pool_alloc(cg_bullet_pool_t* pool);
+void			cg_bullet_pool_free(cg_bullet_pool_t* pool, cg_bullet_t* bullet);
+void			cg_bullet_pool_destroy(cg_bullet_pool_t* pool);
+
+#endif // _CG_BULLET_POOL_H_
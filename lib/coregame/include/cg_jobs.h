@@ -0,0 +1,27 @@
+#ifndef _CG_JOBS_H_
+#define _CG_JOBS_H_
+
+/**
+ *	Jobs - Small work-stealing thread pool.
+ *
+ *	`cg_jobs_parallel_for()` splits [0, count) into chunks of `grain`,
+ *	deals them out evenly to every worker's deque and blocks until all are done.
+ *	The calling thread is worker 0 and works along. A worker that runs
+ *	out of its own chunks steals from the front of the other deques.
+ */
+
+#include <int.h>
+
+typedef struct cg_jobs cg_jobs_t;
+
+/* Runs items [begin, end). `worker` is in [0, cg_jobs_workers()). */
+typedef void (*cg_job_func_t)(void* ctx, u32 begin, u32 end, u32 worker);
+
+/* `threads` is the number of extra threads, 0 runs everything on the caller. */
+cg_jobs_t*	cg_jobs_create(u32 threads);
+void		cg_jobs_destroy(cg_jobs_t* jobs);
+u32			cg_jobs_workers(const cg_jobs_t* jobs);
+void		cg_jobs_parallel_for(cg_jobs_t* jobs, u32 count, u32 grain,
+								 cg_job_func_t func, void* ctx);
+
+#endif // _CG_JOBS_H_
@@ -3,10 +3,14 @@
 
 #include "rect.h"
 #include <stdio.h>
+#include <stdatomic.h>
 #include "cutils.h"
 
 #define CG_MAP_MAGIC ".cgmap"
+#define CG_MAP_MAGIC_V2 ".cgmp2"
 #define CG_MAP_MAGIC_LEN sizeof(CG_MAP_MAGIC)
+#define CG_MAP_VERSION 2
+#define CG_MAP_CHUNK_SIZE 16	// Cells per chunk side in v2
 
 #define CG_CELL_EMPTY 0
 #define CG_CELL_BLOCK 1
@@ -15,27 +19,55 @@
 
 #define CG_PACKED __attribute__((packed))
 
+#define CG_BLOCK_DIST_MAX 255
+#define CG_CELL_IDX_NONE UINT32_MAX
+#define CG_BLOCK_RECT_NONE CG_CELL_IDX_NONE
+
+#define CG_OCCUPANCY_SLAB_SIZE 256
+
 #define MAP_PATH "res/maps"
 
+#define CG_MAP_CACHE_MAGIC ".cgmapc"
+#define CG_MAP_CACHE_VERSION 2
+
 typedef struct 
 {
 	vec2f_t a;
 	vec2f_t b;
 } cg_line_t;
 
-// typedef struct 
-// {
-// 	cg_line_t* top;
-// 	cg_line_t* bot;
-// 	cg_line_t* left;
-// 	cg_line_t* right;
-// } cg_block_cell_data_t;
+/**
+ *	Intrusive occupancy node. Every player owns one per cell it overlaps,
+ *	so linking/unlinking a player in a cell is O(1) and never allocates.
+ */
+typedef struct cg_cell_node
+{
+	struct cg_player*		player;
+	struct cg_cell_node*	prev;
+	struct cg_cell_node*	next;
+	struct cg_empty_cell_data* occupancy;	// Slot it's linked into
+} cg_cell_node_t;
 
-typedef struct 
+typedef struct cg_empty_cell_data
 {
-	array_t contents;
+	cg_cell_node_t* head;	// Players in this cell
+	u32				count;
 } cg_empty_cell_data_t;
 
+/**
+ *	Occupancy slots of the non-block cells. A cell claims one the first time
+ *	a player enters it and keeps it until the map is freed, so cells nobody
+ *	walks on cost nothing. Slots sit in fixed-size slabs and never move. The
+ *	slab table is sized for one slot per cell up front, which lets player
+ *	islands on the job pool claim slots concurrently.
+ */
+typedef struct
+{
+	_Atomic(cg_empty_cell_data_t*)*	slabs;
+	u32								slab_count;
+	atomic_uint						used;
+} cg_occupancy_pool_t;
+
 typedef struct 
 {
 	vec2u16_t	pos;
@@ -46,7 +78,13 @@ typedef struct
 {
 	vec2u16_t	pos;
 	u8			type;
-	void*		data;
+	u8			block_dist;	// Chebyshev distance in cells to the nearest block (0 = block).
+	/**
+	 *	Block cells: the rect covering it in `cg_runtime_map_t.block_rects`.
+	 *	Others: its slot in `cg_runtime_map_t.occupancy`.
+	 *	CG_CELL_IDX_NONE until set.
+	 */
+	u32			idx;
 } cg_runtime_cell_t;
 
 typedef struct 
@@ -57,16 +95,84 @@ typedef struct
 	u16 grid_size;
 } CG_PACKED cg_map_header_t;
 
+/* v1: every non-empty cell with its position. */
 typedef struct 
 {
 	cg_map_header_t header;
 	cg_disk_cell_t cells[];
 } CG_PACKED cg_disk_map_t;
 
+/**
+ *	v2: the grid in square chunks, each a list of runs over its cells,
+ *	plus the spawn list and block rects precomputed. Sections sit at
+ *	their offsets from the start of the file and are read in place.
+ */
 typedef struct 
 {
-	array_t edge_pool;
-} cg_runtime_map_data_t;
+	cg_map_header_t header;	// CG_MAP_MAGIC_V2
+	u16 version;
+	u16 chunk_size;
+	u16 chunks_w;
+	u16 chunks_h;
+	u32 chunks_offset;		// cg_map_chunk_t[chunks_w * chunks_h], row-major
+	u32 runs_offset;		// cg_map_run_t[run_count]
+	u32 run_count;
+	u32 spawns_offset;		// cg_map_spawn_t[spawn_count]
+	u32 spawn_count;
+	u32 rects_offset;		// cg_map_rect_t[rect_count]
+	u32 rect_count;
+	u32 size;				// Whole file
+} CG_PACKED cg_disk_map_v2_t;
+
+typedef struct 
+{
+	u32 first_run;
+	u32 run_count;
+} CG_PACKED cg_map_chunk_t;
+
+/* `length` cells of `type`, row-major inside the chunk. */
+typedef struct 
+{
+	u16 length;
+	u8	type;
+} CG_PACKED cg_map_run_t;
+
+typedef struct 
+{
+	u16 x;
+	u16 y;
+} CG_PACKED cg_map_spawn_t;
+
+/* Merged block rect in cells, what `cg_runtime_map_t.block_rects` is built from. */
+typedef struct 
+{
+	u16 x;
+	u16 y;
+	u16 w;
+	u16 h;
+} CG_PACKED cg_map_rect_t;
+
+/**
+ *	Runtime map as it is right after loading, block distances and rects
+ *	included, so loading it skips the disk cell scatter and both passes.
+ *	`hash` is cg_map_hash() of the disk map it was built from.
+ */
+typedef struct
+{
+	char magic[sizeof(CG_MAP_CACHE_MAGIC)];
+	u32 version;
+	u64 hash;
+	u16 w;
+	u16 h;
+	u16 grid_size;
+	u32 rect_count;
+} CG_PACKED cg_map_cache_header_t;
+
+typedef struct
+{
+	u8	type;
+	u32	rect_idx;	// Block cells only
+} CG_PACKED cg_map_cache_cell_t;
 
 typedef struct 
 {
@@ -75,18 +181,27 @@ typedef struct
 	u32 grid_size;
 	bool editor_mode;
 
-	// struct {
-	// 	array_t edge_pool;
-	// } runtime;
+	/**	`block_rects`
+	 *	Adjacent block cells greedily merged into maximal rectangles (cg_rect_t, world units).
+	 *	Each block cell holds the index of the rect covering it in `idx`.
+	 */
+	array_t block_rects;
+	array_t spawns;		// cg_runtime_cell_t*, every CG_CELL_SPAWN cell
+	cg_occupancy_pool_t occupancy;
 
 	cg_runtime_cell_t		cells[];
 } cg_runtime_map_t;
 
 cg_runtime_map_t*	cg_map_load(const char* path, cg_disk_map_t** disk_map, u32* disk_size);
-cg_runtime_map_t*	cg_map_load_disk(const cg_disk_map_t* disk_map, u32 size);
+cg_runtime_map_t*	cg_map_load_disk(const void* disk_map, u32 size);
+void				cg_map_free_disk(cg_disk_map_t* disk_map, u32 size);
+u32					cg_map_header_version(const cg_map_header_t* header);
+cg_runtime_map_t*	cg_map_load_cache(const char* path, u64 hash);
+bool				cg_map_save_cache(const cg_runtime_map_t* map, u64 hash, const char* path);
+u64					cg_map_hash(const void* disk_map, u32 size);
 cg_runtime_map_t*	cg_map_new(u16 w, u16 h, u16 grid_size);
 void				cg_map_resize(cg_runtime_map_t** mapp, u16 new_w, u16 new_h);
-bool				cg_map_save(const cg_runtime_map_t* map, const char* path);
+bool				cg_map_save(cg_runtime_map_t* map, const char* path);
 
 cg_disk_cell_t*		cg_disk_map_at(cg_disk_map_t* map, u16 x, u16 y);
 cg_runtime_cell_t*	cg_runtime_map_at(cg_runtime_map_t* map, u16 x, u16 y);
@@ -97,7 +212,12 @@ u32					cg_disk_map_calc_size(u16 w, u16 h);
 u32					cg_runtime_map_calc_size(u16 w, u16 h);
 u32					cg_map_size(const cg_runtime_map_t* map);
 void				cg_runtime_map_free(cg_runtime_map_t* map);
-// void				cg_map_compute_edge_pool(cg_runtime_map_t* map);
+void				cg_map_compute_block_dist(cg_runtime_map_t* map);
+void				cg_map_compute_block_rects(cg_runtime_map_t* map);
+void				cg_map_compute_spawns(cg_runtime_map_t* map);
+const cg_rect_t*	cg_map_block_rect(const cg_runtime_map_t* map, const cg_runtime_cell_t* cell);
+cg_empty_cell_data_t* cg_map_occupancy(const cg_runtime_map_t* map, const cg_runtime_cell_t* cell);
+cg_empty_cell_data_t* cg_map_occupy(cg_runtime_map_t* map, cg_runtime_cell_t* cell);
 
 u64			file_size(FILE* f);
 u16			mini16(u16 a, u16 b);
@@ -0,0 +1,46 @@
+#ifndef _CG_RAY_H_
+#define _CG_RAY_H_
+
+/**
+ *	Batched ray vs AABB slab test.
+ *
+ *	Tests one ray against a batch of AABBs stored as structure-of-arrays
+ *	and returns the nearest hit. Picks AVX2, SSE2 or scalar at runtime.
+ *	All paths use true division, so results are bit-identical to the scalar path.
+ */
+
+#include "rect.h"
+
+typedef struct
+{
+	f32*	min_x;
+	f32*	min_y;
+	f32*	max_x;
+	f32*	max_y;
+	void**	data;	// User tag per AABB
+	u32		count;
+	u32		size;
+} cg_aabb_batch_t;
+
+void	cg_aabb_batch_init(cg_aabb_batch_t* batch, u32 initial_size);
+void	cg_aabb_batch_add(cg_aabb_batch_t* batch, const cg_rect_t* rect, void* data);
+void	cg_aabb_batch_del(cg_aabb_batch_t* batch);
+
+static inline void
+cg_aabb_batch_clear(cg_aabb_batch_t* batch)
+{
+	batch->count = 0;
+}
+
+/**
+ *	Returns the index of the AABB with the smallest |t_hit_near| below 1.0,
+ *	or -1 if no AABB is hit. Ties go to the lowest index.
+ *	`t_hit_near` gets the signed entry time of that AABB.
+ */
+i32		cg_ray_aabb_batch(const vec2f_t* origin, const vec2f_t* dir,
+						  const cg_aabb_batch_t* batch, f32* t_hit_near);
+i32		cg_ray_aabb_batch_scalar(const vec2f_t* origin, const vec2f_t* dir,
+								 const cg_aabb_batch_t* batch, f32* t_hit_near);
+const char* cg_ray_aabb_batch_impl(void);
+
+#endif // _CG_RAY_H_
@@ -0,0 +1,124 @@
+#ifndef _CG_REGISTRY_H_
+#define _CG_REGISTRY_H_
+
+/**
+ *	Entity Registry - Sparse set with generational handles.
+ *
+ *	Entities are addressed by a u32 handle: the low bits are a slot
+ *	index into the sparse table, the high bits are the slot's generation.
+ *	A stale handle (slot reused) fails lookup instead of aliasing the new entity.
+ *
+ *	The dense arrays (`ids`, `dense` & the columns) are packed, so iterating
+ *	is a linear walk over contiguous memory instead of a hash table walk.
+ *	Removal is swap-with-last, so dense order is not stable.
+ *
+ *	Columns hold hot components as struct-of-arrays parallel to `dense`:
+ *	column `c` of the entity at dense index `i` is columns[c][i * column_sizes[c]].
+ *	If the entity keeps its own dense index (see cg_registry_set_index_field()),
+ *	the registry keeps it up to date as entities move.
+ */
+
+#include <int.h>
+
+#define CG_HANDLE_SLOT_BITS		20
+#define CG_HANDLE_SLOT_MASK		((1u << CG_HANDLE_SLOT_BITS) - 1)
+#define CG_HANDLE_GEN_MASK		(0xFFFFFFFFu >> CG_HANDLE_SLOT_BITS)
+#define CG_HANDLE_SLOT(id)		((id) & CG_HANDLE_SLOT_MASK)
+#define CG_HANDLE_GEN(id)		((id) >> CG_HANDLE_SLOT_BITS)
+#define CG_HANDLE(slot, gen)	(((gen) << CG_HANDLE_SLOT_BITS) | (slot))
+
+#define CG_REGISTRY_NONE		0xFFFFFFFF
+#define CG_REGISTRY_MAX_COLUMNS	8
+
+typedef void (*cg_registry_free_t)(void* entity);
+
+typedef struct
+{
+	/* Sparse: indexed by slot */
+	u32*	sparse;		// slot -> dense index (CG_REGISTRY_NONE if free)
+	u32*	gens;		// slot -> current generation
+	bool*	listed;		// slot -> already in free_slots
+	u32		sparse_size;
+
+	u32*	free_slots;	// Sized like sparse, a slot is listed at most once.
+	u32		free_count;
+	u32		next_slot;
+
+	/* Dense: packed, indexed by [0, count) */
+	u32*	ids;
+	void**	dense;
+	u32		count;
+	u32		capacity;
+
+	/* Hot components, parallel to `dense` */
+	u8*		columns[CG_REGISTRY_MAX_COLUMNS];
+	u32		column_sizes[CG_REGISTRY_MAX_COLUMNS];
+	u32		column_count;
+	u32		index_offset;	// Offset of the entity's u32 dense index, CG_REGISTRY_NONE if it has none.
+
+	/**
+	 *	Deletes inside CG_REGISTRY_FOREACH leave a tombstone (NULL in `dense`)
+	 *	and are compacted when the outermost loop ends.
+	 */
+	u32		iterating;
+	u32		dead;
+
+	cg_registry_free_t free;	// Runs once the entity left the registry, its columns are gone.
+} cg_registry_t;
+
+void	cg_registry_init(cg_registry_t* reg, u32 initial_size, cg_registry_free_t free);
+void	cg_registry_destroy(cg_registry_t* reg);
+void	cg_registry_clear(cg_registry_t* reg);
+
+/**
+ *	Add a column of `ele_size` byte components, zeroed on insert.
+ *	Returns its index. Must be called while the registry is empty.
+ */
+u32		cg_registry_add_column(cg_registry_t* reg, u32 ele_size);
+/* Entities have a u32 at `offset` the registry keeps equal to their dense index. */
+void	cg_registry_set_index_field(cg_registry_t* reg, u32 offset);
+
+#define CG_REGISTRY_COLUMN(reg, col, type) ((type*)(reg)->columns[col])
+
+/**
+ *	Allocate a new handle (reusing free slots, bumping generation).
+ *	Handles are never 0.
+ */
+u32		cg_registry_new_id(cg_registry_t* reg);
+
+/**
+ *	Insert `entity` at handle `id`. `id` either comes from `cg_registry_new_id()`
+ *	or from a remote registry (e.g. player IDs sent by the server).
+ *	Returns false if the slot is already occupied.
+ */
+bool	cg_registry_insert(cg_registry_t* reg, u32 id, void* entity);
+void*	cg_registry_get(const cg_registry_t* reg, u32 id);
+/* Dense index of `id`, CG_REGISTRY_NONE if it's not in the registry. */
+u32		cg_registry_index(const cg_registry_t* reg, u32 id);
+bool	cg_registry_del(cg_registry_t* reg, u32 id);
+
+/* Used by CG_REGISTRY_FOREACH. begin() returns the number of entries to visit. */
+u32		cg_registry_begin(cg_registry_t* reg);
+void	cg_registry_end(cg_registry_t* reg);
+
+/**
+ *	Iterates forward over the entries present when the loop started.
+ *	The body may delete any entity (the dense array isn't compacted
+ *	until the loop ends) and insert new ones (they aren't visited).
+ *	Don't `return` or `goto` out of the body.
+ */
+#define CG_REGISTRY_FOREACH(var, reg, ...) \
+	do { \
+		cg_registry_t* _reg = (cg_registry_t*)(reg); \
+		const u32 _reg_count = cg_registry_begin(_reg); \
+		for (u32 _reg_i = 0; _reg_i < _reg_count; _reg_i++) \
+		{ \
+			if (_reg->dense[_reg_i] == NULL) \
+				continue; \
+			var = _reg->dense[_reg_i]; \
+			__VA_ARGS__ \
+		} \
+		cg_registry_end(_reg); \
+	} while (0)
+
+#endif // _CG_REGISTRY_H_
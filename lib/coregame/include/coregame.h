@@ -6,6 +6,10 @@
 #include <ght.h>
 #include "rect.h"
 #include "cg_map.h"
+#include "cg_registry.h"
+#include "cg_bullet_pool.h"
+#include "cg_ray.h"
+#include "cg_jobs.h"
 #include "mmframes.h"
 #include "nano_timer.h"
 
@@ -14,6 +18,7 @@
 #endif
 
 #define INTERPOLATE_FACTOR			0.01
+#define CG_MAX_SUBSTEPS				8
 #define INTERPOLATE_THRESHOLD_DIST	1.0
 
 #define GUN_BPS 20.0
@@ -22,6 +27,8 @@
 #define PLAYER_HEALTH 100
 #define	BULLET_DMG	  2.5
 #define PLAYER_NAME_MAX 32
+#define CG_BULLET_JOB_GRAIN 64
+#define CG_PLAYER_HISTORY	64	// Ticks of positions kept for lag compensation (power of 2)
 
 #define UNUSED __attribute__((unused))
 #ifdef _WIN32
@@ -52,6 +59,54 @@ typedef void (*cg_player_damaged_callback_t)(cg_player_t* target_player,
 											 cg_player_t* attacker_player, void* user_data);
 typedef void (*cg_player_free_callback_t)(cg_player_t* player);
 
+enum cg_netcode
+{
+	CG_NETCODE_ROLLBACK,	// Late inputs roll back and resimulate the whole world (sbsm).
+	CG_NETCODE_LAG_COMP,	// Inputs apply on arrival, hits are tested against the shooter's view.
+};
+
+/* Ring of a player's position at the end of each tick. */
+typedef struct
+{
+	vec2f_t pos[CG_PLAYER_HISTORY];
+	u64		count;	// Ticks recorded, latest is pos[(count - 1) % CG_PLAYER_HISTORY]
+} cg_player_history_t;
+
+enum cg_event_type
+{
+	CG_EVENT_PLAYER_CHANGED,
+	CG_EVENT_PLAYER_GUN_CHANGED,
+	CG_EVENT_PLAYER_RELOAD,
+	CG_EVENT_PLAYER_DAMAGED,
+	CG_EVENT_BULLET_CREATE,
+};
+
+/**
+ *	One journal record. Entities are referenced by ID, not pointer,
+ *	since they may be gone by the time the journal is drained.
+ */
+typedef struct
+{
+	u8		type;		// enum cg_event_type
+	bool	rewinding;	// Emitted while the server was rewinding
+	u32		id;			// Player, or bullet for CG_EVENT_BULLET_CREATE
+
+	union {
+		struct {
+			u32 attacker_id;
+			f32 dmg;
+			f32 health;	// Target health after the hit
+		} damaged;
+
+		struct {
+			u32		owner_id;
+			u8		gun_id;
+			vec2f_t pos;
+			vec2f_t dir;
+		} bullet;
+	};
+} cg_event_t;
+
 enum cg_gun_id
 {
 	CG_GUN_ID_SMALL,
@@ -68,40 +123,70 @@ typedef struct
 	f32 ping;
 } cg_player_stats_t;
 
+/**
+ *	Hot player components live in columns of `coregame_t.players`,
+ *	packed by dense index. Access them through CG_PLAYER_*(), which
+ *	are lvalues valid until the player registry changes.
+ */
+enum cg_player_column
+{
+	CG_PLAYER_COL_POS,		// vec2f_t
+	CG_PLAYER_COL_VELOCITY,	// vec2f_t
+	CG_PLAYER_COL_DIR,		// vec2f_t
+	CG_PLAYER_COL_HEALTH,	// f32
+	CG_PLAYER_COL_INPUT,	// u8
+
+	CG_PLAYER_COL_COUNT
+};
+
+#define CG_PLAYER_COL(p, col, type) (CG_REGISTRY_COLUMN((p)->reg, col, type)[(p)->idx])
+#define CG_PLAYER_POS(p)		CG_PLAYER_COL(p, CG_PLAYER_COL_POS, vec2f_t)
+#define CG_PLAYER_VELOCITY(p)	CG_PLAYER_COL(p, CG_PLAYER_COL_VELOCITY, vec2f_t)
+#define CG_PLAYER_DIR(p)		CG_PLAYER_COL(p, CG_PLAYER_COL_DIR, vec2f_t)
+#define CG_PLAYER_HEALTH(p)		CG_PLAYER_COL(p, CG_PLAYER_COL_HEALTH, f32)
+#define CG_PLAYER_INPUT(p)		CG_PLAYER_COL(p, CG_PLAYER_COL_INPUT, u8)
+
 typedef struct cg_player
 {
+	/* Hot: touched every tick by the update loops. */
 	u32		id;
-	vec2f_t pos;
-	vec2f_t dir;
-	vec2f_t velocity;
-	f32		health;
-	f32		max_health;
-	cg_gun_t* gun;
-
+	u32		idx;	// Dense index in `reg`, kept up to date by the registry.
+	cg_registry_t* reg;
+	bool	shoot;
 	vec2f_t size;
 	vec2f_t prev_pos;
 	vec2f_t prev_dir;
-	vec2f_t cursor;
-	char	username[PLAYER_NAME_MAX];
+	vec2f_t step_prev_pos;	// Position before the last step, for render interpolation.
+	cg_gun_t* gun;
 	array_t cells;
-	u8		input;
+	cg_cell_node_t* cell_nodes;		// cell_nodes[i] links the player into cells[i]
+	u32 cell_nodes_size;
+	const cg_runtime_cell_t* cells_min;	// Top-left/bottom-right of `cells`, NULL if none.
+	const cg_runtime_cell_t* cells_max;
 
 #ifdef CG_SERVER
 	bool	dirty;
 	bool	gun_dirty;
 	f64		last_input_timestamp;
+	f32		view_lag_ms;	// How far behind the present the client sees the world.
+	bool	resim;			// Part of the current rollback's interaction set.
+	cg_player_history_t* history;
 #endif
 
 #ifdef CG_CLIENT
 	vec2f_t server_pos;
 	bool	interpolate;
 	bool	bad_local_pos;
+	bool	out_of_view;
 #endif
 
+	/* Cold */
+	f32		max_health;
+	vec2f_t cursor;
 	cg_player_stats_t stats;
 	void*	user_data;
-	bool	shoot;
 	cg_player_free_callback_t on_player_free;
+	char	username[PLAYER_NAME_MAX];
 } cg_player_t;
 
 typedef struct cg_bullet
@@ -109,19 +194,52 @@ typedef struct cg_bullet
 	u32				id;
 	u32				owner_id;
 	cg_rect_t		r;
+	vec2f_t			step_prev_pos;
 	vec2f_t			dir;
 	vec2f_t			velocity;
 	f32				dmg;
 	enum cg_gun_id	gun_id;
+#ifdef CG_SERVER
+	f32				view_lag_ms;	// Owner's `view_lag_ms` when fired.
+	bool			resim;
+#endif
 	array_t			cells;
 	void*			data;
 	bool			collided;
 	vec2f_t			contact_point;
 
+	/* Result of `coregame_trace_bullets()`, applied by `coregame_resolve_bullet()`. */
+	struct {
+		vec2f_t				next_pos;
+		struct cg_player*	target;
+		bool				hit;
+	} trace;
+
 	struct cg_bullet* next;
 	struct cg_bullet* prev;
 } cg_bullet_t;
 
+/**
+ *	Scratch for the parallel player update. Players are grouped into 
+ *	islands that can't touch each other's cells this tick, indexed by 
+ *	their dense index in the players registry.
+ */
+typedef struct 
+{
+	i32*	boxes;		// x0, y0, x1, y1 in cells
+	u32*	parent;		// Union-find
+	u64*	sorted;		// (x0 << 32 | idx)
+	u32*	start;		// First member in `members`, by root
+	u32*	len;		// Member count, by root
+	u32*	members;
+	u32*	roots;		// One per island
+	u32*	gun_events;	// First of each player's gun events in `events`, and the end
+	cg_event_t* events;	// What the guns pushed, put back in registry order
+	u32		events_size;
+	u32		count;		// Islands
+	u32		size;
+} cg_player_islands_t;
+
 typedef struct cg_gun_spec
 {
 	enum cg_gun_id id;
@@ -159,33 +277,68 @@ typedef struct cg_gun
 
 typedef struct coregame 
 {
-	ght_t players;
-	ght_t bullets;
+	cg_registry_t players;
+	cg_registry_t bullets;
+	cg_bullet_pool_t bullet_pool;
+	cg_aabb_batch_t bullet_targets;	// Scratch for bullet collision
+
+	/**	`jobs`
+	 *	Optional thread pool (see `coregame_set_jobs()`). When set, bullets are traced
+	 *	in chunks and, on the server, players are moved in islands on all workers.
+	 *	Everything with side effects is applied afterwards on the calling thread
+	 *	in registry order, so the result matches the single-threaded update.
+	 */
+	cg_jobs_t*		 jobs;
+	cg_aabb_batch_t* job_targets;	// `bullet_targets` for worker 1..n
+	cg_player_islands_t islands;
+
+	/**	`events`
+	 *	Journal (cg_event_t) of everything that happened since it was last drained.
+	 *	Consumers walk it once after `coregame_update()` and clear it, or call
+	 *	`coregame_dispatch_events()` to have it fed to the callbacks below.
+	 */
+	array_t events;
 	cg_rect_t world_border;
 	cg_runtime_map_t* map;
 
 	array_t gun_specs;
 	hr_time_t last_time;
 	f64 delta;
+
+	/**	`fixed`
+	 *	Fixed-timestep mode. When `step` is set, `coregame_update()` accumulates
+	 *	wall-clock time and advances the simulation in whole steps of `step` seconds,
+	 *	so a step always integrates with the exact same delta (live or rewound).
+	 *	`alpha` is how far we are into the next step, for render interpolation.
+	 */
+	struct {
+		f64 step;
+		f64 accumulator;
+		f64 alpha;
+		u32 max_substeps;
+		u32 steps;		// Steps taken by the last update.
+		u64 tick;		// Steps taken in total.
+	} fixed;
 	void* user_data;
 
-	cg_bullet_create_callback_t on_bullet_create;
 	void (*bullet_free_callback)(cg_bullet_t* bullet, void* data);
 	cg_player_free_callback_t    player_free_callback;	
+
+	/* Only called from `coregame_dispatch_events()`. */
+	cg_bullet_create_callback_t on_bullet_create;
 	cg_player_reload_callback_t  player_reload;
 	cg_player_changed_callback_t player_changed;
 	cg_player_changed_callback_t player_gun_changed;
 	cg_player_damaged_callback_t player_damaged;
 
 	f32 time_scale;
-	u32 player_id_seq;
-	u32 bullet_id_seq;
 
 	bool pause;
 
 #ifdef CG_SERVER
 	cg_sbsm_t* sbsm;
 	bool rewinding;
+	enum cg_netcode netcode;
 #endif // CG_SERVER
 
 #ifdef CG_CLIENT
@@ -202,16 +355,34 @@ typedef struct coregame
 
 void coregame_init(coregame_t* coregame, cg_runtime_map_t* map);
 void coregame_server_init(coregame_t* cg, cg_runtime_map_t* map, f32 tick_per_sec);
+/* Client: advances by wall-clock time, in fixed steps if `fixed.step` is set. */
 void coregame_update(coregame_t* coregame);
+void coregame_set_fixed_step(coregame_t* cg, f64 step_s, u32 max_substeps);
+void coregame_set_jobs(coregame_t* cg, cg_jobs_t* jobs);
+vec2f_t coregame_lerp_pos(const coregame_t* cg, const vec2f_t* prev, const vec2f_t* current);
 void coregame_cleanup(coregame_t* coregame);
+void coregame_dispatch_events(coregame_t* cg);
+void coregame_clear_events(coregame_t* cg);
 
+/* NULL if the registry is out of IDs. Hot components start zeroed, health full. */
 cg_player_t* coregame_add_player(coregame_t* coregame, const char* name);
-void coregame_add_player_from(coregame_t* coregame, cg_player_t* player);
+/* False if `player->id` is taken, the caller still owns `player` then. */
+bool coregame_add_player_from(coregame_t* coregame, cg_player_t* player);
+/* Teleport, also moves the player between map cells. */
+void coregame_set_player_pos(coregame_t* coregame, cg_player_t* player, vec2f_t pos);
 void coregame_free_player(coregame_t* coregame, cg_player_t* player);
 void coregame_set_player_input(cg_player_t* player, u8 input);
 
 #ifdef CG_SERVER
+	/**
+	 *	Exactly one fixed step. The server's ticks are already scheduled on
+	 *	absolute deadlines, so it doesn't go through the wall-clock accumulator.
+	 */
+	void coregame_tick(coregame_t* cg);
 	void coregame_set_player_input_t(coregame_t* cg, cg_player_t* player, u8 input, f64 timestamp);
+	void coregame_set_netcode(coregame_t* cg, enum cg_netcode netcode);
+	void coregame_set_rollback_window(coregame_t* cg, f64 window_ms);
+	vec2f_t coregame_player_view_pos(const coregame_t* cg, const cg_player_t* player, f32 lag_ms);
 #endif 
 
 u8	 coregame_get_player_input(const cg_player_t* player);
@@ -227,6 +398,8 @@ bool coregame_player_change_gun(coregame_t* cg, cg_player_t* player, enum cg_gun
 void coregame_player_reload(coregame_t* cg, cg_player_t* player);
 void coregame_update_player(coregame_t* coregame, cg_player_t* player);
 void coregame_update_bullet(coregame_t* cg, cg_bullet_t* bullet);
+void coregame_trace_bullets(coregame_t* cg);
+void coregame_resolve_bullet(coregame_t* cg, cg_bullet_t* bullet);
 cg_bullet_t* cg_add_bullet(coregame_t* cg, cg_gun_t* gun);
 
 #endif // _CORE_GAME_H_
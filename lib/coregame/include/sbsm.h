@@ -7,7 +7,6 @@
 
 #include <int.h>
 #include <array.h>
-#include <ght.h>
 #include "vec.h"
 
 typedef struct cg_game_snapshot cg_game_snapshot_t;
@@ -17,11 +16,14 @@ typedef struct cg_bullet cg_bullet_t;
 
 typedef struct 
 {
-	u32		player_id;
+	u32		player_id;	// 0 if the slot is empty
+	u32		seq;		// Snapshot this was committed in (copied forward otherwise)
 	vec2f_t pos;
 	vec2f_t velocity;
 	u8		input;
 	bool	shooting;
+	f32		health;		// Replicated only, never rewound
+	vec2f_t cursor;
 
 	i32 ammo;
 	f32 bullet_timer;
@@ -37,20 +39,41 @@ typedef struct
 
 typedef struct 
 {
-	u32 bullet_id;
+	u32 bullet_id;		// 0 if the slot is empty
 	vec2f_t pos;
 	bool collided;
 } cg_bullet_snapshot_t;
 
+/**
+ *	Flat arrays indexed by the entity's handle slot, carved from the sbsm arena.
+ *	Each tick starts as a copy of the previous one, so a snapshot holds the
+ *	last committed state of every entity. An entry is only valid if its ID
+ *	matches the full handle (slots get reused).
+ */
 typedef struct cg_game_snapshot
 {
 	f64 timestamp;
 	u32 seq;
-	ght_t player_states;
-	ght_t bullet_states;
+	cg_player_snapshot_t* players;
+	cg_bullet_snapshot_t* bullets;
 	bool dirty;
 } cg_game_snapshot_t;
 
+/* Swept bounds of one entity over the rollback window. */
+typedef struct
+{
+	vec2f_t min;
+	vec2f_t max;
+	bool	member;
+} cg_sbsm_resim_box_t;
+
+typedef struct
+{
+	u64 rollbacks;
+	u64 resimulated;	// Entities resimulated, summed over all rollbacks.
+	u64 skipped;		// Entities left at their committed state.
+} cg_sbsm_resim_stats_t;
+
 typedef struct 
 {
 	u32 seq;
@@ -67,10 +90,40 @@ typedef struct
 	cg_game_snapshot_t* present;
 	u32 present_idx;
 
+	/* One allocation for every snapshot's arrays, `size` * (players + bullets). */
+	u8*		arena;
+	u32		player_slots;
+	u32		bullet_slots;
+
+	/**	`resim`
+	 *	Scratch for the partial rollback. Players first, by dense index,
+	 *	then bullets. `queue` holds indices of members not yet expanded.
+	 */
+	cg_sbsm_resim_box_t* resim;
+	u32*	resim_queue;
+	u32		resim_size;
+
+	/**	`resim_buckets`
+	 *	The boxes bucketed on a coarse grid over the map, so expanding a member
+	 *	only tests the boxes near it. Bucket `b` holds the box indices
+	 *	resim_items[resim_buckets[b] .. resim_buckets[b + 1]).
+	 */
+	u32*	resim_buckets;
+	u32		resim_buckets_size;
+	u32*	resim_items;
+	u32		resim_items_size;
+	bool	resim_all;
+	cg_sbsm_resim_stats_t resim_stats;
+
 	cg_game_snapshot_t snapshots[];
 } cg_sbsm_t;	// Snapshot-Based State Management
 
 cg_sbsm_t* sbsm_create(u32 count, f64 interval_ms);
+void sbsm_destroy(cg_sbsm_t* sbsm);
+void sbsm_reserve(cg_sbsm_t* sbsm, u32 player_slots, u32 bullet_slots);
+cg_player_snapshot_t* sbsm_player_state(const cg_sbsm_t* sbsm, cg_game_snapshot_t* ss, u32 player_id);
+cg_player_snapshot_t* sbsm_player_state_new(const cg_sbsm_t* sbsm, cg_game_snapshot_t* ss, u32 player_id);
+cg_bullet_snapshot_t* sbsm_bullet_state(const cg_sbsm_t* sbsm, cg_game_snapshot_t* ss, u32 bullet_id);
 cg_game_snapshot_t* sbsm_lookup(cg_sbsm_t* sbsm, f64 timestamp_ms);
 void sbsm_rollback(coregame_t* cg);
 void sbsm_rotate(coregame_t* cg, cg_sbsm_t* sbsm);
@@ -78,7 +131,8 @@ void sbsm_print(const cg_sbsm_t* sbsm);
 void sbsm_commit_player(cg_game_snapshot_t* ss, cg_player_t* player);
 void sbsm_commit_bullet(cg_game_snapshot_t* ss, cg_bullet_t* bullet);
 void sbsm_player_to_snapshot(cg_player_snapshot_t* pss, const cg_player_t* player);
-void sbsm_snapshot_to_player(coregame_t* cg, cg_player_t* player, const cg_player_snapshot_t* pss);
+void sbsm_snapshot_to_player(coregame_t* cg, cg_player_t* player, 
+							 const cg_game_snapshot_t* ss, const cg_player_snapshot_t* pss);
 void sbsm_snapshot_to_bullet(cg_bullet_t* bullet, const cg_bullet_snapshot_t* bss);
 void sbsm_delete_player(cg_sbsm_t* sbsm, cg_player_t* player);
 
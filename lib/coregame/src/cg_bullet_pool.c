@@ -0,0 +1,92 @@
+#include "cg_bullet_pool.h"
+#include "coregame.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CG_BULLET_CELLS_INIT 6
+
+static void
+cg_bullet_pool_new_slab(cg_bullet_pool_t* pool)
+{
+	cg_bullet_t* slab = calloc(pool->slab_size, sizeof(cg_bullet_t));
+
+	pool->slabs = realloc(pool->slabs, sizeof(cg_bullet_t*) * (pool->stats.slabs + 1));
+	pool->slabs[pool->stats.slabs++] = slab;
+	pool->stats.capacity += pool->slab_size;
+
+	/* Push in reverse so allocation walks the slab front-to-back. */
+	for (u32 i = pool->slab_size; i-- > 0; )
+	{
+		cg_bullet_t* bullet = slab + i;
+		bullet->next = pool->free_list;
+		pool->free_list = bullet;
+	}
+}
+
+void
+cg_bullet_pool_init(cg_bullet_pool_t* pool, u32 slab_size)
+{
+	memset(pool, 0, sizeof(cg_bullet_pool_t));
+	pool->slab_size = (slab_size) ? slab_size : CG_BULLET_POOL_SLAB_SIZE;
+}
+
+void
+cg_bullet_pool_reserve(cg_bullet_pool_t* pool, u32 count)
+{
+	while (pool->stats.capacity < count)
+		cg_bullet_pool_new_slab(pool);
+}
+
+cg_bullet_t*
+cg_bullet_pool_alloc(cg_bullet_pool_t* pool)
+{
+	cg_bullet_t* bullet;
+	array_t cells;
+
+	if (pool->free_list == NULL)
+		cg_bullet_pool_new_slab(pool);
+
+	bullet = pool->free_list;
+	pool->free_list = bullet->next;
+
+	cells = bullet->cells;
+	memset(bullet, 0, sizeof(cg_bullet_t));
+
+	if (cells.buf)
+	{
+		array_clear(&cells, false);
+		bullet->cells = cells;
+	}
+	else
+		array_init(&bullet->cells, sizeof(const cg_runtime_cell_t**), CG_BULLET_CELLS_INIT);
+
+	pool->stats.in_use++;
+	if (pool->stats.in_use > pool->stats.highest)
+		pool->stats.highest = pool->stats.in_use;
+
+	return bullet;
+}
+
+void
+cg_bullet_pool_free(cg_bullet_pool_t* pool, cg_bullet_t* bullet)
+{
+	bullet->next = pool->free_list;
+	pool->free_list = bullet;
+	pool->stats.in_use--;
+}
+
+void
+cg_bullet_pool_destroy(cg_bullet_pool_t* pool)
+{
+	for (u32 i = 0; i < pool->stats.slabs; i++)
+	{
+		cg_bullet_t* slab = pool->slabs[i];
+
+		for (u32 j = 0; j < pool->slab_size; j++)
+			if (slab[j].cells.buf)
+				array_del(&slab[j].cells);
+		free(slab);
+	}
+	free(pool->slabs);
+	memset(pool, 0, sizeof(cg_bullet_pool_t));
+}
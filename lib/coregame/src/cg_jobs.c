@@ -0,0 +1,227 @@
+#include "cg_jobs.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+/**
+ *	A deque is just a range of chunk indices. Chunks are only dealt out
+ *	at the start of a batch, so the owner pops from the back and thieves
+ *	take from the front without anyone ever pushing mid-batch.
+ */
+typedef struct
+{
+	pthread_mutex_t lock;
+	u32 head;
+	u32 tail;
+} cg_job_deque_t;
+
+typedef struct
+{
+	cg_jobs_t*	jobs;
+	u32			idx;
+} cg_job_worker_t;
+
+struct cg_jobs
+{
+	pthread_t*			threads;
+	cg_job_worker_t*	thread_workers;
+	cg_job_deque_t*		deques;
+	u32					workers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t	wake;
+	u64				generation;
+	bool			quit;
+
+	/* Current batch */
+	cg_job_func_t	func;
+	void*			ctx;
+	u32				count;
+	u32				grain;
+	atomic_uint		pending;
+};
+
+static bool
+cg_jobs_take(cg_jobs_t* jobs, u32 worker, u32* chunk)
+{
+	cg_job_deque_t* own = jobs->deques + worker;
+	bool ret = false;
+
+	pthread_mutex_lock(&own->lock);
+	if (own->head < own->tail)
+	{
+		*chunk = --own->tail;
+		ret = true;
+	}
+	pthread_mutex_unlock(&own->lock);
+
+	for (u32 i = 1; i < jobs->workers && ret == false; i++)
+	{
+		cg_job_deque_t* victim = jobs->deques + ((worker + i) % jobs->workers);
+
+		pthread_mutex_lock(&victim->lock);
+		if (victim->head < victim->tail)
+		{
+			*chunk = victim->head++;
+			ret = true;
+		}
+		pthread_mutex_unlock(&victim->lock);
+	}
+	return ret;
+}
+
+static bool
+cg_jobs_run_one(cg_jobs_t* jobs, u32 worker)
+{
+	u32 chunk;
+	u32 begin;
+	u32 end;
+
+	if (cg_jobs_take(jobs, worker, &chunk) == false)
+		return false;
+
+	begin = chunk * jobs->grain;
+	end = begin + jobs->grain;
+	if (end > jobs->count)
+		end = jobs->count;
+
+	jobs->func(jobs->ctx, begin, end, worker);
+
+	atomic_fetch_sub_explicit(&jobs->pending, 1, memory_order_release);
+	return true;
+}
+
+static void*
+cg_jobs_thread(void* arg)
+{
+	cg_job_worker_t* worker = arg;
+	cg_jobs_t* jobs = worker->jobs;
+	u64 seen = 0;
+
+	while (1)
+	{
+		pthread_mutex_lock(&jobs->lock);
+		while (jobs->generation == seen && jobs->quit == false)
+			pthread_cond_wait(&jobs->wake, &jobs->lock);
+		seen = jobs->generation;
+		if (jobs->quit)
+		{
+			pthread_mutex_unlock(&jobs->lock);
+			break;
+		}
+		pthread_mutex_unlock(&jobs->lock);
+
+		while (cg_jobs_run_one(jobs, worker->idx))
+			;
+	}
+	return NULL;
+}
+
+cg_jobs_t*
+cg_jobs_create(u32 threads)
+{
+	cg_jobs_t* jobs = calloc(1, sizeof(cg_jobs_t));
+
+	jobs->workers = threads + 1;
+	jobs->deques = calloc(jobs->workers, sizeof(cg_job_deque_t));
+	for (u32 i = 0; i < jobs->workers; i++)
+		pthread_mutex_init(&jobs->deques[i].lock, NULL);
+
+	pthread_mutex_init(&jobs->lock, NULL);
+	pthread_cond_init(&jobs->wake, NULL);
+
+	jobs->threads = calloc(threads, sizeof(pthread_t));
+	jobs->thread_workers = calloc(threads, sizeof(cg_job_worker_t));
+	for (u32 i = 0; i < threads; i++)
+	{
+		jobs->thread_workers[i].jobs = jobs;
+		jobs->thread_workers[i].idx = i + 1;
+		pthread_create(jobs->threads + i, NULL, cg_jobs_thread, jobs->thread_workers + i);
+	}
+
+	return jobs;
+}
+
+void
+cg_jobs_destroy(cg_jobs_t* jobs)
+{
+	if (jobs == NULL)
+		return;
+
+	pthread_mutex_lock(&jobs->lock);
+	jobs->quit = true;
+	pthread_cond_broadcast(&jobs->wake);
+	pthread_mutex_unlock(&jobs->lock);
+
+	for (u32 i = 0; i < jobs->workers - 1; i++)
+		pthread_join(jobs->threads[i], NULL);
+
+	for (u32 i = 0; i < jobs->workers; i++)
+		pthread_mutex_destroy(&jobs->deques[i].lock);
+	pthread_mutex_destroy(&jobs->lock);
+	pthread_cond_destroy(&jobs->wake);
+
+	free(jobs->threads);
+	free(jobs->thread_workers);
+	free(jobs->deques);
+	free(jobs);
+}
+
+u32
+cg_jobs_workers(const cg_jobs_t* jobs)
+{
+	return (jobs) ? jobs->workers : 1;
+}
+
+void
+cg_jobs_parallel_for(cg_jobs_t* jobs, u32 count, u32 grain,
+					 cg_job_func_t func, void* ctx)
+{
+	u32 chunks;
+
+	if (count == 0)
+		return;
+	if (grain == 0)
+		grain = 1;
+
+	chunks = (count + grain - 1) / grain;
+
+	if (jobs == NULL || jobs->workers == 1 || chunks == 1)
+	{
+		func(ctx, 0, count, 0);
+		return;
+	}
+
+	/*
+	 * Batch parameters first, then the chunks (under the deque locks),
+	 * so whoever takes a chunk also sees the batch it belongs to.
+	 */
+	jobs->func = func;
+	jobs->ctx = ctx;
+	jobs->count = count;
+	jobs->grain = grain;
+	atomic_store_explicit(&jobs->pending, chunks, memory_order_relaxed);
+
+	for (u32 i = 0; i < jobs->workers; i++)
+	{
+		cg_job_deque_t* deque = jobs->deques + i;
+
+		pthread_mutex_lock(&deque->lock);
+		deque->head = (u64)chunks * i / jobs->workers;
+		deque->tail = (u64)chunks * (i + 1) / jobs->workers;
+		pthread_mutex_unlock(&deque->lock);
+	}
+
+	pthread_mutex_lock(&jobs->lock);
+	jobs->generation++;
+	pthread_cond_broadcast(&jobs->wake);
+	pthread_mutex_unlock(&jobs->lock);
+
+	while (atomic_load_explicit(&jobs->pending, memory_order_acquire))
+	{
+		if (cg_jobs_run_one(jobs, 0) == false)
+			sched_yield();
+	}
+}
@@ -6,6 +6,15 @@
 #include "cutils.h"
 #include "coregame.h"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define CG_MAP_TMP_PATH_MAX 4096
+
 u64
 file_size(FILE* f)
 {
@@ -16,12 +25,54 @@ file_size(FILE* f)
     return ret;
 }
 
-cg_runtime_map_t*	
-cg_map_load(const char* path, cg_disk_map_t** disk_map_p, u32* disk_size_p)
+/**
+ *	Saves go to `path`.tmp and are renamed over `path` once complete, so
+ *	nothing reading the file (a server with it mmap()ed) ever sees it
+ *	half written or truncated under it.
+ */
+static FILE*
+cg_map_create_tmp(const char* path, char tmp_path[CG_MAP_TMP_PATH_MAX])
 {
-	cg_runtime_map_t* ret = NULL;
-	cg_disk_map_t* disk_map;
-	u64 disk_size;
+	FILE* f;
+
+	if ((u32)snprintf(tmp_path, CG_MAP_TMP_PATH_MAX, "%s.tmp", path) >= CG_MAP_TMP_PATH_MAX)
+	{
+		fprintf(stderr, "Map path too long: %s\n", path);
+		return NULL;
+	}
+	if ((f = fopen(tmp_path, "wb")) == NULL)
+		perror("fopen");
+	return f;
+}
+
+static bool
+cg_map_commit_tmp(FILE* f, const char* tmp_path, const char* path, bool ok)
+{
+	if (fclose(f) != 0)
+		ok = false;
+
+#ifdef _WIN32
+	/* rename() won't replace there, and nothing keeps a map mapped to care. */
+	if (ok)
+		remove(path);
+#endif
+	if (ok && rename(tmp_path, path) != 0)
+	{
+		perror("rename");
+		ok = false;
+	}
+	if (ok == false)
+		remove(tmp_path);
+	return ok;
+}
+
+/* The whole file read-only, mmap()ed where there's mmap. Freed with cg_map_free_disk(). */
+static void*
+cg_map_map_file(const char* path, u32* size)
+{
+#ifdef _WIN32
+	void* ret;
+	u64 fsize;
 
 	FILE* f = fopen(path, "rb");
 	if (f == NULL)
@@ -29,36 +80,110 @@ cg_map_load(const char* path, cg_disk_map_t** disk_map_p, u32* disk_size_p)
 		perror("fopen");
 		return NULL;
 	}
-
-	disk_size = file_size(f);
-	disk_map = calloc(1, disk_size);
-	fread(disk_map, 1, disk_size, f);
-
-	if (memcmp(disk_map->header.magic, CG_MAP_MAGIC, CG_MAP_MAGIC_LEN))
+	fsize = file_size(f);
+	ret = malloc(fsize);
+	if (fsize == 0 || fsize > UINT32_MAX || fread(ret, 1, fsize, f) != fsize)
 	{
-		fprintf(stderr, "Loading cgmap (%s) FAILED: Magic mismatch.\n", path);
-		goto err;
+		fclose(f);
+		free(ret);
+		return NULL;
 	}
 	fclose(f);
+	*size = fsize;
+	return ret;
+#else
+	struct stat st;
+	void* ret;
+
+	i32 fd = open(path, O_RDONLY);
+	if (fd == -1)
+	{
+		perror("open");
+		return NULL;
+	}
+	if (fstat(fd, &st) == -1 || st.st_size == 0 || (u64)st.st_size > UINT32_MAX)
+	{
+		close(fd);
+		return NULL;
+	}
+	ret = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ret == MAP_FAILED)
+	{
+		perror("mmap");
+		return NULL;
+	}
+	*size = st.st_size;
+	return ret;
+#endif
+}
 
-	ret = cg_map_load_disk(disk_map, disk_size);
+void
+cg_map_free_disk(cg_disk_map_t* disk_map, UNUSED u32 size)
+{
+	if (disk_map == NULL)
+		return;
+#ifdef _WIN32
+	free(disk_map);
+#else
+	munmap(disk_map, size);
+#endif
+}
 
-	if (disk_map_p)
+/**
+ *	`disk_map_p` gets the file as is (v1 or v2), it's what clients get
+ *	sent. Free it with cg_map_free_disk().
+ */
+cg_runtime_map_t*	
+cg_map_load(const char* path, cg_disk_map_t** disk_map_p, u32* disk_size_p)
+{
+	cg_runtime_map_t* ret;
+	cg_disk_map_t* disk_map;
+	u32 disk_size;
+
+	if ((disk_map = cg_map_map_file(path, &disk_size)) == NULL)
+		return NULL;
+
+	if ((ret = cg_map_load_disk(disk_map, disk_size)) == NULL)
+		fprintf(stderr, "Loading cgmap (%s) FAILED.\n", path);
+
+	if (disk_map_p && ret)
 	{
 		*disk_map_p = disk_map;
 		*disk_size_p = disk_size;
 	}
 	else
-		free(disk_map);
-	return ret;
-err:
-	fclose(f);
-	free(disk_map);
+		cg_map_free_disk(disk_map, disk_size);
 	return ret;
 }
 
-cg_runtime_map_t* 
-cg_map_load_disk(const cg_disk_map_t* disk_map, u32 disk_size)
+/* 1 or 2, 0 if it isn't a cgmap. */
+u32
+cg_map_header_version(const cg_map_header_t* header)
+{
+	if (memcmp(header->magic, CG_MAP_MAGIC, CG_MAP_MAGIC_LEN) == 0)
+		return 1;
+	if (memcmp(header->magic, CG_MAP_MAGIC_V2, CG_MAP_MAGIC_LEN) == 0)
+		return 2;
+	return 0;
+}
+
+/* False if a block cell isn't covered by any rect. */
+static bool
+cg_map_blocks_covered(const cg_runtime_map_t* map)
+{
+	const u32 cells_count = map->w * map->h;
+
+	for (u32 i = 0; i < cells_count; i++)
+	{
+		if (map->cells[i].type == CG_CELL_BLOCK && map->cells[i].idx == CG_BLOCK_RECT_NONE)
+			return false;
+	}
+	return true;
+}
+
+static cg_runtime_map_t* 
+cg_map_load_v1(const cg_disk_map_t* disk_map, u32 disk_size)
 {
 	cg_runtime_map_t* ret;
 	u64 disk_cells_count = 0;
@@ -73,35 +198,316 @@ cg_map_load_disk(const cg_disk_map_t* disk_map, u32 disk_size)
 	{
 		disk_cell = disk_map->cells + i;
 		runtime_cell = cg_runtime_map_at(ret, disk_cell->pos.x, disk_cell->pos.y);
-		runtime_cell->type = disk_cell->type;
-		runtime_cell->pos = disk_cell->pos;
+		if (runtime_cell)
+			runtime_cell->type = disk_cell->type;
 	}
 
-	for (u32 x = 0; x < ret->w; x++)
+	cg_map_compute_block_dist(ret);
+	cg_map_compute_block_rects(ret);
+	cg_map_compute_spawns(ret);
+
+	return ret;
+}
+
+static bool
+cg_map_v2_section_ok(u32 disk_size, u32 offset, u64 count, u32 ele_size)
+{
+	return offset <= disk_size && count * ele_size <= disk_size - offset;
+}
+
+static bool
+cg_map_v2_valid(const cg_disk_map_v2_t* disk_map, u32 disk_size)
+{
+	const u32 cs = disk_map->chunk_size;
+
+	return disk_size >= sizeof(cg_disk_map_v2_t) && disk_map->size == disk_size &&
+		   disk_map->version == CG_MAP_VERSION && cs &&
+		   disk_map->chunks_w == (disk_map->header.w + cs - 1) / cs &&
+		   disk_map->chunks_h == (disk_map->header.h + cs - 1) / cs &&
+		   cg_map_v2_section_ok(disk_size, disk_map->chunks_offset, 
+								(u64)disk_map->chunks_w * disk_map->chunks_h, sizeof(cg_map_chunk_t)) &&
+		   cg_map_v2_section_ok(disk_size, disk_map->runs_offset, disk_map->run_count, sizeof(cg_map_run_t)) &&
+		   cg_map_v2_section_ok(disk_size, disk_map->spawns_offset, disk_map->spawn_count, sizeof(cg_map_spawn_t)) &&
+		   cg_map_v2_section_ok(disk_size, disk_map->rects_offset, disk_map->rect_count, sizeof(cg_map_rect_t));
+}
+
+/* Sets the types of the chunk's cells from its runs, empty runs are skipped. */
+static bool
+cg_map_v2_decode_chunk(cg_runtime_map_t* map, const cg_disk_map_v2_t* disk_map, 
+					   const cg_map_chunk_t* chunk, u32 x0, u32 y0)
+{
+	const cg_map_run_t* runs = (const void*)((const u8*)disk_map + disk_map->runs_offset);
+	const u32 cw = (map->w - x0 < disk_map->chunk_size) ? map->w - x0 : disk_map->chunk_size;
+	const u32 ch = (map->h - y0 < disk_map->chunk_size) ? map->h - y0 : disk_map->chunk_size;
+	u32 i = 0;
+
+	if ((u64)chunk->first_run + chunk->run_count > disk_map->run_count)
+		return false;
+
+	for (u32 r = chunk->first_run; r < chunk->first_run + chunk->run_count; r++)
+	{
+		const cg_map_run_t* run = runs + r;
+
+		if (i + run->length > cw * ch)
+			return false;
+
+		if (run->type == CG_CELL_EMPTY)
+		{
+			i += run->length;
+			continue;
+		}
+		for (u32 left = run->length; left; )
+		{
+			const u32 lx = i % cw;
+			const u32 n = (left < cw - lx) ? left : cw - lx;
+			cg_runtime_cell_t* cell = cg_runtime_map_at(map, x0 + lx, y0 + i / cw);
+
+			for (u32 k = 0; k < n; k++)
+				cell[k].type = run->type;
+			i += n;
+			left -= n;
+		}
+	}
+	return i == cw * ch;
+}
+
+static cg_runtime_map_t* 
+cg_map_load_v2(const cg_disk_map_v2_t* disk_map, u32 disk_size)
+{
+	const u8* base = (const u8*)disk_map;
+	const cg_map_chunk_t* chunks = (const void*)(base + disk_map->chunks_offset);
+	const cg_map_spawn_t* spawns = (const void*)(base + disk_map->spawns_offset);
+	const cg_map_rect_t* rects = (const void*)(base + disk_map->rects_offset);
+	const f32 grid_size = disk_map->header.grid_size;
+	cg_runtime_map_t* ret;
+	cg_runtime_cell_t* cell;
+
+	if (cg_map_v2_valid(disk_map, disk_size) == false)
+	{
+		fprintf(stderr, "Loading cgmap v2 FAILED: Bad header.\n");
+		return NULL;
+	}
+
+	ret = cg_map_new(disk_map->header.w, disk_map->header.h, disk_map->header.grid_size);
+
+	for (u32 cy = 0; cy < disk_map->chunks_h; cy++)
 	{
-		for (u32 y = 0; y < ret->h; y++)
+		for (u32 cx = 0; cx < disk_map->chunks_w; cx++)
 		{
-			runtime_cell = cg_runtime_map_at(ret, x, y);
-			// if (runtime_cell->type == CG_CELL_BLOCK)
-			// 	runtime_cell->data = calloc(1, sizeof(cg_block_cell_data_t));
-			// else
-			if (runtime_cell->type != CG_CELL_BLOCK)
+			if (cg_map_v2_decode_chunk(ret, disk_map, chunks + cy * disk_map->chunks_w + cx, 
+									   cx * disk_map->chunk_size, cy * disk_map->chunk_size) == false)
+				goto err;
+		}
+	}
+
+	array_init(&ret->block_rects, sizeof(cg_rect_t), disk_map->rect_count + 1);
+	for (u32 i = 0; i < disk_map->rect_count; i++)
+	{
+		const cg_map_rect_t* rect = rects + i;
+		cg_rect_t* runtime_rect;
+
+		if ((u32)rect->x + rect->w > ret->w || (u32)rect->y + rect->h > ret->h)
+			goto err;
+
+		for (u32 y = rect->y; y < (u32)rect->y + rect->h; y++)
+		{
+			for (u32 x = rect->x; x < (u32)rect->x + rect->w; x++)
 			{
-				runtime_cell->data = calloc(1, sizeof(cg_empty_cell_data_t));
-				cg_empty_cell_data_t* data = runtime_cell->data;
-				array_init(&data->contents, sizeof(cg_player_t**), 2);
+				cell = cg_runtime_map_at(ret, x, y);
+				if (cell->type != CG_CELL_BLOCK || cell->idx != CG_BLOCK_RECT_NONE)
+					goto err;
+				cell->idx = i;
 			}
 		}
+
+		runtime_rect = array_add_into(&ret->block_rects);
+		runtime_rect->pos = vec2f(rect->x * grid_size, rect->y * grid_size);
+		runtime_rect->size = vec2f(rect->w * grid_size, rect->h * grid_size);
+	}
+
+	for (u32 i = 0; i < disk_map->spawn_count; i++)
+	{
+		cell = cg_runtime_map_at(ret, spawns[i].x, spawns[i].y);
+		if (cell == NULL || cell->type != CG_CELL_SPAWN)
+			goto err;
+		array_add_voidp(&ret->spawns, cell);
+	}
+
+	if (cg_map_blocks_covered(ret) == false)
+		goto err;
+	cg_map_compute_block_dist(ret);
+
+	return ret;
+err:
+	fprintf(stderr, "Loading cgmap v2 FAILED: Corrupt chunks, rects or spawns.\n");
+	cg_runtime_map_free(ret);
+	return NULL;
+}
+
+/* v1 or v2, read in place. `disk_map` isn't kept. */
+cg_runtime_map_t* 
+cg_map_load_disk(const void* disk_map, u32 disk_size)
+{
+	if (disk_size < sizeof(cg_map_header_t))
+	{
+		fprintf(stderr, "Loading cgmap FAILED: Too small.\n");
+		return NULL;
+	}
+
+	switch (cg_map_header_version(disk_map))
+	{
+		case 1:
+			return cg_map_load_v1(disk_map, disk_size);
+		case 2:
+			return cg_map_load_v2(disk_map, disk_size);
+		default:
+			fprintf(stderr, "Loading cgmap FAILED: Magic mismatch.\n");
+			return NULL;
+	}
+}
+
+/* FNV-1a, identifies a disk map by content for the client's map cache. */
+u64
+cg_map_hash(const void* disk_map, u32 size)
+{
+	const u8* bytes = disk_map;
+	u64 hash = 0xcbf29ce484222325;
+
+	for (u32 i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+/* Block cell `i` has to lie inside the rect it claims to be merged into. */
+static bool
+cg_map_cache_cell_covered(const cg_runtime_map_t* map, u32 i, u32 rect_idx)
+{
+	const f32 grid_size = map->grid_size;
+	const f32 x = (i % map->w) * grid_size;
+	const f32 y = (i / map->w) * grid_size;
+	const cg_rect_t* rect;
+
+	if (rect_idx >= map->block_rects.count)
+		return false;
+
+	rect = (const cg_rect_t*)map->block_rects.buf + rect_idx;
+	return rect->pos.x <= x && rect->pos.y <= y &&
+		   x + grid_size <= rect->pos.x + rect->size.x &&
+		   y + grid_size <= rect->pos.y + rect->size.y;
+}
+
+cg_runtime_map_t*
+cg_map_load_cache(const char* path, u64 hash)
+{
+	cg_runtime_map_t* ret = NULL;
+	cg_map_cache_header_t header;
+	cg_map_cache_cell_t* cells = NULL;
+	cg_runtime_cell_t* cell;
+	u32 cells_count;
+	u64 size;
+
+	FILE* f = fopen(path, "rb");
+	if (f == NULL)
+		return NULL;
+
+	if (fread(&header, 1, sizeof(header), f) != sizeof(header) ||
+		memcmp(header.magic, CG_MAP_CACHE_MAGIC, sizeof(CG_MAP_CACHE_MAGIC)) ||
+		header.version != CG_MAP_CACHE_VERSION || header.hash != hash ||
+		header.w == 0 || header.h == 0 || header.grid_size == 0)
+		goto out;
+
+	cells_count = (u32)header.w * header.h;
+	size = sizeof(header) + (u64)cells_count * sizeof(cg_map_cache_cell_t) + (u64)header.rect_count * sizeof(cg_rect_t);
+	if (file_size(f) != size)
+		goto out;
+	fseek(f, sizeof(header), SEEK_SET);
+
+	cells = malloc(cells_count * sizeof(cg_map_cache_cell_t));
+	if (fread(cells, sizeof(cg_map_cache_cell_t), cells_count, f) != cells_count)
+		goto out;
+
+	ret = cg_map_new(header.w, header.h, header.grid_size);
+	array_init(&ret->block_rects, sizeof(cg_rect_t), header.rect_count);
+	if (fread(ret->block_rects.buf, sizeof(cg_rect_t), header.rect_count, f) != header.rect_count)
+	{
+		cg_runtime_map_free(ret);
+		ret = NULL;
+		goto out;
 	}
+	ret->block_rects.count = header.rect_count;
 
-	// array_init(&ret->runtime.edge_pool, sizeof(cg_line_t), 16);
-	// cg_map_compute_edge_pool(ret);
+	for (u32 i = 0; i < cells_count; i++)
+	{
+		cell = ret->cells + i;
+		cell->type = cells[i].type;
+
+		if (cell->type > CG_CELL_DEADZ ||
+			(cell->type == CG_CELL_BLOCK && cg_map_cache_cell_covered(ret, i, cells[i].rect_idx) == false))
+		{
+			/* The hash only covers the disk map, so a cache that got corrupted is re-requested. */
+			fprintf(stderr, "Map cache %s: bad cell %u, ignoring it.\n", path, i);
+			cg_runtime_map_free(ret);
+			ret = NULL;
+			goto out;
+		}
 
+		if (cell->type == CG_CELL_BLOCK)
+			cell->idx = cells[i].rect_idx;
+		else if (cell->type == CG_CELL_SPAWN)
+			array_add_voidp(&ret->spawns, cell);
+	}
+	/* Cheap next to the rects, and a stale distance would let rays skip through blocks. */
+	cg_map_compute_block_dist(ret);
+out:
+	fclose(f);
+	free(cells);
 	return ret;
 }
 
+bool
+cg_map_save_cache(const cg_runtime_map_t* map, u64 hash, const char* path)
+{
+	const u32 cells_count = map->w * map->h;
+	cg_map_cache_header_t header = {
+		.magic = CG_MAP_CACHE_MAGIC,
+		.version = CG_MAP_CACHE_VERSION,
+		.hash = hash,
+		.w = map->w,
+		.h = map->h,
+		.grid_size = map->grid_size,
+		.rect_count = map->block_rects.count
+	};
+	cg_map_cache_cell_t* cells;
+	const cg_runtime_cell_t* cell;
+	char tmp_path[CG_MAP_TMP_PATH_MAX];
+	bool ret;
+
+	FILE* f = cg_map_create_tmp(path, tmp_path);
+	if (f == NULL)
+		return false;
+
+	cells = calloc(cells_count, sizeof(cg_map_cache_cell_t));
+	for (u32 i = 0; i < cells_count; i++)
+	{
+		cell = map->cells + i;
+		cells[i].type = cell->type;
+		if (cell->type == CG_CELL_BLOCK)
+			cells[i].rect_idx = cell->idx;
+	}
+
+	ret = fwrite(&header, sizeof(header), 1, f) == 1 &&
+		  fwrite(cells, sizeof(cg_map_cache_cell_t), cells_count, f) == cells_count &&
+		  fwrite(map->block_rects.buf, sizeof(cg_rect_t), header.rect_count, f) == header.rect_count;
+
+	free(cells);
+	return cg_map_commit_tmp(f, tmp_path, path, ret);
+}
+
 static void
-cg_map_set_cells_pos(cg_runtime_map_t* map)
+cg_map_init_cells(cg_runtime_map_t* map)
 {
 	cg_runtime_cell_t* cell;
 
@@ -112,6 +518,7 @@ cg_map_set_cells_pos(cg_runtime_map_t* map)
 			cell = &map->cells[(y * map->w) + x];
 			cell->pos.x = x;
 			cell->pos.y = y;
+			cell->idx = CG_CELL_IDX_NONE;
 		}
 	}
 }
@@ -144,9 +551,11 @@ cg_map_new(u16 w, u16 h, u16 grid_size)
 	map->w = w;
 	map->h = h;
 	map->grid_size = grid_size;
-	// array_init(&map->runtime.edge_pool, sizeof(cg_line_t), 16);
+	array_init(&map->spawns, sizeof(cg_runtime_cell_t*), 4);
+	map->occupancy.slab_count = (w * h + CG_OCCUPANCY_SLAB_SIZE - 1) / CG_OCCUPANCY_SLAB_SIZE;
+	map->occupancy.slabs = calloc(map->occupancy.slab_count + 1, sizeof(cg_empty_cell_data_t*));
 
-	cg_map_set_cells_pos(map);
+	cg_map_init_cells(map);
 
 	return map;
 }
@@ -190,70 +599,121 @@ cg_map_resize(cg_runtime_map_t** mapp, u16 new_w, u16 new_h)
 			new_cell->type = old_cell->type;
 		}
 	}
-	free(map);
+	cg_runtime_map_free(map);
 	*mapp = new_map;
 }
 
-static u64 
-cg_map_runtime_disk_size(const cg_runtime_map_t* map, array_t* idx_array)
+/* Runs of one chunk's cells, row-major inside it. */
+static void
+cg_map_encode_chunk(cg_runtime_map_t* map, array_t* runs, u32 x0, u32 y0)
 {
-	u64 size = sizeof(cg_map_header_t);
-	u32 cells_count = map->w * map->h;
-	const cg_runtime_cell_t* cell;
+	const u32 x1 = (x0 + CG_MAP_CHUNK_SIZE < map->w) ? x0 + CG_MAP_CHUNK_SIZE : map->w;
+	const u32 y1 = (y0 + CG_MAP_CHUNK_SIZE < map->h) ? y0 + CG_MAP_CHUNK_SIZE : map->h;
+	cg_map_run_t* run = NULL;
 
-	for (u32 i = 0; i < cells_count; i++)
+	for (u32 y = y0; y < y1; y++)
 	{
-		cell = map->cells + i;
-		if (cell->type)
+		for (u32 x = x0; x < x1; x++)
 		{
-			size += sizeof(cg_disk_cell_t);
-			array_add_i32(idx_array, i);
+			const u8 type = cg_runtime_map_at(map, x, y)->type;
+
+			if (run && run->type == type && run->length < UINT16_MAX)
+				run->length++;
+			else
+			{
+				run = array_add_into(runs);
+				run->type = type;
+				run->length = 1;
+			}
 		}
 	}
-	return size;
 }
 
+/* Always writes v2, saving a loaded v1 map converts it. */
 bool		
-cg_map_save(const cg_runtime_map_t* map, const char* path)
+cg_map_save(cg_runtime_map_t* map, const char* path)
 {
-	FILE* f = fopen(path, "wb+");
+	cg_disk_map_v2_t header = {0};
+	cg_map_chunk_t* chunks;
+	cg_map_rect_t* rects;
+	cg_map_spawn_t* spawns;
+	array_t runs;
+	u32 chunk_count;
+	char tmp_path[CG_MAP_TMP_PATH_MAX];
+	bool ret;
+
+	FILE* f = cg_map_create_tmp(path, tmp_path);
 	if (f == NULL)
-	{
-		perror("fopen");
 		return false;
-	}
 
-	array_t idx_array;
-	array_init(&idx_array, sizeof(u32), map->w * map->h);
-	u32* idx_buf = (u32*)idx_array.buf;
-	u64 disk_size = cg_map_runtime_disk_size(map, &idx_array);
-
-	if (idx_array.count == 0)
-		return false;
+	cg_map_compute_block_rects(map);
+	cg_map_compute_spawns(map);
+
+	memcpy(header.header.magic, CG_MAP_MAGIC_V2, CG_MAP_MAGIC_LEN);
+	header.header.w = map->w;
+	header.header.h = map->h;
+	header.header.grid_size = map->grid_size;
+	header.version = CG_MAP_VERSION;
+	header.chunk_size = CG_MAP_CHUNK_SIZE;
+	header.chunks_w = (map->w + CG_MAP_CHUNK_SIZE - 1) / CG_MAP_CHUNK_SIZE;
+	header.chunks_h = (map->h + CG_MAP_CHUNK_SIZE - 1) / CG_MAP_CHUNK_SIZE;
+	chunk_count = header.chunks_w * header.chunks_h;
+
+	chunks = calloc(chunk_count, sizeof(cg_map_chunk_t));
+	array_init(&runs, sizeof(cg_map_run_t), chunk_count);
+	for (u32 cy = 0; cy < header.chunks_h; cy++)
+	{
+		for (u32 cx = 0; cx < header.chunks_w; cx++)
+		{
+			cg_map_chunk_t* chunk = chunks + cy * header.chunks_w + cx;
 
-	cg_disk_map_t* map_disk = calloc(1, disk_size);
-	memcpy(map_disk->header.magic, CG_MAP_MAGIC, CG_MAP_MAGIC_LEN);
-	map_disk->header.w = map->w;
-	map_disk->header.h = map->h;
-	map_disk->header.grid_size = map->grid_size;
+			chunk->first_run = runs.count;
+			cg_map_encode_chunk(map, &runs, cx * CG_MAP_CHUNK_SIZE, cy * CG_MAP_CHUNK_SIZE);
+			chunk->run_count = runs.count - chunk->first_run;
+		}
+	}
 
-	for (u32 i = 0; i < idx_array.count; i++)
+	header.spawn_count = map->spawns.count;
+	spawns = calloc(header.spawn_count + 1, sizeof(cg_map_spawn_t));
+	for (u32 i = 0; i < header.spawn_count; i++)
 	{
-		cg_disk_cell_t* dest_cell = map_disk->cells + i;
-		const cg_runtime_cell_t* src_cell = map->cells + idx_buf[i];
+		const cg_runtime_cell_t* cell = *(cg_runtime_cell_t**)array_idx(&map->spawns, i);
 
-		dest_cell->type = src_cell->type;
-		dest_cell->pos = src_cell->pos;
+		spawns[i].x = cell->pos.x;
+		spawns[i].y = cell->pos.y;
 	}
-	array_del(&idx_array);
-
-	fwrite(map_disk, disk_size, 1, f);
 
-	fclose(f);
+	header.rect_count = map->block_rects.count;
+	rects = calloc(header.rect_count + 1, sizeof(cg_map_rect_t));
+	for (u32 i = 0; i < header.rect_count; i++)
+	{
+		const cg_rect_t* rect = (const cg_rect_t*)map->block_rects.buf + i;
 
-	free(map_disk);
+		rects[i].x = rect->pos.x / map->grid_size + 0.5f;
+		rects[i].y = rect->pos.y / map->grid_size + 0.5f;
+		rects[i].w = rect->size.x / map->grid_size + 0.5f;
+		rects[i].h = rect->size.y / map->grid_size + 0.5f;
+	}
 
-	return true;
+	header.run_count = runs.count;
+	header.chunks_offset = sizeof(cg_disk_map_v2_t);
+	header.runs_offset = header.chunks_offset + chunk_count * sizeof(cg_map_chunk_t);
+	header.spawns_offset = header.runs_offset + header.run_count * sizeof(cg_map_run_t);
+	header.rects_offset = header.spawns_offset + header.spawn_count * sizeof(cg_map_spawn_t);
+	header.size = header.rects_offset + header.rect_count * sizeof(cg_map_rect_t);
+
+	ret = fwrite(&header, sizeof(cg_disk_map_v2_t), 1, f) == 1 &&
+		  fwrite(chunks, sizeof(cg_map_chunk_t), chunk_count, f) == chunk_count &&
+		  fwrite(runs.buf, sizeof(cg_map_run_t), header.run_count, f) == header.run_count &&
+		  fwrite(spawns, sizeof(cg_map_spawn_t), header.spawn_count, f) == header.spawn_count &&
+		  fwrite(rects, sizeof(cg_map_rect_t), header.rect_count, f) == header.rect_count;
+
+	free(chunks);
+	free(spawns);
+	free(rects);
+	array_del(&runs);
+
+	return cg_map_commit_tmp(f, tmp_path, path, ret);
 }
 
 cg_disk_cell_t*	
@@ -304,154 +764,195 @@ cg_runtime_map_free(cg_runtime_map_t* map)
 	if (map == NULL)
 		return;
 
-	for (u32 x = 0; x < map->w; x++)
+	for (u32 i = 0; i < map->occupancy.slab_count; i++)
+		free(map->occupancy.slabs[i]);
+	free(map->occupancy.slabs);
+	if (map->block_rects.buf)
+		array_del(&map->block_rects);
+	array_del(&map->spawns);
+	free(map);
+}
+
+static inline void
+cg_map_relax_block_dist(cg_runtime_cell_t* cell, const cg_runtime_cell_t* neighbor)
+{
+	if (neighbor && neighbor->block_dist + 1 < cell->block_dist)
+		cell->block_dist = neighbor->block_dist + 1;
+}
+
+/**
+ *	Two-pass chamfer over the grid. With all 8 neighbors weighted 1
+ *	this gives the exact Chebyshev distance, saturated at CG_BLOCK_DIST_MAX.
+ */
+void
+cg_map_compute_block_dist(cg_runtime_map_t* map)
+{
+	cg_runtime_cell_t* cell;
+	const u32 cells_count = map->w * map->h;
+
+	for (u32 i = 0; i < cells_count; i++)
+	{
+		cell = map->cells + i;
+		cell->block_dist = (cell->type == CG_CELL_BLOCK) ? 0 : CG_BLOCK_DIST_MAX;
+	}
+
+	for (i32 y = 0; y < (i32)map->h; y++)
+	{
+		for (i32 x = 0; x < (i32)map->w; x++)
+		{
+			cell = cg_runtime_map_at(map, x, y);
+			cg_map_relax_block_dist(cell, cg_runtime_map_at(map, x - 1, y));
+			cg_map_relax_block_dist(cell, cg_runtime_map_at(map, x - 1, y - 1));
+			cg_map_relax_block_dist(cell, cg_runtime_map_at(map, x, y - 1));
+			cg_map_relax_block_dist(cell, cg_runtime_map_at(map, x + 1, y - 1));
+		}
+	}
+
+	for (i32 y = map->h - 1; y >= 0; y--)
+	{
+		for (i32 x = map->w - 1; x >= 0; x--)
+		{
+			cell = cg_runtime_map_at(map, x, y);
+			cg_map_relax_block_dist(cell, cg_runtime_map_at(map, x + 1, y));
+			cg_map_relax_block_dist(cell, cg_runtime_map_at(map, x + 1, y + 1));
+			cg_map_relax_block_dist(cell, cg_runtime_map_at(map, x, y + 1));
+			cg_map_relax_block_dist(cell, cg_runtime_map_at(map, x - 1, y + 1));
+		}
+	}
+}
+
+static bool
+cg_map_is_unmerged_block(cg_runtime_map_t* map, u32 x, u32 y)
+{
+	const cg_runtime_cell_t* cell = cg_runtime_map_at(map, x, y);
+
+	if (cell == NULL || cell->type != CG_CELL_BLOCK)
+		return false;
+	return cell->idx == CG_BLOCK_RECT_NONE;
+}
+
+/**
+ *	Greedy meshing: take the first unmerged block in scan order, grow it 
+ *	right as far as it goes, then grow that run down while the whole
+ *	row below is unmerged blocks.
+ */
+void
+cg_map_compute_block_rects(cg_runtime_map_t* map)
+{
+	const f32 grid_size = map->grid_size;
+	const u32 cells_count = map->w * map->h;
+	cg_runtime_cell_t* cell;
+
+	if (map->block_rects.buf)
+		array_clear(&map->block_rects, false);
+	else
+		array_init(&map->block_rects, sizeof(cg_rect_t), 16);
+
+	for (u32 i = 0; i < cells_count; i++)
+	{
+		cell = map->cells + i;
+		if (cell->type == CG_CELL_BLOCK)
+			cell->idx = CG_BLOCK_RECT_NONE;
+	}
+
+	for (u32 y = 0; y < map->h; y++)
 	{
-		for (u32 y = 0; y < map->h; y++)
+		for (u32 x = 0; x < map->w; x++)
 		{
-			cg_runtime_cell_t* cell = cg_runtime_map_at(map, x, y);
-			if (cell->data == NULL)
+			u32 w = 1;
+			u32 h = 1;
+			bool row_ok = true;
+
+			if (cg_map_is_unmerged_block(map, x, y) == false)
 				continue;
-			if (cell->type != CG_CELL_BLOCK)
+
+			while (cg_map_is_unmerged_block(map, x + w, y))
+				w++;
+
+			while (row_ok && y + h < map->h)
 			{
-				cg_empty_cell_data_t* data = cell->data;
-				array_del(&data->contents);
+				for (u32 i = 0; i < w && row_ok; i++)
+					row_ok = cg_map_is_unmerged_block(map, x + i, y + h);
+				if (row_ok)
+					h++;
+			}
+
+			const u32 rect_idx = map->block_rects.count;
+			cg_rect_t* rect = array_add_into(&map->block_rects);
+			rect->pos = vec2f(x * grid_size, y * grid_size);
+			rect->size = vec2f(w * grid_size, h * grid_size);
+
+			for (u32 j = 0; j < h; j++)
+			{
+				for (u32 i = 0; i < w; i++)
+				{
+					cell = cg_runtime_map_at(map, x + i, y + j);
+					cell->idx = rect_idx;
+				}
 			}
-			free(cell->data);
 		}
 	}
-	// array_del(&map->runtime.edge_pool);
-	free(map);
 }
 
-// static cg_runtime_cell_t* 
-// cg_runtime_map_at_edge(cg_runtime_map_t* map, u16 x, u16 y)
-// {
-// 	cg_runtime_cell_t* ret;
-//
-// 	ret = cg_runtime_map_at(map, x, y);
-// 	if (ret && ret->type != CG_CELL_BLOCK)
-// 		ret = NULL;
-// 	return ret;
-// }
-
-// static void
-// cg_map_get_cell_edges(cg_runtime_map_t* map, cg_runtime_cell_t* cell)
-// {
-// 	array_t* edge_pool = &map->runtime.edge_pool;
-// 	cg_block_cell_data_t* cell_data = cell->data;
-// 	cg_runtime_cell_t* left = NULL;
-// 	cg_runtime_cell_t* top = NULL;
-// 	cg_runtime_cell_t* right = NULL;
-// 	cg_runtime_cell_t* bot = NULL;
-// 	cg_line_t*	left_edge = NULL;
-// 	cg_line_t*	top_edge = NULL;
-// 	cg_line_t*	right_edge = NULL;
-// 	cg_line_t*	bot_edge = NULL;
-// 	cg_block_cell_data_t* left_data = NULL;
-// 	cg_block_cell_data_t* top_data = NULL;
-//
-// 	if (cell->type != CG_CELL_BLOCK)
-// 		return;
-//
-// 	left = cg_runtime_map_at_edge(map,	cell->pos.x - 1,	cell->pos.y);
-// 	if (left)
-// 		left_data = left->data;
-//
-// 	top = cg_runtime_map_at_edge(map,	cell->pos.x,		cell->pos.y - 1);
-// 	if (top)
-// 		top_data = top->data;
-//
-// 	right = cg_runtime_map_at_edge(map,	cell->pos.x + 1,	cell->pos.y);
-// 	bot = cg_runtime_map_at_edge(map,	cell->pos.x,		cell->pos.y + 1);
-//
-// 	if (left == NULL)
-// 	{
-// 		if (top == NULL || top_data->left == NULL)
-// 		{
-// 			left_edge = array_add_into(edge_pool);
-//
-// 			left_edge->a.x = cell->pos.x * map->grid_size;
-// 			left_edge->a.y = cell->pos.y * map->grid_size;
-//
-// 			left_edge->b.x = left_edge->a.x;
-// 			left_edge->b.y = left_edge->a.y + map->grid_size;
-// 		}
-// 		else
-// 		{
-// 			left_edge = top_data->left;
-// 			left_edge->b.y += map->grid_size;
-// 		}
-// 	}
-// 	if (top == NULL)
-// 	{
-// 		if (left == NULL || left_data->top == NULL)
-// 		{
-// 			top_edge = array_add_into(edge_pool);
-//
-// 			top_edge->a.x = cell->pos.x * map->grid_size;
-// 			top_edge->a.y = cell->pos.y * map->grid_size;
-//
-// 			top_edge->b.x = top_edge->a.x + map->grid_size;
-// 			top_edge->b.y = top_edge->a.y;
-// 		}
-// 		else
-// 		{
-// 			top_edge = left_data->top;
-// 			top_edge->b.x += map->grid_size;
-// 		}
-// 	}
-// 	if (right == NULL)
-// 	{
-// 		if (top == NULL || top_data->right == NULL)
-// 		{
-// 			right_edge = array_add_into(edge_pool);
-//
-// 			right_edge->a.x = (cell->pos.x * map->grid_size) + map->grid_size;
-// 			right_edge->a.y = cell->pos.y * map->grid_size;
-//
-// 			right_edge->b.x = right_edge->a.x;
-// 			right_edge->b.y = right_edge->a.y + map->grid_size;
-// 		}
-// 		else
-// 		{
-// 			right_edge = top_data->right;
-// 			right_edge->b.y += map->grid_size;
-// 		}
-// 	}
-// 	if (bot == NULL)
-// 	{
-// 		if (left == NULL || left_data->bot == NULL)
-// 		{
-// 			bot_edge = array_add_into(edge_pool);
-//
-// 			bot_edge->a.x = cell->pos.x * map->grid_size;
-// 			bot_edge->a.y = (cell->pos.y * map->grid_size) + map->grid_size;
-//
-// 			bot_edge->b.x = bot_edge->a.x + map->grid_size;
-// 			bot_edge->b.y = bot_edge->a.y;
-// 		}
-// 		else
-// 		{
-// 			bot_edge = left_data->bot;
-// 			bot_edge->b.x += map->grid_size;
-// 		}
-// 	}
-// 	
-// 	cell_data->left = left_edge;
-// 	cell_data->right = right_edge;
-// 	cell_data->top = top_edge;
-// 	cell_data->bot = bot_edge;
-// }
-
-// void 
-// cg_map_compute_edge_pool(cg_runtime_map_t* map)
-// {
-// 	array_clear(&map->runtime.edge_pool, true);
-// 	for (u32 x = 0; x < map->w; x++)
-// 	{
-// 		for (u32 y = 0; y < map->h; y++)
-// 		{
-// 			cg_map_get_cell_edges(map, cg_runtime_map_at(map, x, y));
-// 		}
-// 	}
-// }
+void
+cg_map_compute_spawns(cg_runtime_map_t* map)
+{
+	const u32 cells_count = map->w * map->h;
+
+	array_clear(&map->spawns, false);
+	for (u32 i = 0; i < cells_count; i++)
+	{
+		if (map->cells[i].type == CG_CELL_SPAWN)
+			array_add_voidp(&map->spawns, map->cells + i);
+	}
+}
+
+const cg_rect_t*
+cg_map_block_rect(const cg_runtime_map_t* map, const cg_runtime_cell_t* cell)
+{
+	if (cell->type != CG_CELL_BLOCK || cell->idx == CG_BLOCK_RECT_NONE)
+		return NULL;
+	return ((const cg_rect_t*)map->block_rects.buf) + cell->idx;
+}
+
+/* The cell's occupancy, NULL if no player has entered it yet. */
+cg_empty_cell_data_t*
+cg_map_occupancy(const cg_runtime_map_t* map, const cg_runtime_cell_t* cell)
+{
+	const cg_occupancy_pool_t* pool = &map->occupancy;
+	cg_empty_cell_data_t* slab;
+
+	if (cell->type == CG_CELL_BLOCK || cell->idx == CG_CELL_IDX_NONE)
+		return NULL;
+	slab = atomic_load_explicit(pool->slabs + cell->idx / CG_OCCUPANCY_SLAB_SIZE, memory_order_acquire);
+	return slab + cell->idx % CG_OCCUPANCY_SLAB_SIZE;
+}
+
+/**
+ *	The cell's occupancy, claiming a slot first if it has none. Two threads
+ *	may race for a slab, never for a cell: islands don't share cells.
+ */
+cg_empty_cell_data_t*
+cg_map_occupy(cg_runtime_map_t* map, cg_runtime_cell_t* cell)
+{
+	cg_occupancy_pool_t* pool = &map->occupancy;
+	_Atomic(cg_empty_cell_data_t*)* slab_p;
+	cg_empty_cell_data_t* slab;
+	cg_empty_cell_data_t* expected = NULL;
+
+	if (cell->idx == CG_CELL_IDX_NONE)
+		cell->idx = atomic_fetch_add_explicit(&pool->used, 1, memory_order_relaxed);
+
+	slab_p = pool->slabs + cell->idx / CG_OCCUPANCY_SLAB_SIZE;
+	if ((slab = atomic_load_explicit(slab_p, memory_order_acquire)) == NULL)
+	{
+		slab = calloc(CG_OCCUPANCY_SLAB_SIZE, sizeof(cg_empty_cell_data_t));
+		if (atomic_compare_exchange_strong_explicit(slab_p, &expected, slab, 
+													memory_order_acq_rel, memory_order_acquire) == false)
+		{
+			free(slab);
+			slab = expected;
+		}
+	}
+	return slab + cell->idx % CG_OCCUPANCY_SLAB_SIZE;
+}
@@ -0,0 +1,323 @@
+#include "cg_ray.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define CG_RAY_X86 1
+#include <immintrin.h>
+#else
+#define CG_RAY_X86 0
+#endif
+
+#define CG_AABB_BATCH_INIT 32
+
+typedef i32 (*cg_ray_batch_func_t)(const vec2f_t* origin, const vec2f_t* dir,
+								   const cg_aabb_batch_t* batch, f32* t_hit_near);
+
+static cg_ray_batch_func_t	cg_ray_batch_func = NULL;
+static const char*			cg_ray_batch_name = "scalar";
+
+void
+cg_aabb_batch_init(cg_aabb_batch_t* batch, u32 initial_size)
+{
+	if (initial_size == 0)
+		initial_size = CG_AABB_BATCH_INIT;
+
+	batch->count = 0;
+	batch->size = initial_size;
+	batch->min_x = malloc(sizeof(f32) * initial_size);
+	batch->min_y = malloc(sizeof(f32) * initial_size);
+	batch->max_x = malloc(sizeof(f32) * initial_size);
+	batch->max_y = malloc(sizeof(f32) * initial_size);
+	batch->data = malloc(sizeof(void*) * initial_size);
+
+	/* Resolve dispatch up front, so worker threads only ever read it. */
+	cg_ray_aabb_batch_impl();
+}
+
+void
+cg_aabb_batch_add(cg_aabb_batch_t* batch, const cg_rect_t* rect, void* data)
+{
+	if (batch->count >= batch->size)
+	{
+		batch->size *= 2;
+		batch->min_x = realloc(batch->min_x, sizeof(f32) * batch->size);
+		batch->min_y = realloc(batch->min_y, sizeof(f32) * batch->size);
+		batch->max_x = realloc(batch->max_x, sizeof(f32) * batch->size);
+		batch->max_y = realloc(batch->max_y, sizeof(f32) * batch->size);
+		batch->data = realloc(batch->data, sizeof(void*) * batch->size);
+	}
+
+	const u32 i = batch->count++;
+	batch->min_x[i] = rect->pos.x;
+	batch->min_y[i] = rect->pos.y;
+	batch->max_x[i] = rect->pos.x + rect->size.x;
+	batch->max_y[i] = rect->pos.y + rect->size.y;
+	batch->data[i] = data;
+}
+
+void
+cg_aabb_batch_del(cg_aabb_batch_t* batch)
+{
+	free(batch->min_x);
+	free(batch->min_y);
+	free(batch->max_x);
+	free(batch->max_y);
+	free(batch->data);
+	batch->count = batch->size = 0;
+}
+
+/**
+ *	Same math & rejection rules as `cg_ray_collision_test()` in coregame.c.
+ */
+static inline bool
+cg_ray_aabb_test(const vec2f_t* o, const vec2f_t* d,
+				 const cg_aabb_batch_t* batch, u32 i, f32* t_hit_near)
+{
+	f32 t_near_x = (batch->min_x[i] - o->x) / d->x;
+	f32 t_near_y = (batch->min_y[i] - o->y) / d->y;
+	f32 t_far_x = (batch->max_x[i] - o->x) / d->x;
+	f32 t_far_y = (batch->max_y[i] - o->y) / d->y;
+	f32 tmp;
+
+	if (isnan(t_far_x) || isnan(t_far_y) || isnan(t_near_x) || isnan(t_near_y))
+		return false;
+
+	if (t_near_x > t_far_x)
+	{
+		tmp = t_near_x;
+		t_near_x = t_far_x;
+		t_far_x = tmp;
+	}
+	if (t_near_y > t_far_y)
+	{
+		tmp = t_near_y;
+		t_near_y = t_far_y;
+		t_far_y = tmp;
+	}
+
+	if (t_near_x > t_far_y || t_near_y > t_far_x)
+		return false;
+
+	if (fminf(t_far_x, t_far_y) < 0)
+		return false;
+
+	*t_hit_near = fmaxf(t_near_x, t_near_y);
+	return true;
+}
+
+static inline void
+cg_ray_aabb_tail(const vec2f_t* o, const vec2f_t* d, const cg_aabb_batch_t* batch,
+				 u32 start, i32* best_idx, f32* best_key, f32* best_t)
+{
+	f32 t;
+
+	for (u32 i = start; i < batch->count; i++)
+	{
+		if (cg_ray_aabb_test(o, d, batch, i, &t) && fabsf(t) < *best_key)
+		{
+			*best_key = fabsf(t);
+			*best_t = t;
+			*best_idx = i;
+		}
+	}
+}
+
+i32
+cg_ray_aabb_batch_scalar(const vec2f_t* origin, const vec2f_t* dir,
+						 const cg_aabb_batch_t* batch, f32* t_hit_near)
+{
+	i32 best_idx = -1;
+	f32 best_key = 1.0f;
+	f32 best_t = 0;
+
+	cg_ray_aabb_tail(origin, dir, batch, 0, &best_idx, &best_key, &best_t);
+
+	if (best_idx != -1)
+		*t_hit_near = best_t;
+	return best_idx;
+}
+
+#if CG_RAY_X86
+static inline void
+cg_ray_reduce_lanes(const f32* keys, const f32* ts, u32 lanes, u32 base,
+					i32* best_idx, f32* best_key, f32* best_t)
+{
+	for (u32 l = 0; l < lanes; l++)
+	{
+		if (keys[l] < *best_key)
+		{
+			*best_key = keys[l];
+			*best_t = ts[l];
+			*best_idx = base + l;
+		}
+	}
+}
+
+static i32
+cg_ray_aabb_batch_sse2(const vec2f_t* origin, const vec2f_t* dir,
+					   const cg_aabb_batch_t* batch, f32* t_hit_near)
+{
+	const __m128 ox = _mm_set1_ps(origin->x);
+	const __m128 oy = _mm_set1_ps(origin->y);
+	const __m128 dx = _mm_set1_ps(dir->x);
+	const __m128 dy = _mm_set1_ps(dir->y);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 inf = _mm_set1_ps(INFINITY);
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	f32 keys[4] __attribute__((aligned(16)));
+	f32 ts[4] __attribute__((aligned(16)));
+	i32 best_idx = -1;
+	f32 best_key = 1.0f;
+	f32 best_t = 0;
+	u32 i;
+
+	for (i = 0; i + 4 <= batch->count; i += 4)
+	{
+		const __m128 ax = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(batch->min_x + i), ox), dx);
+		const __m128 bx = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(batch->max_x + i), ox), dx);
+		const __m128 ay = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(batch->min_y + i), oy), dy);
+		const __m128 by = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(batch->max_y + i), oy), dy);
+
+		__m128 valid = _mm_and_ps(_mm_cmpord_ps(ax, bx), _mm_cmpord_ps(ay, by));
+
+		const __m128 t_near_x = _mm_min_ps(ax, bx);
+		const __m128 t_far_x = _mm_max_ps(ax, bx);
+		const __m128 t_near_y = _mm_min_ps(ay, by);
+		const __m128 t_far_y = _mm_max_ps(ay, by);
+
+		valid = _mm_and_ps(valid, _mm_cmple_ps(t_near_x, t_far_y));
+		valid = _mm_and_ps(valid, _mm_cmple_ps(t_near_y, t_far_x));
+
+		const __m128 t_hit_n = _mm_max_ps(t_near_x, t_near_y);
+		const __m128 t_hit_f = _mm_min_ps(t_far_x, t_far_y);
+		const __m128 key = _mm_and_ps(t_hit_n, abs_mask);
+
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(t_hit_f, zero));
+		valid = _mm_and_ps(valid, _mm_cmplt_ps(key, one));
+
+		if (_mm_movemask_ps(valid) == 0)
+			continue;
+
+		_mm_store_ps(keys, _mm_or_ps(_mm_and_ps(valid, key), _mm_andnot_ps(valid, inf)));
+		_mm_store_ps(ts, t_hit_n);
+		cg_ray_reduce_lanes(keys, ts, 4, i, &best_idx, &best_key, &best_t);
+	}
+	cg_ray_aabb_tail(origin, dir, batch, i, &best_idx, &best_key, &best_t);
+
+	if (best_idx != -1)
+		*t_hit_near = best_t;
+	return best_idx;
+}
+
+__attribute__((target("avx2")))
+static i32
+cg_ray_aabb_batch_avx2(const vec2f_t* origin, const vec2f_t* dir,
+					   const cg_aabb_batch_t* batch, f32* t_hit_near)
+{
+	const __m256 ox = _mm256_set1_ps(origin->x);
+	const __m256 oy = _mm256_set1_ps(origin->y);
+	const __m256 dx = _mm256_set1_ps(dir->x);
+	const __m256 dy = _mm256_set1_ps(dir->y);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 inf = _mm256_set1_ps(INFINITY);
+	const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	f32 keys[8] __attribute__((aligned(32)));
+	f32 ts[8] __attribute__((aligned(32)));
+	i32 best_idx = -1;
+	f32 best_key = 1.0f;
+	f32 best_t = 0;
+	u32 i;
+
+	for (i = 0; i + 8 <= batch->count; i += 8)
+	{
+		const __m256 ax = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(batch->min_x + i), ox), dx);
+		const __m256 bx = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(batch->max_x + i), ox), dx);
+		const __m256 ay = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(batch->min_y + i), oy), dy);
+		const __m256 by = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(batch->max_y + i), oy), dy);
+
+		__m256 valid = _mm256_and_ps(_mm256_cmp_ps(ax, bx, _CMP_ORD_Q),
+									 _mm256_cmp_ps(ay, by, _CMP_ORD_Q));
+
+		const __m256 t_near_x = _mm256_min_ps(ax, bx);
+		const __m256 t_far_x = _mm256_max_ps(ax, bx);
+		const __m256 t_near_y = _mm256_min_ps(ay, by);
+		const __m256 t_far_y = _mm256_max_ps(ay, by);
+
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(t_near_x, t_far_y, _CMP_LE_OQ));
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(t_near_y, t_far_x, _CMP_LE_OQ));
+
+		const __m256 t_hit_n = _mm256_max_ps(t_near_x, t_near_y);
+		const __m256 t_hit_f = _mm256_min_ps(t_far_x, t_far_y);
+		const __m256 key = _mm256_and_ps(t_hit_n, abs_mask);
+
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(t_hit_f, zero, _CMP_GE_OQ));
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(key, one, _CMP_LT_OQ));
+
+		if (_mm256_movemask_ps(valid) == 0)
+			continue;
+
+		_mm256_store_ps(keys, _mm256_blendv_ps(inf, key, valid));
+		_mm256_store_ps(ts, t_hit_n);
+		cg_ray_reduce_lanes(keys, ts, 8, i, &best_idx, &best_key, &best_t);
+	}
+	cg_ray_aabb_tail(origin, dir, batch, i, &best_idx, &best_key, &best_t);
+
+	if (best_idx != -1)
+		*t_hit_near = best_t;
+	return best_idx;
+}
+#endif // CG_RAY_X86
+
+const char*
+cg_ray_aabb_batch_impl(void)
+{
+	if (cg_ray_batch_func)
+		return cg_ray_batch_name;
+
+#if CG_RAY_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		cg_ray_batch_func = cg_ray_aabb_batch_avx2;
+		cg_ray_batch_name = "avx2";
+	}
+	else
+	{
+		cg_ray_batch_func = cg_ray_aabb_batch_sse2;
+		cg_ray_batch_name = "sse2";
+	}
+#else
+	cg_ray_batch_func = cg_ray_aabb_batch_scalar;
+	cg_ray_batch_name = "scalar";
+#endif
+
+	return cg_ray_batch_name;
+}
+
+i32
+cg_ray_aabb_batch(const vec2f_t* origin, const vec2f_t* dir,
+				  const cg_aabb_batch_t* batch, f32* t_hit_near)
+{
+	i32 ret;
+
+	if (cg_ray_batch_func == NULL)
+		cg_ray_aabb_batch_impl();
+
+	ret = cg_ray_batch_func(origin, dir, batch, t_hit_near);
+
+#ifdef CG_RAY_CROSSCHECK
+	f32 scalar_t = 0;
+	const i32 scalar_ret = cg_ray_aabb_batch_scalar(origin, dir, batch, &scalar_t);
+	if (scalar_ret != ret || (ret != -1 && scalar_t != *t_hit_near))
+	{
+		fprintf(stderr, "cg_ray_aabb_batch (%s) mismatch: %d (t: %f) != scalar %d (t: %f)\n",
+				cg_ray_batch_name, ret, (ret != -1) ? *t_hit_near : 0, scalar_ret, scalar_t);
+	}
+#endif // CG_RAY_CROSSCHECK
+
+	return ret;
+}
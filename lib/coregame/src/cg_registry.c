@@ -0,0 +1,283 @@
+#include "cg_registry.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void
+cg_registry_grow_sparse(cg_registry_t* reg, u32 min_size)
+{
+	u32 new_size = (reg->sparse_size) ? reg->sparse_size : 16;
+
+	while (new_size < min_size)
+		new_size *= 2;
+	if (new_size == reg->sparse_size)
+		return;
+
+	reg->sparse = realloc(reg->sparse, sizeof(u32) * new_size);
+	reg->gens = realloc(reg->gens, sizeof(u32) * new_size);
+	reg->listed = realloc(reg->listed, sizeof(bool) * new_size);
+	reg->free_slots = realloc(reg->free_slots, sizeof(u32) * new_size);
+
+	memset(reg->sparse + reg->sparse_size, 0xFF, sizeof(u32) * (new_size - reg->sparse_size));
+	memset(reg->gens + reg->sparse_size, 0, sizeof(u32) * (new_size - reg->sparse_size));
+	memset(reg->listed + reg->sparse_size, 0, sizeof(bool) * (new_size - reg->sparse_size));
+
+	reg->sparse_size = new_size;
+}
+
+static void
+cg_registry_alloc_dense(cg_registry_t* reg, u32 capacity)
+{
+	reg->capacity = capacity;
+	reg->ids = realloc(reg->ids, sizeof(u32) * capacity);
+	reg->dense = realloc(reg->dense, sizeof(void*) * capacity);
+	for (u32 c = 0; c < reg->column_count; c++)
+		reg->columns[c] = realloc(reg->columns[c], (size_t)reg->column_sizes[c] * capacity);
+}
+
+static void
+cg_registry_grow_dense(cg_registry_t* reg)
+{
+	if (reg->count < reg->capacity)
+		return;
+
+	cg_registry_alloc_dense(reg, (reg->capacity) ? reg->capacity * 2 : 16);
+}
+
+static inline void
+cg_registry_set_index(const cg_registry_t* reg, u32 idx)
+{
+	if (reg->index_offset != CG_REGISTRY_NONE)
+		memcpy((u8*)reg->dense[idx] + reg->index_offset, &idx, sizeof(u32));
+}
+
+/* Move dense entry `from` into `to`, which is free (deleted or a tombstone). */
+static void
+cg_registry_move(cg_registry_t* reg, u32 from, u32 to)
+{
+	reg->ids[to] = reg->ids[from];
+	reg->dense[to] = reg->dense[from];
+	for (u32 c = 0; c < reg->column_count; c++)
+	{
+		const u32 size = reg->column_sizes[c];
+		memcpy(reg->columns[c] + (size_t)to * size, reg->columns[c] + (size_t)from * size, size);
+	}
+	reg->sparse[CG_HANDLE_SLOT(reg->ids[to])] = to;
+	cg_registry_set_index(reg, to);
+}
+
+static void
+cg_registry_free_slot(cg_registry_t* reg, u32 slot)
+{
+	reg->sparse[slot] = CG_REGISTRY_NONE;
+	if (reg->listed[slot])
+		return;
+	reg->listed[slot] = true;
+	reg->free_slots[reg->free_count++] = slot;
+}
+
+void
+cg_registry_init(cg_registry_t* reg, u32 initial_size, cg_registry_free_t free)
+{
+	memset(reg, 0, sizeof(cg_registry_t));
+	reg->free = free;
+	reg->index_offset = CG_REGISTRY_NONE;
+	reg->next_slot = 1; // Slot 0 is never handed out, so handle 0 means "none".
+
+	cg_registry_grow_sparse(reg, initial_size);
+	cg_registry_alloc_dense(reg, initial_size);
+}
+
+u32
+cg_registry_add_column(cg_registry_t* reg, u32 ele_size)
+{
+	const u32 col = reg->column_count++;
+
+	reg->column_sizes[col] = ele_size;
+	reg->columns[col] = malloc((size_t)ele_size * reg->capacity);
+
+	return col;
+}
+
+void
+cg_registry_set_index_field(cg_registry_t* reg, u32 offset)
+{
+	reg->index_offset = offset;
+}
+
+void
+cg_registry_clear(cg_registry_t* reg)
+{
+	while (reg->count)
+		cg_registry_del(reg, reg->ids[reg->count - 1]);
+}
+
+void
+cg_registry_destroy(cg_registry_t* reg)
+{
+	cg_registry_clear(reg);
+	free(reg->sparse);
+	free(reg->gens);
+	free(reg->listed);
+	free(reg->free_slots);
+	free(reg->ids);
+	free(reg->dense);
+	for (u32 c = 0; c < reg->column_count; c++)
+		free(reg->columns[c]);
+	memset(reg, 0, sizeof(cg_registry_t));
+}
+
+u32
+cg_registry_new_id(cg_registry_t* reg)
+{
+	u32 slot = 0;
+	u32 gen;
+
+	while (reg->free_count)
+	{
+		slot = reg->free_slots[--reg->free_count];
+		reg->listed[slot] = false;
+		/* Slot could have been taken by a remote ID since it was freed. */
+		if (reg->sparse[slot] == CG_REGISTRY_NONE)
+			break;
+		slot = 0;
+	}
+
+	if (slot == 0)
+	{
+		while (reg->next_slot < reg->sparse_size && reg->sparse[reg->next_slot] != CG_REGISTRY_NONE)
+			reg->next_slot++;
+		slot = reg->next_slot++;
+		if (slot >= reg->sparse_size)
+			cg_registry_grow_sparse(reg, slot + 1);
+	}
+
+	gen = (reg->gens[slot] + 1) & CG_HANDLE_GEN_MASK;
+	if (gen == 0)
+		gen = 1;
+	reg->gens[slot] = gen;
+
+	return CG_HANDLE(slot, gen);
+}
+
+bool
+cg_registry_insert(cg_registry_t* reg, u32 id, void* entity)
+{
+	const u32 slot = CG_HANDLE_SLOT(id);
+
+	if (slot == 0 || entity == NULL)
+		return false;
+
+	if (slot >= reg->sparse_size)
+		cg_registry_grow_sparse(reg, slot + 1);
+
+	if (reg->sparse[slot] != CG_REGISTRY_NONE)
+		return false;
+
+	cg_registry_grow_dense(reg);
+
+	reg->gens[slot] = CG_HANDLE_GEN(id);
+	reg->sparse[slot] = reg->count;
+	reg->ids[reg->count] = id;
+	reg->dense[reg->count] = entity;
+	for (u32 c = 0; c < reg->column_count; c++)
+	{
+		const u32 size = reg->column_sizes[c];
+		memset(reg->columns[c] + (size_t)reg->count * size, 0, size);
+	}
+	cg_registry_set_index(reg, reg->count);
+	reg->count++;
+
+	return true;
+}
+
+void*
+cg_registry_get(const cg_registry_t* reg, u32 id)
+{
+	const u32 idx = cg_registry_index(reg, id);
+
+	if (idx == CG_REGISTRY_NONE)
+		return NULL;
+
+	return reg->dense[idx];
+}
+
+u32
+cg_registry_index(const cg_registry_t* reg, u32 id)
+{
+	const u32 slot = CG_HANDLE_SLOT(id);
+	u32 idx;
+
+	if (slot >= reg->sparse_size)
+		return CG_REGISTRY_NONE;
+	if ((idx = reg->sparse[slot]) == CG_REGISTRY_NONE)
+		return CG_REGISTRY_NONE;
+	if (reg->ids[idx] != id)
+		return CG_REGISTRY_NONE;
+
+	return idx;
+}
+
+bool
+cg_registry_del(cg_registry_t* reg, u32 id)
+{
+	const u32 slot = CG_HANDLE_SLOT(id);
+	u32 idx;
+	u32 last;
+	void* entity;
+
+	if (slot >= reg->sparse_size)
+		return false;
+	if ((idx = reg->sparse[slot]) == CG_REGISTRY_NONE || reg->ids[idx] != id)
+		return false;
+
+	entity = reg->dense[idx];
+
+	if (reg->iterating)
+	{
+		/* Leave a tombstone, a loop may still be walking past `idx`. */
+		reg->ids[idx] = CG_REGISTRY_NONE;
+		reg->dense[idx] = NULL;
+		reg->dead++;
+	}
+	else
+	{
+		last = reg->count - 1;
+		if (idx != last)
+			cg_registry_move(reg, last, idx);
+		reg->count--;
+	}
+	cg_registry_free_slot(reg, slot);
+
+	if (reg->free)
+		reg->free(entity);
+
+	return true;
+}
+
+u32
+cg_registry_begin(cg_registry_t* reg)
+{
+	reg->iterating++;
+	return reg->count;
+}
+
+void
+cg_registry_end(cg_registry_t* reg)
+{
+	u32 n = 0;
+
+	if (--reg->iterating || reg->dead == 0)
+		return;
+
+	/* Stable compaction, so entities keep their relative order. */
+	for (u32 i = 0; i < reg->count; i++)
+	{
+		if (reg->dense[i] == NULL)
+			continue;
+		if (i != n)
+			cg_registry_move(reg, i, n);
+		n++;
+	}
+	reg->count = n;
+	reg->dead = 0;
+}
@@ -29,19 +29,32 @@ cg_get_gun_spec(const coregame_t* cg, enum cg_gun_id id)
 	return NULL;
 }
 
-static void
-cg_remove_player_from_cell(cg_player_t* player, cg_runtime_cell_t* cell)
+static inline void
+cg_cell_link(cg_runtime_map_t* map, cg_runtime_cell_t* cell, cg_cell_node_t* node)
 {
-	cg_empty_cell_data_t* data = cell->data;
-	for (u32 i = 0; i < data->contents.count; i++)
-	{
-		cg_player_t* player_in_cell = ((cg_player_t**)data->contents.buf)[i];
-		if (player_in_cell == player)
-		{
-			array_erase(&data->contents, i);
-			return;
-		}
-	}
+	cg_empty_cell_data_t* data = cg_map_occupy(map, cell);
+
+	node->occupancy = data;
+	node->prev = NULL;
+	node->next = data->head;
+	if (data->head)
+		data->head->prev = node;
+	data->head = node;
+	data->count++;
+}
+
+static inline void
+cg_cell_unlink(cg_cell_node_t* node)
+{
+	cg_empty_cell_data_t* data = node->occupancy;
+
+	if (node->prev)
+		node->prev->next = node->next;
+	else
+		data->head = node->next;
+	if (node->next)
+		node->next->prev = node->prev;
+	data->count--;
 }
 
 static void
@@ -51,22 +64,32 @@ cg_player_remove_self_from_cells(cg_player_t* player)
 	{
 		cg_runtime_cell_t* cell = ((cg_runtime_cell_t**)player->cells.buf)[i];
 		if (cell->type != CG_CELL_BLOCK)
-			cg_remove_player_from_cell(player, cell);
+			cg_cell_unlink(player->cell_nodes + i);
 	}
+	array_clear(&player->cells, false);
+	player->cells_min = player->cells_max = NULL;
 }
 
+/**
+ *	Moves the player into the cells overlapped by `pos + velocity`.
+ *	Does nothing if that is the same footprint as last time,
+ *	so standing still or moving inside a cell doesn't touch the cells.
+ */
 static void
-cg_player_get_cells(cg_runtime_map_t* map, cg_player_t* player)
+cg_player_update_cells(cg_runtime_map_t* map, cg_player_t* player)
 {
-	array_clear(&player->cells, false);
-
-	vec2f_t pos = vec2f(player->pos.x + player->velocity.x, player->pos.y + player->velocity.y);
+	vec2f_t pos = vec2f(CG_PLAYER_POS(player).x + CG_PLAYER_VELOCITY(player).x, CG_PLAYER_POS(player).y + CG_PLAYER_VELOCITY(player).y);
 	vec2f_t bot_right = vec2f(pos.x + player->size.x, 
 							 pos.y + player->size.y);
 	cg_runtime_cell_t* c_left = cg_map_at_wpos(map, &pos);
 	cg_runtime_cell_t* c_right = cg_map_at_wpos(map, &bot_right);
 	cg_runtime_cell_t* cell;
 
+	if (c_left == player->cells_min && c_right == player->cells_max)
+		return;
+
+	cg_player_remove_self_from_cells(player);
+
 	if (c_left == NULL || c_right == NULL)
 	{
 		// Probably means the player is out of the map. 
@@ -83,20 +106,25 @@ cg_player_get_cells(cg_runtime_map_t* map, cg_player_t* player)
 			array_add_voidp(&player->cells, cell);
 		}
 	}
-}
 
-static void
-cg_player_add_into_cells(cg_player_t* player)
-{
+	/* Nothing is linked at this point, so the nodes can move. */
+	if (player->cells.count > player->cell_nodes_size)
+	{
+		player->cell_nodes_size = player->cells.count;
+		player->cell_nodes = realloc(player->cell_nodes, sizeof(cg_cell_node_t) * player->cell_nodes_size);
+	}
+
 	for (u32 i = 0; i < player->cells.count; i++)
 	{
-		cg_runtime_cell_t* cell = ((cg_runtime_cell_t**)player->cells.buf)[i];
+		cell = ((cg_runtime_cell_t**)player->cells.buf)[i];
 		if (cell->type != CG_CELL_BLOCK)
 		{
-			cg_empty_cell_data_t* data = cell->data;
-			array_add_voidp(&data->contents, player);
+			player->cell_nodes[i].player = player;
+			cg_cell_link(map, cell, player->cell_nodes + i);
 		}
 	}
+	player->cells_min = c_left;
+	player->cells_max = c_right;
 }
 
 static bool
@@ -169,14 +197,14 @@ cg_ray_collision_test(const vec2f_t* ray_point,
 }
 
 static bool
-cg_bullet_cell_collision(const cg_bullet_t* bullet, 
+cg_player_cell_collision(const cg_player_t* player, 
 						 const cg_rect_t* target, 
 						 vec2f_t* contact_point,
 						 vec2f_t* contact_normal,
 						 f32* contact_time)
 {
-	const f32 w = bullet->r.size.x;
-	const f32 h = bullet->r.size.y;
+	const f32 w = player->size.x;
+	const f32 h = player->size.y;
 
 	const cg_rect_t expanded_target = {
 		.pos.x = target->pos.x - (w / 2.0),
@@ -185,102 +213,122 @@ cg_bullet_cell_collision(const cg_bullet_t* bullet,
 		.size.y = target->size.y + h
 	};
 	const vec2f_t mid = {
-		.x = bullet->r.pos.x + (w / 2.0),
-		.y = bullet->r.pos.y + (h / 2.0),
+		.x = CG_PLAYER_POS(player).x + (w / 2.0),
+		.y = CG_PLAYER_POS(player).y + (h / 2.0),
 	};
 
 	if (cg_ray_collision_test(&mid, 
-							&bullet->velocity, 
+							&CG_PLAYER_VELOCITY(player), 
 							&expanded_target, 
 							contact_point, 
 							contact_normal, 
 							contact_time))
 	{
-		*contact_time = fabsf(*contact_time);
-		return (*contact_time < 1.0f);
+		return (*contact_time >= 0.0f && *contact_time < 1.0f);
 	}
 	return false;
 }
 
-static bool
-cg_player_cell_collision(const cg_player_t* player, 
-						 const cg_rect_t* target, 
-						 vec2f_t* contact_point,
-						 vec2f_t* contact_normal,
-						 f32* contact_time)
+static void
+cg_add_block_neighbors(cg_runtime_map_t* map, array_t* cells, const cg_runtime_cell_t* cell)
 {
-	const f32 w = player->size.x;
-	const f32 h = player->size.y;
+	for (i32 y = cell->pos.y - 1; y <= cell->pos.y + 1; y++)
+	{
+		for (i32 x = cell->pos.x - 1; x <= cell->pos.x + 1; x++)
+		{
+			cg_runtime_cell_t* neighbor = cg_runtime_map_at(map, x, y);
+			const cg_rect_t* rect;
+			bool added = false;
 
-	const cg_rect_t expanded_target = {
-		.pos.x = target->pos.x - (w / 2.0),
-		.pos.y = target->pos.y - (h / 2.0),
-		.size.x = target->size.x + w,
-		.size.y = target->size.y + h
-	};
-	const vec2f_t mid = {
-		.x = player->pos.x + (w / 2.0),
-		.y = player->pos.y + (h / 2.0),
-	};
+			if (neighbor == NULL || neighbor->type != CG_CELL_BLOCK)
+				continue;
 
-	if (cg_ray_collision_test(&mid, 
-							&player->velocity, 
-							&expanded_target, 
-							contact_point, 
-							contact_normal, 
-							contact_time))
-	{
-		return (*contact_time >= 0.0f && *contact_time < 1.0f);
+			/* One cell per merged rect is enough. */
+			rect = cg_map_block_rect(map, neighbor);
+			for (u32 i = 0; i < cells->count && !added; i++)
+			{
+				const cg_runtime_cell_t* other = ((cg_runtime_cell_t**)cells->buf)[i];
+				added = (other == neighbor || (rect && cg_map_block_rect(map, other) == rect));
+			}
+			if (!added)
+				array_add_voidp(cells, neighbor);
+		}
 	}
-	return false;
 }
 
+/**
+ *	Collects the block cells next to the segment start-end, one per merged rect.
+ *	Walks the grid cell by cell, but uses the map's block distance field
+ *	to stride over open space: from a cell `d` cells away from any block
+ *	we can jump (d - 2.5) cells along the segment without passing
+ *	a cell that has a block next to it.
+ */
 static void
-cg_get_cells_2points(cg_runtime_map_t* map, 
+cg_get_block_cells_2points(cg_runtime_map_t* map, 
 					array_t* cells,
 					const vec2f_t* start,
 					const vec2f_t* end)
 {
 	const f32 grid_size = map->grid_size;
 
-	i32 x0 = floorf(start->x / grid_size);
-	i32 y0 = floorf(start->y / grid_size);
-
-	i32 x1 = floorf(end->x / grid_size);
-	i32 y1 = floorf(end->y / grid_size);
+	const f32 dx = end->x - start->x;
+	const f32 dy = end->y - start->y;
+	const f32 len = sqrtf(dx * dx + dy * dy);
 
-	f32 dx = end->x - start->x;
-	f32 dy = end->y - start->y;
+	const i32 x1 = floorf(end->x / grid_size);
+	const i32 y1 = floorf(end->y / grid_size);
 
-	i32 step_x = (dx > 0) ? 1 : -1;
-	i32 step_y = (dy > 0) ? 1 : -1;
+	const i32 step_x = (dx > 0) ? 1 : -1;
+	const i32 step_y = (dy > 0) ? 1 : -1;
 
-	f32 t_max_x = ((x0 + (step_x > 0)) * grid_size - start->x) / dx;
-	f32 t_max_y = ((y0 + (step_y > 0)) * grid_size - start->y) / dy;
+	const f32 t_delta_x = (dx != 0) ? fabsf(grid_size / dx) : INFINITY;
+	const f32 t_delta_y = (dy != 0) ? fabsf(grid_size / dy) : INFINITY;
 
-	f32 t_delta_x = fabs(grid_size / dx);
-	f32 t_delta_y = fabs(grid_size / dy);
+	f32 t = 0.0;
 
 	while (1)
 	{
-		cg_runtime_cell_t* cell = cg_runtime_map_at(map, x0, y0);
-		if (cell)
-			array_add_voidp(cells, cell);
-		else
-			break;
+		const vec2f_t p = vec2f(start->x + dx * t, start->y + dy * t);
+		i32 x0 = floorf(p.x / grid_size);
+		i32 y0 = floorf(p.y / grid_size);
 
-		if (x0 == x1 && y0 == y1)
-			break;
+		f32 t_max_x = (dx != 0) ? t + ((x0 + (step_x > 0)) * grid_size - p.x) / dx : INFINITY;
+		f32 t_max_y = (dy != 0) ? t + ((y0 + (step_y > 0)) * grid_size - p.y) / dy : INFINITY;
+		f32 t_enter = t;
 
-		if (t_max_x < t_max_y)
+		while (1)
 		{
-			t_max_x += t_delta_x;
-			x0 += step_x;
-		}
-		else
-		{
-			t_max_y += t_delta_y;
-			y0 += step_y;
+			const cg_runtime_cell_t* cell = cg_runtime_map_at(map, x0, y0);
+			if (cell == NULL)
+				return;
+
+			if (cell->block_dist >= 3 && len > 0)
+			{
+				t = t_enter + ((cell->block_dist - 2.5) * grid_size) / len;
+				if (t >= 1.0)
+					return;
+				break;
+			}
+			if (cell->block_dist <= 1)
+				cg_add_block_neighbors(map, cells, cell);
+
+			if (x0 == x1 && y0 == y1)
+				return;
+
+			if (t_max_x < t_max_y)
+			{
+				t_enter = t_max_x;
+				t_max_x += t_delta_x;
+				x0 += step_x;
+			}
+			else
+			{
+				t_enter = t_max_y;
+				t_max_y += t_delta_y;
+				y0 += step_y;
+			}
+			if (t_enter > 1.0)
+				return;
 		}
 	}
 }
@@ -296,30 +344,56 @@ coregame_get_delta_time(coregame_t* cg)
 	memcpy(&cg->last_time, &current_time, sizeof(hr_time_t));
 }
 
+static cg_event_t*
+cg_push_event(coregame_t* cg, enum cg_event_type type, u32 id)
+{
+	cg_event_t* event = array_add_into(&cg->events);
+
+	event->type = type;
+	event->id = id;
+#ifdef CG_SERVER
+	event->rewinding = cg->rewinding;
+#else
+	event->rewinding = false;
+#endif // CG_SERVER
+	return event;
+}
+
 cg_bullet_t*
 cg_add_bullet(coregame_t* cg, cg_gun_t* gun)
 {
-	cg_bullet_t* bullet = calloc(1, sizeof(cg_bullet_t));
+	cg_event_t* event;
+	cg_bullet_t* bullet = cg_bullet_pool_alloc(&cg->bullet_pool);
 	const cg_player_t* player = gun->owner;
 
-	bullet->id = ++cg->bullet_id_seq;
+	bullet->id = cg_registry_new_id(&cg->bullets);
 	bullet->owner_id = player->id;
-	bullet->r.pos = player->pos;
+	bullet->r.pos = CG_PLAYER_POS(player);
 	bullet->r.size = vec2f(10, 10);
-	bullet->r.pos.x += (player->size.x / 2) + (player->dir.x * PLAYER_SPEED * cg->delta);
-	bullet->r.pos.y += (player->size.y / 2) + (player->dir.y * PLAYER_SPEED * cg->delta);
+	bullet->r.pos.x += (player->size.x / 2) + (CG_PLAYER_DIR(player).x * PLAYER_SPEED * cg->delta);
+	bullet->r.pos.y += (player->size.y / 2) + (CG_PLAYER_DIR(player).y * PLAYER_SPEED * cg->delta);
+	bullet->step_prev_pos = bullet->r.pos;
 	bullet->dmg = gun->spec->dmg;
 	bullet->gun_id = gun->spec->id;
-	array_init(&bullet->cells, sizeof(const cg_runtime_cell_t**), 6);
+#ifdef CG_SERVER
+	bullet->view_lag_ms = player->view_lag_ms;
+	bullet->resim = cg->rewinding;
+#endif // CG_SERVER
 
 	bullet->dir.x = player->cursor.x - bullet->r.pos.x;
 	bullet->dir.y = player->cursor.y - bullet->r.pos.y;
 	vec2f_norm(&bullet->dir);
 
-	ght_insert(&cg->bullets, bullet->id, bullet);
+	cg_registry_insert(&cg->bullets, bullet->id, bullet);
+#ifdef CG_SERVER
+	sbsm_reserve(cg->sbsm, 0, CG_HANDLE_SLOT(bullet->id) + 1);
+#endif // CG_SERVER
 
-	if (cg->on_bullet_create)
-		cg->on_bullet_create(bullet, cg->user_data);
+	event = cg_push_event(cg, CG_EVENT_BULLET_CREATE, bullet->id);
+	event->bullet.owner_id = bullet->owner_id;
+	event->bullet.gun_id = bullet->gun_id;
+	event->bullet.pos = bullet->r.pos;
+	event->bullet.dir = bullet->dir;
 
 	return bullet;
 }
@@ -335,8 +409,8 @@ cg_default_gun_shoot(coregame_t* cg, cg_gun_t* gun)
 
 	if (gun->spec->knockback_force)
 	{
-		player->velocity.x += -bullet->dir.x * gun->spec->knockback_force;
-		player->velocity.y += -bullet->dir.y * gun->spec->knockback_force;
+		CG_PLAYER_VELOCITY(player).x += -bullet->dir.x * gun->spec->knockback_force;
+		CG_PLAYER_VELOCITY(player).y += -bullet->dir.y * gun->spec->knockback_force;
 	}
 }
 
@@ -348,21 +422,29 @@ cg_do_free_player(cg_player_t* player)
 	free(player->gun);
 	cg_player_remove_self_from_cells(player);
 	array_del(&player->cells);
+	free(player->cell_nodes);
+#ifdef CG_SERVER
+	free(player->history);
+#endif // CG_SERVER
 	free(player);
 }
 
-static void
-cg_do_free_bullet(cg_bullet_t* bullet)
-{
-	array_del(&bullet->cells);
-	free(bullet);
-}
-
 void 
 coregame_init(coregame_t* coregame, cg_runtime_map_t* map)
 {
-	ght_init(&coregame->players, 10, (ght_free_t)cg_do_free_player);
-	ght_init(&coregame->bullets, 100, (ght_free_t)cg_do_free_bullet);
+	cg_registry_init(&coregame->players, 16, (cg_registry_free_t)cg_do_free_player);
+	cg_registry_set_index_field(&coregame->players, offsetof(cg_player_t, idx));
+	cg_registry_add_column(&coregame->players, sizeof(vec2f_t));	// CG_PLAYER_COL_POS
+	cg_registry_add_column(&coregame->players, sizeof(vec2f_t));	// CG_PLAYER_COL_VELOCITY
+	cg_registry_add_column(&coregame->players, sizeof(vec2f_t));	// CG_PLAYER_COL_DIR
+	cg_registry_add_column(&coregame->players, sizeof(f32));		// CG_PLAYER_COL_HEALTH
+	cg_registry_add_column(&coregame->players, sizeof(u8));		// CG_PLAYER_COL_INPUT
+	cg_registry_init(&coregame->bullets, CG_BULLET_POOL_SLAB_SIZE, NULL);
+	cg_bullet_pool_init(&coregame->bullet_pool, CG_BULLET_POOL_SLAB_SIZE);
+	cg_aabb_batch_init(&coregame->bullet_targets, 0);
+	coregame->jobs = NULL;
+	coregame->job_targets = NULL;
+	memset(&coregame->islands, 0, sizeof(cg_player_islands_t));
 	coregame->time_scale = 1.0;
 
 	coregame->world_border = cg_rect(
@@ -383,6 +465,7 @@ coregame_init(coregame_t* coregame, cg_runtime_map_t* map)
 		coregame->map = map;
 	
 	array_init(&coregame->gun_specs, sizeof(cg_gun_spec_t), 4);
+	array_init(&coregame->events, sizeof(cg_event_t), 64);
 }
 
 #ifdef CG_SERVER
@@ -392,6 +475,10 @@ coregame_server_init(coregame_t* cg, cg_runtime_map_t* map, f32 tick_per_sec)
 	coregame_init(cg, map);
 
 	cg->sbsm = sbsm_create(tick_per_sec / 4, 1000.0 / tick_per_sec);
+	cg->netcode = CG_NETCODE_ROLLBACK;
+
+	/* Same delta `sbsm_rollback()` uses, so live and rewound ticks match bit-for-bit. */
+	coregame_set_fixed_step(cg, cg->sbsm->interval_ms / 1000.0, CG_MAX_SUBSTEPS);
 }
 #endif // CG_SERVER
 
@@ -422,14 +509,45 @@ cg_resolve_player_collision(cg_player_t* player,
 							const vec2f_t* contact_normal, 
 							f32 contact_time)
 {
-	const f32 x_velabs = fabsf(player->velocity.x);
-	const f32 y_velabs = fabsf(player->velocity.y);
+	const f32 x_velabs = fabsf(CG_PLAYER_VELOCITY(player).x);
+	const f32 y_velabs = fabsf(CG_PLAYER_VELOCITY(player).y);
 
 	const f32 resolved_x = clampf((contact_normal->x * x_velabs) * (1 - contact_time), -x_velabs, x_velabs);
 	const f32 resolved_y = clampf((contact_normal->y * y_velabs) * (1 - contact_time), -y_velabs, y_velabs);
 
-	player->velocity.x += resolved_x;
-	player->velocity.y += resolved_y;
+	CG_PLAYER_VELOCITY(player).x += resolved_x;
+	CG_PLAYER_VELOCITY(player).y += resolved_y;
+}
+
+/* The merged rect covering a block cell, or just the cell if the map has none. */
+static inline cg_rect_t
+cg_block_target(const cg_runtime_map_t* map, const cg_runtime_cell_t* cell)
+{
+	const f32 grid_size = map->grid_size;
+	const cg_rect_t* rect = cg_map_block_rect(map, cell);
+
+	if (rect)
+		return *rect;
+	return cg_rect(
+		vec2f(cell->pos.x * grid_size, cell->pos.y * grid_size), 
+		vec2f(grid_size, grid_size)
+	);
+}
+
+/* True if a block cell before `idx` in `cells` is part of the same merged rect. */
+static bool
+cg_block_rect_seen(const cg_runtime_map_t* map, const array_t* cells, u32 idx)
+{
+	const cg_runtime_cell_t** cells_buf = (const cg_runtime_cell_t**)cells->buf;
+	const cg_rect_t* rect = cg_map_block_rect(map, cells_buf[idx]);
+
+	if (rect == NULL)
+		return false;
+
+	for (u32 i = 0; i < idx; i++)
+		if (cells_buf[i]->type == CG_CELL_BLOCK && cg_map_block_rect(map, cells_buf[i]) == rect)
+			return true;
+	return false;
 }
 
 static void
@@ -437,17 +555,10 @@ cg_player_handle_block_collision(coregame_t* cg,
 								 cg_player_t* player, 
 								 const cg_runtime_cell_t* cell)
 {
-	const u32 grid_size = cg->map->grid_size;
 	vec2f_t contact_normal = {0, 0};
 	vec2f_t contact_point = {0, 0};
 	f32 contact_time = 0;
-	cg_rect_t target = {
-		.pos = vec2f(
-			cell->pos.x * grid_size, 
-			cell->pos.y * grid_size
-		),
-		.size = vec2f(grid_size, grid_size)
-	};
+	cg_rect_t target = cg_block_target(cg->map, cell);
 
 	if (cg_player_cell_collision(player, 
 							  &target, 
@@ -460,19 +571,24 @@ cg_player_handle_block_collision(coregame_t* cg,
 }
 
 static void
-cg_player_handle_player_collision(cg_player_t* player, const cg_runtime_cell_t* cell)
+cg_player_handle_player_collision(const cg_runtime_map_t* map, cg_player_t* player, const cg_runtime_cell_t* cell)
 {
 	vec2f_t contact_normal = {0, 0};
 	vec2f_t contact_point = {0, 0};
 	f32 contact_time = 0;
-	const cg_empty_cell_data_t* data = cell->data;
+	const cg_empty_cell_data_t* data = cg_map_occupancy(map, cell);
 
-	for (u32 i = 0; i < data->contents.count; i++)
+	if (data == NULL)
+		return;
+
+	for (const cg_cell_node_t* node = data->head; node; node = node->next)
 	{
-		const cg_player_t* target_player = ((const cg_player_t**)data->contents.buf)[i];
+		const cg_player_t* target_player = node->player;
+		if (target_player == player)
+			continue;
 
 		cg_rect_t target = {
-			.pos = target_player->pos,
+			.pos = CG_PLAYER_POS(target_player),
 			.size = target_player->size
 		};
 
@@ -495,53 +611,63 @@ cg_player_handle_collision(coregame_t* cg, cg_player_t* player)
 		const cg_runtime_cell_t* cell = ((const cg_runtime_cell_t**)player->cells.buf)[i];
 
 		if (cell->type == CG_CELL_BLOCK)
-			cg_player_handle_block_collision(cg, player, cell);
+		{
+			if (cg_block_rect_seen(cg->map, &player->cells, i) == false)
+				cg_player_handle_block_collision(cg, player, cell);
+		}
 		else
-			cg_player_handle_player_collision(player, cell);
+			cg_player_handle_player_collision(cg->map, player, cell);
 	}
 }
 
-void 
-coregame_update_player(coregame_t* coregame, cg_player_t* player)
+static void
+cg_player_move(coregame_t* coregame, cg_player_t* player)
 {
-	if (player->velocity.x || player->velocity.y)
+	if (CG_PLAYER_VELOCITY(player).x || CG_PLAYER_VELOCITY(player).y)
 	{
-		player->velocity.x *= coregame->delta;
-		player->velocity.y *= coregame->delta;
-
-		cg_player_remove_self_from_cells(player);
-		cg_player_get_cells(coregame->map, player);
+		CG_PLAYER_VELOCITY(player).x *= coregame->delta;
+		CG_PLAYER_VELOCITY(player).y *= coregame->delta;
 
+		cg_player_update_cells(coregame->map, player);
 		cg_player_handle_collision(coregame, player);
 
-		player->pos.x += player->velocity.x;
-		player->pos.y += player->velocity.y;
+		CG_PLAYER_POS(player).x += CG_PLAYER_VELOCITY(player).x;
+		CG_PLAYER_POS(player).y += CG_PLAYER_VELOCITY(player).y;
 
-		cg_player_get_cells(coregame->map, player);
-		cg_player_add_into_cells(player);
+		cg_player_update_cells(coregame->map, player);
 	}
+}
 
-	if (player->prev_dir.x != player->dir.x || player->prev_dir.y != player->dir.y ||
-		player->prev_pos.x != player->pos.x || player->prev_pos.y != player->pos.y)
+static void
+cg_player_check_changed(coregame_t* coregame, cg_player_t* player)
+{
+	if (player->prev_dir.x != CG_PLAYER_DIR(player).x || player->prev_dir.y != CG_PLAYER_DIR(player).y ||
+		player->prev_pos.x != CG_PLAYER_POS(player).x || player->prev_pos.y != CG_PLAYER_POS(player).y)
 	{
 	#ifdef CG_SERVER
 		player->dirty = true;
 		coregame->sbsm->dirty = true;
 	#endif // CG_SERVER
 
-		if (coregame->player_changed)
-			coregame->player_changed(player, coregame->user_data);
+		cg_push_event(coregame, CG_EVENT_PLAYER_CHANGED, player->id);
 
-		player->prev_pos = player->pos;
-		player->prev_dir = player->dir;
+		player->prev_pos = CG_PLAYER_POS(player);
+		player->prev_dir = CG_PLAYER_DIR(player);
 	}
 }
 
+void
+coregame_update_player(coregame_t* coregame, cg_player_t* player)
+{
+	cg_player_move(coregame, player);
+	cg_player_check_changed(coregame, player);
+}
+
 #ifdef CG_CLIENT
 static void 
 coregame_interpolate_player(coregame_t* cg, cg_player_t* player)
 {
-	vec2f_t* client_pos = &player->pos;
+	vec2f_t* client_pos = &CG_PLAYER_POS(player);
 	const vec2f_t* server_pos = &player->server_pos;
 	const f32 dist = coregame_dist(client_pos, server_pos);
 
@@ -551,7 +677,7 @@ coregame_interpolate_player(coregame_t* cg, cg_player_t* player)
 	}
 	else if (dist < cg->interp_threshold_dist)
 	{
-		player->pos = player->server_pos;
+		CG_PLAYER_POS(player) = player->server_pos;
 		player->interpolate = false;
 		player->bad_local_pos = false;
 		return;
@@ -560,8 +686,7 @@ coregame_interpolate_player(coregame_t* cg, cg_player_t* player)
 	vec2f_t new_pos;
 	if (player->bad_local_pos)
 	{
-		cg_player_remove_self_from_cells(player);
-		cg_player_get_cells(cg->map, player);
+		cg_player_update_cells(cg->map, player);
 		cg_interpolate_pos(client_pos, server_pos, 0.1);
 	}
 	else
@@ -569,28 +694,264 @@ coregame_interpolate_player(coregame_t* cg, cg_player_t* player)
 		const f32 interp = (player == cg->local_player) ? cg->local_interp_factor : cg->remote_interp_factor;
 		cg_blend_pos(&new_pos, client_pos, server_pos, interp);
 
-		player->velocity.x = new_pos.x - client_pos->x;
-		player->velocity.y = new_pos.y - client_pos->y;
+		CG_PLAYER_VELOCITY(player).x = new_pos.x - client_pos->x;
+		CG_PLAYER_VELOCITY(player).y = new_pos.y - client_pos->y;
 
-		cg_player_remove_self_from_cells(player);
-		cg_player_get_cells(cg->map, player);
+		cg_player_update_cells(cg->map, player);
 		cg_player_handle_collision(cg, player);
 
-		client_pos->x += player->velocity.x;
-		client_pos->y += player->velocity.y;
+		client_pos->x += CG_PLAYER_VELOCITY(player).x;
+		client_pos->y += CG_PLAYER_VELOCITY(player).y;
 
 		const f32 new_dist = coregame_dist(client_pos, server_pos);
 		if (new_dist >= dist)
 			player->bad_local_pos = true;
 	}
-	cg_player_add_into_cells(player);
 }
 #endif // CG_CLIENT
 
+#ifdef CG_SERVER
+/**
+ *	Cells a player may read or (un)link this tick. Collisions only ever shrink
+ *	velocity and the footprint is taken at most two steps ahead, so
+ *	2 * |velocity| around the player plus its current cells covers it.
+ */
+static void
+cg_player_island_box(const coregame_t* cg, const cg_player_t* player, 
+					 const vec2f_t* pos, const vec2f_t* velocity, i32* box)
+{
+	const cg_runtime_map_t* map = cg->map;
+	const f32 grid_size = map->grid_size;
+	const f32 mx = fabs(velocity->x * cg->delta) * 2;
+	const f32 my = fabs(velocity->y * cg->delta) * 2;
+
+	box[0] = clampi(floorf((pos->x - mx) / grid_size), 0, map->w - 1);
+	box[1] = clampi(floorf((pos->y - my) / grid_size), 0, map->h - 1);
+	box[2] = clampi(floorf((pos->x + player->size.x + mx) / grid_size), 0, map->w - 1);
+	box[3] = clampi(floorf((pos->y + player->size.y + my) / grid_size), 0, map->h - 1);
+
+	if (player->cells_min)
+	{
+		if (player->cells_min->pos.x < box[0])
+			box[0] = player->cells_min->pos.x;
+		if (player->cells_min->pos.y < box[1])
+			box[1] = player->cells_min->pos.y;
+		if (player->cells_max->pos.x > box[2])
+			box[2] = player->cells_max->pos.x;
+		if (player->cells_max->pos.y > box[3])
+			box[3] = player->cells_max->pos.y;
+	}
+}
+
+static u32
+cg_island_find(u32* parent, u32 i)
+{
+	while (parent[i] != i)
+	{
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+static void
+cg_island_union(u32* parent, u32 a, u32 b)
+{
+	a = cg_island_find(parent, a);
+	b = cg_island_find(parent, b);
+	if (a < b)
+		parent[b] = a;
+	else if (b < a)
+		parent[a] = b;
+}
+
+static i32
+cg_island_cmp(const void* a, const void* b)
+{
+	const u64 x = *(const u64*)a;
+	const u64 y = *(const u64*)b;
+	return (x > y) - (x < y);
+}
+
+static void
+cg_player_islands_reserve(cg_player_islands_t* isl, u32 n)
+{
+	if (n <= isl->size)
+		return;
+
+	isl->size = n;
+	isl->boxes = realloc(isl->boxes, sizeof(i32) * 4 * n);
+	isl->parent = realloc(isl->parent, sizeof(u32) * n);
+	isl->sorted = realloc(isl->sorted, sizeof(u64) * n);
+	isl->start = realloc(isl->start, sizeof(u32) * n);
+	isl->len = realloc(isl->len, sizeof(u32) * n);
+	isl->members = realloc(isl->members, sizeof(u32) * n);
+	isl->roots = realloc(isl->roots, sizeof(u32) * n);
+	isl->gun_events = realloc(isl->gun_events, sizeof(u32) * (n + 1));
+}
+
+static void
+cg_player_islands_build(coregame_t* cg)
+{
+	cg_player_islands_t* isl = &cg->islands;
+	cg_player_t** dense = (cg_player_t**)cg->players.dense;
+	const vec2f_t* pos = CG_REGISTRY_COLUMN(&cg->players, CG_PLAYER_COL_POS, vec2f_t);
+	const vec2f_t* velocity = CG_REGISTRY_COLUMN(&cg->players, CG_PLAYER_COL_VELOCITY, vec2f_t);
+	const u32 n = cg->players.count;
+	u32 offset = 0;
+
+	for (u32 i = 0; i < n; i++)
+	{
+		cg_player_island_box(cg, dense[i], pos + i, velocity + i, isl->boxes + i * 4);
+		isl->parent[i] = i;
+		isl->len[i] = 0;
+		isl->sorted[i] = ((u64)isl->boxes[i * 4] << 32) | i;
+	}
+
+	/* Sweep on x, then check y. */
+	qsort(isl->sorted, n, sizeof(u64), cg_island_cmp);
+	for (u32 a = 0; a < n; a++)
+	{
+		const u32 ia = (u32)isl->sorted[a];
+		const i32* box_a = isl->boxes + ia * 4;
+
+		for (u32 b = a + 1; b < n; b++)
+		{
+			const u32 ib = (u32)isl->sorted[b];
+			const i32* box_b = isl->boxes + ib * 4;
+
+			if (box_b[0] > box_a[2])
+				break;
+			if (box_b[1] <= box_a[3] && box_a[1] <= box_b[3])
+				cg_island_union(isl->parent, ia, ib);
+		}
+	}
+
+	isl->count = 0;
+	for (u32 i = 0; i < n; i++)
+		isl->len[cg_island_find(isl->parent, i)]++;
+	for (u32 i = 0; i < n; i++)
+	{
+		if (isl->parent[i] != i)
+			continue;
+		isl->roots[isl->count++] = i;
+		isl->start[i] = offset;
+		offset += isl->len[i];
+		isl->len[i] = 0;
+	}
+
+	/* Same order as CG_REGISTRY_FOREACH, so an island moves exactly like the serial loop. */
+	for (u32 i = 0; i < n; i++)
+	{
+		const u32 root = isl->parent[i];
+		isl->members[isl->start[root] + isl->len[root]++] = i;
+	}
+}
+
+static void
+cg_player_islands_job(void* ctx, u32 begin, u32 end, UNUSED u32 worker)
+{
+	coregame_t* cg = ctx;
+	const cg_player_islands_t* isl = &cg->islands;
+	cg_player_t** dense = (cg_player_t**)cg->players.dense;
+
+	for (u32 i = begin; i < end; i++)
+	{
+		const u32 root = isl->roots[i];
+		for (u32 m = isl->start[root]; m < isl->start[root] + isl->len[root]; m++)
+			cg_player_move(cg, dense[isl->members[m]]);
+	}
+}
+
+/**
+ *	Takes the events the guns pushed off the journal, to be put back
+ *	player by player with the rest of their events.
+ */
+static void
+cg_player_islands_hold_events(coregame_t* cg, u32 base)
+{
+	cg_player_islands_t* isl = &cg->islands;
+	const u32 count = cg->events.count - base;
+
+	if (count > isl->events_size)
+	{
+		isl->events_size = count;
+		isl->events = realloc(isl->events, sizeof(cg_event_t) * count);
+	}
+	memcpy(isl->events, (cg_event_t*)cg->events.buf + base, sizeof(cg_event_t) * count);
+	cg->events.count = base;
+}
+
+/**
+ *	Same result as the serial loop: guns only touch their owner, islands
+ *	never share a cell, and everything else runs in registry order after.
+ *	Gun events are held back until then, so each player's events stay
+ *	together in the journal as the serial loop pushes them.
+ */
+static void
+coregame_update_players_parallel(coregame_t* cg)
+{
+	cg_player_islands_t* isl = &cg->islands;
+	const cg_registry_t* players = &cg->players;
+	cg_player_t** dense = (cg_player_t**)players->dense;
+	vec2f_t* velocity = CG_REGISTRY_COLUMN(players, CG_PLAYER_COL_VELOCITY, vec2f_t);
+	const vec2f_t* dir = CG_REGISTRY_COLUMN(players, CG_PLAYER_COL_DIR, vec2f_t);
+	const u32 base = cg->events.count;
+	cg_player_t* player;
+
+	cg_player_islands_reserve(isl, players->count);
+	for (u32 i = 0; i < players->count; i++)
+	{
+		velocity[i].x = dir[i].x * PLAYER_SPEED;
+		velocity[i].y = dir[i].y * PLAYER_SPEED;
+	}
+
+	for (u32 i = 0; i < players->count; i++)
+	{
+		player = dense[i];
+		player->step_prev_pos = CG_PLAYER_POS(player);
+
+		isl->gun_events[i] = cg->events.count - base;
+		if (player->gun)
+			coregame_gun_update(cg, player->gun);
+	}
+	isl->gun_events[players->count] = cg->events.count - base;
+	cg_player_islands_hold_events(cg, base);
+
+	cg_player_islands_build(cg);
+	cg_jobs_parallel_for(cg->jobs, isl->count, 1, cg_player_islands_job, cg);
+
+	for (u32 i = 0; i < players->count; i++)
+	{
+		player = dense[i];
+		for (u32 e = isl->gun_events[i]; e < isl->gun_events[i + 1]; e++)
+			*(cg_event_t*)array_add_into(&cg->events) = isl->events[e];
+
+		cg_player_check_changed(cg, player);
+
+		if (player->gun_dirty)
+		{
+			 cg_push_event(cg, CG_EVENT_PLAYER_GUN_CHANGED, player->id);
+			 player->gun_dirty = false;
+		}
+
+		sbsm_commit_player(cg->sbsm->present, player);
+	}
+}
+#endif // CG_SERVER
+
 static void 
 coregame_update_players(coregame_t* cg)
 {
-	const ght_t* players = &cg->players;
+	const cg_registry_t* players = &cg->players;
+
+#ifdef CG_SERVER
+	if (cg->jobs)
+	{
+		coregame_update_players_parallel(cg);
+		return;
+	}
+#endif // CG_SERVER
 
 #ifdef CG_CLIENT
 	if (cg->target_local_interp_factor != cg->local_interp_factor)
@@ -599,10 +960,11 @@ coregame_update_players(coregame_t* cg)
 		cg->remote_interp_factor = cg->remote_interp_factor * (1 - BLEND_RATE) + cg->target_remote_interp_factor * BLEND_RATE;
 #endif // CG_CLIENT
 
-	GHT_FOREACH(cg_player_t* player, players, 
+	CG_REGISTRY_FOREACH(cg_player_t* player, players, 
 	{
-		player->velocity.x = player->dir.x * PLAYER_SPEED;
-		player->velocity.y = player->dir.y * PLAYER_SPEED;
+		player->step_prev_pos = CG_PLAYER_POS(player);
+		CG_PLAYER_VELOCITY(player).x = CG_PLAYER_DIR(player).x * PLAYER_SPEED;
+		CG_PLAYER_VELOCITY(player).y = CG_PLAYER_DIR(player).y * PLAYER_SPEED;
 
 		if (player->gun)
 			coregame_gun_update(cg, player->gun);
@@ -616,7 +978,7 @@ coregame_update_players(coregame_t* cg)
 	#ifdef CG_SERVER
 		if (player->gun_dirty)
 		{
-			 cg->player_gun_changed(player, cg->user_data);
+			 cg_push_event(cg, CG_EVENT_PLAYER_GUN_CHANGED, player->id);
 			 player->gun_dirty = false;
 		}
 
@@ -625,161 +987,400 @@ coregame_update_players(coregame_t* cg)
 	});
 }
 
-static bool
-cg_bullet_block_cell_collision_test(coregame_t* cg, 
-									cg_bullet_t* bullet, 
-									const cg_runtime_cell_t* cell, 
-									vec2f_t* next_pos)
-{
-	u32 grid_size = cg->map->grid_size;
-	vec2f_t contact_normal;
-	vec2f_t contact_point;
-	f32 contact_time = 0;
+static inline cg_rect_t
+cg_bullet_expand_target(const cg_bullet_t* bullet, const vec2f_t* pos, const vec2f_t* size)
+{
+	const f32 w = bullet->r.size.x;
+	const f32 h = bullet->r.size.y;
 
-	cg_rect_t target = {
-		.pos = vec2f(cell->pos.x * grid_size, cell->pos.y * grid_size),
-		.size = vec2f(grid_size, grid_size)
+	const cg_rect_t expanded_target = {
+		.pos.x = pos->x - (w / 2.0),
+		.pos.y = pos->y - (h / 2.0),
+		.size.x = size->x + w,
+		.size.y = size->y + h
 	};
-	if (cg_bullet_cell_collision(
-								bullet, 
-								&target, 
-								&contact_point,	
-								&contact_normal, 
-								&contact_time))
+	return expanded_target;
+}
+
+/**
+ *	How far a target's hitbox can be from the cells it's linked into. Cells
+ *	are a step ahead (see `cg_player_update_cells()`), and lag compensation
+ *	rewinds the hitbox up to `view_lag_ms`. Players move at most PLAYER_SPEED
+ *	per second, teleports restart their history.
+ */
+static f32
+cg_bullet_target_reach(const coregame_t* cg, UNUSED const cg_bullet_t* bullet)
+{
+	u32 steps = 1;
+
+#ifdef CG_SERVER
+	if (cg->netcode == CG_NETCODE_LAG_COMP && bullet->view_lag_ms > 0)
 	{
-		bullet->collided = true;
-		bullet->contact_point = contact_point;
-		*next_pos = contact_point;
-		return true;
+		const u32 back = bullet->view_lag_ms / cg->sbsm->interval_ms;
+		steps += (back + 1 < CG_PLAYER_HISTORY) ? back + 1 : CG_PLAYER_HISTORY;
 	}
-	return false;
+#endif // CG_SERVER
+
+	return PLAYER_SPEED * cg->delta * steps;
 }
 
-static bool
-cg_bullet_empty_cell_collision_test(coregame_t* cg, 
-									cg_bullet_t* bullet, 
-									const cg_runtime_cell_t* cell, 
-									vec2f_t* next_pos)
+/* Adds the players linked into cell (x, y) the sweep can reach, once each. */
+static void
+cg_bullet_add_cell_targets(coregame_t* cg, const cg_bullet_t* bullet, 
+						   const cg_rect_t* sweep, i32 x, i32 y,
+						   cg_aabb_batch_t* targets)
 {
-	vec2f_t contact_normal;
-	vec2f_t contact_point;
-	f32 contact_time = 0;
-	const cg_empty_cell_data_t* data = cell->data;
+	const cg_runtime_map_t* map = cg->map;
+	const cg_empty_cell_data_t* data;
+	cg_rect_t target;
 
-	for (u32 i = 0; i < data->contents.count; i++)
+	if (x < 0 || y < 0 || x >= (i32)map->w || y >= (i32)map->h)
+		return;
+	if ((data = cg_map_occupancy(map, map->cells + (y * map->w) + x)) == NULL)
+		return;
+
+	for (const cg_cell_node_t* node = data->head; node; node = node->next)
 	{
-		cg_player_t* target_player = ((cg_player_t**)data->contents.buf)[i];
+		cg_player_t* target_player = node->player;
+		bool added = false;
+
 		if (target_player->id == bullet->owner_id)
 			continue;
+		/* Players span several cells. */
+		for (u32 i = 0; i < targets->count && !added; i++)
+			added = (targets->data[i] == target_player);
+		if (added)
+			continue;
 
-		const cg_rect_t target = {
-			.pos = target_player->pos,
-			.size = target_player->size
-		};
-		if (cg_bullet_cell_collision(bullet, 
-									&target, 
-									&contact_point, 
-									&contact_normal, 
-									&contact_time))
-		{
-			cg_player_t* attacker_player;
-			if (cg->player_damaged)
-			{
-				attacker_player = ght_get(&cg->players, bullet->owner_id);
-				if (attacker_player == NULL)
-					return true;
-
-				target_player->health -= bullet->dmg;
-				if (target_player->health < 0)
-					target_player->health = 0;
+	#ifdef CG_SERVER
+		/* Lag compensation: test against where the shooter saw the target. */
+		const vec2f_t target_pos = (cg->netcode == CG_NETCODE_LAG_COMP) 
+			? coregame_player_view_pos(cg, target_player, bullet->view_lag_ms) 
+			: CG_PLAYER_POS(target_player);
+	#else
+		const vec2f_t target_pos = CG_PLAYER_POS(target_player);
+	#endif // CG_SERVER
 
-				cg->player_damaged(target_player, attacker_player, cg->user_data);
-			}
+		target = cg_bullet_expand_target(bullet, &target_pos, &target_player->size);
+		if (target.pos.x > sweep->pos.x + sweep->size.x ||
+			target.pos.y > sweep->pos.y + sweep->size.y ||
+			target.pos.x + target.size.x < sweep->pos.x ||
+			target.pos.y + target.size.y < sweep->pos.y)
+			continue;
 
-			bullet->collided = true;
-			bullet->contact_point = contact_point;
-			*next_pos = contact_point;
-			return true;
-		}
+		cg_aabb_batch_add(targets, &target, target_player);
 	}
-	return false;
 }
 
-static bool
-cg_bullet_collision_test(coregame_t* cg, cg_bullet_t* bullet, vec2f_t* next_pos)
+/**
+ *	Players come from the occupancy lists of the cells along start-end,
+ *	widened by `r` cells on each side to cover the bullet's size and
+ *	the targets' reach. The walk moves one cell at a time, so only the
+ *	row or column of the window that comes into view is visited.
+ */
+static void
+cg_bullet_gather_players(coregame_t* cg, const cg_bullet_t* bullet, 
+						 const vec2f_t* start, const vec2f_t* end,
+						 const cg_rect_t* sweep, cg_aabb_batch_t* targets)
 {
-	for (u32 i = 0; i < bullet->cells.count; i++)
+	const f32 grid_size = cg->map->grid_size;
+	const f32 half = fmaxf(bullet->r.size.x, bullet->r.size.y) / 2.0;
+	const i32 r = ceilf((half + cg_bullet_target_reach(cg, bullet)) / grid_size);
+
+	const f32 dx = end->x - start->x;
+	const f32 dy = end->y - start->y;
+	const i32 step_x = (dx > 0) ? 1 : -1;
+	const i32 step_y = (dy > 0) ? 1 : -1;
+
+	i32 x = floorf(start->x / grid_size);
+	i32 y = floorf(start->y / grid_size);
+	const i32 x1 = floorf(end->x / grid_size);
+	const i32 y1 = floorf(end->y / grid_size);
+	u32 steps = abs(x1 - x) + abs(y1 - y);
+
+	const f32 t_delta_x = (dx != 0) ? fabsf(grid_size / dx) : INFINITY;
+	const f32 t_delta_y = (dy != 0) ? fabsf(grid_size / dy) : INFINITY;
+	f32 t_max_x = (dx != 0) ? ((x + (step_x > 0)) * grid_size - start->x) / dx : INFINITY;
+	f32 t_max_y = (dy != 0) ? ((y + (step_y > 0)) * grid_size - start->y) / dy : INFINITY;
+
+	for (i32 wy = y - r; wy <= y + r; wy++)
+		for (i32 wx = x - r; wx <= x + r; wx++)
+			cg_bullet_add_cell_targets(cg, bullet, sweep, wx, wy, targets);
+
+	while (steps--)
 	{
-		const cg_runtime_cell_t* cell = ((const cg_runtime_cell_t**)bullet->cells.buf)[i];
-
-		if (cell->type == CG_CELL_BLOCK)
+		if (t_max_x < t_max_y)
 		{
-			if (cg_bullet_block_cell_collision_test(cg, bullet, cell, next_pos))
-				return true;
+			t_max_x += t_delta_x;
+			x += step_x;
+			for (i32 wy = y - r; wy <= y + r; wy++)
+				cg_bullet_add_cell_targets(cg, bullet, sweep, x + step_x * r, wy, targets);
 		}
 		else
 		{
-			if (cg_bullet_empty_cell_collision_test(cg, bullet, cell, next_pos))
-				return true;
+			t_max_y += t_delta_y;
+			y += step_y;
+			for (i32 wx = x - r; wx <= x + r; wx++)
+				cg_bullet_add_cell_targets(cg, bullet, sweep, wx, y + step_y * r, targets);
 		}
 	}
-	return false;
+}
+
+static void
+cg_bullet_gather_targets(coregame_t* cg, const cg_bullet_t* bullet, 
+						 const vec2f_t* start, const vec2f_t* end,
+						 cg_aabb_batch_t* targets)
+{
+	const cg_rect_t sweep = {
+		.pos = vec2f(fminf(start->x, end->x), fminf(start->y, end->y)),
+		.size = vec2f(fabsf(end->x - start->x), fabsf(end->y - start->y)),
+	};
+	cg_rect_t target;
+
+	cg_aabb_batch_clear(targets);
+
+	for (u32 i = 0; i < bullet->cells.count; i++)
+	{
+		const cg_runtime_cell_t* cell = ((const cg_runtime_cell_t**)bullet->cells.buf)[i];
+		const cg_rect_t block = cg_block_target(cg->map, cell);
+
+		target = cg_bullet_expand_target(bullet, &block.pos, &block.size);
+		cg_aabb_batch_add(targets, &target, NULL);
+	}
+
+	/* 
+	 * The block walk strides over open space, so players get their own
+	 * walk over every cell the bullet passes.
+	 */
+	cg_bullet_gather_players(cg, bullet, start, end, &sweep, targets);
+}
+
+static bool
+cg_bullet_collision_test(coregame_t* cg, cg_bullet_t* bullet, vec2f_t* next_pos, cg_aabb_batch_t* targets)
+{
+	const vec2f_t mid = {
+		.x = bullet->r.pos.x + (bullet->r.size.x / 2.0),
+		.y = bullet->r.pos.y + (bullet->r.size.y / 2.0),
+	};
+	const vec2f_t next_mid = {
+		.x = next_pos->x + (bullet->r.size.x / 2.0),
+		.y = next_pos->y + (bullet->r.size.y / 2.0),
+	};
+	f32 t_hit_near;
+	i32 idx;
+
+	array_clear(&bullet->cells, false);
+	cg_get_block_cells_2points(cg->map, &bullet->cells, &mid, &next_mid);
+
+	cg_bullet_gather_targets(cg, bullet, &mid, &next_mid, targets);
+	if (targets->count == 0)
+		return false;
+
+	const vec2f_t travel = vec2f(next_mid.x - mid.x, next_mid.y - mid.y);
+	if ((idx = cg_ray_aabb_batch(&mid, &travel, targets, &t_hit_near)) == -1)
+		return false;
+
+	bullet->trace.target = targets->data[idx];
+	bullet->contact_point.x = mid.x + t_hit_near * travel.x;
+	bullet->contact_point.y = mid.y + t_hit_near * travel.y;
+	*next_pos = bullet->contact_point;
+	return true;
+}
+
+/**
+ *	Moves the bullet and finds what it hits, without side effects on
+ *	anything but the bullet itself, so bullets can be traced in parallel.
+ */
+static void
+cg_bullet_trace(coregame_t* cg, cg_bullet_t* bullet, cg_aabb_batch_t* targets)
+{
+	if (bullet->collided)
+		return;
+
+	bullet->step_prev_pos = bullet->r.pos;
+	vec2f_t next_pos = vec2f(
+		bullet->r.pos.x + bullet->velocity.x * cg->delta,
+		bullet->r.pos.y + bullet->velocity.y * cg->delta
+	);
+	bullet->trace.target = NULL;
+	bullet->trace.hit = cg_bullet_collision_test(cg, bullet, &next_pos, targets);
+	bullet->trace.next_pos = next_pos;
+}
+
+static void
+cg_trace_bullets_job(void* ctx, u32 begin, u32 end, u32 worker)
+{
+	coregame_t* cg = ctx;
+	cg_aabb_batch_t* targets = (worker) ? cg->job_targets + (worker - 1) : &cg->bullet_targets;
+
+	for (u32 i = begin; i < end; i++)
+		cg_bullet_trace(cg, cg->bullets.dense[i], targets);
 }
 
 void
-coregame_update_bullet(coregame_t* cg, cg_bullet_t* bullet)
+coregame_trace_bullets(coregame_t* cg)
+{
+	cg_jobs_parallel_for(cg->jobs, cg->bullets.count, CG_BULLET_JOB_GRAIN, cg_trace_bullets_job, cg);
+}
+
+/* Applies the trace: damage, position, and freeing the bullet if it left the map. */
+void
+coregame_resolve_bullet(coregame_t* cg, cg_bullet_t* bullet)
 {
+#ifdef CG_SERVER
+	cg_player_t* target_player = bullet->trace.target;
+	cg_event_t* event;
+#endif // CG_SERVER
+
 	if (bullet->collided)
 	{
 	#ifdef CG_CLIENT
 		coregame_free_bullet(cg, bullet);
 	#endif // CG_CLIENT
+		return;
 	}
-	else
-	{
-		vec2f_t next_pos = vec2f(
-			bullet->r.pos.x + bullet->velocity.x * cg->delta,
-			bullet->r.pos.y + bullet->velocity.y * cg->delta
-		);
-		array_clear(&bullet->cells, false);
-		cg_get_cells_2points(cg->map, &bullet->cells, &bullet->r.pos, &next_pos);
-		if (cg_bullet_collision_test(cg, bullet, &next_pos))
-		{
-			bullet->collided = true;
-		}
-		bullet->r.pos = next_pos;
 
-		if (bullet->r.pos.x < 0 || bullet->r.pos.y < 0 ||
-			bullet->r.pos.x > cg->map->w * cg->map->grid_size ||
-			bullet->r.pos.y > cg->map->h * cg->map->grid_size)
+	if (bullet->trace.hit)
+	{
+	#ifdef CG_SERVER
+		/*
+		 * Health is server authoritative. A player at 0 health is waiting
+		 * for the journal to be drained (respawn), so don't kill it twice.
+		 */
+		if (target_player && CG_PLAYER_HEALTH(target_player) > 0 &&
+			cg_registry_get(&cg->players, bullet->owner_id))
 		{
-			coregame_free_bullet(cg, bullet);
+			CG_PLAYER_HEALTH(target_player) -= bullet->dmg;
+			if (CG_PLAYER_HEALTH(target_player) < 0)
+				CG_PLAYER_HEALTH(target_player) = 0;
+			target_player->dirty = true;
+
+			event = cg_push_event(cg, CG_EVENT_PLAYER_DAMAGED, target_player->id);
+			event->damaged.attacker_id = bullet->owner_id;
+			event->damaged.dmg = bullet->dmg;
+			event->damaged.health = CG_PLAYER_HEALTH(target_player);
 		}
-
-	#ifdef CG_SERVER
-		sbsm_commit_bullet(cg->sbsm->present, bullet);
 	#endif // CG_SERVER
+		bullet->collided = true;
+	}
+	bullet->r.pos = bullet->trace.next_pos;
+
+	if (bullet->r.pos.x < 0 || bullet->r.pos.y < 0 ||
+		bullet->r.pos.x > cg->map->w * cg->map->grid_size ||
+		bullet->r.pos.y > cg->map->h * cg->map->grid_size)
+	{
+		coregame_free_bullet(cg, bullet);
 	}
+
+#ifdef CG_SERVER
+	sbsm_commit_bullet(cg->sbsm->present, bullet);
+#endif // CG_SERVER
 }
 
+void
+coregame_update_bullet(coregame_t* cg, cg_bullet_t* bullet)
+{
+	cg_bullet_trace(cg, bullet, &cg->bullet_targets);
+	coregame_resolve_bullet(cg, bullet);
+}
+
+/**
+ *	Trace every bullet first (in parallel if we have jobs), then apply
+ *	the results in registry order. Damage is deferred until all bullets
+ *	have been traced, so the outcome doesn't depend on the worker count.
+ */
 static void
 coregame_update_bullets(coregame_t* cg)
 {
-	ght_t* bullets = &cg->bullets;
+	cg_registry_t* bullets = &cg->bullets;
+
+	coregame_trace_bullets(cg);
 
-	GHT_FOREACH(cg_bullet_t* bullet, bullets, 
+	CG_REGISTRY_FOREACH(cg_bullet_t* bullet, bullets,
 	{
-		coregame_update_bullet(cg, bullet);
+		coregame_resolve_bullet(cg, bullet);
 	});
 }
 
-void 
-coregame_update(coregame_t* cg)
+#ifdef CG_SERVER
+static void
+cg_record_player_history(coregame_t* cg)
 {
-	coregame_get_delta_time(cg);
-	if (cg->pause)
-		return;
+	const cg_registry_t* players = &cg->players;
+
+	CG_REGISTRY_FOREACH(cg_player_t* player, players,
+	{
+		if (player->history == NULL)
+			player->history = calloc(1, sizeof(cg_player_history_t));
+
+		player->history->pos[player->history->count % CG_PLAYER_HISTORY] = CG_PLAYER_POS(player);
+		player->history->count++;
+	});
+}
 
+/**
+ *	Where `player` was `lag_ms` ago, interpolated between recorded ticks.
+ *	Clamped to the oldest tick we still have.
+ */
+vec2f_t
+coregame_player_view_pos(const coregame_t* cg, const cg_player_t* player, f32 lag_ms)
+{
+	const cg_player_history_t* history = player->history;
+	u64 available;
+	u64 back;
+	f32 ticks;
+	f32 t;
+
+	if (history == NULL || history->count == 0 || lag_ms <= 0)
+		return CG_PLAYER_POS(player);
+
+	available = (history->count < CG_PLAYER_HISTORY) ? history->count : CG_PLAYER_HISTORY;
+	ticks = lag_ms / cg->sbsm->interval_ms;
+	back = (u64)ticks;
+	if (back >= available - 1)
+		return history->pos[(history->count - available) % CG_PLAYER_HISTORY];
+
+	t = ticks - back;
+	const vec2f_t* a = history->pos + (history->count - 1 - back) % CG_PLAYER_HISTORY;
+	const vec2f_t* b = history->pos + (history->count - 2 - back) % CG_PLAYER_HISTORY;
+
+	return vec2f(a->x + (b->x - a->x) * t, a->y + (b->y - a->y) * t);
+}
+
+/**
+ *	CG_NETCODE_LAG_COMP trades rollback's exact resimulation for a bounded
+ *	per-tick cost: no world rewinds, only the target hitboxes are moved
+ *	back to the shooter's view when bullets are tested.
+ */
+void
+coregame_set_netcode(coregame_t* cg, enum cg_netcode netcode)
+{
+	cg->netcode = netcode;
+	cg->sbsm->oldest_change = NULL;
+}
+
+/**
+ *	Resizes the rollback window (how late an input may be and still be applied).
+ *	Drops all snapshot history, so call it before the game starts.
+ */
+void
+coregame_set_rollback_window(coregame_t* cg, f64 window_ms)
+{
+	const f64 interval_ms = cg->sbsm->interval_ms;
+	u32 count = ceil(window_ms / interval_ms) + 1;
+
+	if (count < 2)
+		count = 2;
+
+	sbsm_destroy(cg->sbsm);
+	cg->sbsm = sbsm_create(count, interval_ms);
+	sbsm_reserve(cg->sbsm, cg->players.sparse_size, cg->bullets.sparse_size);
+}
+#endif // CG_SERVER
+
+static void
+coregame_step(coregame_t* cg)
+{
 #ifdef CG_SERVER
 	if (cg->sbsm->oldest_change)
 		sbsm_rollback(cg);
@@ -788,6 +1389,10 @@ coregame_update(coregame_t* cg)
 #endif // CG_SERVER
 
 	coregame_update_players(cg);
+#ifdef CG_SERVER
+	if (cg->netcode == CG_NETCODE_LAG_COMP)
+		cg_record_player_history(cg);
+#endif // CG_SERVER
 	coregame_update_bullets(cg);
 
 	// if (cg->sbsm->dirty)
@@ -797,39 +1402,239 @@ coregame_update(coregame_t* cg)
 	// }
 }
 
+void 
+coregame_update(coregame_t* cg)
+{
+	coregame_get_delta_time(cg);
+	if (cg->pause)
+	{
+		cg->fixed.accumulator = 0;
+		return;
+	}
+
+	if (cg->fixed.step <= 0)
+	{
+		coregame_step(cg);
+		return;
+	}
+
+	cg->fixed.accumulator += cg->delta;
+	/* Drop time instead of spiraling when we fall too far behind. */
+	if (cg->fixed.accumulator > cg->fixed.step * cg->fixed.max_substeps)
+		cg->fixed.accumulator = cg->fixed.step * cg->fixed.max_substeps;
+
+	cg->fixed.steps = 0;
+	while (cg->fixed.accumulator >= cg->fixed.step)
+	{
+		cg->delta = cg->fixed.step;
+		coregame_step(cg);
+
+		cg->fixed.accumulator -= cg->fixed.step;
+		cg->fixed.steps++;
+		cg->fixed.tick++;
+	}
+	cg->fixed.alpha = cg->fixed.accumulator / cg->fixed.step;
+}
+
+#ifdef CG_SERVER
+void
+coregame_tick(coregame_t* cg)
+{
+	if (cg->pause)
+		return;
+
+	cg->delta = cg->fixed.step;
+	coregame_step(cg);
+
+	cg->fixed.steps = 1;
+	cg->fixed.tick++;
+}
+#endif // CG_SERVER
+
+/**
+ *	Compatibility adapter: feeds the journal to the old callbacks, 
+ *	in the order the events happened. Entities that are gone by now are skipped.
+ */
+void
+coregame_dispatch_events(coregame_t* cg)
+{
+	cg_player_t* player;
+	cg_player_t* attacker;
+	cg_bullet_t* bullet;
+
+	/* Callbacks may push events, so re-read the buffer every time. */
+	for (u32 i = 0; i < cg->events.count; i++)
+	{
+		const cg_event_t event = ((const cg_event_t*)cg->events.buf)[i];
+
+		if (event.type == CG_EVENT_BULLET_CREATE)
+		{
+			if (cg->on_bullet_create && (bullet = cg_registry_get(&cg->bullets, event.id)))
+				cg->on_bullet_create(bullet, cg->user_data);
+			continue;
+		}
+
+		if ((player = cg_registry_get(&cg->players, event.id)) == NULL)
+			continue;
+
+	#ifdef CG_SERVER
+		cg->rewinding = event.rewinding;
+	#endif // CG_SERVER
+
+		switch (event.type)
+		{
+			case CG_EVENT_PLAYER_CHANGED:
+				if (cg->player_changed)
+					cg->player_changed(player, cg->user_data);
+				break;
+			case CG_EVENT_PLAYER_GUN_CHANGED:
+				if (cg->player_gun_changed)
+					cg->player_gun_changed(player, cg->user_data);
+				break;
+			case CG_EVENT_PLAYER_RELOAD:
+				if (cg->player_reload)
+					cg->player_reload(player, cg->user_data);
+				break;
+			case CG_EVENT_PLAYER_DAMAGED:
+				attacker = cg_registry_get(&cg->players, event.damaged.attacker_id);
+				if (cg->player_damaged && attacker)
+					cg->player_damaged(player, attacker, cg->user_data);
+				break;
+			default:
+				break;
+		}
+	}
+
+#ifdef CG_SERVER
+	cg->rewinding = false;
+#endif // CG_SERVER
+	coregame_clear_events(cg);
+}
+
+void
+coregame_clear_events(coregame_t* cg)
+{
+	array_clear(&cg->events, false);
+}
+
+void
+coregame_set_jobs(coregame_t* cg, cg_jobs_t* jobs)
+{
+	const u32 workers = cg_jobs_workers(cg->jobs);
+
+	for (u32 i = 0; i < workers - 1; i++)
+		cg_aabb_batch_del(cg->job_targets + i);
+	free(cg->job_targets);
+	cg->job_targets = NULL;
+
+	cg->jobs = jobs;
+	if (jobs == NULL)
+		return;
+
+	cg->job_targets = calloc(cg_jobs_workers(jobs) - 1, sizeof(cg_aabb_batch_t));
+	for (u32 i = 0; i < cg_jobs_workers(jobs) - 1; i++)
+		cg_aabb_batch_init(cg->job_targets + i, 0);
+}
+
+void
+coregame_set_fixed_step(coregame_t* cg, f64 step_s, u32 max_substeps)
+{
+	cg->fixed.step = step_s;
+	cg->fixed.max_substeps = (max_substeps) ? max_substeps : 1;
+	cg->fixed.accumulator = 0;
+	cg->fixed.alpha = 0;
+}
+
+vec2f_t
+coregame_lerp_pos(const coregame_t* cg, const vec2f_t* prev, const vec2f_t* current)
+{
+	if (cg->fixed.step <= 0)
+		return *current;
+
+	const f32 alpha = cg->fixed.alpha;
+	return vec2f(
+		prev->x + (current->x - prev->x) * alpha,
+		prev->y + (current->y - prev->y) * alpha
+	);
+}
+
 void 
 coregame_cleanup(coregame_t* cg)
 {
-	ght_destroy(&cg->players);
-	ght_destroy(&cg->bullets);
+	cg_registry_destroy(&cg->players);
+	cg_registry_destroy(&cg->bullets);
+	cg_bullet_pool_destroy(&cg->bullet_pool);
+	cg_aabb_batch_del(&cg->bullet_targets);
+	coregame_set_jobs(cg, NULL);
+	free(cg->islands.boxes);
+	free(cg->islands.parent);
+	free(cg->islands.sorted);
+	free(cg->islands.start);
+	free(cg->islands.len);
+	free(cg->islands.members);
+	free(cg->islands.roots);
+	free(cg->islands.gun_events);
+	free(cg->islands.events);
 	cg_runtime_map_free(cg->map);
 	array_del(&cg->gun_specs);
+	array_del(&cg->events);
+#ifdef CG_SERVER
+	sbsm_destroy(cg->sbsm);
+#endif // CG_SERVER
 }
 
 cg_player_t* 
 coregame_add_player(coregame_t* coregame, const char* name)
 {
 	cg_player_t* player = calloc(1, sizeof(cg_player_t));
-	player->id = ++coregame->player_id_seq;
+	player->id = cg_registry_new_id(&coregame->players);
 	strncpy(player->username, name, PLAYER_NAME_MAX - 1);
-	player->pos = vec2f(0, 0);
 	player->size = vec2f(150, 150);
-	player->health = PLAYER_HEALTH;
 	player->max_health = PLAYER_HEALTH;
 
-	coregame_add_player_from(coregame, player);
+	if (coregame_add_player_from(coregame, player) == false)
+	{
+		free(player);
+		return NULL;
+	}
+	CG_PLAYER_HEALTH(player) = PLAYER_HEALTH;
 
 	return player;
 }
 
-void 
+bool
 coregame_add_player_from(coregame_t* cg, cg_player_t* player)
 {
-	ght_insert(&cg->players, player->id, player);
+	if (cg_registry_insert(&cg->players, player->id, player) == false)
+	{
+		fprintf(stderr, "coregame_add_player_from: Player ID %u is already taken.\n", player->id);
+		return false;
+	}
+	player->reg = &cg->players;
+#ifdef CG_SERVER
+	sbsm_reserve(cg->sbsm, CG_HANDLE_SLOT(player->id) + 1, 0);
+#endif // CG_SERVER
 	array_init(&player->cells, sizeof(cg_runtime_cell_t**), 6);
-	cg_player_get_cells(cg->map, player);
-	cg_player_add_into_cells(player);
+	player->cell_nodes = NULL;
+	player->cell_nodes_size = 0;
+	player->cells_min = player->cells_max = NULL;
+	cg_player_update_cells(cg->map, player);
 	player->on_player_free = cg->player_free_callback;
+
+	return true;
+}
+
+void
+coregame_set_player_pos(coregame_t* cg, cg_player_t* player, vec2f_t pos)
+{
+	CG_PLAYER_POS(player) = pos;
+	player->step_prev_pos = pos;
+	cg_player_update_cells(cg->map, player);
+#ifdef CG_SERVER
+	/* Lag compensation must not interpolate across the teleport. */
+	if (player->history)
+		player->history->count = 0;
+#endif // CG_SERVER
 }
 
 void 
@@ -839,7 +1644,7 @@ coregame_free_player(coregame_t* cg, cg_player_t* player)
 	sbsm_delete_player(cg->sbsm, player);
 #endif // CG_SERVER
 
-	ght_del(&cg->players, player->id);
+	cg_registry_del(&cg->players, player->id);
 }
 
 // static inline void
@@ -869,12 +1674,12 @@ coregame_set_player_input(cg_player_t* player, u8 input)
 	if (input & PLAYER_INPUT_RIGHT)
 		dir_vec.x += 1.0;
 
-	player->dir = dir_vec;
+	CG_PLAYER_DIR(player) = dir_vec;
 
-	vec2f_norm(&player->dir);
+	vec2f_norm(&CG_PLAYER_DIR(player));
 
 	player->shoot = input & PLAYER_INPUT_SHOOT;
-	player->input = input;
+	CG_PLAYER_INPUT(player) = input;
 }
 
 #ifdef CG_SERVER
@@ -888,18 +1693,20 @@ coregame_set_player_input_t(coregame_t* cg, cg_player_t* player, u8 input, f64 t
 	else
 		player->last_input_timestamp = ss->timestamp;
 
+	if (cg->netcode == CG_NETCODE_LAG_COMP)
+	{
+		player->view_lag_ms = clampf(cg->sbsm->present->timestamp - timestamp, 
+									 0, cg->sbsm->interval_ms * (CG_PLAYER_HISTORY - 1));
+		coregame_set_player_input(player, input);
+		return;
+	}
+
 	ss->dirty = true;
-	cg_player_snapshot_t* ps = ght_get(&ss->player_states, player->id);
+	cg_player_snapshot_t* ps = sbsm_player_state(cg->sbsm, ss, player->id);
 	if (ps == NULL)
 	{
-		ps = calloc(1, sizeof(cg_player_snapshot_t));
-		ps->player_id = player->id;
+		ps = sbsm_player_state_new(cg->sbsm, ss, player->id);
 		sbsm_player_to_snapshot(ps, player);
-
-		/* TODO: Find the oldest changes */
-		// ps->prev = NULL;
-
-		ght_insert(&ss->player_states, player->id, ps);
 	}
 	else if (ps->input == input || ps->dirty_count > 1)
 		return;
@@ -922,13 +1729,13 @@ coregame_get_player_input(const cg_player_t* player)
 {
 	u8 input = 0;
 
-	if (player->dir.x > 0)
+	if (CG_PLAYER_DIR(player).x > 0)
 		input |= PLAYER_INPUT_RIGHT;
-	else if (player->dir.x < 0)
+	else if (CG_PLAYER_DIR(player).x < 0)
 		input |= PLAYER_INPUT_LEFT;
-	if (player->dir.y > 0)
+	if (CG_PLAYER_DIR(player).y > 0)
 		input |= PLAYER_INPUT_DOWN;
-	if (player->dir.y < 0)
+	if (CG_PLAYER_DIR(player).y < 0)
 		input |= PLAYER_INPUT_UP;
 
 	if (player->shoot)
@@ -943,7 +1750,8 @@ coregame_free_bullet(coregame_t* coregame, cg_bullet_t* bullet)
 	if (coregame->bullet_free_callback)
 		coregame->bullet_free_callback(bullet, coregame->user_data);
 
-	ght_del(&coregame->bullets, bullet->id);
+	if (cg_registry_del(&coregame->bullets, bullet->id))
+		cg_bullet_pool_free(&coregame->bullet_pool, bullet);
 }
 
 void
@@ -1021,8 +1829,8 @@ coregame_gun_update(coregame_t* cg, cg_gun_t* gun)
 		gun->owner->dirty = gun->owner->gun_dirty = true;
 #endif // CG_SERVER
 
-	if (gun->ammo <= 0 && cg->player_reload)
-		cg->player_reload(gun->owner, cg->user_data);
+	if (gun->ammo <= 0)
+		cg_push_event(cg, CG_EVENT_PLAYER_RELOAD, gun->owner->id);
 }
 
 cg_gun_t* 
@@ -1089,7 +1897,6 @@ coregame_player_reload(coregame_t* cg, cg_player_t* player)
 
 	player->gun->ammo = 0;
 
-	if (cg->player_reload)
-		cg->player_reload(player, cg->user_data);
+	cg_push_event(cg, CG_EVENT_PLAYER_RELOAD, player->id);
 }
 
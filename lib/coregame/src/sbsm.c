@@ -2,6 +2,10 @@
 #include "coregame.h"
 #include <string.h>
 
+#define SBSM_MIN_PLAYER_SLOTS 16
+#define SBSM_MIN_BULLET_SLOTS 256
+#define SBSM_RESIM_BUCKET_CELLS 8	// Map cells per side of a resim bucket
+
 cg_sbsm_t* 
 sbsm_create(u32 size, f64 interval_ms)
 {
@@ -12,16 +16,56 @@ sbsm_create(u32 size, f64 interval_ms)
 	
 	sbsm->base = sbsm->present = sbsm->snapshots;
 
-	for (u32 i = 0; i < size; i++)
+	sbsm_reserve(sbsm, SBSM_MIN_PLAYER_SLOTS, SBSM_MIN_BULLET_SLOTS);
+	sbsm_rotate(NULL, sbsm);
+
+	return sbsm;
+}
+
+/**
+ *	Makes every snapshot hold at least `player_slots` and `bullet_slots` entries.
+ *	Only reallocates when a registry grows past its high-water mark, so memory
+ *	is `size` * live slots rather than per entity per tick.
+ */
+void
+sbsm_reserve(cg_sbsm_t* sbsm, u32 player_slots, u32 bullet_slots)
+{
+	u32 new_player_slots = sbsm->player_slots;
+	u32 new_bullet_slots = sbsm->bullet_slots;
+	u64 stride;
+	u8* arena;
+
+	if (player_slots <= new_player_slots && bullet_slots <= new_bullet_slots)
+		return;
+
+	while (new_player_slots < player_slots)
+		new_player_slots = (new_player_slots) ? new_player_slots * 2 : SBSM_MIN_PLAYER_SLOTS;
+	while (new_bullet_slots < bullet_slots)
+		new_bullet_slots = (new_bullet_slots) ? new_bullet_slots * 2 : SBSM_MIN_BULLET_SLOTS;
+
+	stride = sizeof(cg_player_snapshot_t) * new_player_slots + 
+			 sizeof(cg_bullet_snapshot_t) * new_bullet_slots;
+	arena = calloc(sbsm->size, stride);
+
+	for (u32 i = 0; i < sbsm->size; i++)
 	{
 		cg_game_snapshot_t* ss = sbsm->snapshots + i;
-		ght_init(&ss->player_states, 10, free);
-		ght_init(&ss->bullet_states, 100, free);
-	}
+		cg_player_snapshot_t* players = (cg_player_snapshot_t*)(arena + stride * i);
+		cg_bullet_snapshot_t* bullets = (cg_bullet_snapshot_t*)(players + new_player_slots);
 
-	sbsm_rotate(NULL, sbsm);
+		if (ss->players)
+		{
+			memcpy(players, ss->players, sizeof(cg_player_snapshot_t) * sbsm->player_slots);
+			memcpy(bullets, ss->bullets, sizeof(cg_bullet_snapshot_t) * sbsm->bullet_slots);
+		}
+		ss->players = players;
+		ss->bullets = bullets;
+	}
 
-	return sbsm;
+	free(sbsm->arena);
+	sbsm->arena = arena;
+	sbsm->player_slots = new_player_slots;
+	sbsm->bullet_slots = new_bullet_slots;
 }
 
 static inline u32
@@ -30,6 +74,20 @@ sbsm_index(const cg_sbsm_t* sbsm, f64 timestamp_ms)
 	return (u32)ceil(timestamp_ms / sbsm->interval_ms) % sbsm->size;
 }
 
+void
+sbsm_destroy(cg_sbsm_t* sbsm)
+{
+	if (sbsm == NULL)
+		return;
+
+	free(sbsm->arena);
+	free(sbsm->resim);
+	free(sbsm->resim_queue);
+	free(sbsm->resim_buckets);
+	free(sbsm->resim_items);
+	free(sbsm);
+}
+
 cg_game_snapshot_t* 
 sbsm_lookup(cg_sbsm_t* sbsm, f64 timestamp_ms)
 {
@@ -43,41 +101,73 @@ sbsm_lookup(cg_sbsm_t* sbsm, f64 timestamp_ms)
 	return ret;
 }
 
+cg_player_snapshot_t* 
+sbsm_player_state(const cg_sbsm_t* sbsm, cg_game_snapshot_t* ss, u32 player_id)
+{
+	const u32 slot = CG_HANDLE_SLOT(player_id);
+
+	if (slot >= sbsm->player_slots || ss->players[slot].player_id != player_id)
+		return NULL;
+	return ss->players + slot;
+}
+
+cg_player_snapshot_t* 
+sbsm_player_state_new(const cg_sbsm_t* sbsm, cg_game_snapshot_t* ss, u32 player_id)
+{
+	const u32 slot = CG_HANDLE_SLOT(player_id);
+	cg_player_snapshot_t* pss;
+
+	if (slot >= sbsm->player_slots)
+		return NULL;
+
+	pss = ss->players + slot;
+	memset(pss, 0, sizeof(cg_player_snapshot_t));
+	pss->player_id = player_id;
+	return pss;
+}
+
+cg_bullet_snapshot_t* 
+sbsm_bullet_state(const cg_sbsm_t* sbsm, cg_game_snapshot_t* ss, u32 bullet_id)
+{
+	const u32 slot = CG_HANDLE_SLOT(bullet_id);
+
+	if (slot >= sbsm->bullet_slots || ss->bullets[slot].bullet_id != bullet_id)
+		return NULL;
+	return ss->bullets + slot;
+}
+
+/**
+ *	The entity's slot must have been reserved (see `sbsm_reserve()`), 
+ *	coregame does that when players and bullets are added.
+ */
 void
 sbsm_commit_player(cg_game_snapshot_t* ss, cg_player_t* player)
 {
-	cg_player_snapshot_t* pss;
+	cg_player_snapshot_t* pss = ss->players + CG_HANDLE_SLOT(player->id);
 
+	/* Unchanged, the entry copied forward from the last tick is still right. */
 	if (player->dirty == false)
-	{
-		ght_del(&ss->player_states, player->id);
 		return;
-	}
-
-	pss = ght_get(&ss->player_states, player->id);
 
-	if (pss == NULL)
+	if (pss->player_id != player->id)
 	{
-		pss = calloc(1, sizeof(cg_player_snapshot_t));
+		memset(pss, 0, sizeof(cg_player_snapshot_t));
 		pss->player_id = player->id;
-		ght_insert(&ss->player_states, pss->player_id, pss);
 	}
 	
 	sbsm_player_to_snapshot(pss, player);
+	pss->seq = ss->seq;
 	pss->dirty = false;
+	pss->dirty_count = 0;
 	player->dirty = false;
 }
 
 void
 sbsm_commit_bullet(cg_game_snapshot_t* ss, cg_bullet_t* bullet)
 {
-	cg_bullet_snapshot_t* bss = ght_get(&ss->bullet_states, bullet->id);
-	if (bss == NULL)
-	{
-		bss = malloc(sizeof(cg_player_snapshot_t));
-		bss->bullet_id = bullet->id;
-		ght_insert(&ss->bullet_states, bss->bullet_id, bss);
-	}
+	cg_bullet_snapshot_t* bss = ss->bullets + CG_HANDLE_SLOT(bullet->id);
+
+	bss->bullet_id = bullet->id;
 	bss->pos = bullet->r.pos;
 	bss->collided = bullet->collided;
 }
@@ -85,10 +175,12 @@ sbsm_commit_bullet(cg_game_snapshot_t* ss, cg_bullet_t* bullet)
 void 
 sbsm_player_to_snapshot(cg_player_snapshot_t* pss, const cg_player_t* player)
 {
-	pss->pos = player->pos;
-	pss->velocity = player->velocity;
-	pss->input = player->input;
+	pss->pos = CG_PLAYER_POS(player);
+	pss->velocity = CG_PLAYER_VELOCITY(player);
+	pss->input = CG_PLAYER_INPUT(player);
 	pss->shooting = player->shoot;
+	pss->health = CG_PLAYER_HEALTH(player);
+	pss->cursor = player->cursor;
 
 	if (player->gun == NULL)
 		return;
@@ -101,12 +193,17 @@ sbsm_player_to_snapshot(cg_player_snapshot_t* pss, const cg_player_t* player)
 }
 
 void
-sbsm_snapshot_to_player(coregame_t* cg, cg_player_t* player, const cg_player_snapshot_t* pss)
+sbsm_snapshot_to_player(coregame_t* cg, cg_player_t* player, 
+						const cg_game_snapshot_t* ss, const cg_player_snapshot_t* pss)
 {
-	player->pos = pss->pos;
-	player->pos.x -= pss->velocity.x;
-	player->pos.y -= pss->velocity.y;
-	player->input = pss->input;
+	/* Back to where the player was at the start of the tick. */
+	CG_PLAYER_POS(player) = pss->pos;
+	if (pss->seq == ss->seq)
+	{
+		CG_PLAYER_POS(player).x -= pss->velocity.x;
+		CG_PLAYER_POS(player).y -= pss->velocity.y;
+	}
+	CG_PLAYER_INPUT(player) = pss->input;
 	player->shoot = pss->shooting;
 
 	if (pss->gun_id != player->gun->spec->id)
@@ -130,23 +227,19 @@ sbsm_snapshot_to_bullet(cg_bullet_t* bullet, const cg_bullet_snapshot_t* bss)
 void
 sbsm_delete_player(cg_sbsm_t* sbsm, cg_player_t* player)
 {
-	u32 index = sbsm_index(sbsm, sbsm->base->timestamp);
+	cg_player_snapshot_t* pss;
 
 	for (u32 i = 0; i < sbsm->size; i++)
 	{
-		cg_game_snapshot_t* gss = (cg_game_snapshot_t*)sbsm->snapshots + index;
-		ght_del(&gss->player_states, player->id);
-		
-		index++;
-		if (index >= sbsm->size)
-			index = 0;
+		if ((pss = sbsm_player_state(sbsm, sbsm->snapshots + i, player->id)))
+			pss->player_id = 0;
 	}
 }
 
 static inline void
 sbsm_rewind_player(coregame_t* cg, cg_game_snapshot_t* gss, cg_player_t* player)
 {
-	cg_player_snapshot_t* pss = ght_get(&gss->player_states, player->id);
+	cg_player_snapshot_t* pss = sbsm_player_state(cg->sbsm, gss, player->id);
 
 	if (pss && pss->dirty)
 	{
@@ -157,35 +250,58 @@ sbsm_rewind_player(coregame_t* cg, cg_game_snapshot_t* gss, cg_player_t* player)
 	if (player->gun)
 		coregame_gun_update(cg, player->gun);
 
-	player->velocity.x = player->dir.x * PLAYER_SPEED;
-	player->velocity.y = player->dir.y * PLAYER_SPEED;
+	CG_PLAYER_VELOCITY(player).x = CG_PLAYER_DIR(player).x * PLAYER_SPEED;
+	CG_PLAYER_VELOCITY(player).y = CG_PLAYER_DIR(player).y * PLAYER_SPEED;
 
 	coregame_update_player(cg, player);
 
+	/* 
+	 * Always commit: this snapshot still holds the old timeline's entry,
+	 * which is only right if the player didn't diverge.
+	 */
+	player->dirty = true;
 	sbsm_commit_player(gss, player);
 }
 
 static inline void
 sbsm_rewind_players(coregame_t* cg, cg_game_snapshot_t* gss)
 {
-	ght_t* players = &cg->players;
+	cg_registry_t* players = &cg->players;
 
-	GHT_FOREACH(cg_player_t* player, players, 
+	CG_REGISTRY_FOREACH(cg_player_t* player, players, 
 	{
-		sbsm_rewind_player(cg, gss, player);
+		if (player->resim)
+			sbsm_rewind_player(cg, gss, player);
 	});
 }
 
 static inline void
 sbsm_rewind_bullets(coregame_t* cg, cg_game_snapshot_t* gss)
 {
-	ght_t* bullets = &cg->bullets;
+	cg_registry_t* bullets = &cg->bullets;
+
+	if (cg->sbsm->resim_all)
+	{
+		coregame_trace_bullets(cg);
+
+		CG_REGISTRY_FOREACH(cg_bullet_t* bullet, bullets, 
+		{
+			coregame_resolve_bullet(cg, bullet);
 
-	GHT_FOREACH(cg_bullet_t* bullet, bullets, 
+			sbsm_commit_bullet(gss, bullet);
+		});
+		return;
+	}
+
+	/* Bullets fired during the rewind are members too (see `cg_add_bullet()`). */
+	CG_REGISTRY_FOREACH(cg_bullet_t* bullet, bullets, 
 	{
-		coregame_update_bullet(cg, bullet);
+		if (bullet->resim)
+		{
+			coregame_update_bullet(cg, bullet);
 
-		sbsm_commit_bullet(gss, bullet);
+			sbsm_commit_bullet(gss, bullet);
+		}
 	});
 }
 
@@ -215,12 +331,12 @@ sbsm_rewind(coregame_t* cg, cg_game_snapshot_t* gss)
 }
 
 static inline void
-sbsm_rollback_player(coregame_t* cg, cg_player_snapshot_t* pss)
+sbsm_rollback_player(coregame_t* cg, cg_game_snapshot_t* gss, cg_player_snapshot_t* pss)
 {
-	cg_player_t* player = ght_get(&cg->players, pss->player_id);
-	if (player)
+	cg_player_t* player = cg_registry_get(&cg->players, pss->player_id);
+	if (player && player->resim)
 	{
-		sbsm_snapshot_to_player(cg, player, pss);
+		sbsm_snapshot_to_player(cg, player, gss, pss);
 		coregame_set_player_input(player, pss->input);
 		pss->dirty = false;
 	}
@@ -229,18 +345,18 @@ sbsm_rollback_player(coregame_t* cg, cg_player_snapshot_t* pss)
 static inline void
 sbsm_rollback_players(coregame_t* cg, cg_game_snapshot_t* gss)
 {
-	ght_t* player_states = &gss->player_states;
-	GHT_FOREACH(cg_player_snapshot_t* pss, player_states, 
+	for (u32 i = 0; i < cg->sbsm->player_slots; i++)
 	{
-		sbsm_rollback_player(cg, pss);
-	});
+		if (gss->players[i].player_id)
+			sbsm_rollback_player(cg, gss, gss->players + i);
+	}
 }
 
 static inline void
 sbsm_rollback_bullet(coregame_t* cg, cg_bullet_snapshot_t* bss)
 {
-	cg_bullet_t* bullet = ght_get(&cg->bullets, bss->bullet_id);
-	if (bullet)
+	cg_bullet_t* bullet = cg_registry_get(&cg->bullets, bss->bullet_id);
+	if (bullet && bullet->resim)
 	{
 		sbsm_snapshot_to_bullet(bullet, bss);
 	}
@@ -249,93 +365,281 @@ sbsm_rollback_bullet(coregame_t* cg, cg_bullet_snapshot_t* bss)
 static inline void
 sbsm_rollback_bullets(coregame_t* cg, cg_game_snapshot_t* gss)
 {
-	ght_t* bullet_states = &gss->bullet_states;
-	GHT_FOREACH(cg_bullet_snapshot_t* bss, bullet_states, 
+	for (u32 i = 0; i < cg->sbsm->bullet_slots; i++)
 	{
-		sbsm_rollback_bullet(cg, bss);
-	});
+		if (gss->bullets[i].bullet_id)
+			sbsm_rollback_bullet(cg, gss->bullets + i);
+	}
 }
 
-void 
-sbsm_rollback(coregame_t* cg)
+static inline void
+sbsm_resim_expand(cg_sbsm_resim_box_t* box, f32 x, f32 y, const vec2f_t* size)
+{
+	box->min.x = fminf(box->min.x, x);
+	box->min.y = fminf(box->min.y, y);
+	box->max.x = fmaxf(box->max.x, x + size->x);
+	box->max.y = fmaxf(box->max.y, y + size->y);
+}
+
+static inline bool
+sbsm_resim_overlap(const cg_sbsm_resim_box_t* a, const cg_sbsm_resim_box_t* b)
+{
+	return a->min.x <= b->max.x && b->min.x <= a->max.x &&
+		   a->min.y <= b->max.y && b->min.y <= a->max.y;
+}
+
+static inline void
+sbsm_resim_add(cg_sbsm_t* sbsm, u32 idx, u32* queue_len)
+{
+	if (sbsm->resim[idx].member)
+		return;
+
+	sbsm->resim[idx].member = true;
+	sbsm->resim_queue[(*queue_len)++] = idx;
+}
+
+/* Buckets covered by `box`: x0, y0, x1, y1. */
+static inline void
+sbsm_resim_bucket_range(const cg_runtime_map_t* map, const cg_sbsm_resim_box_t* box, 
+						u32 w, u32 h, u32* range)
+{
+	const f32 size = map->grid_size * SBSM_RESIM_BUCKET_CELLS;
+
+	range[0] = clampi(floorf(box->min.x / size), 0, w - 1);
+	range[1] = clampi(floorf(box->min.y / size), 0, h - 1);
+	range[2] = clampi(floorf(box->max.x / size), 0, w - 1);
+	range[3] = clampi(floorf(box->max.y / size), 0, h - 1);
+}
+
+/* Counting sort of the `n` boxes into the buckets they overlap. */
+static void
+sbsm_resim_bucket(coregame_t* cg, u32 n, u32 w, u32 h)
 {
 	cg_sbsm_t* sbsm = cg->sbsm;
-	cg_game_snapshot_t* gss = sbsm->oldest_change;
+	const u32 buckets = w * h;
+	u32 range[4];
+	u32 items = 0;
 
-	sbsm->oldest_change = NULL;
+	if (buckets + 1 > sbsm->resim_buckets_size)
+	{
+		sbsm->resim_buckets_size = buckets + 1;
+		sbsm->resim_buckets = realloc(sbsm->resim_buckets, sizeof(u32) * sbsm->resim_buckets_size);
+	}
+	memset(sbsm->resim_buckets, 0, sizeof(u32) * (buckets + 1));
 
-	cg->delta = sbsm->interval_ms / 1000.0;
+	for (u32 i = 0; i < n; i++)
+	{
+		sbsm_resim_bucket_range(cg->map, sbsm->resim + i, w, h, range);
+		for (u32 y = range[1]; y <= range[3]; y++)
+			for (u32 x = range[0]; x <= range[2]; x++)
+				sbsm->resim_buckets[y * w + x]++;
+	}
+	for (u32 b = 1; b < buckets; b++)
+		sbsm->resim_buckets[b] += sbsm->resim_buckets[b - 1];
+	items = sbsm->resim_buckets[buckets] = sbsm->resim_buckets[buckets - 1];
 
-	sbsm_rollback_players(cg, gss);
-	sbsm_rollback_bullets(cg, gss);
+	if (items > sbsm->resim_items_size)
+	{
+		sbsm->resim_items_size = items * 2;
+		sbsm->resim_items = realloc(sbsm->resim_items, sizeof(u32) * sbsm->resim_items_size);
+	}
 
-	sbsm_rewind(cg, gss);
+	/* Counts became bucket ends, filling moves them back to the starts. */
+	for (u32 i = n; i-- > 0; )
+	{
+		sbsm_resim_bucket_range(cg->map, sbsm->resim + i, w, h, range);
+		for (u32 y = range[1]; y <= range[3]; y++)
+			for (u32 x = range[0]; x <= range[2]; x++)
+				sbsm->resim_items[--sbsm->resim_buckets[y * w + x]] = i;
+	}
 }
 
-static inline void
-sbsm_player_states_backfilling(cg_game_snapshot_t* new_gss, cg_game_snapshot_t* old_gss)
+static void
+sbsm_resim_sweep_window(coregame_t* cg, cg_game_snapshot_t* gss, u32* queue_len)
 {
-	ght_t* old_player_states = &old_gss->player_states;
-	ght_t* new_player_states = &new_gss->player_states;
+	cg_sbsm_t* sbsm = cg->sbsm;
+	const u32 n_players = cg->players.count;
+	u32 index = sbsm_index(sbsm, gss->timestamp);
 
-	GHT_FOREACH(cg_player_snapshot_t* pss, old_player_states, 
+	while (1)
 	{
-		cg_player_snapshot_t* new_pss = ght_get(new_player_states, pss->player_id);
-		if (new_pss == NULL)
+		for (u32 slot = 0; slot < sbsm->player_slots; slot++)
 		{
-			cg_player_snapshot_t* pss_copy = malloc(sizeof(cg_player_snapshot_t));
-			memcpy(pss_copy, pss, sizeof(cg_player_snapshot_t));
-			ght_insert(new_player_states, pss_copy->player_id, pss_copy);
+			const cg_player_snapshot_t* pss = gss->players + slot;
+			const u32 idx = cg_registry_index(&cg->players, pss->player_id);
+			if (pss->player_id == 0 || idx == CG_REGISTRY_NONE)
+				continue;
+
+			const cg_player_t* player = cg->players.dense[idx];
+			cg_sbsm_resim_box_t* box = sbsm->resim + idx;
+
+			sbsm_resim_expand(box, pss->pos.x, pss->pos.y, &player->size);
+			if (pss->seq == gss->seq)
+			{
+				sbsm_resim_expand(box, pss->pos.x - pss->velocity.x, 
+								  pss->pos.y - pss->velocity.y, &player->size);
+			}
+			if (pss->dirty)
+				sbsm_resim_add(sbsm, idx, queue_len);
 		}
-	});
+
+		for (u32 slot = 0; slot < sbsm->bullet_slots; slot++)
+		{
+			const cg_bullet_snapshot_t* bss = gss->bullets + slot;
+			const u32 idx = cg_registry_index(&cg->bullets, bss->bullet_id);
+			if (bss->bullet_id == 0 || idx == CG_REGISTRY_NONE)
+				continue;
+
+			const cg_bullet_t* bullet = cg->bullets.dense[idx];
+			sbsm_resim_expand(sbsm->resim + n_players + idx, bss->pos.x, bss->pos.y, &bullet->r.size);
+		}
+
+		if (gss == sbsm->present)
+			break;
+
+		index++;
+		if (index >= sbsm->size)
+			index = 0;
+		gss = sbsm->snapshots + index;
+	}
 }
 
-static inline void
-sbsm_do_bullet_backfilling(coregame_t* cg, ght_t* new_bullet_states, cg_bullet_snapshot_t* old_bss)
+/**
+ *	Finds the interaction set for a rollback to `gss`: every player with a
+ *	late input, plus every player or bullet whose swept bounds over the window
+ *	touch a member's, transitively. A member player may now end up anywhere
+ *	it can reach within the window, so its bounds grow by that before testing,
+ *	against the boxes in the buckets those bounds cover.
+ *	Only members get restored and resimulated.
+ */
+static void
+sbsm_resim_collect(coregame_t* cg, cg_game_snapshot_t* gss)
 {
-	if (old_bss->collided)
+	cg_sbsm_t* sbsm = cg->sbsm;
+	const u32 n_players = cg->players.count;
+	const u32 n = n_players + cg->bullets.count;
+	const f32 reach = PLAYER_SPEED * (sbsm->present->timestamp - gss->timestamp + sbsm->interval_ms) / 1000.0;
+	const u32 bw = (cg->map->w + SBSM_RESIM_BUCKET_CELLS - 1) / SBSM_RESIM_BUCKET_CELLS;
+	const u32 bh = (cg->map->h + SBSM_RESIM_BUCKET_CELLS - 1) / SBSM_RESIM_BUCKET_CELLS;
+	u32 range[4];
+	u32 queue_len = 0;
+	u32 members = 0;
+
+	if (n > sbsm->resim_size)
 	{
-		/**
-		 *	Do bullet deallaction here.
-		 *	Only if bullet has collided.
-		 */
-		cg_bullet_t* bullet = ght_get(&cg->bullets, old_bss->bullet_id);
-		if (bullet)
-			coregame_free_bullet(cg, bullet);
-		return;
+		sbsm->resim_size = n * 2;
+		sbsm->resim = realloc(sbsm->resim, sizeof(cg_sbsm_resim_box_t) * sbsm->resim_size);
+		sbsm->resim_queue = realloc(sbsm->resim_queue, sizeof(u32) * sbsm->resim_size);
+	}
+
+	for (u32 i = 0; i < n_players; i++)
+	{
+		const cg_player_t* player = cg->players.dense[i];
+		cg_sbsm_resim_box_t* box = sbsm->resim + i;
+
+		box->min = box->max = CG_PLAYER_POS(player);
+		box->member = false;
+		sbsm_resim_expand(box, CG_PLAYER_POS(player).x, CG_PLAYER_POS(player).y, &player->size);
+	}
+	for (u32 i = 0; i < cg->bullets.count; i++)
+	{
+		const cg_bullet_t* bullet = cg->bullets.dense[i];
+		cg_sbsm_resim_box_t* box = sbsm->resim + n_players + i;
+
+		box->min = box->max = bullet->r.pos;
+		box->member = false;
+		sbsm_resim_expand(box, bullet->r.pos.x, bullet->r.pos.y, &bullet->r.size);
 	}
 
-	cg_bullet_snapshot_t* new_bss = ght_get(new_bullet_states, old_bss->bullet_id);
-	if (new_bss == NULL)
+	sbsm_resim_sweep_window(cg, gss, &queue_len);
+	sbsm_resim_bucket(cg, n, bw, bh);
+
+	while (queue_len)
+	{
+		cg_sbsm_resim_box_t* box = sbsm->resim + sbsm->resim_queue[--queue_len];
+
+		if (box < sbsm->resim + n_players)
+		{
+			box->min.x -= reach;
+			box->min.y -= reach;
+			box->max.x += reach;
+			box->max.y += reach;
+		}
+
+		sbsm_resim_bucket_range(cg->map, box, bw, bh, range);
+		for (u32 y = range[1]; y <= range[3]; y++)
+		{
+			for (u32 x = range[0]; x <= range[2]; x++)
+			{
+				const u32 b = y * bw + x;
+				for (u32 j = sbsm->resim_buckets[b]; j < sbsm->resim_buckets[b + 1]; j++)
+				{
+					const u32 i = sbsm->resim_items[j];
+					if (sbsm->resim[i].member == false && sbsm_resim_overlap(box, sbsm->resim + i))
+						sbsm_resim_add(sbsm, i, &queue_len);
+				}
+			}
+		}
+	}
+
+	for (u32 i = 0; i < n_players; i++)
+	{
+		((cg_player_t*)cg->players.dense[i])->resim = sbsm->resim[i].member;
+		members += sbsm->resim[i].member;
+	}
+	for (u32 i = 0; i < cg->bullets.count; i++)
 	{
-		cg_bullet_snapshot_t* bss_copy = malloc(sizeof(cg_bullet_snapshot_t));
-		memcpy(bss_copy, old_bss, sizeof(cg_bullet_snapshot_t));
-		ght_insert(new_bullet_states, bss_copy->bullet_id, bss_copy);
+		((cg_bullet_t*)cg->bullets.dense[i])->resim = sbsm->resim[n_players + i].member;
+		members += sbsm->resim[n_players + i].member;
 	}
+
+	sbsm->resim_all = (members == n);
+	sbsm->resim_stats.rollbacks++;
+	sbsm->resim_stats.resimulated += members;
+	sbsm->resim_stats.skipped += n - members;
 }
 
-static inline void
-sbsm_bullet_states_backfilling(coregame_t* cg, cg_game_snapshot_t* new_gss, cg_game_snapshot_t* old_gss)
+void 
+sbsm_rollback(coregame_t* cg)
 {
-	ght_t* old_bullet_states = &old_gss->bullet_states;
-	ght_t* new_bullet_states = &new_gss->bullet_states;
+	cg_sbsm_t* sbsm = cg->sbsm;
+	cg_game_snapshot_t* gss = sbsm->oldest_change;
 
-	GHT_FOREACH(cg_bullet_snapshot_t* old_bss, old_bullet_states, 
-	{
-		sbsm_do_bullet_backfilling(cg, new_bullet_states, old_bss);
-	});
+	sbsm->oldest_change = NULL;
+
+	cg->delta = sbsm->interval_ms / 1000.0;
+
+	sbsm_resim_collect(cg, gss);
+
+	sbsm_rollback_players(cg, gss);
+	sbsm_rollback_bullets(cg, gss);
+
+	sbsm_rewind(cg, gss);
 }
 
-static inline void
-sbsm_state_backfilling(coregame_t* cg, cg_game_snapshot_t* new_gss, cg_game_snapshot_t* old_gss)
+/**
+ *	Collided bullets are kept around until they fall out of the rollback 
+ *	window, since a rollback could still undo the collision.
+ */
+static void
+sbsm_free_collided_bullets(coregame_t* cg, const cg_sbsm_t* sbsm, const cg_game_snapshot_t* old_base)
 {
-	sbsm_player_states_backfilling(new_gss, old_gss);
-	sbsm_bullet_states_backfilling(cg, new_gss, old_gss);
+	cg_bullet_t* bullet;
+
+	for (u32 i = 0; i < sbsm->bullet_slots; i++)
+	{
+		const cg_bullet_snapshot_t* bss = old_base->bullets + i;
+
+		if (bss->bullet_id && bss->collided && (bullet = cg_registry_get(&cg->bullets, bss->bullet_id)))
+			coregame_free_bullet(cg, bullet);
+	}
 }
 
 void
 sbsm_rotate(coregame_t* cg, cg_sbsm_t* sbsm)
 {
+	const cg_game_snapshot_t* prev = sbsm->present;
+
 	sbsm->present_idx++;
 	if (sbsm->present_idx >= sbsm->size)
 		sbsm->present_idx = 0;
@@ -343,19 +647,25 @@ sbsm_rotate(coregame_t* cg, cg_sbsm_t* sbsm)
 
 	if (sbsm->present == sbsm->base)
 	{
-		cg_game_snapshot_t* current_base_ss = sbsm->base;
 		sbsm->base_idx++;
 		if (sbsm->base_idx >= sbsm->size)
 			sbsm->base_idx = 0;
 		sbsm->base = sbsm->snapshots + sbsm->base_idx;
 
-		sbsm_state_backfilling(cg, sbsm->base, current_base_ss);
+		/* The new base already has everything the old one had, copied forward. */
+		if (cg)
+			sbsm_free_collided_bullets(cg, sbsm, sbsm->present);
+	}
+
+	if (sbsm->present != prev)
+	{
+		memcpy(sbsm->present->players, prev->players, sizeof(cg_player_snapshot_t) * sbsm->player_slots);
+		memcpy(sbsm->present->bullets, prev->bullets, sizeof(cg_bullet_snapshot_t) * sbsm->bullet_slots);
 	}
 
 	sbsm->time += sbsm->interval_ms;
 	sbsm->present->timestamp = sbsm->time;
 	sbsm->present->seq = sbsm->seq++;
-	ght_clear(&sbsm->present->player_states);
 }
 
 void
@@ -380,9 +690,12 @@ sbsm_print(const cg_sbsm_t* sbsm)
 			ss->dirty = false;
 		}
 		printf("\ttime: %f\n", ss->timestamp);
-		ght_t* player_states = &ss->player_states;
-		
-		GHT_FOREACH(cg_player_snapshot_t* pss, player_states, {
+		for (u32 slot = 0; slot < sbsm->player_slots; slot++)
+		{
+			const cg_player_snapshot_t* pss = ss->players + slot;
+			if (pss->player_id == 0)
+				continue;
+
 			printf("\tp%u: pos: (%f/%f), input: ",
 				pss->player_id, pss->pos.x, pss->pos.y);
 
@@ -395,7 +708,7 @@ sbsm_print(const cg_sbsm_t* sbsm)
 			if (pss->input & PLAYER_INPUT_DOWN)
 				printf("DOWN ");
 			printf("(%u)\n", pss->input);
-		});
+		}
 		printf("\n");
 
 		index++;
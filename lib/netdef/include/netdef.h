@@ -5,9 +5,13 @@
 #include "ssp.h"
 #include "ssp_tcp.h"
 #include "nano_timer.h"
+#include <stdio.h>
 
 #define DEFAULT_PORT 49420
 #define CHAT_MSG_MAX 128
+#define NET_SNAPSHOT_FRAMES 32
+#define NET_SNAPSHOT_NONE UINT32_MAX
+#define NET_CODEC_MAX_STRUCT 64
 
 enum segtypes
 {
@@ -23,6 +27,8 @@ enum segtypes
 	NET_TCP_GUN_SPEC,
 	NET_TCP_BOT_MODE,
 	NET_TCP_USERNAME_CHANGE,
+	NET_TCP_CG_MAP_INFO,
+	NET_TCP_CG_MAP_REQUEST,
 
 	NET_UDP_PLAYER_MOVE,
 	NET_UDP_PLAYER_CURSOR,
@@ -36,6 +42,11 @@ enum segtypes
 	NET_UDP_PLAYER_GUN_STATE,
 	NET_UDP_MOVE_BOT,
 	NET_UDP_BULLET,
+	NET_UDP_SNAPSHOT,
+	NET_UDP_SNAPSHOT_ACK,
+	NET_UDP_PLAYER_VIEW,
+	NET_UDP_PLAYER_ENTER,
+	NET_UDP_PLAYER_LEAVE,
 
 	NET_UDP_PING,
 	NET_UDP_PONG,
@@ -104,6 +115,18 @@ typedef struct
 	char msg[CHAT_MSG_MAX];
 } net_tcp_chat_msg_t;
 
+/* Sent on connect instead of the map, the client answers with net_tcp_cg_map_request_t. */
+typedef struct 
+{
+	u64 hash;	// cg_map_hash() of the disk map
+	u32 size;
+} net_tcp_cg_map_info_t;
+
+typedef struct 
+{
+	bool want_map;	// Not in the client's map cache, send NET_TCP_CG_MAP first
+} net_tcp_cg_map_request_t;
+
 typedef struct 
 {
 	u32		player_id;
@@ -183,6 +206,29 @@ typedef struct
 	u8		gun_id;
 } net_udp_bullet_t;
 
+/* World units the client can see, the server sizes its area of interest by it. */
+typedef struct 
+{
+	vec2f_t size;
+} net_udp_player_view_t;
+
+/* A player came into the area of interest, with everything needed to show it. */
+typedef struct 
+{
+	u32		player_id;
+	vec2f_t pos;
+	vec2f_t cursor;
+	f32		health;
+	u8		input;
+	u8		gun_id;
+	i32		ammo;
+} net_udp_player_enter_t;
+
+typedef struct 
+{
+	u32 player_id;
+} net_udp_player_leave_t;
+
 typedef struct 
 {
 	u32 id;
@@ -197,12 +243,124 @@ typedef struct
 	bool shoot;
 } net_tcp_new_player_t;
 
+/* Replicated state of one player, what snapshot deltas are taken of. */
+typedef struct
+{
+	u32		player_id;	// 0 if the slot is empty
+	vec2f_t pos;
+	u8		input;
+	f32		health;
+	vec2f_t cursor;
+	u32		gun_id;
+	i32		ammo;
+	f32		bullet_timer;
+	f32		charge_timer;
+	f32		reload_timer;
+} net_player_state_t;
+
+/* Field groups of a player delta, written in this order after the mask. */
+enum net_delta_fields
+{
+	NET_DELTA_POS		= 1 << 0,
+	NET_DELTA_INPUT		= 1 << 1,
+	NET_DELTA_HEALTH	= 1 << 2,
+	NET_DELTA_CURSOR	= 1 << 3,
+	NET_DELTA_GUN		= 1 << 4,
+	NET_DELTA_ALL		= 0x1F,
+	NET_DELTA_REMOVED	= 1 << 7,
+};
+
+#define NET_DELTA_MAX_SIZE (sizeof(u32) + sizeof(u8) + sizeof(vec2f_t) + sizeof(u8) + \
+							sizeof(f32) + sizeof(vec2f_t) + sizeof(u32) + sizeof(i32) + sizeof(f32) * 3)
+
+/**
+ *	Budget for one snapshot segment, header included. Leaves room under a
+ *	1280 byte path MTU for the ssp packet header and the tick's other
+ *	segments, so a snapshot never goes out as a fragmented datagram.
+ */
+#define NET_SNAPSHOT_MAX_SIZE 1024
+
+/**
+ *	`data` holds `count` player deltas: u32 player_id, u8 fields, then
+ *	the fields present. Fields not present equal the `baseline` snapshot,
+ *	which the receiver has acked. NET_SNAPSHOT_NONE means against nothing.
+ */
+typedef struct
+{
+	u32 seq;
+	u32 baseline;
+	u16 slots;
+	u16 count;
+	u8	data[];
+} _SSP_PACKED net_udp_snapshot_t;
+
+typedef struct
+{
+	u32 seq;
+} net_udp_snapshot_ack_t;
+
+/**
+ *	The last NET_SNAPSHOT_FRAMES snapshots sent (server, per client) or
+ *	received (client), each a flat array indexed by player handle slot.
+ */
+typedef struct
+{
+	u32					seq[NET_SNAPSHOT_FRAMES];
+	net_player_state_t*	states;
+	u32					slots;
+} net_snapshot_ring_t;
+
+#define NET_SHARED_BLOCK_MAX 1024
+
+/**
+ *	Unreliable segments every client gets the same, serialized once per
+ *	tick and sent outside of ssp: a per-client net_shared_header_t followed
+ *	by the block, as `count` of {u8 type, u16 size, packed data}.
+ */
+typedef struct
+{
+	u32 magic;
+	u32 session_id;
+	u32 tick;
+} _SSP_PACKED net_shared_header_t;
+
+typedef struct
+{
+	u8	type;
+	u16 size;
+} _SSP_PACKED net_shared_segment_t;
+
+typedef struct
+{
+	u8	buf[NET_SHARED_BLOCK_MAX];
+	u32 size;
+	u32 count;
+} net_shared_block_t;
+
+/**
+ *	What packing schema'd segments depends on: the map extents positions
+ *	are quantized against and the frame memory packed segments live in.
+ *	One per room on the server, one on the client.
+ */
+typedef struct
+{
+	vec2f_t		world;
+	mmframes_t*	mmf;
+} net_codec_t;
+
+/* Codec to unpack a segment from `source_data` with, NULL drops it. */
+typedef const net_codec_t* (*netdef_codec_func_t)(void* user_data, void* source_data);
+
 typedef struct 
 {
 	coregame_t* coregame;
 	ssp_io_ctx_t ssp_ctx;
+	ssp_segment_callback_t callbacks[NET_SEGTYPES_LEN];
+	netdef_codec_func_t codec_of;
+	u32 shared_magic;
 } netdef_t;
 
+/* `ipaddr` and `port` are only filled in when needed, empty `ipaddr` means not yet. */
 typedef struct 
 {
 	struct sockaddr_in addr;
@@ -227,6 +385,13 @@ typedef struct
 	i64 tick_time_avg;
 	i64 tick_time_highest;
 
+	struct {
+		i64 p50;
+		i64 p99;
+		i64 p999;
+		i64 max;
+	} tick_lateness;	// Tick start past its deadline, last second
+
 	struct {
 		u32 dropped;
 		u32 lost;
@@ -238,8 +403,27 @@ typedef struct
 		u32 total_packets;
 	} tx;
 
+	struct {
+		u32 in_use;
+		u32 highest;
+		u32 capacity;
+	} bullet_pool;
+
+	struct {
+		u32 syscalls;	// recvmmsg() calls that returned packets
+		u32 allocs;		// Receive buffers allocated
+	} udp_rx;
+
+	struct {
+		u64 rollbacks;
+		u64 resimulated;	// Entities resimulated by rollbacks
+		u64 skipped;		// Entities outside the interaction set
+	} rollback;
+
 	u32 tcp_connections;
-	u32 players;
+	u32 players;	// In the client's room
+	u32 room_id;
+	u32 rooms;
 } server_stats_t, udp_server_stats_t;
 
 void netdef_init(netdef_t* netdef, coregame_t* coregame, 
@@ -247,5 +431,38 @@ void netdef_init(netdef_t* netdef, coregame_t* coregame,
 void netdef_destroy(netdef_t* netdef);
 const char* netdef_segtypes_str(enum segtypes type);
 
+/**
+ *	Codec - Schema'd segments are bit-packed on the wire. Push them with
+ *	netdef_push_ref*() instead of ssp_io_push_ref*(), callbacks registered
+ *	through netdef_init() get them unpacked with netdef_t.codec_of's codec.
+ */
+void netdef_codec_init(void);
+void netdef_codec_register(netdef_t* netdef, u8 type, ssp_segment_callback_t callback);
+void netdef_codec_report(FILE* f, const net_codec_t* codec);
+void net_codec_init(net_codec_t* codec, mmframes_t* mmf);
+void net_codec_set_world(net_codec_t* codec, const cg_runtime_map_t* map);
+u16	 netdef_packed_size(u8 type, u16 size);
+void netdef_encode(const net_codec_t* codec, u8 type, void* dst, const void* src);
+void netdef_write(const net_codec_t* codec, u8 type, void* dst, u16 size, const void* src);
+bool netdef_decode(const net_codec_t* codec, u8 type, void* dst, const void* src, u16 size);
+void netdef_push_ref(const net_codec_t* codec, ssp_io_t* io, u8 type, u16 size, const void* data);
+void netdef_push_ref_i(const net_codec_t* codec, ssp_io_t* io, u8 type, u16 size, const void* data);
+
+void net_snapshot_ring_reserve(net_snapshot_ring_t* ring, u32 slots);
+void net_snapshot_ring_destroy(net_snapshot_ring_t* ring);
+net_player_state_t* net_snapshot_ring_get(const net_snapshot_ring_t* ring, u32 seq);
+net_player_state_t* net_snapshot_ring_put(net_snapshot_ring_t* ring, u32 seq);
+u8	net_player_state_diff(const net_player_state_t* a, const net_player_state_t* b);
+u32 net_snapshot_write(net_udp_snapshot_t* out, const net_player_state_t* base, 
+					   net_player_state_t* cur, u32 slots, u32* first);
+bool net_snapshot_read(const net_udp_snapshot_t* in, u32 size, const net_player_state_t* base, 
+					   net_player_state_t* out, u32 slots);
+
+bool netdef_shared_push(net_shared_block_t* block, const net_codec_t* codec, u8 type, u16 size, const void* data);
+void netdef_shared_clear(net_shared_block_t* block);
+void netdef_shared_header(const netdef_t* netdef, net_shared_header_t* header, u32 session_id, u32 tick);
+bool netdef_shared_process(const netdef_t* netdef, const void* buf, u32 size, 
+						   u32 session_id, u32* last_tick, void* source_data);
+
 #endif // _NETDEF_H_
 
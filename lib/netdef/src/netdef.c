@@ -1,5 +1,9 @@
 #include "netdef.h"
 #include <stdio.h>
+#include <string.h>
+
+/* Keeps shared block datagrams apart from ssp packets of the same version. */
+#define NET_SHARED_MAGIC_XOR 0x53484B42
 
 void 
 tcp_debug_msg(const ssp_segment_t* segment, UNUSED void* user_data, UNUSED void* source_data)
@@ -16,6 +20,8 @@ netdef_init(netdef_t* netdef, coregame_t* coregame,
 	netdef->coregame = coregame;
 	const u32 magic = ssp_checksum32(VERSION, sizeof(VERSION)); 
 	ssp_io_ctx_init(&netdef->ssp_ctx, magic, 0);
+	netdef->shared_magic = magic ^ NET_SHARED_MAGIC_XOR;
+	netdef_codec_init();
 
 	ssp_io_ctx_register_dispatch(&netdef->ssp_ctx, NET_DEBUG_MSG, tcp_debug_msg);
 
@@ -25,7 +31,7 @@ netdef_init(netdef_t* netdef, coregame_t* coregame,
 		{
 			const ssp_segment_callback_t* callback = callbacks_override + i;
 			if (*callback != NULL)
-				ssp_io_ctx_register_dispatch(&netdef->ssp_ctx, i, *callback);
+				netdef_codec_register(netdef, i, *callback);
 		}
 	}
 }
@@ -60,6 +66,10 @@ netdef_segtypes_str(enum segtypes type)
 			return "NET_TCP_CHAT_MSG";
 		case NET_TCP_GUN_SPEC:
 			return "NET_TCP_GUN_SPEC";
+		case NET_TCP_CG_MAP_INFO:
+			return "NET_TCP_CG_MAP_INFO";
+		case NET_TCP_CG_MAP_REQUEST:
+			return "NET_TCP_CG_MAP_REQUEST";
 		case NET_UDP_PLAYER_MOVE:
 			return "NET_UDP_PLAYER_MOVE";
 		case NET_UDP_PLAYER_CURSOR:
@@ -76,6 +86,16 @@ netdef_segtypes_str(enum segtypes type)
 			return "NET_UDP_PLAYER_GUN_ID";
 		case NET_UDP_PLAYER_INPUT:
 			return "NET_UDP_PLAYER_INPUT";
+		case NET_UDP_SNAPSHOT:
+			return "NET_UDP_SNAPSHOT";
+		case NET_UDP_SNAPSHOT_ACK:
+			return "NET_UDP_SNAPSHOT_ACK";
+		case NET_UDP_PLAYER_VIEW:
+			return "NET_UDP_PLAYER_VIEW";
+		case NET_UDP_PLAYER_ENTER:
+			return "NET_UDP_PLAYER_ENTER";
+		case NET_UDP_PLAYER_LEAVE:
+			return "NET_UDP_PLAYER_LEAVE";
 		case NET_UDP_PING:
 			return "NET_UDP_PING";
 		case NET_UDP_PONG:
@@ -90,3 +110,216 @@ netdef_segtypes_str(enum segtypes type)
 			return "Unknown";
 	}
 }
+
+/**
+ *	Grows every frame to `slots` entries. Frames keep their contents, so a
+ *	new player joining never invalidates a baseline.
+ */
+void
+net_snapshot_ring_reserve(net_snapshot_ring_t* ring, u32 slots)
+{
+	net_player_state_t* states;
+
+	if (ring->states == NULL)
+	{
+		for (u32 i = 0; i < NET_SNAPSHOT_FRAMES; i++)
+			ring->seq[i] = NET_SNAPSHOT_NONE;
+	}
+	else if (slots <= ring->slots)
+		return;
+
+	states = calloc((u64)NET_SNAPSHOT_FRAMES * slots, sizeof(net_player_state_t));
+	for (u32 i = 0; i < NET_SNAPSHOT_FRAMES && ring->states; i++)
+	{
+		memcpy(states + (u64)i * slots, ring->states + (u64)i * ring->slots, 
+			   sizeof(net_player_state_t) * ring->slots);
+	}
+
+	free(ring->states);
+	ring->states = states;
+	ring->slots = slots;
+}
+
+void
+net_snapshot_ring_destroy(net_snapshot_ring_t* ring)
+{
+	free(ring->states);
+	ring->states = NULL;
+	ring->slots = 0;
+}
+
+net_player_state_t*
+net_snapshot_ring_get(const net_snapshot_ring_t* ring, u32 seq)
+{
+	const u32 idx = seq % NET_SNAPSHOT_FRAMES;
+
+	if (seq == NET_SNAPSHOT_NONE || ring->states == NULL || ring->seq[idx] != seq)
+		return NULL;
+	return ring->states + (u64)idx * ring->slots;
+}
+
+net_player_state_t*
+net_snapshot_ring_put(net_snapshot_ring_t* ring, u32 seq)
+{
+	const u32 idx = seq % NET_SNAPSHOT_FRAMES;
+
+	ring->seq[idx] = seq;
+	return ring->states + (u64)idx * ring->slots;
+}
+
+u8
+net_player_state_diff(const net_player_state_t* a, const net_player_state_t* b)
+{
+	u8 fields = 0;
+
+	if (a->player_id != b->player_id)
+		return (b->player_id) ? NET_DELTA_ALL : NET_DELTA_REMOVED;
+
+	if (a->pos.x != b->pos.x || a->pos.y != b->pos.y)
+		fields |= NET_DELTA_POS;
+	if (a->input != b->input)
+		fields |= NET_DELTA_INPUT;
+	if (a->health != b->health)
+		fields |= NET_DELTA_HEALTH;
+	if (a->cursor.x != b->cursor.x || a->cursor.y != b->cursor.y)
+		fields |= NET_DELTA_CURSOR;
+	if (a->gun_id != b->gun_id || a->ammo != b->ammo || a->bullet_timer != b->bullet_timer ||
+		a->charge_timer != b->charge_timer || a->reload_timer != b->reload_timer)
+		fields |= NET_DELTA_GUN;
+
+	return fields;
+}
+
+#define NET_DELTA_PUT(dst, val) do { memcpy(dst, &(val), sizeof(val)); dst += sizeof(val); } while (0)
+#define NET_DELTA_GET(src, end, val) do { \
+		if (src + sizeof(val) > end) return false; \
+		memcpy(&(val), src, sizeof(val)); src += sizeof(val); \
+	} while (0)
+
+/**
+ *	Writes the deltas from `base` (NULL for empty) to `cur` into `out`,
+ *	starting at slot `*first` and wrapping around. `out` must have room for
+ *	NET_SNAPSHOT_MAX_SIZE bytes. Deltas past the budget are left for a later
+ *	snapshot: their slot in `cur` is set back to `base`, so `cur` ends up as
+ *	what the receiver will rebuild, and `*first` is set to the first of them
+ *	so the next snapshot starts there. Returns the segment size.
+ */
+u32
+net_snapshot_write(net_udp_snapshot_t* out, const net_player_state_t* base, 
+				   net_player_state_t* cur, u32 slots, u32* first)
+{
+	const net_player_state_t empty = {0};
+	const u8* end = (const u8*)out + NET_SNAPSHOT_MAX_SIZE;
+	const u32 start = (*first < slots) ? *first : 0;
+	bool deferred = false;
+	u8* dst = out->data;
+
+	out->slots = slots;
+	out->count = 0;
+	*first = start;
+
+	for (u32 n = 0; n < slots; n++)
+	{
+		const u32 i = (start + n) % slots;
+		const net_player_state_t* from = (base) ? base + i : &empty;
+		net_player_state_t* to = cur + i;
+		const u8 fields = net_player_state_diff(from, to);
+
+		if (fields == 0)
+			continue;
+
+		if (deferred || dst + NET_DELTA_MAX_SIZE > end)
+		{
+			if (!deferred)
+				*first = i;
+			deferred = true;
+			*to = *from;
+			continue;
+		}
+
+		if (fields & NET_DELTA_REMOVED)
+			NET_DELTA_PUT(dst, from->player_id);
+		else
+			NET_DELTA_PUT(dst, to->player_id);
+		NET_DELTA_PUT(dst, fields);
+
+		if (fields & NET_DELTA_POS)
+			NET_DELTA_PUT(dst, to->pos);
+		if (fields & NET_DELTA_INPUT)
+			NET_DELTA_PUT(dst, to->input);
+		if (fields & NET_DELTA_HEALTH)
+			NET_DELTA_PUT(dst, to->health);
+		if (fields & NET_DELTA_CURSOR)
+			NET_DELTA_PUT(dst, to->cursor);
+		if (fields & NET_DELTA_GUN)
+		{
+			NET_DELTA_PUT(dst, to->gun_id);
+			NET_DELTA_PUT(dst, to->ammo);
+			NET_DELTA_PUT(dst, to->bullet_timer);
+			NET_DELTA_PUT(dst, to->charge_timer);
+			NET_DELTA_PUT(dst, to->reload_timer);
+		}
+		out->count++;
+	}
+
+	return dst - (u8*)out;
+}
+
+/**
+ *	Rebuilds the full snapshot in `out` from `base` (NULL for empty) and the
+ *	deltas in `in`. False if the segment is malformed.
+ */
+bool
+net_snapshot_read(const net_udp_snapshot_t* in, u32 size, const net_player_state_t* base, 
+				  net_player_state_t* out, u32 slots)
+{
+	const u8* src = in->data;
+	const u8* end = (const u8*)in + size;
+
+	if (size < sizeof(net_udp_snapshot_t))
+		return false;
+
+	if (base)
+		memmove(out, base, sizeof(net_player_state_t) * slots);
+	else
+		memset(out, 0, sizeof(net_player_state_t) * slots);
+
+	for (u32 i = 0; i < in->count; i++)
+	{
+		net_player_state_t* state;
+		u32 player_id;
+		u8 fields;
+
+		NET_DELTA_GET(src, end, player_id);
+		NET_DELTA_GET(src, end, fields);
+
+		if (player_id == 0 || CG_HANDLE_SLOT(player_id) >= slots)
+			return false;
+		state = out + CG_HANDLE_SLOT(player_id);
+
+		if (fields & NET_DELTA_REMOVED)
+		{
+			memset(state, 0, sizeof(net_player_state_t));
+			continue;
+		}
+		state->player_id = player_id;
+
+		if (fields & NET_DELTA_POS)
+			NET_DELTA_GET(src, end, state->pos);
+		if (fields & NET_DELTA_INPUT)
+			NET_DELTA_GET(src, end, state->input);
+		if (fields & NET_DELTA_HEALTH)
+			NET_DELTA_GET(src, end, state->health);
+		if (fields & NET_DELTA_CURSOR)
+			NET_DELTA_GET(src, end, state->cursor);
+		if (fields & NET_DELTA_GUN)
+		{
+			NET_DELTA_GET(src, end, state->gun_id);
+			NET_DELTA_GET(src, end, state->ammo);
+			NET_DELTA_GET(src, end, state->bullet_timer);
+			NET_DELTA_GET(src, end, state->charge_timer);
+			NET_DELTA_GET(src, end, state->reload_timer);
+		}
+	}
+	return true;
+}
@@ -0,0 +1,533 @@
+#include "netdef.h"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+
+/**
+ *	Codec - Bit-packed wire format for the fixed size UDP segments.
+ *
+ *	Each schema'd segment type lists its struct fields with how to quantize
+ *	them. Pushes pack the struct into the codec's frame memory, dispatch
+ *	unpacks it back into the struct before the segment callback sees it,
+ *	so handlers keep working on plain C structs. Positions are relative to
+ *	the map, so every room (or client) packs through its own net_codec_t.
+ */
+
+/* Positions range over [-world, 2 * world] so cursors past the map edge survive. */
+#define NET_POS_BITS	22
+#define NET_ANGLE_BITS	16
+#define NET_TIMER_BITS	20
+#define NET_TIMER_MIN	-50.0
+#define NET_TIMER_SCALE 10000.0	// 0.1 ms steps
+
+enum net_field_kind
+{
+	NET_FIELD_UINT,
+	NET_FIELD_INT,
+	NET_FIELD_BOOL,
+	NET_FIELD_FIXED,	// (v - min) * scale as an unsigned int
+	NET_FIELD_POS,		// vec2f_t relative to the map size
+	NET_FIELD_ANGLE,	// Unit vec2f_t as an angle
+};
+
+typedef struct
+{
+	const char* name;
+	u16 offset;
+	u8	size;
+	u8	kind;
+	u8	bits;
+	f64 min;
+	f64 scale;
+} net_field_t;
+
+typedef struct
+{
+	const char*			name;
+	const net_field_t*	fields;
+	u32					count;
+	u16					struct_size;
+	u16					packed_size;
+} net_schema_t;
+
+#define NET_FIELD(T, f, k, b, m, s) \
+	{ #f, offsetof(T, f), sizeof(((T*)0)->f), k, b, m, s }
+#define NET_UINT(T, f, b)	NET_FIELD(T, f, NET_FIELD_UINT, b, 0, 0)
+#define NET_INT(T, f, b)	NET_FIELD(T, f, NET_FIELD_INT, b, 0, 0)
+#define NET_BOOL(T, f)		NET_FIELD(T, f, NET_FIELD_BOOL, 1, 0, 0)
+#define NET_FIXED(T, f, b, m, s) NET_FIELD(T, f, NET_FIELD_FIXED, b, m, s)
+#define NET_POS(T, f)		NET_FIELD(T, f, NET_FIELD_POS, NET_POS_BITS * 2, 0, 0)
+#define NET_ANGLE(T, f)		NET_FIELD(T, f, NET_FIELD_ANGLE, NET_ANGLE_BITS, 0, 0)
+#define NET_TIMER(T, f)		NET_FIXED(T, f, NET_TIMER_BITS, NET_TIMER_MIN, NET_TIMER_SCALE)
+
+static const net_field_t net_player_move_fields[] = {
+	NET_UINT(net_udp_player_move_t, player_id, 32),
+	NET_POS(net_udp_player_move_t, pos),
+	NET_UINT(net_udp_player_move_t, input, 5),
+	NET_BOOL(net_udp_player_move_t, absolute),
+};
+
+static const net_field_t net_player_cursor_fields[] = {
+	NET_POS(net_udp_player_cursor_t, cursor_pos),
+	NET_UINT(net_udp_player_cursor_t, player_id, 32),
+};
+
+static const net_field_t net_player_health_fields[] = {
+	NET_UINT(net_udp_player_health_t, player_id, 32),
+	NET_INT(net_udp_player_health_t, health, 16),
+};
+
+static const net_field_t net_player_stats_fields[] = {
+	NET_UINT(net_udp_player_stats_t, player_id, 32),
+	NET_UINT(net_udp_player_stats_t, kills, 16),
+	NET_UINT(net_udp_player_stats_t, deaths, 16),
+};
+
+static const net_field_t net_player_died_fields[] = {
+	NET_UINT(net_udp_player_died_t, target_player_id, 32),
+	NET_UINT(net_udp_player_died_t, attacker_player_id, 32),
+};
+
+static const net_field_t net_player_ping_fields[] = {
+	NET_UINT(net_udp_player_ping_t, player_id, 32),
+	NET_FIXED(net_udp_player_ping_t, ms, 16, 0, 8),	// 0.125 ms steps, up to 8 s
+};
+
+static const net_field_t net_player_gun_id_fields[] = {
+	NET_UINT(net_udp_player_gun_id_t, gun_id, 8),
+	NET_UINT(net_udp_player_gun_id_t, player_id, 32),
+};
+
+static const net_field_t net_player_input_fields[] = {
+	NET_UINT(net_udp_player_input_t, flags, 5),
+	NET_FIXED(net_udp_player_input_t, timestamp, 48, 0, 16),	// 1/16 ms steps, 557 years
+	NET_UINT(net_udp_player_input_t, player_id, 32),
+};
+
+static const net_field_t net_player_gun_state_fields[] = {
+	NET_UINT(net_udp_player_gun_state_t, player_id, 32),
+	NET_UINT(net_udp_player_gun_state_t, gun_id, 8),
+	NET_INT(net_udp_player_gun_state_t, ammo, 16),
+	NET_TIMER(net_udp_player_gun_state_t, bullet_timer),
+	NET_TIMER(net_udp_player_gun_state_t, charge_timer),
+	NET_TIMER(net_udp_player_gun_state_t, reload_timer),
+};
+
+static const net_field_t net_move_bot_fields[] = {
+	NET_POS(net_udp_move_bot_t, pos),
+};
+
+static const net_field_t net_bullet_fields[] = {
+	NET_UINT(net_udp_bullet_t, owner_id, 32),
+	NET_POS(net_udp_bullet_t, pos),
+	NET_ANGLE(net_udp_bullet_t, dir),
+	NET_UINT(net_udp_bullet_t, gun_id, 8),
+};
+
+static const net_field_t net_player_enter_fields[] = {
+	NET_UINT(net_udp_player_enter_t, player_id, 32),
+	NET_POS(net_udp_player_enter_t, pos),
+	NET_POS(net_udp_player_enter_t, cursor),
+	NET_FIXED(net_udp_player_enter_t, health, 16, 0, 64),	// 1/64 steps, up to 1024
+	NET_UINT(net_udp_player_enter_t, input, 5),
+	NET_UINT(net_udp_player_enter_t, gun_id, 8),
+	NET_INT(net_udp_player_enter_t, ammo, 16),
+};
+
+static const net_field_t net_player_leave_fields[] = {
+	NET_UINT(net_udp_player_leave_t, player_id, 32),
+};
+
+#define NET_SCHEMAS(X) \
+	X(NET_UDP_PLAYER_MOVE, net_udp_player_move_t, net_player_move_fields) \
+	X(NET_UDP_PLAYER_CURSOR, net_udp_player_cursor_t, net_player_cursor_fields) \
+	X(NET_UDP_PLAYER_HEALTH, net_udp_player_health_t, net_player_health_fields) \
+	X(NET_UDP_PLAYER_STATS, net_udp_player_stats_t, net_player_stats_fields) \
+	X(NET_UDP_PLAYER_DIED, net_udp_player_died_t, net_player_died_fields) \
+	X(NET_UDP_PLAYER_PING, net_udp_player_ping_t, net_player_ping_fields) \
+	X(NET_UDP_PLAYER_GUN_ID, net_udp_player_gun_id_t, net_player_gun_id_fields) \
+	X(NET_UDP_PLAYER_INPUT, net_udp_player_input_t, net_player_input_fields) \
+	X(NET_UDP_PLAYER_GUN_STATE, net_udp_player_gun_state_t, net_player_gun_state_fields) \
+	X(NET_UDP_MOVE_BOT, net_udp_move_bot_t, net_move_bot_fields) \
+	X(NET_UDP_BULLET, net_udp_bullet_t, net_bullet_fields) \
+	X(NET_UDP_PLAYER_ENTER, net_udp_player_enter_t, net_player_enter_fields) \
+	X(NET_UDP_PLAYER_LEAVE, net_udp_player_leave_t, net_player_leave_fields)
+
+#define NET_SCHEMA_ENTRY(type, T, f) \
+	[type] = { #type, f, sizeof(f) / sizeof(*f), sizeof(T), 0 },
+static net_schema_t net_schemas[NET_SEGTYPES_LEN] = {
+	NET_SCHEMAS(NET_SCHEMA_ENTRY)
+};
+
+/* One netdef per process, the dispatch trampoline has no other way to them. */
+static const netdef_t* net_netdef;
+static ssp_segment_callback_t net_callbacks[NET_SEGTYPES_LEN];
+
+typedef struct
+{
+	u8* buf;
+	u32 bit;
+} net_bits_t;
+
+static void
+net_bits_write(net_bits_t* bits, u64 value, u32 count)
+{
+	while (count)
+	{
+		const u32 shift = bits->bit & 7;
+		const u32 n = (8 - shift < count) ? 8 - shift : count;
+
+		bits->buf[bits->bit >> 3] |= (value & ((1u << n) - 1)) << shift;
+		value >>= n;
+		count -= n;
+		bits->bit += n;
+	}
+}
+
+static u64
+net_bits_read(net_bits_t* bits, u32 count)
+{
+	u64 value = 0;
+	u32 done = 0;
+
+	while (done < count)
+	{
+		const u32 shift = bits->bit & 7;
+		const u32 n = (8 - shift < count - done) ? 8 - shift : count - done;
+
+		value |= (u64)((bits->buf[bits->bit >> 3] >> shift) & ((1u << n) - 1)) << done;
+		done += n;
+		bits->bit += n;
+	}
+	return value;
+}
+
+static inline u64
+net_bits_max(u32 count)
+{
+	return (count >= 64) ? UINT64_MAX : (1ull << count) - 1;
+}
+
+static u64
+net_quantize(f64 value, f64 min, f64 scale, u32 count)
+{
+	const f64 q = round((value - min) * scale);
+
+	if (q <= 0 || isnan(q))
+		return 0;
+	if (q >= (f64)net_bits_max(count))
+		return net_bits_max(count);
+	return q;
+}
+
+static inline f64
+net_pos_scale(f32 world)
+{
+	return net_bits_max(NET_POS_BITS) / (3.0 * world);
+}
+
+static u64
+net_field_load_int(const void* src, u8 size, bool is_signed)
+{
+	switch (size)
+	{
+		case 1:
+			return (is_signed) ? (u64)*(const i8*)src : *(const u8*)src;
+		case 2:
+			return (is_signed) ? (u64)*(const i16*)src : *(const u16*)src;
+		case 4:
+			return (is_signed) ? (u64)*(const i32*)src : *(const u32*)src;
+		default:
+			return *(const u64*)src;
+	}
+}
+
+static void
+net_field_store_int(void* dst, u8 size, u64 value)
+{
+	switch (size)
+	{
+		case 1:
+			*(u8*)dst = value;
+			break;
+		case 2:
+			*(u16*)dst = value;
+			break;
+		case 4:
+			*(u32*)dst = value;
+			break;
+		default:
+			*(u64*)dst = value;
+			break;
+	}
+}
+
+static void
+net_field_encode(const net_codec_t* codec, net_bits_t* bits, const net_field_t* field, const void* src)
+{
+	switch (field->kind)
+	{
+		case NET_FIELD_UINT:
+		case NET_FIELD_INT:
+			net_bits_write(bits, net_field_load_int(src, field->size, field->kind == NET_FIELD_INT), field->bits);
+			break;
+		case NET_FIELD_BOOL:
+			net_bits_write(bits, *(const bool*)src, 1);
+			break;
+		case NET_FIELD_FIXED:
+		{
+			const f64 value = (field->size == sizeof(f64)) ? *(const f64*)src : *(const f32*)src;
+			net_bits_write(bits, net_quantize(value, field->min, field->scale, field->bits), field->bits);
+			break;
+		}
+		case NET_FIELD_POS:
+		{
+			const vec2f_t* pos = src;
+			const vec2f_t world = codec->world;
+			net_bits_write(bits, net_quantize(pos->x, -world.x, net_pos_scale(world.x), NET_POS_BITS), NET_POS_BITS);
+			net_bits_write(bits, net_quantize(pos->y, -world.y, net_pos_scale(world.y), NET_POS_BITS), NET_POS_BITS);
+			break;
+		}
+		case NET_FIELD_ANGLE:
+		{
+			const vec2f_t* dir = src;
+			const f64 turns = atan2(dir->y, dir->x) / (2 * M_PI);
+			const u64 steps = 1ull << field->bits;
+			net_bits_write(bits, (u64)llround((turns + 1.0) * steps) % steps, field->bits);
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+static void
+net_field_decode(const net_codec_t* codec, net_bits_t* bits, const net_field_t* field, void* dst)
+{
+	switch (field->kind)
+	{
+		case NET_FIELD_UINT:
+			net_field_store_int(dst, field->size, net_bits_read(bits, field->bits));
+			break;
+		case NET_FIELD_INT:
+		{
+			const u64 sign = 1ull << (field->bits - 1);
+			const u64 value = net_bits_read(bits, field->bits);
+			net_field_store_int(dst, field->size, (value ^ sign) - sign);
+			break;
+		}
+		case NET_FIELD_BOOL:
+			*(bool*)dst = net_bits_read(bits, 1);
+			break;
+		case NET_FIELD_FIXED:
+		{
+			const f64 value = net_bits_read(bits, field->bits) / field->scale + field->min;
+			if (field->size == sizeof(f64))
+				*(f64*)dst = value;
+			else
+				*(f32*)dst = value;
+			break;
+		}
+		case NET_FIELD_POS:
+		{
+			vec2f_t* pos = dst;
+			const vec2f_t world = codec->world;
+			pos->x = net_bits_read(bits, NET_POS_BITS) / net_pos_scale(world.x) - world.x;
+			pos->y = net_bits_read(bits, NET_POS_BITS) / net_pos_scale(world.y) - world.y;
+			break;
+		}
+		case NET_FIELD_ANGLE:
+		{
+			vec2f_t* dir = dst;
+			const f64 angle = net_bits_read(bits, field->bits) * (2 * M_PI) / (1ull << field->bits);
+			dir->x = cos(angle);
+			dir->y = sin(angle);
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+static void
+netdef_dispatch_decoded(const ssp_segment_t* segment, void* user_data, void* source_data)
+{
+	const net_schema_t* schema = net_schemas + segment->type;
+	const net_codec_t* codec = (net_netdef->codec_of) ? net_netdef->codec_of(user_data, source_data) : NULL;
+	union {
+		max_align_t align;
+		u8			data[NET_CODEC_MAX_STRUCT];
+	} buf;
+	ssp_segment_t decoded = *segment;
+
+	/* No map to unpack positions against yet (not in a room), nothing to hand on. */
+	if (codec == NULL || netdef_decode(codec, segment->type, buf.data, segment->data, segment->size) == false)
+		return;
+
+	decoded.data = buf.data;
+	decoded.size = schema->struct_size;
+	net_callbacks[segment->type](&decoded, user_data, source_data);
+}
+
+void
+netdef_codec_init(void)
+{
+	for (u32 type = 0; type < NET_SEGTYPES_LEN; type++)
+	{
+		net_schema_t* schema = net_schemas + type;
+		u32 bits = 0;
+
+		for (u32 i = 0; i < schema->count; i++)
+			bits += schema->fields[i].bits;
+		schema->packed_size = (bits + 7) / 8;
+	}
+}
+
+/**
+ *	Registers `callback` for `type`. Schema'd types get the decode
+ *	trampoline in front, so `callback` still sees the plain struct.
+ */
+void
+netdef_codec_register(netdef_t* netdef, u8 type, ssp_segment_callback_t callback)
+{
+	if (net_schemas[type].fields == NULL)
+	{
+		netdef->callbacks[type] = callback;
+		ssp_io_ctx_register_dispatch(&netdef->ssp_ctx, type, callback);
+		return;
+	}
+
+	net_netdef = netdef;
+	net_callbacks[type] = callback;
+	netdef->callbacks[type] = netdef_dispatch_decoded;
+	ssp_io_ctx_register_dispatch(&netdef->ssp_ctx, type, netdef_dispatch_decoded);
+}
+
+/* `mmf` holds packed segments until the ios they're pushed to are serialized. */
+void
+net_codec_init(net_codec_t* codec, mmframes_t* mmf)
+{
+	codec->world = vec2f(1.0, 1.0);
+	codec->mmf = mmf;
+}
+
+void
+net_codec_set_world(net_codec_t* codec, const cg_runtime_map_t* map)
+{
+	codec->world.x = map->w * map->grid_size;
+	codec->world.y = map->h * map->grid_size;
+}
+
+u16
+netdef_packed_size(u8 type, u16 size)
+{
+	return (net_schemas[type].fields) ? net_schemas[type].packed_size : size;
+}
+
+void
+netdef_encode(const net_codec_t* codec, u8 type, void* dst, const void* src)
+{
+	const net_schema_t* schema = net_schemas + type;
+	net_bits_t bits = { .buf = dst };
+
+	memset(dst, 0, schema->packed_size);
+	for (u32 i = 0; i < schema->count; i++)
+	{
+		const net_field_t* field = schema->fields + i;
+		net_field_encode(codec, &bits, field, (const u8*)src + field->offset);
+	}
+}
+
+/* Writes `src` as it goes on the wire, packed when the type has a schema. */
+void
+netdef_write(const net_codec_t* codec, u8 type, void* dst, u16 size, const void* src)
+{
+	if (net_schemas[type].fields)
+		netdef_encode(codec, type, dst, src);
+	else
+		memcpy(dst, src, size);
+}
+
+bool
+netdef_decode(const net_codec_t* codec, u8 type, void* dst, const void* src, u16 size)
+{
+	const net_schema_t* schema = net_schemas + type;
+	net_bits_t bits = { .buf = (u8*)src };
+
+	if (schema->fields == NULL || size != schema->packed_size)
+		return false;
+
+	memset(dst, 0, schema->struct_size);
+	for (u32 i = 0; i < schema->count; i++)
+	{
+		const net_field_t* field = schema->fields + i;
+		net_field_decode(codec, &bits, field, (u8*)dst + field->offset);
+	}
+	return true;
+}
+
+/* Packs schema'd segments now, against `codec`'s map, instead of when the io is serialized. */
+static const void*
+netdef_pack(const net_codec_t* codec, u8 type, u16* size, const void* data)
+{
+	const net_schema_t* schema = net_schemas + type;
+	void* packed;
+
+	if (schema->fields == NULL)
+		return data;
+
+	packed = mmframes_alloc(codec->mmf, schema->packed_size);
+	netdef_encode(codec, type, packed, data);
+	*size = schema->packed_size;
+	return packed;
+}
+
+void
+netdef_push_ref(const net_codec_t* codec, ssp_io_t* io, u8 type, u16 size, const void* data)
+{
+	data = netdef_pack(codec, type, &size, data);
+	ssp_io_push_ref(io, type, size, data);
+}
+
+void
+netdef_push_ref_i(const net_codec_t* codec, ssp_io_t* io, u8 type, u16 size, const void* data)
+{
+	data = netdef_pack(codec, type, &size, data);
+	ssp_io_push_ref_i(io, type, size, data);
+}
+
+/* Raw vs packed bytes of every schema'd segment, and each field's step size. */
+void
+netdef_codec_report(FILE* f, const net_codec_t* codec)
+{
+	u32 raw_total = 0;
+	u32 packed_total = 0;
+
+	fprintf(f, "%-28s %5s %6s\n", "Segment", "Raw", "Packed");
+	for (u32 type = 0; type < NET_SEGTYPES_LEN; type++)
+	{
+		const net_schema_t* schema = net_schemas + type;
+
+		if (schema->fields == NULL)
+			continue;
+
+		fprintf(f, "%-28s %5u %6u\n", schema->name, schema->struct_size, schema->packed_size);
+		for (u32 i = 0; i < schema->count; i++)
+		{
+			const net_field_t* field = schema->fields + i;
+
+			fprintf(f, "    %-24s %2u bits", field->name, field->bits);
+			if (field->kind == NET_FIELD_FIXED)
+				fprintf(f, ", step %g", 1.0 / field->scale);
+			else if (field->kind == NET_FIELD_POS)
+				fprintf(f, ", step %g x %g", 1.0 / net_pos_scale(codec->world.x), 1.0 / net_pos_scale(codec->world.y));
+			else if (field->kind == NET_FIELD_ANGLE)
+				fprintf(f, ", step %g rad", 2 * M_PI / (1ull << field->bits));
+			fprintf(f, "\n");
+		}
+		raw_total += schema->struct_size;
+		packed_total += schema->packed_size;
+	}
+	fprintf(f, "%-28s %5u %6u\n", "Total", raw_total, packed_total);
+}
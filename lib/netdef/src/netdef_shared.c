@@ -0,0 +1,85 @@
+#include "netdef.h"
+
+/**
+ *	Shared tick block - Broadcasts that are identical for every client get
+ *	packed once into a single buffer, and every client's datagram points
+ *	at it next to its own small header, so sendmmsg() sends it without a
+ *	per-client serialize or copy. It bypasses ssp entirely: no reliability,
+ *	acks or compression, only what can be lost anyway belongs here.
+ */
+
+bool
+netdef_shared_push(net_shared_block_t* block, const net_codec_t* codec, u8 type, u16 size, const void* data)
+{
+	const u16 packed_size = netdef_packed_size(type, size);
+	net_shared_segment_t* segment;
+
+	if (block->size + sizeof(net_shared_segment_t) + packed_size > NET_SHARED_BLOCK_MAX)
+		return false;
+
+	segment = (net_shared_segment_t*)(block->buf + block->size);
+	segment->type = type;
+	segment->size = packed_size;
+	netdef_write(codec, type, segment + 1, size, data);
+
+	block->size += sizeof(net_shared_segment_t) + packed_size;
+	block->count++;
+	return true;
+}
+
+void
+netdef_shared_clear(net_shared_block_t* block)
+{
+	block->size = 0;
+	block->count = 0;
+}
+
+void
+netdef_shared_header(const netdef_t* netdef, net_shared_header_t* header, u32 session_id, u32 tick)
+{
+	header->magic = netdef->shared_magic;
+	header->session_id = session_id;
+	header->tick = tick;
+}
+
+/**
+ *	False if `buf` isn't a shared block datagram, so it's for ssp_io_process().
+ *	Blocks older than `last_tick`, for another session or malformed are dropped.
+ */
+bool
+netdef_shared_process(const netdef_t* netdef, const void* buf, u32 size,
+					  u32 session_id, u32* last_tick, void* source_data)
+{
+	const net_shared_header_t* header = buf;
+	const u8* cur = (const u8*)(header + 1);
+	const u8* end = (const u8*)buf + size;
+
+	if (size < sizeof(net_shared_header_t) || header->magic != netdef->shared_magic)
+		return false;
+
+	if (header->session_id != session_id || header->tick <= *last_tick)
+		return true;
+	*last_tick = header->tick;
+
+	while (cur + sizeof(net_shared_segment_t) <= end)
+	{
+		const net_shared_segment_t* segment_header = (const net_shared_segment_t*)cur;
+		ssp_segment_t segment;
+
+		if (cur + sizeof(net_shared_segment_t) + segment_header->size > end ||
+			segment_header->type >= NET_SEGTYPES_LEN)
+			break;
+
+		segment = (ssp_segment_t){
+			.type = segment_header->type,
+			.size = segment_header->size,
+			.data = (u8*)(segment_header + 1),
+			.packet = NULL,
+		};
+		if (netdef->callbacks[segment.type])
+			netdef->callbacks[segment.type](&segment, netdef->ssp_ctx.user_data, source_data);
+
+		cur += sizeof(net_shared_segment_t) + segment.size;
+	}
+	return true;
+}
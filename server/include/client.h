@@ -5,13 +5,35 @@
 #include "netdef.h"
 
 typedef struct server server_t;
+typedef struct server_room server_room_t;
+typedef struct event event_t;
+
+/**
+ *	Serialized TCP packets waiting for the socket. Queued during the tick,
+ *	written once at its end and on EPOLLOUT when the socket was full.
+ */
+typedef struct
+{
+	array_t		packets;	// ssp_packet_t*
+	u32			head;		// First packet not fully written
+	u32			offset;		// Bytes of `head` already written
+	u32			bytes;		// Queued and not yet written
+	f64			last_progress;
+	f64			behind_since;	// Flush that left more than --tcp-queue, 0 when under
+	bool		pending;	// In server_t.tcp_pending
+	bool		refused;	// Turned away, closed at the next flush
+} client_tcp_out_t;
 
 typedef struct 
 {
 	u32				session_id;
-	cg_player_t*	player;
+	server_room_t*	room;		// NULL until NET_TCP_CONNECT
+	cg_player_t*	player;		// NULL until NET_TCP_CG_MAP_REQUEST
+	char			username[PLAYER_NAME_MAX];	// From NET_TCP_CONNECT, for the player
 	ssp_tcp_sock_t	tcp_sock;
 	ssp_io_t		tcp_io;
+	client_tcp_out_t tcp_out;
+	event_t*		tcp_event;
 	ssp_io_t		udp_io;
 	udp_addr_t		udp;
 	char*			og_username;
@@ -19,9 +41,29 @@ typedef struct
 	bool			want_stats;
 	bool			bot;
 	f64				last_packet_time;
+
+	/* Snapshot replication, baselines are what this client was sent. */
+	net_snapshot_ring_t snapshots;
+	u32				snapshot_acked;
+	u32				snapshot_sent;
+	u32				snapshot_first;	// Slot the next delta starts at, rotates past what didn't fit
+
+	/* Area of interest, the cells around the player this client gets updates about. */
+	struct {
+		vec2f_t		view;		// World units, 0 until the client reports it (sees everything)
+		u32*		seen;		// Player ID per handle slot if in the area, 0 if not
+		u32			seen_size;
+		u32*		ids;		// The player IDs in `seen`, `count` of them (room for `seen_size`)
+		u32			count;
+	} aoi;
 } client_t;
 
 client_t* accept_client(server_t* server);
 i64 client_send(server_t* server, client_t* client, ssp_packet_t* packet);
+void client_tcp_queue(server_t* server, client_t* client);
+void client_tcp_refuse(server_t* server, client_t* client);
+i32 client_tcp_write(client_t* client, f64 current_time);
+void client_tcp_free(client_t* client);
+bool client_sees(const client_t* client, const cg_player_t* player);
 
 #endif // _CLIENT_H_
@@ -8,6 +8,7 @@ typedef struct event event_t;
 
 typedef void (*event_read_t)(server_t* server, event_t* event);
 typedef void (*event_close_t)(server_t* server, event_t* event);
+typedef void (*event_write_t)(server_t* server, event_t* event);
 
 typedef struct event
 {
@@ -15,12 +16,16 @@ typedef struct event
 	void* data;
 	event_read_t read;
 	event_close_t close;
+	event_write_t write;	// On EPOLLOUT, while want_write is set
+	bool want_write;
+	bool closed;	// Only io_uring keeps closed events around
 
 	struct event* next;
 	struct event* prev;
 } event_t;
 
-void server_add_event(server_t* server, i32 fd, void* data, event_read_t read, event_close_t close);
+event_t* server_add_event(server_t* server, i32 fd, void* data, event_read_t read, event_close_t close);
+void server_event_want_write(server_t* server, event_t* event, bool want_write);
 void server_close_event(server_t* server, event_t* event);
 void server_close_all_events(server_t* server);
 void server_handle_event(server_t* server, event_t* event, u32 events);
@@ -7,6 +7,10 @@
 #include "event.h"
 #include "netdef.h"
 #include "mmframes.h"
+#include "udp_workers.h"
+#include "server_uring.h"
+#include "server_tick.h"
+#include "server_room.h"
 
 #include <sys/random.h>
 #include <time.h>
@@ -21,6 +25,26 @@
 #define FRAMETIMES_LEN 128
 #define FRAMETIME_LEN 63
 #define SSP_FLAGS (SSP_SESSION_BIT)
+#define UDP_RX_BATCH 32
+#define SERVER_AOI_MARGIN 2	// Cells past the client's view still in its area of interest
+
+enum server_replication
+{
+	SERVER_REPLICATION_EVENTS,		// Push every change as it happens
+	SERVER_REPLICATION_SNAPSHOT,	// Delta each tick against the client's acked snapshot
+};
+
+/**
+ *	recvmmsg() ring. Buffers are reused every batch, one is only replaced
+ *	when ssp keeps it (SSP_BUFFERED).
+ */
+typedef struct
+{
+	struct mmsghdr	msgs[UDP_RX_BATCH];
+	struct iovec	iovs[UDP_RX_BATCH];
+	udp_addr_t		addrs[UDP_RX_BATCH];
+	void*			bufs[UDP_RX_BATCH];
+} server_udp_rx_t;
 
 typedef struct server
 {
@@ -32,14 +56,18 @@ typedef struct server
 	u16 port;
 	u16 udp_port;
 	ght_t clients;
+	array_t tcp_pending;	// client_t* with queued TCP packets, NULL once closed
+	u32 tcp_queue_max;		// Bytes a client can stay behind on TCP before it's closed
 	struct epoll_event ep_events[MAX_EVENTS];
 	netdef_t netdef;
-	coregame_t game;
 
-	array_t spawn_points;
-	u32 spawn_idx;
+	server_room_t*	rooms;
+	u32				room_count;
+	server_room_t**	due_rooms;
+	array_t			room_specs;	// server_room_spec_t, from --room
+	u32				rooms_default;	// --rooms on the default map and tickrate
+	server_map_t*	maps;
 
-	mmframes_t mmf;
 	bool running;
 	f64		tickrate;
 	f64		interval;
@@ -50,10 +78,9 @@ typedef struct server
 	struct {
 		event_t* head;
 		event_t* tail;
+		event_t* handling;	// In server_handle_event(), NULL once it got closed
 	} events;
 	const char* cgmap_path;
-	cg_disk_map_t*	disk_map;
-	u32			disk_map_size;
 
 	nano_timer_t timer;
 	hr_time_t prev_time;
@@ -61,18 +88,31 @@ typedef struct server
 
 	f64 routine_time;
 	f64 client_timeout_threshold;
-
-	u64 tick_count;
-	u64 tick_time_total;
-	server_stats_t stats;
+	u32 bullet_pool_reserve;
+	u32 sim_threads;
+	enum cg_netcode netcode;
+	f64 rollback_window_ms;
+	enum server_replication replication;
+	bool codec_report;
+	cg_jobs_t* jobs;
+
+	server_stats_t stats;	// Only the UDP RX counters, they're process-wide
 	f64 last_stat_update;
-	bool send_stats;
 	bool reset_stats;
 
 	ssp_io_t io;
-	array_t packet_tx_buf;
-	array_t tx_msgs;
-	u32		total_tx_size;
+	server_udp_rx_t	udp_rx;
+	udp_workers_t	udp_workers;
+	u32				udp_worker_count;
+	bool			io_uring;
+	server_uring_t*	uring;	// NULL when on epoll
+	i32				tick_fd;
+	bool			tick_due;
+	i64				tick_wakeup_ns;		// Earliest room wakeup, 0 when no room ticks
+	i64				tick_deadline_ns;	// Earliest room deadline, to spin to
+	i64				tick_spin_ns;
+	i32				cpu;			// -1 to leave affinity alone
+	i32				realtime_prio;	// 0 for SCHED_OTHER
 } server_t;
 
 i32 server_init(server_t* server, i32 argc, char* const* argv);
@@ -81,14 +121,23 @@ void server_cleanup(server_t* server);
 void server_close_client(server_t* server, client_t* client);
 
 void server_timerfd_timeout(server_t* server, event_t* event);
+void server_tick_timeout(server_t* server, event_t* event);
 void signalfd_read(server_t* server, event_t* event);
 bool server_verify_session(u32 session_id, server_t* server, udp_addr_t* source_data, void** new_source, ssp_io_t** io);
+const net_codec_t* server_client_codec(server_t* server, const client_t* client);
 void server_read_udp_packet(server_t* server, event_t* event);
+void server_drain_udp_workers(server_t* server);
+i32	 server_process_udp_packet(server_t* server, void* buf, u32 size, udp_addr_t* info, f64 timestamp_s);
+void server_init_udp_rx(server_t* server);
+void server_free_udp_rx(server_t* server);
 void server_handle_new_connection(server_t* server, UNUSED event_t* event);
 void event_signalfd_close(server_t* server, UNUSED event_t* ev);
-vec2f_t server_next_spawn(server_t* server);
+vec2f_t server_next_spawn(server_room_t* room);
 
-void server_add_data_all_udp_clients(server_t* server, u8 type, const void* data, u16 size, u32 ignore_player_id);
-void server_add_data_all_udp_clients_i(server_t* server, u8 type, const void* data, u16 size, u32 ignore_player_id);
+void server_add_data_all_udp_clients(server_room_t* room, u8 type, const void* data, u16 size, 
+									 const cg_player_t* subject, u32 ignore_player_id);
+void server_add_data_all_udp_clients_i(server_room_t* room, u8 type, const void* data, u16 size, 
+									   const cg_player_t* subject, u32 ignore_player_id);
+void server_add_shared_udp(server_room_t* room, u8 type, const void* data, u16 size);
 
 #endif // _SERVER_H_
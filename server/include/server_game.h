@@ -3,16 +3,19 @@
 
 #include "server.h"
 
-void server_on_player_reload(cg_player_t* player, server_t* server);
+void server_on_player_reload(cg_player_t* player, server_room_t* room);
 void player_ping(const ssp_segment_t* segment, server_t* server, client_t* source_client);
 void udp_ping(const ssp_segment_t* segment, server_t* server, client_t* source_client);
 void player_cursor(const ssp_segment_t* segment, server_t* server, client_t* source_client);
 void client_tcp_connect(const ssp_segment_t* segment, server_t* server, client_t* client);
-void on_player_damaged(cg_player_t* target_player, cg_player_t* attacker_player, server_t* server);
-void on_player_changed(cg_player_t* player, server_t* server);
-void server_on_player_gun_changed(cg_player_t* player, server_t* server);
-void server_on_bullet_create(cg_bullet_t* bullet, server_t* server);
-void broadcast_delete_player(server_t* server, u32 id);
+void client_tcp_map_request(const ssp_segment_t* segment, server_t* server, client_t* client);
+void on_player_damaged(cg_player_t* target_player, cg_player_t* attacker_player, server_room_t* room);
+void on_player_changed(cg_player_t* player, server_room_t* room);
+void server_on_player_gun_changed(cg_player_t* player, server_room_t* room);
+void server_drain_game_events(server_room_t* room);
+void server_replicate_snapshots(server_room_t* room);
+void server_update_aoi(server_room_t* room);
+void broadcast_delete_player(server_room_t* room, u32 id);
 void want_server_stats(const ssp_segment_t* segment, UNUSED server_t* server, client_t* source_client);
 void chat_msg(const ssp_segment_t* segment, server_t* server, client_t* source_client);
 void player_gun_id(const ssp_segment_t* segment, server_t* server, client_t* source_client);
@@ -20,5 +23,7 @@ void player_input(const ssp_segment_t* segment, server_t* server, client_t* sour
 void player_reload(const ssp_segment_t* segment, server_t* server, client_t* source_client);
 void bot_mode(const ssp_segment_t* segment, server_t* server, client_t* source_client);
 void move_bot(const ssp_segment_t* segment, server_t* server, client_t* source_client);
+void player_view(const ssp_segment_t* segment, server_t* server, client_t* source_client);
+void snapshot_ack(const ssp_segment_t* segment, server_t* server, client_t* source_client);
 
 #endif // _SERVER_GAME_H_
@@ -0,0 +1,78 @@
+#ifndef _SERVER_ROOM_H_
+#define _SERVER_ROOM_H_
+
+#include "server_common.h"
+#include "netdef.h"
+#include "mmframes.h"
+#include "server_tick.h"
+
+typedef struct server server_t;
+
+/* What --room asked for, rooms are created from these at init. */
+typedef struct
+{
+	const char*	map_path;
+	f64			tickrate;
+} server_room_spec_t;
+
+/**
+ *	A map's disk blob, read once and shared by every room on it. It's
+ *	what clients get sent and what each room builds its own runtime map
+ *	from, since cell occupancy is per game.
+ */
+typedef struct server_map
+{
+	const char*		path;
+	cg_disk_map_t*	disk;
+	u32				disk_size;
+	u64				hash;	// cg_map_hash(), what clients look their map cache up by
+	u32				refs;
+	struct server_map* next;
+} server_map_t;
+
+/**
+ *	One match: its own game, map, tickrate and clients. Rooms tick on
+ *	their own deadlines. Simulation runs on the job pool, everything
+ *	touching sockets and ssp stays on the server thread.
+ */
+typedef struct server_room
+{
+	u32				id;
+	server_t*		server;
+	server_map_t*	map;
+	coregame_t		game;
+	ght_t			clients;	// Not owned, server_t.clients frees them
+
+	u32				spawn_idx;	// Into game.map->spawns
+
+	f64				tickrate;
+	f64				interval;
+	server_tick_t	tick;
+	nano_timer_t	timer;		// Simulation part of the tick
+	f64				current_time;
+
+	mmframes_t		mmf;
+	net_codec_t		codec;		// Packs this room's segments against its own map
+	net_shared_block_t	shared;
+	u32				shared_tick;
+	array_t			packet_tx_buf;
+	array_t			tx_msgs;
+	u32				total_tx_size;
+
+	u64				tick_count;
+	u64				tick_time_total;
+	server_stats_t	stats;
+	bool			send_stats;
+} server_room_t;
+
+i32	 server_room_init(server_room_t* room, server_t* server, u32 id, const server_room_spec_t* spec);
+void server_room_cleanup(server_room_t* room);
+server_room_t* server_room_pick(server_t* server);
+void server_room_publish_stats(server_room_t* room);
+
+i64	 server_rooms_schedule(server_t* server);
+bool server_rooms_woke(const server_t* server);
+u32	 server_rooms_due(server_t* server, i64 now_ns);
+void server_rooms_update(server_t* server, u32 count);
+
+#endif // _SERVER_ROOM_H_
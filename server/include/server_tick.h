@@ -0,0 +1,44 @@
+#ifndef _SERVER_TICK_H_
+#define _SERVER_TICK_H_
+
+#include "int.h"
+#include "nano_timer.h"
+#include <sched.h>
+
+/* Log-linear lateness buckets, 4 per power of two nanoseconds. */
+#define TICK_HIST_SUB		4
+#define TICK_HIST_BUCKETS	160
+
+/**
+ *	Tick scheduler, one per room. Ticks start on absolute deadlines one
+ *	interval apart, so a late tick never shifts the ones after it. The
+ *	process waits for the earliest room on one timerfd (TFD_TIMER_ABSTIME),
+ *	or an absolute timeout with io_uring, which fires `spin_ns` early; the
+ *	rest is spent spinning on the clock.
+ */
+typedef struct
+{
+	i64		deadline_ns;	// CLOCK_MONOTONIC, 0 until the first tick
+	i64		interval_ns;
+	i64		spin_ns;
+	bool	scheduled;		// Waited for the deadline, so lateness counts
+
+	u32		histogram[TICK_HIST_BUCKETS];
+	u32		samples;
+	i64		max_ns;
+} server_tick_t;
+
+void server_tick_init(server_tick_t* tick, i64 interval_ns, i64 spin_ns);
+i64	 server_tick_wakeup_ns(const server_tick_t* tick);
+void server_tick_begin(server_tick_t* tick, const hr_time_t* start);
+i64	 server_tick_percentile(const server_tick_t* tick, f64 p);
+void server_tick_reset_histogram(server_tick_t* tick);
+
+i32	 server_tick_timer_create(void);
+void server_tick_timer_arm(i32 fd, i64 wakeup_ns);
+void server_tick_spin_until(i64 deadline_ns);
+
+i32	 server_tick_pin_cpu(i32 cpu);
+i32	 server_tick_realtime(i32 priority);
+
+#endif // _SERVER_TICK_H_
@@ -0,0 +1,22 @@
+#ifndef _SERVER_URING_H_
+#define _SERVER_URING_H_
+
+#include "int.h"
+#include <sys/socket.h>
+
+typedef struct server server_t;
+typedef struct event event_t;
+typedef struct server_uring server_uring_t;
+
+/**
+ *	io_uring backend, an alternative to epoll (--io-uring). Only built
+ *	with liburing (SERVER_IO_URING), server_uring_init() fails without.
+ */
+i32	 server_uring_init(server_t* server);
+void server_uring_add_event(server_t* server, event_t* event);
+void server_uring_del_event(server_t* server, event_t* event);
+void server_uring_poll(server_t* server);
+i32	 server_uring_sendmmsg(server_t* server, struct mmsghdr* msgs, u32 count);
+void server_uring_destroy(server_t* server);
+
+#endif // _SERVER_URING_H_
@@ -0,0 +1,55 @@
+#ifndef _SERVER_UDP_WORKERS_H_
+#define _SERVER_UDP_WORKERS_H_
+
+#include "server_common.h"
+#include "netdef.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define UDP_WORKER_QUEUE_SIZE 1024	// Power of two
+#define UDP_WORKER_BUFFER_SIZE 4096
+
+typedef struct
+{
+	void*		buf;
+	u32			size;
+	f64			timestamp_s;
+	udp_addr_t	addr;
+} udp_datagram_t;
+
+/**
+ *	One receive thread on its own SO_REUSEPORT socket. The kernel keeps
+ *	each client on the same socket, so a client's datagrams stay in order
+ *	through the worker's single-producer single-consumer queue. Every
+ *	queue slot owns a receive buffer for good, the worker reads straight
+ *	into the slot at `head`.
+ */
+typedef struct
+{
+	pthread_t		thread;
+	i32				fd;
+	const atomic_bool* quit;
+	void*			overflow;	// Reads go here while the queue is full, to be dropped
+
+	udp_datagram_t	queue[UDP_WORKER_QUEUE_SIZE];
+	_Alignas(64) atomic_uint head;	// Written by the worker
+	_Alignas(64) atomic_uint tail;	// Written by the tick thread
+	atomic_uint		dropped;
+} udp_worker_t;
+
+typedef struct
+{
+	udp_worker_t*	workers;
+	u32				count;
+	atomic_bool		quit;
+} udp_workers_t;
+
+/* True if it kept `datagram->buf`, the slot then gets a new one. */
+typedef bool (*udp_datagram_func_t)(void* ctx, udp_datagram_t* datagram);
+
+i32	 udp_workers_init(udp_workers_t* workers, u32 count, const struct sockaddr* addr, socklen_t addr_len);
+void udp_workers_drain(udp_workers_t* workers, udp_datagram_func_t func, void* ctx);
+u32	 udp_workers_dropped(const udp_workers_t* workers);
+void udp_workers_destroy(udp_workers_t* workers);
+
+#endif // _SERVER_UDP_WORKERS_H_
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "client.h"
 #include "server.h"
 #include <sys/random.h>
@@ -6,6 +7,7 @@
 #define UDP_TX_COMPRESSION_THRESHOLD 1400
 #define TX_COMPRESSION_LEVEL 9
 #define UDP_TX_COMPRESSION_LEVEL 2
+#define TCP_IOV_MAX 64
 
 client_t* 
 accept_client(server_t* server)
@@ -26,12 +28,15 @@ accept_client(server_t* server)
 	client->tcp_io.tx.compression.auto_do = true;
 	client->tcp_io.tx.compression.threshold = TX_COMPRESSION_THRESHOLD; // Only do tx.compression over this.
 	client->tcp_io.tx.compression.level = TX_COMPRESSION_LEVEL;
+	array_init(&client->tcp_out.packets, sizeof(ssp_packet_t*), 4);
 
 	ssp_io_init(&client->udp_io, &server->netdef.ssp_ctx, SSP_FLAGS);
 	client->udp_io.tx.compression.auto_do = true;
 	client->udp_io.tx.compression.threshold = UDP_TX_COMPRESSION_THRESHOLD; // Only do tx.compression over this.
 	client->udp_io.tx.compression.level = UDP_TX_COMPRESSION_LEVEL;
 
+	client->snapshot_acked = client->snapshot_sent = NET_SNAPSHOT_NONE;
+
 	getrandom(&client->session_id, sizeof(u32), 0);
 	client->udp_io.session_id = client->session_id;
 
@@ -45,6 +50,143 @@ accept_client(server_t* server)
 	return client;
 }
 
+/* Whether `player` is in the client's area of interest, a client always sees itself. */
+bool
+client_sees(const client_t* client, const cg_player_t* player)
+{
+	const u32 slot = CG_HANDLE_SLOT(player->id);
+
+	if (client->player == player)
+		return true;
+	return slot < client->aoi.seen_size && client->aoi.seen[slot] == player->id;
+}
+
+/* Serializes what got pushed on the client's TCP io to the back of its queue. */
+void
+client_tcp_queue(server_t* server, client_t* client)
+{
+	client_tcp_out_t* out = &client->tcp_out;
+	ssp_packet_t* packet = ssp_io_serialize(&client->tcp_io);
+
+	if (packet == NULL)
+		return;
+
+	if (out->bytes == 0)
+		out->last_progress = server->current_time;
+	array_add_voidp(&out->packets, packet);
+	out->bytes += packet->size;
+
+	if (out->pending == false)
+	{
+		out->pending = true;
+		array_add_voidp(&server->tcp_pending, client);
+	}
+}
+
+/**
+ *	Closes the client at the end of the tick, after what it has queued.
+ *	For segment callbacks, which run inside ssp_io_process() on the
+ *	client's own io and can't close it there.
+ */
+void
+client_tcp_refuse(server_t* server, client_t* client)
+{
+	client_tcp_out_t* out = &client->tcp_out;
+
+	out->refused = true;
+	if (out->pending == false)
+	{
+		out->pending = true;
+		array_add_voidp(&server->tcp_pending, client);
+	}
+}
+
+/**
+ *	Writes as much of the queue as the socket takes without blocking,
+ *	TCP_IOV_MAX packets per sendmsg(). Returns -1 on a socket error.
+ */
+i32
+client_tcp_write(client_t* client, f64 current_time)
+{
+	client_tcp_out_t* out = &client->tcp_out;
+	ssp_packet_t** packets = (ssp_packet_t**)out->packets.buf;
+	struct iovec iov[TCP_IOV_MAX];
+	struct msghdr msg = { .msg_iov = iov };
+	u64 batch_size;
+	i64 sent;
+	i32 flags;
+
+	while (out->head < out->packets.count)
+	{
+		batch_size = 0;
+		msg.msg_iovlen = 0;
+		for (u32 i = out->head; i < out->packets.count && msg.msg_iovlen < TCP_IOV_MAX; i++)
+		{
+			const u32 skip = (i == out->head) ? out->offset : 0;
+
+			iov[msg.msg_iovlen].iov_base = (u8*)packets[i]->buf + skip;
+			iov[msg.msg_iovlen].iov_len = packets[i]->size - skip;
+			batch_size += packets[i]->size - skip;
+			msg.msg_iovlen++;
+		}
+
+		/* More batches behind this one, let the kernel fill whole segments. */
+		flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+		if (out->head + msg.msg_iovlen < out->packets.count)
+			flags |= MSG_MORE;
+
+		if ((sent = sendmsg(client->tcp_sock.sockfd, &msg, flags)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			perror("sendmsg tcp");
+			return -1;
+		}
+		out->bytes -= sent;
+		out->last_progress = current_time;
+
+		for (i64 left = sent; left > 0; )
+		{
+			const u32 remaining = packets[out->head]->size - out->offset;
+
+			if (left < remaining)
+			{
+				out->offset += left;
+				break;
+			}
+			left -= remaining;
+			ssp_packet_free(packets[out->head]);
+			out->head++;
+			out->offset = 0;
+		}
+
+		/* Socket buffer is full, the rest waits for EPOLLOUT. */
+		if ((u64)sent < batch_size)
+			break;
+	}
+
+	if (out->head == out->packets.count)
+	{
+		array_clear(&out->packets, false);
+		out->head = 0;
+	}
+	return 0;
+}
+
+void
+client_tcp_free(client_t* client)
+{
+	client_tcp_out_t* out = &client->tcp_out;
+	ssp_packet_t** packets = (ssp_packet_t**)out->packets.buf;
+
+	for (u32 i = out->head; i < out->packets.count; i++)
+		ssp_packet_free(packets[i]);
+	array_del(&out->packets);
+	out->bytes = 0;
+}
+
 i64 
 client_send(server_t* server, client_t* client, ssp_packet_t* packet)
 {
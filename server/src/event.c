@@ -14,6 +14,17 @@ server_ep_add_event(server_t* server, event_t* event)
 	}
 }
 
+static void 
+server_ep_mod_event(server_t* server, event_t* event)
+{
+	struct epoll_event ev = {
+		.data.ptr = event,
+		.events = EPOLLIN | EPOLLRDHUP | ((event->want_write) ? EPOLLOUT : 0)
+	};
+	if (epoll_ctl(server->epfd, EPOLL_CTL_MOD, event->fd, &ev) == -1)
+		perror("epoll_ctl MOD");
+}
+
 static void 
 server_ep_del_event(server_t* server, event_t* event)
 {
@@ -35,7 +46,7 @@ server_close_all_events(server_t* server)
 	}
 }
 
-void 
+event_t* 
 server_add_event(server_t* server, i32 fd, void* data, event_read_t read, event_close_t close)
 {
 	event_t* event = calloc(1, sizeof(event_t));
@@ -44,27 +55,46 @@ server_add_event(server_t* server, i32 fd, void* data, event_read_t read, event_
 	event->read = read;
 	event->close = close;
 
-	server_ep_add_event(server, event);
+	if (server->uring)
+		server_uring_add_event(server, event);
+	else
+		server_ep_add_event(server, event);
 
 	if (server->events.head == NULL)
 	{
 		server->events.head = event;
 		server->events.tail = event;
-		return;
+		return event;
 	}
 
 	server->events.tail->next = event;
 	event->prev = server->events.tail;
 	server->events.tail = event;
+	return event;
+}
+
+/* io_uring picks it up when the event's poll is re-armed, the tick's flush retries meanwhile. */
+void
+server_event_want_write(server_t* server, event_t* event, bool want_write)
+{
+	if (event->want_write == want_write)
+		return;
+
+	event->want_write = want_write;
+	if (server->uring == NULL)
+		server_ep_mod_event(server, event);
 }
 
 void 
 server_close_event(server_t* server, event_t* event)
 {
-	server_ep_del_event(server, event);
+	if (server->uring == NULL)
+		server_ep_del_event(server, event);
 
 	if (event->close)
 		event->close(server, event);
+	if (server->events.handling == event)
+		server->events.handling = NULL;
 
 	if (event->prev)
 		event->prev->next = event->next;
@@ -83,18 +113,26 @@ server_close_event(server_t* server, event_t* event)
 			server->events.tail = server->events.head;
 	}
 
-	free(event);
+	if (server->uring)
+		server_uring_del_event(server, event);
+	else
+		free(event);
 }
 
+/* Reads before writing, the read may close the event and then it's gone. */
 void 
 server_handle_event(server_t* server, event_t* event, u32 events)
 {
 	if (events & (EPOLLERR | EPOLLHUP))
 	{
 		server_close_event(server, event);
+		return;
 	}
-	else if (events & EPOLLIN)
-	{
+
+	server->events.handling = event;
+	if (events & EPOLLIN)
 		event->read(server, event);
-	}
+	if (server->events.handling && (events & EPOLLOUT) && event->write)
+		event->write(server, event);
+	server->events.handling = NULL;
 }
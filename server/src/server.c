@@ -3,46 +3,60 @@
 
 #define RECV_BUFFER_SIZE 4096
 
+/* `subject` is the player the data is about, only clients seeing it get it. NULL for everyone. */
 void
-server_add_data_all_udp_clients(server_t* server, u8 type, const void* data, u16 size, 
-								u32 ignore_player_id)
+server_add_data_all_udp_clients(server_room_t* room, u8 type, const void* data, u16 size, 
+								const cg_player_t* subject, u32 ignore_player_id)
 {
-	ght_t* clients = &server->clients;
+	ght_t* clients = &room->clients;
 
 	GHT_FOREACH(client_t* client, clients, 
 	{
-		if (client->player && client->player->id != ignore_player_id)
-			ssp_io_push_ref(&client->udp_io, type, size, data);
+		if (client->player && client->player->id != ignore_player_id &&
+			(subject == NULL || client_sees(client, subject)))
+			netdef_push_ref(&room->codec, &client->udp_io, type, size, data);
 	});
 }
 
 void
-server_add_data_all_udp_clients_i(server_t* server, u8 type, const void* data, u16 size, 
-								u32 ignore_player_id)
+server_add_data_all_udp_clients_i(server_room_t* room, u8 type, const void* data, u16 size, 
+								const cg_player_t* subject, u32 ignore_player_id)
 {
-	ght_t* clients = &server->clients;
+	ght_t* clients = &room->clients;
 
 	GHT_FOREACH(client_t* client, clients, 
 	{
-		if (client->player && client->player->id != ignore_player_id)
-			ssp_io_push_ref_i(&client->udp_io, type, size, data);
+		if (client->player && client->player->id != ignore_player_id &&
+			(subject == NULL || client_sees(client, subject)))
+			netdef_push_ref_i(&room->codec, &client->udp_io, type, size, data);
 	});
 }
 
+/**
+ *	Unreliable segment for every client, serialized into this tick's shared
+ *	block. Falls back to per-client pushes once the block is full.
+ */
+void
+server_add_shared_udp(server_room_t* room, u8 type, const void* data, u16 size)
+{
+	if (netdef_shared_push(&room->shared, &room->codec, type, size, data) == false)
+		server_add_data_all_udp_clients(room, type, data, size, NULL, 0);
+}
+
 vec2f_t 
-server_next_spawn(server_t* server)
+server_next_spawn(server_room_t* room)
 {
 	vec2f_t ret;
-	const cg_runtime_map_t* map = server->game.map;
-	const cg_runtime_cell_t* spawn_cell = *(const cg_runtime_cell_t**)array_idx(&server->spawn_points, server->spawn_idx);
+	const cg_runtime_map_t* map = room->game.map;
+	const cg_runtime_cell_t* spawn_cell = *(const cg_runtime_cell_t**)array_idx(&map->spawns, room->spawn_idx);
 
 	ret = vec2f(
 		spawn_cell->pos.x * map->grid_size, 
 		spawn_cell->pos.y * map->grid_size
 	);
-	server->spawn_idx++;
-	if (server->spawn_idx >= server->spawn_points.count)
-		server->spawn_idx = 0;
+	room->spawn_idx++;
+	if (room->spawn_idx >= map->spawns.count)
+		room->spawn_idx = 0;
 	return ret;
 }
 
@@ -79,6 +93,21 @@ server_timerfd_timeout(server_t* server, event_t* event)
 	server_routine_checks(server);
 }
 
+void
+server_tick_timeout(server_t* server, event_t* event)
+{
+	u64 expirations;
+
+	if (read(event->fd, &expirations, sizeof(u64)) == -1)
+	{
+		if (errno != EAGAIN)
+			perror("tick timerfd read");
+		return;
+	}
+
+	server->tick_due = true;
+}
+
 static void
 read_client(server_t* server, event_t* event)
 {
@@ -121,13 +150,29 @@ read_client(server_t* server, event_t* event)
 void
 server_close_client(server_t* server, client_t* client)
 {
+	server_room_t* room = client->room;
 	u32 player_id = 0;
 
 	if (server->running == false && client->player)
 	{
 		ssp_io_push_ref(&client->tcp_io, NET_TCP_SERVER_SHUTDOWN, 0, NULL);
-		ssp_tcp_send_io(&client->tcp_sock, &client->tcp_io);
+		client_tcp_queue(server, client);
+		client_tcp_write(client, server->current_time);
 	}
+	if (client->tcp_out.pending)
+	{
+		client_t** pending = (client_t**)server->tcp_pending.buf;
+
+		for (u32 i = 0; i < server->tcp_pending.count; i++)
+		{
+			if (pending[i] == client)
+			{
+				pending[i] = NULL;
+				break;
+			}
+		}
+	}
+	client_tcp_free(client);
 
 	ssp_tcp_sock_close(&client->tcp_sock);
 	printf("Client (%s) (fd:%d) closed.\t(%zu connected clients)\n", 
@@ -136,26 +181,40 @@ server_close_client(server_t* server, client_t* client)
 	if (client->player)
 	{
 		player_id = client->player->id;
-		coregame_free_player(&server->game, client->player);
+		coregame_free_player(&room->game, client->player);
 	}
+	if (room)
+		ght_del(&room->clients, client->session_id);
 
 	ssp_io_deinit(&client->udp_io);
 	ssp_io_deinit(&client->tcp_io);
+	net_snapshot_ring_destroy(&client->snapshots);
+	free(client->aoi.seen);
+	free(client->aoi.ids);
 	if (client->og_username)
 		free(client->og_username);
 	ght_del(&server->clients, client->session_id);
 
 	if (player_id)
-		broadcast_delete_player(server, player_id);
+		broadcast_delete_player(room, player_id);
 }
 
 static void
 event_close_client(server_t* server, event_t* event)
 {
 	server_close_client(server, event->data);
+}
 
-	server->stats.tcp_connections = server->clients.count;
-	server->stats.players = server->game.players.count;
+/* The socket has room again for what the tick's flush couldn't write. */
+static void
+write_client(server_t* server, event_t* event)
+{
+	client_t* client = event->data;
+
+	if (client_tcp_write(client, server->current_time) == -1)
+		server_close_event(server, event);
+	else if (client->tcp_out.bytes == 0)
+		server_event_want_write(server, event, false);
 }
 
 void
@@ -165,60 +224,196 @@ server_handle_new_connection(server_t* server, UNUSED event_t* event)
 	if (client == NULL)
 		return;
 
-	server_add_event(server, client->tcp_sock.sockfd, client, read_client, event_close_client);
-	server->stats.tcp_connections = server->clients.count;
-	server->stats.players = server->game.players.count;
+	client->tcp_event = server_add_event(server, client->tcp_sock.sockfd, client, read_client, event_close_client);
+	client->tcp_event->write = write_client;
 }
 
-static void
-set_udp_info(udp_addr_t* info)
+/* Returns true while the client still has packets queued. */
+static bool
+server_flush_tcp_client(server_t* server, client_t* client)
 {
-	inet_ntop(AF_INET, &info->addr.sin_addr, info->ipaddr, INET6_ADDRSTRLEN);
-	info->port = ntohs(info->addr.sin_port);
+	client_tcp_out_t* out = &client->tcp_out;
+	const char* reason = NULL;
+
+	if (client_tcp_write(client, server->current_time) == -1)
+		reason = "failed to write";
+	else if (out->bytes && server->current_time - out->last_progress > server->client_timeout_threshold)
+		reason = "stopped reading";
+	else if (out->bytes > server->tcp_queue_max && out->behind_since
+			 && server->current_time - out->behind_since > server->client_timeout_threshold)
+		reason = "fell too far behind";
+	else if (out->refused)
+		reason = "was refused";
+
+	if (reason)
+	{
+		printf("Client (%s) %s on TCP (%u bytes queued). Closing client.\n",
+				client->tcp_sock.ipstr, reason, out->bytes);
+		out->pending = false;
+		server_close_event(server, client->tcp_event);
+		return false;
+	}
+
+	/* A burst like the map can go past the limit, only staying there closes. */
+	if (out->bytes <= server->tcp_queue_max)
+		out->behind_since = 0;
+	else if (out->behind_since == 0)
+		out->behind_since = server->current_time;
+
+	server_event_want_write(server, client->tcp_event, out->bytes != 0);
+	out->pending = out->bytes != 0;
+	return out->pending;
 }
 
-void 
-server_read_udp_packet(server_t* server, event_t* event)
+/**
+ *	Writes the TCP packets queued during the tick, once per client.
+ *	Whatever the socket didn't take stays queued, written on EPOLLOUT.
+ */
+static void
+server_flush_tcp_clients(server_t* server)
 {
-	void* buf = calloc(1, RECV_BUFFER_SIZE);
-	i64 bytes_read;
-	i32 ret;
-	f64 timestamp_s;
-	hr_time_t current_time;
-	udp_addr_t info = {
-		.addr_len = sizeof(struct sockaddr_in),
-	};
+	array_t* pending = &server->tcp_pending;
+	client_t* client;
+	u32 kept = 0;
 
-	nano_gettime(&current_time);
-	timestamp_s = nano_time_s(&current_time);
+	/* Closing a client queues its delete to others, `pending` can grow while in here. */
+	for (u32 i = 0; i < pending->count; i++)
+	{
+		if ((client = ((client_t**)pending->buf)[i]) == NULL)
+			continue;
 
-	if ((bytes_read = recvfrom(event->fd, buf, RECV_BUFFER_SIZE, 0, &info.addr, &info.addr_len)) == -1)
+		if (server_flush_tcp_client(server, client))
+			((client_t**)pending->buf)[kept++] = client;
+	}
+	pending->count = kept;
+}
+
+static udp_addr_t*
+udp_addr_format(udp_addr_t* info)
+{
+	if (info->ipaddr[0] == 0x00)
 	{
-		perror("recvfrom");
-		free(buf);
-		return;
+		inet_ntop(AF_INET, &info->addr.sin_addr, info->ipaddr, INET6_ADDRSTRLEN);
+		info->port = ntohs(info->addr.sin_port);
 	}
+	return info;
+}
+
+/* Returns the ssp_io_process() result, `buf` is still the caller's unless SSP_BUFFERED. */
+i32
+server_process_udp_packet(server_t* server, void* buf, u32 size, udp_addr_t* info, f64 timestamp_s)
+{
+	i32 ret;
 
-	set_udp_info(&info);
 	server->stats.udp_pps_in++;
-	if ((server->stats.udp_pps_in_bytes += bytes_read) > server->stats.udp_pps_in_bytes_highest)
+	if ((server->stats.udp_pps_in_bytes += size) > server->stats.udp_pps_in_bytes_highest)
 		server->stats.udp_pps_in_bytes_highest = server->stats.udp_pps_in_bytes;
 
 	ssp_io_process_params_t params = {
 		.ctx = &server->netdef.ssp_ctx,
 		.io = NULL,
 		.buf = buf,
-		.size = bytes_read,
-		.peer_data = &info,
+		.size = size,
+		.peer_data = info,
 		.timestamp_s = timestamp_s
 	};
 
 	ret = ssp_io_process(&params);
 	if (ret == SSP_FAILED)
-		printf("Invalid UDP packet (%zu bytes) from %s:%u.\n", bytes_read, info.ipaddr, info.port);
+	{
+		udp_addr_format(info);
+		printf("Invalid UDP packet (%u bytes) from %s:%u.\n", size, info->ipaddr, info->port);
+	}
+	return ret;
+}
+
+void
+server_init_udp_rx(server_t* server)
+{
+	server_udp_rx_t* rx = &server->udp_rx;
+
+	for (u32 i = 0; i < UDP_RX_BATCH; i++)
+	{
+		rx->bufs[i] = malloc(RECV_BUFFER_SIZE);
+		rx->iovs[i].iov_base = rx->bufs[i];
+		rx->iovs[i].iov_len = RECV_BUFFER_SIZE;
+		rx->msgs[i].msg_hdr.msg_name = &rx->addrs[i].addr;
+		rx->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		rx->msgs[i].msg_hdr.msg_iov = rx->iovs + i;
+		rx->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+}
 
-	if (ret != SSP_BUFFERED)
-		free(buf);
+void
+server_free_udp_rx(server_t* server)
+{
+	for (u32 i = 0; i < UDP_RX_BATCH; i++)
+		free(server->udp_rx.bufs[i]);
+}
+
+/**
+ *	Drains the socket in recvmmsg() batches until it would block. One
+ *	timestamp per batch, they all arrived by the time it returned.
+ */
+void 
+server_read_udp_packet(server_t* server, event_t* event)
+{
+	server_udp_rx_t* rx = &server->udp_rx;
+	hr_time_t current_time;
+	f64 timestamp_s;
+	i32 count;
+
+	do {
+		if ((count = recvmmsg(event->fd, rx->msgs, UDP_RX_BATCH, MSG_DONTWAIT, NULL)) == -1)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				perror("recvmmsg");
+			return;
+		}
+		server->stats.udp_rx.syscalls++;
+
+		nano_gettime(&current_time);
+		timestamp_s = nano_time_s(&current_time);
+
+		for (i32 i = 0; i < count; i++)
+		{
+			udp_addr_t* info = rx->addrs + i;
+
+			info->addr_len = rx->msgs[i].msg_hdr.msg_namelen;
+			info->ipaddr[0] = 0x00;
+
+			if (server_process_udp_packet(server, rx->bufs[i], rx->msgs[i].msg_len, info, timestamp_s) == SSP_BUFFERED)
+			{
+				rx->bufs[i] = rx->iovs[i].iov_base = malloc(RECV_BUFFER_SIZE);
+				server->stats.udp_rx.allocs++;
+			}
+			rx->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		}
+	} while (count == UDP_RX_BATCH);
+}
+
+/* Only a buffer ssp keeps costs the worker slot an allocation. */
+static bool
+server_process_udp_datagram(server_t* server, udp_datagram_t* datagram)
+{
+	if (server_process_udp_packet(server, datagram->buf, datagram->size, 
+								  &datagram->addr, datagram->timestamp_s) != SSP_BUFFERED)
+		return false;
+	server->stats.udp_rx.allocs++;
+	return true;
+}
+
+/**
+ *	With UDP receive workers, datagrams were already read and timestamped
+ *	off the tick thread, into buffers the worker queues reuse. ssp
+ *	processing and the segment callbacks run here: ssp_io_process() does
+ *	header parsing, session lookup, decompression and the receive window
+ *	in one call, on io and client state the tick thread owns.
+ */
+void
+server_drain_udp_workers(server_t* server)
+{
+	udp_workers_drain(&server->udp_workers, (udp_datagram_func_t)server_process_udp_datagram, server);
 }
 
 static void
@@ -248,23 +443,30 @@ server_verify_session(u32 session_id, server_t* server, udp_addr_t* source_data,
 		server_ask_client_reconnect(server, source_data);
 		return false;
 	}
+	if (client->player == NULL)
+		return false;
 
 	if (client->udp_connected)
 	{
 		if (client->udp.addr.sin_addr.s_addr != source_data->addr.sin_addr.s_addr)
 		{
+			udp_addr_format(&client->udp);
+			udp_addr_format(source_data);
 			printf("UDP \"connected\" client IP Address dones't match from new packet. (og: %s != new: %s)...\n",
 					client->udp.ipaddr, source_data->ipaddr);
 		}
 
 		if (client->udp.addr.sin_port != source_data->addr.sin_port)
 		{
+			udp_addr_format(&client->udp);
+			udp_addr_format(source_data);
 			printf("UDP \"connected\" client source port dones't match from new packet. (og: %u != new: %u)...\n",
 					client->udp.port, source_data->port);
 		}
 	}
 	else if (client->tcp_sock.addr.sockaddr.in.sin_addr.s_addr != source_data->addr.sin_addr.s_addr)
 	{
+		udp_addr_format(source_data);
 		printf("Client TCP IP Address (%s) != to UDP Address (%s)!\n",
 				client->tcp_sock.ipstr, source_data->ipaddr);
 		return false;
@@ -281,6 +483,13 @@ server_verify_session(u32 session_id, server_t* server, udp_addr_t* source_data,
 	return true;
 }
 
+/* Schema'd segments are packed against the map of the client's room, none before it joins one. */
+const net_codec_t*
+server_client_codec(UNUSED server_t* server, const client_t* client)
+{
+	return (client && client->room) ? &client->room->codec : NULL;
+}
+
 void
 signalfd_read(server_t* server, event_t* event)
 {
@@ -326,15 +535,15 @@ event_signalfd_close(server_t* server, UNUSED event_t* ev)
 }
 
 static inline void 
-server_buffer_packet(server_t* server, const ssp_packet_t* packet, client_t* client)
+server_buffer_packet(server_room_t* room, const ssp_packet_t* packet, client_t* client)
 {
-	struct iovec* iov = mmframes_alloc(&server->mmf, sizeof(struct iovec));
+	struct iovec* iov = mmframes_alloc(&room->mmf, sizeof(struct iovec));
 	iov->iov_base = packet->buf;
 	iov->iov_len = packet->size;
 
-	server->total_tx_size += packet->size;
+	room->total_tx_size += packet->size;
 
-	struct mmsghdr* msgvec = array_add_into(&server->tx_msgs);
+	struct mmsghdr* msgvec = array_add_into(&room->tx_msgs);
 	msgvec->msg_hdr.msg_name = &client->udp.addr;
 	msgvec->msg_hdr.msg_namelen = client->udp.addr_len;
 	msgvec->msg_hdr.msg_iov = iov;
@@ -344,115 +553,146 @@ server_buffer_packet(server_t* server, const ssp_packet_t* packet, client_t* cli
 	msgvec->msg_hdr.msg_flags = 0;
 	msgvec->msg_len = 0;
 
-	array_add_voidp(&server->packet_tx_buf, (void*)packet);
+	array_add_voidp(&room->packet_tx_buf, (void*)packet);
 }
 
 static inline void
-server_prepare_udp_client(server_t* server, client_t* client)
+server_prepare_udp_client(server_room_t* room, client_t* client)
 {
 	if (client->udp_connected == false)
 		return;
 
-	if (server->send_stats && client->want_stats)
+	if (room->send_stats && client->want_stats)
 	{
-		server->stats.udp_pps_out++;
-		server->stats.udp_pps_out_bytes += ssp_io_ref_ring_size(&client->udp_io) + sizeof(server_stats_t);
-		if (server->stats.udp_pps_out_bytes > server->stats.udp_pps_out_bytes_highest)
-			server->stats.udp_pps_out_bytes_highest = server->stats.udp_pps_out_bytes;
+		room->stats.udp_pps_out++;
+		room->stats.udp_pps_out_bytes += ssp_io_ref_ring_size(&client->udp_io) + sizeof(server_stats_t);
+		if (room->stats.udp_pps_out_bytes > room->stats.udp_pps_out_bytes_highest)
+			room->stats.udp_pps_out_bytes_highest = room->stats.udp_pps_out_bytes;
 
-		server->stats.tx.rto = client->udp_io.tx.rto;
-		server->stats.tx.total_packets = client->udp_io.tx.total_packets;
+		room->stats.tx.rto = client->udp_io.tx.rto;
+		room->stats.tx.total_packets = client->udp_io.tx.total_packets;
 
-		server->stats.rx.lost = client->udp_io.rx.window.lost_packets;
-		server->stats.rx.dropped = client->udp_io.rx.dropped_packets;
-		server->stats.rx.total_packets = client->udp_io.rx.total_packets;
+		room->stats.rx.lost = client->udp_io.rx.window.lost_packets;
+		room->stats.rx.dropped = client->udp_io.rx.dropped_packets;
+		room->stats.rx.total_packets = client->udp_io.rx.total_packets;
 
-		ssp_io_push_ref(&client->udp_io, NET_UDP_SERVER_STATS, sizeof(server_stats_t), &server->stats);
+		ssp_io_push_ref(&client->udp_io, NET_UDP_SERVER_STATS, sizeof(server_stats_t), &room->stats);
 	}
 
 	ssp_packet_t* packet = ssp_io_serialize(&client->udp_io);
 	if (packet)
 	{
-		packet->timestamp = server->current_time;
+		packet->timestamp = room->current_time;
 
-		if (!(server->send_stats && client->want_stats))
+		if (!(room->send_stats && client->want_stats))
 		{
-			server->stats.udp_pps_out++;
-			server->stats.udp_pps_out_bytes += packet->size;
+			room->stats.udp_pps_out++;
+			room->stats.udp_pps_out_bytes += packet->size;
 		}
 
-		server_buffer_packet(server, packet, client);
+		server_buffer_packet(room, packet, client);
 	}
 
-	while ((packet = ssp_io_find_expired_packet(&client->udp_io, server->current_time)))
+	while ((packet = ssp_io_find_expired_packet(&client->udp_io, room->current_time)))
 	{
-		if (!(server->send_stats && client->want_stats))
+		if (!(room->send_stats && client->want_stats))
 		{
-			server->stats.udp_pps_out++;
-			server->stats.udp_pps_out_bytes += packet->size;
+			room->stats.udp_pps_out++;
+			room->stats.udp_pps_out_bytes += packet->size;
 		}
 
-		server_buffer_packet(server, packet, client);
+		server_buffer_packet(room, packet, client);
 	}
 
 	ssp_io_process_window(&client->udp_io, client);
 }
 
+/**
+ *	Two iovecs, the client's own header and the tick's shared block,
+ *	which every client's message points at without copying it.
+ */
 static inline void
-server_sendmmsg(server_t* server)
+server_buffer_shared(server_room_t* room, client_t* client)
 {
-	if (server->packet_tx_buf.count == 0)
+	struct iovec* iov;
+	net_shared_header_t* header;
+
+	if (client->udp_connected == false || client->player == NULL)
 		return;
 
-	struct mmsghdr* msgvec = (struct mmsghdr*)server->tx_msgs.buf;
+	iov = mmframes_alloc(&room->mmf, sizeof(struct iovec) * 2);
+	header = mmframes_alloc(&room->mmf, sizeof(net_shared_header_t));
+	netdef_shared_header(&room->server->netdef, header, client->session_id, room->shared_tick);
+	iov[0].iov_base = header;
+	iov[0].iov_len = sizeof(net_shared_header_t);
+	iov[1].iov_base = room->shared.buf;
+	iov[1].iov_len = room->shared.size;
 
-	i64 ret = sendmmsg(server->udp_fd, msgvec, server->tx_msgs.count, 0);
-	if (ret == -1)
-	{
+	room->stats.udp_pps_out++;
+	room->stats.udp_pps_out_bytes += sizeof(net_shared_header_t) + room->shared.size;
+	room->total_tx_size += sizeof(net_shared_header_t) + room->shared.size;
+
+	struct mmsghdr* msgvec = array_add_into(&room->tx_msgs);
+	msgvec->msg_hdr.msg_name = &client->udp.addr;
+	msgvec->msg_hdr.msg_namelen = client->udp.addr_len;
+	msgvec->msg_hdr.msg_iov = iov;
+	msgvec->msg_hdr.msg_iovlen = 2;
+	msgvec->msg_hdr.msg_control = NULL;
+	msgvec->msg_hdr.msg_controllen = 0;
+	msgvec->msg_hdr.msg_flags = 0;
+	msgvec->msg_len = 0;
+}
+
+static inline void
+server_sendmmsg(server_room_t* room)
+{
+	if (room->tx_msgs.count == 0)
+		return;
+
+	struct mmsghdr* msgvec = (struct mmsghdr*)room->tx_msgs.buf;
+
+	if (room->server->uring)
+		server_uring_sendmmsg(room->server, msgvec, room->tx_msgs.count);
+	else if (sendmmsg(room->server->udp_fd, msgvec, room->tx_msgs.count, 0) == -1)
 		perror("sendmmsg");
-	}
 
-	for (u32 i = 0; i < server->packet_tx_buf.count; i++)
+	for (u32 i = 0; i < room->packet_tx_buf.count; i++)
 	{
-		ssp_packet_t* packet = ((ssp_packet_t**)server->packet_tx_buf.buf)[i];
+		ssp_packet_t* packet = ((ssp_packet_t**)room->packet_tx_buf.buf)[i];
 		ssp_packet_free(packet);
 	}
 
-	array_clear(&server->packet_tx_buf, false);
-	array_clear(&server->tx_msgs, false);
-	server->total_tx_size = 0;
+	array_clear(&room->packet_tx_buf, false);
+	array_clear(&room->tx_msgs, false);
+	room->total_tx_size = 0;
 }
 
 static void 
-server_flush_udp_clients(server_t* server)
+server_flush_udp_clients(server_room_t* room)
 {
-	ght_t* clients = &server->clients;
+	ght_t* clients = &room->clients;
+
+	if (room->shared.count)
+		room->shared_tick++;
 
 	GHT_FOREACH(client_t* client, clients, 
 	{
-		server_prepare_udp_client(server, client);
+		server_prepare_udp_client(room, client);
+		if (room->shared.count)
+			server_buffer_shared(room, client);
 	});
 
-	server_sendmmsg(server);
+	server_sendmmsg(room);
+	netdef_shared_clear(&room->shared);
 
-	if (server->send_stats)
+	if (room->send_stats)
 	{
-		server->send_stats = false;
-		server->stats.udp_pps_in = 0;
-		server->stats.udp_pps_in_bytes = 0;
-
-		server->stats.udp_pps_out = 0;
-		server->stats.udp_pps_out_bytes = 0;
+		room->send_stats = false;
+		room->stats.udp_pps_out = 0;
+		room->stats.udp_pps_out_bytes = 0;
 	}
 }
 
-static inline void
-ns_to_timespec(struct timespec* timespec, i64 ns)
-{
-	timespec->tv_sec = ns / 1e9;
-	timespec->tv_nsec = ns % (i64)1e9;
-}
-
 // static void 
 // format_ns(char* buf, u64 max, i64 ns)
 // {
@@ -466,85 +706,108 @@ static void
 server_poll(server_t* server)
 {
 	i32 nfds;
-	i64 prev_frame_time_ns;
-	i64 elapsed_time_ns;
-	i64 timeout_time_ns = 0;
 	u32 errors = 0;
-	struct timespec timeout = {0};
-	hr_time_t current_time;
-	struct timespec* do_timeout = (server->clients.count == 0) ? NULL : &timeout;
 	struct epoll_event* event;
 
-
 	f64 current_time_s = server->timer.start_time_s;
 	f64 time_elapsed = current_time_s - server->last_stat_update;
 	
 	if (time_elapsed >= 1.0)
 	{
-		server->send_stats = true;
+		for (u32 i = 0; i < server->room_count; i++)
+			server_room_publish_stats(server->rooms + i);
+
+		server->stats.udp_pps_in = 0;
+		server->stats.udp_pps_in_bytes = 0;
+		server->stats.udp_rx.syscalls = 0;
+		server->stats.udp_rx.allocs = 0;
 
 		server->last_stat_update = current_time_s;
 	}
 
-	if (do_timeout)
+	server->tick_due = false;
+	server->tick_wakeup_ns = server_rooms_schedule(server);
+
+	if (server->uring)
+		server_uring_poll(server);
+	else
 	{
-		prev_frame_time_ns = server->timer.elapsed_time_ns;
-		server->stats.tick_time = prev_frame_time_ns;
-		server->tick_time_total += prev_frame_time_ns;
-		server->stats.tick_time_avg = server->tick_time_total / server->tick_count;
-		if (prev_frame_time_ns > server->stats.tick_time_highest)
-		{
-			server->stats.tick_time_highest = prev_frame_time_ns;
-			// format_ns(server->highest_frametime_str, FRAMETIME_LEN, prev_frame_time_ns);
-		}
-		timeout_time_ns = server->interval_ns - prev_frame_time_ns;
-		if (timeout_time_ns > 0)
-			ns_to_timespec(&timeout, timeout_time_ns);
-	}
+		if (server->tick_wakeup_ns)
+			server_tick_timer_arm(server->tick_fd, server->tick_wakeup_ns);
 
-	do {
-		do_timeout = (server->clients.count == 0) ? NULL : &timeout;
+		/* The tick timerfd ends the wait, so events never shorten or stretch it. */
+		do {
+			nfds = epoll_pwait2(server->epfd, server->ep_events, MAX_EVENTS, NULL, NULL);
+			if (nfds == -1)
+			{
+				if (errno == EINTR)
+					continue;
+				perror("epoll_pwait2");
+				errors++;
+				if (errors >= 3)
+				{
+					server->running = false;
+					break;
+				}
+			}
 
-		nfds = epoll_pwait2(server->epfd, server->ep_events, MAX_EVENTS, do_timeout, NULL);
-		if (nfds == -1)
-		{
-			if (errno == EINTR)
-				continue;
-			perror("epoll_pwait2");
-			errors++;
-			if (errors >= 3)
+			for (i32 i = 0; i < nfds; i++)
 			{
-				server->running = false;
-				break;
+				event = server->ep_events + i;
+				server_handle_event(server, event->data.ptr, event->events);
 			}
-		}
 
-		for (i32 i = 0; i < nfds; i++)
-		{
-			event = server->ep_events + i;
-			server_handle_event(server, event->data.ptr, event->events);
-		}
+			/* A room got its first client, start ticking it right away. */
+			if (server_rooms_woke(server))
+				break;
+		} while (server->tick_due == false && server->running);
+	}
 
-		if (do_timeout)
-		{
-			nano_gettime(&current_time);
-			elapsed_time_ns = nano_time_diff_ns(&server->timer.end_time, &current_time);
-			timeout_time_ns -= elapsed_time_ns;
-			memcpy(&server->timer.end_time, &current_time, sizeof(hr_time_t));
-			if (timeout_time_ns > 0)
-				ns_to_timespec(&timeout, timeout_time_ns);
-			else
-				timeout.tv_sec = timeout.tv_nsec = 0;
-		}
-	} while ((nfds || timeout_time_ns > 0) && server->running);
+	if (server->tick_due && server->tick_spin_ns && server->tick_deadline_ns)
+		server_tick_spin_until(server->tick_deadline_ns);
+}
+
+/* Network half of a room's tick, on the server thread after its simulation. */
+static void
+server_room_send(server_room_t* room)
+{
+	server_t* server = room->server;
+	hr_time_t start_time;
+	hr_time_t end_time;
+	i64 tick_time_ns;
+
+	nano_gettime(&start_time);
+	server->netdef.ssp_ctx.current_time = room->current_time;
+
+	server_update_aoi(room);
+	server_drain_game_events(room);
+	if (server->replication == SERVER_REPLICATION_SNAPSHOT)
+		server_replicate_snapshots(room);
+	server_flush_udp_clients(room);
+	mmframes_clear(&room->mmf);
+	room->tick_count++;
+
+	nano_gettime(&end_time);
+	tick_time_ns = room->timer.elapsed_time_ns + nano_time_diff_ns(&start_time, &end_time);
+	room->stats.tick_time = tick_time_ns;
+	room->tick_time_total += tick_time_ns;
+	room->stats.tick_time_avg = room->tick_time_total / room->tick_count;
+	if (tick_time_ns > room->stats.tick_time_highest)
+	{
+		room->stats.tick_time_highest = tick_time_ns;
+		// format_ns(server->highest_frametime_str, FRAMETIME_LEN, tick_time_ns);
+	}
 }
 
 void 
 server_run(server_t* server)
 {
+	u32 due;
+
 	if (server->running)
 	{
 		printf("Server is up & running!\n\t");
+		printf("Rooms:     %u\n\t", server->room_count);
 		printf("Tick rate: %.1f     (%fms interval).\n\t",
 				server->tickrate, server->interval * 1000.0);
 		printf("TCP port:  %u\n\t", server->port);
@@ -562,10 +825,14 @@ server_run(server_t* server)
 		server->current_time = server->timer.start_time_s;
 		server->netdef.ssp_ctx.current_time = server->current_time;
 
-		coregame_update(&server->game);
-		server_flush_udp_clients(server);
-		mmframes_clear(&server->mmf);
-		server->tick_count++;
+		server_drain_udp_workers(server);
+
+		/* Simulation of every due room in parallel, then their sends one by one. */
+		due = server_rooms_due(server, nano_time_ns(&server->timer.start_time));
+		server_rooms_update(server, due);
+		for (u32 i = 0; i < due; i++)
+			server_room_send(server->due_rooms[i]);
+		server_flush_tcp_clients(server);
 
 		nano_end_time(&server->timer);
 	}
@@ -580,36 +847,49 @@ server_cleanup_clients(server_t* server)
 		if (client->player)
 		{
 			ssp_io_push_ref(&client->tcp_io, NET_TCP_SERVER_SHUTDOWN, 0, NULL);
-			ssp_tcp_send_io(&client->tcp_sock, &client->tcp_io);
+			client_tcp_queue(server, client);
+			client_tcp_write(client, server->current_time);
 		}
 		server_close_client(server, client);
 	});
 
 	ght_destroy(&server->clients);
+	array_del(&server->tcp_pending);
 }
 
 void 
 server_cleanup(server_t* server)
 {
-	array_del(&server->packet_tx_buf);
+	server_free_udp_rx(server);
 	server_close_all_events(server);
 	server_cleanup_clients(server);
 	ssp_tcp_sock_close(&server->tcp_sock);
 	signalfd_close(server);
 	ssp_io_deinit(&server->io);
-	free(server->disk_map);
 
 	if (server->timerfd > 0 && close(server->timerfd) == -1)
 		perror("close timerfd");
+	if (server->tick_fd > 0 && close(server->tick_fd) == -1)
+		perror("close tick timerfd");
 
-	if (server->udp_fd > 0 && close(server->udp_fd) == -1)
+	if (server->udp_workers.count)
+	{
+		if (udp_workers_dropped(&server->udp_workers))
+			printf("UDP workers dropped %u datagrams.\n", udp_workers_dropped(&server->udp_workers));
+		udp_workers_destroy(&server->udp_workers);
+	}
+	else if (server->udp_fd > 0 && close(server->udp_fd) == -1)
 		perror("close udp fd");
 
 	if (server->epfd > 0 && close(server->epfd) == -1)
 		perror("close epoll");
-
-	coregame_cleanup(&server->game);
-	array_del(&server->spawn_points);
-	mmframes_free(&server->mmf);
+	server_uring_destroy(server);
+
+	for (u32 i = 0; i < server->room_count; i++)
+		server_room_cleanup(server->rooms + i);
+	free(server->rooms);
+	free(server->due_rooms);
+	array_del(&server->room_specs);
+	cg_jobs_destroy(server->jobs);
 	netdef_destroy(&server->netdef);
 }
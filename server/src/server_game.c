@@ -8,29 +8,30 @@ typedef struct
 } server_pong_t;
 
 void
-server_on_player_reload(cg_player_t* player, server_t* server)
+server_on_player_reload(cg_player_t* player, server_room_t* room)
 {
 	client_t* source_client = player->user_data;
 
-	net_udp_player_reload_t* reload_out = mmframes_alloc(&server->mmf, sizeof(net_udp_player_reload_t));
+	net_udp_player_reload_t* reload_out = mmframes_alloc(&room->mmf, sizeof(net_udp_player_reload_t));
 	reload_out->player_id = source_client->player->id;
 
-	server_add_data_all_udp_clients_i(server, NET_UDP_PLAYER_RELOAD, reload_out, sizeof(net_udp_player_reload_t), player->id);
+	server_add_data_all_udp_clients_i(room, NET_UDP_PLAYER_RELOAD, reload_out, sizeof(net_udp_player_reload_t), 
+									  player, player->id);
 }
 
 static net_tcp_new_player_t*
-client_to_tcp_new_player(server_t* server, const client_t* client)
+client_to_tcp_new_player(server_room_t* room, const client_t* client)
 {
 	const cg_player_t* player = client->player;
 
-	net_tcp_new_player_t* tcp_new_player = mmframes_alloc(&server->mmf, sizeof(net_tcp_new_player_t));
+	net_tcp_new_player_t* tcp_new_player = mmframes_alloc(&room->mmf, sizeof(net_tcp_new_player_t));
 	tcp_new_player->id = player->id;
 	tcp_new_player->gun_id = player->gun->spec->id;
-	tcp_new_player->pos = player->pos;
+	tcp_new_player->pos = CG_PLAYER_POS(player);
 	tcp_new_player->size = player->size;
-	tcp_new_player->dir = player->dir;
+	tcp_new_player->dir = CG_PLAYER_DIR(player);
 	tcp_new_player->cursor = player->cursor;
-	tcp_new_player->health = player->health;
+	tcp_new_player->health = CG_PLAYER_HEALTH(player);
 	tcp_new_player->max_health = player->max_health;
 	tcp_new_player->shoot = player->shoot;
 	strncpy(tcp_new_player->username, player->username, PLAYER_NAME_MAX);
@@ -39,10 +40,10 @@ client_to_tcp_new_player(server_t* server, const client_t* client)
 }
 
 static void 
-broadcast_new_player(server_t* server, client_t* new_client)
+broadcast_new_player(server_room_t* room, client_t* new_client)
 {
-	ght_t* clients = &server->clients;
-	const net_tcp_new_player_t* new_player = client_to_tcp_new_player(server, new_client);
+	ght_t* clients = &room->clients;
+	const net_tcp_new_player_t* new_player = client_to_tcp_new_player(room, new_client);
 
 	GHT_FOREACH(client_t* client, clients, {
 		if (client->player)
@@ -50,48 +51,52 @@ broadcast_new_player(server_t* server, client_t* new_client)
 			ssp_io_push_ref(&client->tcp_io, NET_TCP_NEW_PLAYER, sizeof(net_tcp_new_player_t), new_player);
 			if (client != new_client)
 			{
-				const net_tcp_new_player_t* other_player = client_to_tcp_new_player(server, client);
+				const net_tcp_new_player_t* other_player = client_to_tcp_new_player(room, client);
 				ssp_io_push_ref(&new_client->tcp_io, NET_TCP_NEW_PLAYER, sizeof(net_tcp_new_player_t), other_player);
 
-				ssp_tcp_send_io(&client->tcp_sock, &client->tcp_io);
+				client_tcp_queue(room->server, client);
 			}
 		}
 	});
-	ssp_tcp_send_io(&new_client->tcp_sock, &new_client->tcp_io);
+	client_tcp_queue(room->server, new_client);
 }
 
 void 
-broadcast_delete_player(server_t* server, u32 id)
+broadcast_delete_player(server_room_t* room, u32 id)
 {
-	ght_t* clients = &server->clients;
+	ght_t* clients = &room->clients;
 	net_tcp_delete_player_t del_player = {id};
 
 	GHT_FOREACH(client_t* client, clients, {
-		ssp_io_push_ref(&client->tcp_io, NET_TCP_DELETE_PLAYER, sizeof(net_tcp_delete_player_t), &del_player);
-		ssp_tcp_send_io(&client->tcp_sock, &client->tcp_io);
+		if (client->player)
+		{
+			ssp_io_push_ref(&client->tcp_io, NET_TCP_DELETE_PLAYER, sizeof(net_tcp_delete_player_t), &del_player);
+			client_tcp_queue(room->server, client);
+		}
 	});
 }
 
 void
-on_player_changed(cg_player_t* player, server_t* server)
+on_player_changed(cg_player_t* player, server_room_t* room)
 {
-	ght_t* clients = &server->clients;
-	net_udp_player_move_t* move = mmframes_alloc(&server->mmf, sizeof(net_udp_player_move_t));
+	ght_t* clients = &room->clients;
+	net_udp_player_move_t* move = mmframes_alloc(&room->mmf, sizeof(net_udp_player_move_t));
 	move->player_id = player->id;
-	move->pos = player->pos;
-	move->input = player->input;
+	move->pos = CG_PLAYER_POS(player);
+	move->input = CG_PLAYER_INPUT(player);
 	move->absolute = false;
 
 	GHT_FOREACH(client_t* client, clients, {
-		ssp_io_push_ref(&client->udp_io, NET_UDP_PLAYER_MOVE, sizeof(net_udp_player_move_t), move);
+		if (client_sees(client, player))
+			netdef_push_ref(&room->codec, &client->udp_io, NET_UDP_PLAYER_MOVE, sizeof(net_udp_player_move_t), move);
 	});
 }
 
 void
-server_on_player_gun_changed(cg_player_t* player, server_t* server)
+server_on_player_gun_changed(cg_player_t* player, server_room_t* room)
 {
-	ght_t* clients = &server->clients;
-	net_udp_player_gun_state_t* gun_state_out = mmframes_alloc(&server->mmf, sizeof(net_udp_player_gun_state_t));
+	ght_t* clients = &room->clients;
+	net_udp_player_gun_state_t* gun_state_out = mmframes_alloc(&room->mmf, sizeof(net_udp_player_gun_state_t));
 	const cg_gun_t* gun = player->gun;
 
 	gun_state_out->player_id = player->id;
@@ -103,77 +108,69 @@ server_on_player_gun_changed(cg_player_t* player, server_t* server)
 
 	GHT_FOREACH(client_t* client, clients, 
 	{
-		ssp_io_push_ref_i(&client->udp_io, NET_UDP_PLAYER_GUN_STATE, sizeof(net_udp_player_gun_state_t), gun_state_out);
+		if (client_sees(client, player))
+			netdef_push_ref_i(&room->codec, &client->udp_io, NET_UDP_PLAYER_GUN_STATE, sizeof(net_udp_player_gun_state_t), gun_state_out);
 	});
 }
 
-static void 
-serialize_bullet(net_udp_bullet_t* out_bullet, cg_bullet_t* bullet, UNUSED u16 size)
-{
-	out_bullet->owner_id = bullet->owner_id;
-	out_bullet->pos = bullet->r.pos;
-	out_bullet->dir = bullet->dir;
-	out_bullet->gun_id = bullet->gun_id;
-}
-
-static inline void
-server_send_rewind_bullet(client_t* client, cg_bullet_t* bullet)
+static void
+server_on_bullet_create(server_room_t* room, const cg_event_t* event)
 {
-	if (client->player == NULL || client->player->id == bullet->owner_id)
+	if (event->rewinding == false)
 		return;
 
-	ssp_io_push_hook_ref_i(&client->udp_io, NET_UDP_BULLET, sizeof(net_udp_bullet_t), bullet, 
-					   (ssp_copy_hook_t)serialize_bullet);
-}
-
-void
-server_on_bullet_create(cg_bullet_t* bullet, server_t* server)
-{
-	if (server->game.rewinding == false)
-		return;
+	ght_t* clients = &room->clients;
+	net_udp_bullet_t* bullet = mmframes_alloc(&room->mmf, sizeof(net_udp_bullet_t));
+	bullet->owner_id = event->bullet.owner_id;
+	bullet->pos = event->bullet.pos;
+	bullet->dir = event->bullet.dir;
+	bullet->gun_id = event->bullet.gun_id;
 
-	ght_t* clients = &server->clients;
 	GHT_FOREACH(client_t* client, clients, 
 	{
-		server_send_rewind_bullet(client, bullet);
+		if (client->player && client->player->id != bullet->owner_id)
+			netdef_push_ref_i(&room->codec, &client->udp_io, NET_UDP_BULLET, sizeof(net_udp_bullet_t), bullet);
 	});
 }
 
 void
-on_player_damaged(cg_player_t* target_player, cg_player_t* attacker_player, server_t* server)
+on_player_damaged(cg_player_t* target_player, cg_player_t* attacker_player, server_room_t* room)
 {
-	ght_t* clients = &server->clients;
-	net_udp_player_health_t* health = mmframes_alloc(&server->mmf, sizeof(net_udp_player_health_t));
+	ght_t* clients = &room->clients;
+	net_udp_player_health_t* health = mmframes_alloc(&room->mmf, sizeof(net_udp_player_health_t));
 	net_udp_player_move_t* move = NULL;
 	net_udp_player_stats_t* target_stats;
 	net_udp_player_stats_t* attacker_stats;
 	net_udp_player_died_t* player_died;
+	const bool push_health = (room->server->replication == SERVER_REPLICATION_EVENTS);
 	health->player_id = target_player->id;
-	health->health = target_player->health;
+	health->health = CG_PLAYER_HEALTH(target_player);
 
-	if (target_player->health <= 0)
+	if (CG_PLAYER_HEALTH(target_player) <= 0)
 	{
-		sbsm_delete_player(server->game.sbsm, target_player);
+		sbsm_delete_player(room->game.sbsm, target_player);
 
-		move = mmframes_alloc(&server->mmf, sizeof(net_udp_player_move_t));
+		move = mmframes_alloc(&room->mmf, sizeof(net_udp_player_move_t));
 		move->player_id = target_player->id;
 		move->absolute = true;
-		target_player->pos = move->pos = server_next_spawn(server);
-		target_player->health = health->health = target_player->max_health;
+		move->pos = server_next_spawn(room);
+		coregame_set_player_pos(&room->game, target_player, move->pos);
+		CG_PLAYER_HEALTH(target_player) = health->health = target_player->max_health;
+		target_player->dirty = true;
 
 		attacker_player->stats.kills++;
 		target_player->stats.deaths++;
 
-		player_died = mmframes_alloc(&server->mmf, sizeof(net_udp_player_died_t));
+		player_died = mmframes_alloc(&room->mmf, sizeof(net_udp_player_died_t));
 		player_died->target_player_id = target_player->id;
 		player_died->attacker_player_id = attacker_player->id;
 
-		target_stats = mmframes_alloc(&server->mmf, sizeof(net_udp_player_stats_t));
+		target_stats = mmframes_alloc(&room->mmf, sizeof(net_udp_player_stats_t));
 		target_stats->player_id = target_player->id;
 		target_stats->kills = target_player->stats.kills;
 		target_stats->deaths = target_player->stats.deaths;
 
-		attacker_stats = mmframes_alloc(&server->mmf, sizeof(net_udp_player_stats_t));
+		attacker_stats = mmframes_alloc(&room->mmf, sizeof(net_udp_player_stats_t));
 		attacker_stats->player_id = attacker_player->id;
 		attacker_stats->kills = attacker_player->stats.kills;
 		attacker_stats->deaths = attacker_player->stats.deaths;
@@ -182,71 +179,417 @@ on_player_damaged(cg_player_t* target_player, cg_player_t* attacker_player, serv
 	}
 
 	GHT_FOREACH(client_t* client, clients, {
-		ssp_io_push_ref_i(&client->udp_io, NET_UDP_PLAYER_HEALTH, sizeof(net_udp_player_health_t), health);
+		if (push_health)
+			netdef_push_ref_i(&room->codec, &client->udp_io, NET_UDP_PLAYER_HEALTH, sizeof(net_udp_player_health_t), health);
 		if (move)
+			netdef_push_ref_i(&room->codec, &client->udp_io, NET_UDP_PLAYER_MOVE, sizeof(net_udp_player_move_t), move);
+	});
+
+	if (move)
+	{
+		server_add_shared_udp(room, NET_UDP_PLAYER_DIED, player_died, sizeof(net_udp_player_died_t));
+		server_add_shared_udp(room, NET_UDP_PLAYER_STATS, target_stats, sizeof(net_udp_player_stats_t));
+		server_add_shared_udp(room, NET_UDP_PLAYER_STATS, attacker_stats, sizeof(net_udp_player_stats_t));
+	}
+}
+
+/**
+ *	Drains the coregame event journal once per tick, after the simulation
+ *	is done, so no network work is interleaved with the update loops.
+ */
+void
+server_drain_game_events(server_room_t* room)
+{
+	coregame_t* cg = &room->game;
+	const bool snapshots = (room->server->replication == SERVER_REPLICATION_SNAPSHOT);
+	cg_player_t* player;
+	cg_player_t* attacker;
+
+	for (u32 i = 0; i < cg->events.count; i++)
+	{
+		const cg_event_t* event = (const cg_event_t*)cg->events.buf + i;
+
+		if (event->type == CG_EVENT_BULLET_CREATE)
+		{
+			server_on_bullet_create(room, event);
+			continue;
+		}
+
+		if ((player = cg_registry_get(&cg->players, event->id)) == NULL)
+			continue;
+
+		switch (event->type)
+		{
+			case CG_EVENT_PLAYER_CHANGED:
+				if (snapshots == false)
+					on_player_changed(player, room);
+				break;
+			case CG_EVENT_PLAYER_GUN_CHANGED:
+				if (snapshots == false)
+					server_on_player_gun_changed(player, room);
+				break;
+			case CG_EVENT_PLAYER_RELOAD:
+				server_on_player_reload(player, room);
+				break;
+			case CG_EVENT_PLAYER_DAMAGED:
+				if ((attacker = cg_registry_get(&cg->players, event->damaged.attacker_id)))
+					on_player_damaged(player, attacker, room);
+				break;
+			default:
+				break;
+		}
+	}
+	coregame_clear_events(cg);
+}
+
+typedef struct
+{
+	vec2i_t min;
+	vec2i_t max;
+} server_aoi_window_t;
+
+static inline vec2i_t
+server_player_cell(const cg_runtime_map_t* map, const cg_player_t* player)
+{
+	return (vec2i_t){
+		floorf((CG_PLAYER_POS(player).x + player->size.x * 0.5) / map->grid_size),
+		floorf((CG_PLAYER_POS(player).y + player->size.y * 0.5) / map->grid_size),
+	};
+}
+
+/**
+ *	Cells around the client's player covering its view plus a margin,
+ *	clipped to the map. `aoi.view` is capped when it arrives, so `half`
+ *	stays in range.
+ */
+static server_aoi_window_t
+server_aoi_window(const server_room_t* room, const client_t* client)
+{
+	const cg_runtime_map_t* map = room->game.map;
+	const vec2i_t last = { (i32)map->w - 1, (i32)map->h - 1 };
+	const vec2i_t center = server_player_cell(map, client->player);
+	const vec2i_t half = {
+		ceilf(client->aoi.view.x * 0.5 / map->grid_size) + SERVER_AOI_MARGIN,
+		ceilf(client->aoi.view.y * 0.5 / map->grid_size) + SERVER_AOI_MARGIN,
+	};
+
+	if (client->aoi.view.x <= 0 || client->aoi.view.y <= 0)
+		return (server_aoi_window_t){ {0, 0}, last };
+
+	return (server_aoi_window_t){
+		{clampi(center.x - half.x, 0, last.x), clampi(center.y - half.y, 0, last.y)},
+		{clampi(center.x + half.x, 0, last.x), clampi(center.y + half.y, 0, last.y)},
+	};
+}
+
+static inline bool
+server_aoi_inside(const server_aoi_window_t* window, vec2i_t cell)
+{
+	return cell.x >= window->min.x && cell.x <= window->max.x &&
+		   cell.y >= window->min.y && cell.y <= window->max.y;
+}
+
+static void
+server_aoi_enter(server_room_t* room, client_t* client, const cg_player_t* player)
+{
+	net_udp_player_enter_t* enter = mmframes_alloc(&room->mmf, sizeof(net_udp_player_enter_t));
+
+	enter->player_id = player->id;
+	enter->pos = CG_PLAYER_POS(player);
+	enter->cursor = player->cursor;
+	enter->health = CG_PLAYER_HEALTH(player);
+	enter->input = CG_PLAYER_INPUT(player);
+	enter->gun_id = (player->gun) ? player->gun->spec->id : 0;
+	enter->ammo = (player->gun) ? player->gun->ammo : 0;
+
+	client->aoi.seen[CG_HANDLE_SLOT(player->id)] = player->id;
+	client->aoi.ids[client->aoi.count++] = player->id;
+	netdef_push_ref_i(&room->codec, &client->udp_io, NET_UDP_PLAYER_ENTER, sizeof(net_udp_player_enter_t), enter);
+}
+
+static void
+server_aoi_leave(server_room_t* room, client_t* client, u32 slot)
+{
+	net_udp_player_leave_t* leave = mmframes_alloc(&room->mmf, sizeof(net_udp_player_leave_t));
+
+	leave->player_id = client->aoi.seen[slot];
+	client->aoi.seen[slot] = 0;
+	netdef_push_ref_i(&room->codec, &client->udp_io, NET_UDP_PLAYER_LEAVE, sizeof(net_udp_player_leave_t), leave);
+}
+
+/**
+ *	Only looks at the players linked into the cells under the window, and
+ *	at the ones the client already sees for who left it, instead of at
+ *	every player in the room.
+ */
+static void
+server_update_client_aoi(server_room_t* room, client_t* client)
+{
+	cg_registry_t* players = &room->game.players;
+	const cg_runtime_map_t* map = room->game.map;
+	const server_aoi_window_t window = server_aoi_window(room, client);
+	/* Occupancy is a step ahead of the position the window is tested with. */
+	const i32 lead = ceilf(PLAYER_SPEED * room->interval / map->grid_size);
+	const i32 x_end = clampi(window.max.x + lead, 0, (i32)map->w - 1);
+	const i32 y_end = clampi(window.max.y + lead, 0, (i32)map->h - 1);
+
+	if (client->aoi.seen_size < players->sparse_size)
+	{
+		client->aoi.seen = realloc(client->aoi.seen, sizeof(u32) * players->sparse_size);
+		client->aoi.ids = realloc(client->aoi.ids, sizeof(u32) * players->sparse_size);
+		memset(client->aoi.seen + client->aoi.seen_size, 0, 
+			   sizeof(u32) * (players->sparse_size - client->aoi.seen_size));
+		client->aoi.seen_size = players->sparse_size;
+	}
+
+	for (u32 i = 0; i < client->aoi.count; )
+	{
+		const u32 player_id = client->aoi.ids[i];
+		const u32 slot = CG_HANDLE_SLOT(player_id);
+		const cg_player_t* player = cg_registry_get(players, player_id);
+
+		if (player && server_aoi_inside(&window, server_player_cell(map, player)))
+		{
+			i++;
+			continue;
+		}
+
+		/* Deleted players, the client already knows from NET_TCP_DELETE_PLAYER. */
+		if (player)
+			server_aoi_leave(room, client, slot);
+		else if (client->aoi.seen[slot] == player_id)
+			client->aoi.seen[slot] = 0;
+		client->aoi.ids[i] = client->aoi.ids[--client->aoi.count];
+	}
+
+	for (i32 y = clampi(window.min.y - lead, 0, y_end); y <= y_end; y++)
+	{
+		for (i32 x = clampi(window.min.x - lead, 0, x_end); x <= x_end; x++)
 		{
-			ssp_io_push_ref_i(&client->udp_io, NET_UDP_PLAYER_MOVE, sizeof(net_udp_player_move_t), move);
-			ssp_io_push_ref(&client->udp_io, NET_UDP_PLAYER_DIED, sizeof(net_udp_player_died_t), player_died);
-			ssp_io_push_ref(&client->udp_io, NET_UDP_PLAYER_STATS, sizeof(net_udp_player_stats_t), target_stats);
-			ssp_io_push_ref(&client->udp_io, NET_UDP_PLAYER_STATS, sizeof(net_udp_player_stats_t), attacker_stats);
+			const cg_empty_cell_data_t* data = cg_map_occupancy(map, map->cells + (y * map->w) + x);
+
+			if (data == NULL)
+				continue;
+
+			/* Players span several cells, `seen` already has the ones entered through another. */
+			for (const cg_cell_node_t* node = data->head; node; node = node->next)
+			{
+				const cg_player_t* player = node->player;
+
+				if (player == client->player || client->aoi.seen[CG_HANDLE_SLOT(player->id)] == player->id)
+					continue;
+				if (server_aoi_inside(&window, server_player_cell(map, player)))
+					server_aoi_enter(room, client, player);
+			}
 		}
+	}
+}
+
+/**
+ *	Interest management. Every client sees only the players within a window
+ *	of map cells around its own, sized by its view. Players crossing the
+ *	window edge are sent as enter/leave events, everything else about a
+ *	player goes only to clients that see it.
+ */
+void
+server_update_aoi(server_room_t* room)
+{
+	ght_t* clients = &room->clients;
+
+	GHT_FOREACH(client_t* client, clients, 
+	{
+		if (client->player)
+			server_update_client_aoi(room, client);
+	});
+}
+
+static void
+server_snapshot_to_state(net_player_state_t* state, const cg_player_snapshot_t* pss)
+{
+	if (pss->player_id == 0)
+	{
+		memset(state, 0, sizeof(net_player_state_t));
+		return;
+	}
+
+	state->player_id = pss->player_id;
+	state->pos = pss->pos;
+	state->input = pss->input;
+	state->health = pss->health;
+	state->cursor = pss->cursor;
+	state->gun_id = pss->gun_id;
+	state->ammo = pss->ammo;
+	state->bullet_timer = pss->bullet_timer;
+	state->charge_timer = pss->charge_timer;
+	state->reload_timer = pss->reload_timer;
+}
+
+static void
+server_send_snapshot(server_room_t* room, client_t* client, u32 seq, 
+					 const net_player_state_t* all, u32 slots)
+{
+	const net_player_state_t* base;
+	net_player_state_t* cur;
+	net_udp_snapshot_t* out;
+	u32 size;
+
+	if (client->player == NULL || seq == client->snapshot_sent)
+		return;
+
+	/* Players outside the area of interest are left out, as if they weren't there. */
+	cur = mmframes_alloc(&room->mmf, sizeof(net_player_state_t) * slots);
+	for (u32 i = 0; i < slots; i++)
+	{
+		const bool seen = (all[i].player_id == client->player->id ||
+						   (i < client->aoi.seen_size && client->aoi.seen[i] == all[i].player_id));
+
+		if (all[i].player_id && seen)
+			cur[i] = all[i];
+		else
+			memset(cur + i, 0, sizeof(net_player_state_t));
+	}
+
+	net_snapshot_ring_reserve(&client->snapshots, slots);
+	base = net_snapshot_ring_get(&client->snapshots, client->snapshot_acked);
+
+	/* Capped at the MTU, whatever doesn't fit goes out in the next tick's snapshot. */
+	out = mmframes_alloc(&room->mmf, NET_SNAPSHOT_MAX_SIZE);
+	out->seq = seq;
+	out->baseline = (base) ? client->snapshot_acked : NET_SNAPSHOT_NONE;
+	size = net_snapshot_write(out, base, cur, slots, &client->snapshot_first);
+
+	/* Nothing changed since the baseline, don't spend a ring frame on it. */
+	if (out->count == 0 && base)
+		return;
+
+	memcpy(net_snapshot_ring_put(&client->snapshots, seq), cur, sizeof(net_player_state_t) * slots);
+	client->snapshot_sent = seq;
+
+	ssp_io_push_ref(&client->udp_io, NET_UDP_SNAPSHOT, size, out);
+}
+
+/**
+ *	Sends every client the present sbsm snapshot as a delta against the
+ *	last one it acked. Lost snapshots are never resent, the next delta
+ *	covers whatever they carried.
+ */
+void
+server_replicate_snapshots(server_room_t* room)
+{
+	const cg_sbsm_t* sbsm = room->game.sbsm;
+	const cg_game_snapshot_t* ss = sbsm->present;
+	const u32 slots = sbsm->player_slots;
+	ght_t* clients = &room->clients;
+	net_player_state_t* cur;
+
+	if (slots == 0)
+		return;
+
+	cur = mmframes_alloc(&room->mmf, sizeof(net_player_state_t) * slots);
+	for (u32 i = 0; i < slots; i++)
+		server_snapshot_to_state(cur + i, ss->players + i);
+
+	GHT_FOREACH(client_t* client, clients, 
+	{
+		server_send_snapshot(room, client, ss->seq, cur, slots);
 	});
 }
 
+/**
+ *	Joins the client to a room and advertises its map by hash, so a
+ *	client with the map cached doesn't get sent the blob. The player is
+ *	only created once the client answers with NET_TCP_CG_MAP_REQUEST.
+ */
 void 
 client_tcp_connect(const ssp_segment_t* segment, server_t* server, client_t* client)
 {
-	net_tcp_sessionid_t* session = mmframes_alloc(&server->mmf, sizeof(net_tcp_sessionid_t));
-	net_tcp_udp_info_t* udp_info = mmframes_alloc(&server->mmf, sizeof(net_tcp_udp_info_t));
+	const net_tcp_connect_t* connect = (net_tcp_connect_t*)segment->data;
+	server_room_t* room;
+	net_tcp_cg_map_info_t map_info;
+
+	if (client->room)
+		return;
+
+	room = client->room = server_room_pick(server);
+	ght_insert(&room->clients, client->session_id, client);
+	strncpy(client->username, connect->username, PLAYER_NAME_MAX - 1);
+
+	map_info.hash = room->map->hash;
+	map_info.size = room->map->disk_size;
+	ssp_io_push_ref(&client->tcp_io, NET_TCP_CG_MAP_INFO, sizeof(net_tcp_cg_map_info_t), &map_info);
+	client_tcp_queue(server, client);
+}
+
+void 
+client_tcp_map_request(const ssp_segment_t* segment, server_t* server, client_t* client)
+{
+	const net_tcp_cg_map_request_t* request = (const net_tcp_cg_map_request_t*)segment->data;
+	server_room_t* room = client->room;
+
+	if (room == NULL || client->player)
+		return;
+
+	net_tcp_sessionid_t* session = mmframes_alloc(&room->mmf, sizeof(net_tcp_sessionid_t));
+	net_tcp_udp_info_t* udp_info = mmframes_alloc(&room->mmf, sizeof(net_tcp_udp_info_t));
 
 	udp_info->port = server->udp_port;
-	udp_info->tickrate = server->tickrate;
+	udp_info->tickrate = room->tickrate;
 	udp_info->ssp_flags = SSP_FLAGS;
-	udp_info->time = server->game.sbsm->present->timestamp;
+	udp_info->time = room->game.sbsm->present->timestamp;
 
-	const net_tcp_connect_t* connect = (net_tcp_connect_t*)segment->data;
-
-	client->player = coregame_add_player(&server->game, connect->username);
+	if ((client->player = coregame_add_player(&room->game, client->username)) == NULL)
+	{
+		fprintf(stderr, "Client '%s' (%s) can't join room %u: No player IDs left.\n",
+				client->username, client->tcp_sock.ipstr, room->id);
+		ght_del(&room->clients, client->session_id);
+		client->room = NULL;
+		client_tcp_refuse(server, client);
+		return;
+	}
 	client->player->user_data = client;
-	coregame_create_gun(&server->game, CG_GUN_ID_SMALL, client->player);
+	coregame_create_gun(&room->game, CG_GUN_ID_SMALL, client->player);
 
-	client->player->pos = server_next_spawn(server);
+	coregame_set_player_pos(&room->game, client->player, server_next_spawn(room));
 
 	session->session_id = client->session_id;
 	session->player_id = client->player->id;
 
-	printf("Client '%s' (%s) got %u for session ID.\n", 
-			connect->username, client->tcp_sock.ipstr, session->session_id);
+	printf("Client '%s' (%s) got %u for session ID, joined room %u%s.\n", 
+			client->username, client->tcp_sock.ipstr, session->session_id, room->id,
+			(request->want_map) ? "" : " (map cached)");
 
 	ssp_io_push_ref(&client->tcp_io, NET_TCP_SESSION_ID, sizeof(net_tcp_sessionid_t), session);
-	ssp_io_push_ref(&client->tcp_io, NET_TCP_CG_MAP, server->disk_map_size, server->disk_map);
+	if (request->want_map)
+		ssp_io_push_ref(&client->tcp_io, NET_TCP_CG_MAP, room->map->disk_size, room->map->disk);
 	ssp_io_push_ref(&client->tcp_io, NET_TCP_UDP_INFO, sizeof(net_tcp_udp_info_t), udp_info);
 
-	const cg_gun_spec_t* gun_specs = (const cg_gun_spec_t*)server->game.gun_specs.buf;
-	for (u32 i = 0; i < server->game.gun_specs.count; i++)
+	const cg_gun_spec_t* gun_specs = (const cg_gun_spec_t*)room->game.gun_specs.buf;
+	for (u32 i = 0; i < room->game.gun_specs.count; i++)
 		ssp_io_push_ref(&client->tcp_io, NET_TCP_GUN_SPEC, sizeof(cg_gun_spec_t), gun_specs + i);
 
-	broadcast_new_player(server, client);
-
-	server->stats.tcp_connections = server->clients.count;
-	server->stats.players = server->game.players.count;
+	broadcast_new_player(room, client);
 }
 
 void 
 player_cursor(const ssp_segment_t* segment, server_t* server, client_t* source_client)
 {
-	ght_t* clients = &server->clients;
+	server_room_t* room = source_client->room;
+	ght_t* clients = &room->clients;
 
 	const net_udp_player_cursor_t* cursor = (const net_udp_player_cursor_t*)segment->data;
 	source_client->player->cursor = cursor->cursor_pos;
+	source_client->player->dirty = true;
+
+	if (server->replication == SERVER_REPLICATION_SNAPSHOT)
+		return;
 
-	net_udp_player_cursor_t* new_cursor = mmframes_alloc(&server->mmf, sizeof(net_udp_player_cursor_t));
+	net_udp_player_cursor_t* new_cursor = mmframes_alloc(&room->mmf, sizeof(net_udp_player_cursor_t));
 	new_cursor->cursor_pos = cursor->cursor_pos;
 	new_cursor->player_id = source_client->player->id;
 
 	GHT_FOREACH(client_t* client, clients, {
-		if (client != source_client)
-			ssp_io_push_ref(&client->udp_io, NET_UDP_PLAYER_CURSOR, sizeof(net_udp_player_cursor_t), new_cursor);
+		if (client != source_client && client_sees(client, source_client->player))
+			netdef_push_ref(&room->codec, &client->udp_io, NET_UDP_PLAYER_CURSOR, sizeof(net_udp_player_cursor_t), new_cursor);
 	});
 }
 
@@ -262,13 +605,14 @@ udp_ping_set_client_time(net_udp_pingpong_t* dst, const server_pong_t* src, UNUS
 }
 
 void 
-udp_ping(const ssp_segment_t* segment, server_t* server, client_t* source_client)
+udp_ping(const ssp_segment_t* segment, UNUSED server_t* server, client_t* source_client)
 {
+	server_room_t* room = source_client->room;
 	const net_udp_pingpong_t* in_ping = (const net_udp_pingpong_t*)segment->data;
-	server_pong_t* out_pong = mmframes_alloc(&server->mmf, sizeof(server_pong_t));
+	server_pong_t* out_pong = mmframes_alloc(&room->mmf, sizeof(server_pong_t));
 
 	out_pong->t_client_s = in_ping->t_client_s;
-	out_pong->t_server_ms = server->game.sbsm->present->timestamp;
+	out_pong->t_server_ms = room->game.sbsm->present->timestamp;
 	out_pong->recv_s = segment->packet->timestamp;
 
 	ssp_io_push_hook_ref(&source_client->udp_io, NET_UDP_PONG, sizeof(net_udp_pingpong_t), out_pong, 
@@ -276,8 +620,9 @@ udp_ping(const ssp_segment_t* segment, server_t* server, client_t* source_client
 }
 
 void 
-player_ping(const ssp_segment_t* segment, server_t* server, client_t* source_client)
+player_ping(const ssp_segment_t* segment, UNUSED server_t* server, client_t* source_client)
 {
+	server_room_t* room = source_client->room;
 	const net_udp_player_ping_t* og_client_ping = (const net_udp_player_ping_t*)segment->data;
 	if (og_client_ping->ms < 0)
 	{
@@ -285,18 +630,15 @@ player_ping(const ssp_segment_t* segment, server_t* server, client_t* source_cli
 		return;
 	}
 
-	net_udp_player_ping_t* client_ping = mmframes_alloc(&server->mmf, sizeof(net_udp_player_ping_t));
-	ght_t* clients = &server->clients;
+	net_udp_player_ping_t* client_ping = mmframes_alloc(&room->mmf, sizeof(net_udp_player_ping_t));
 
 	ssp_io_set_rtt(&source_client->udp_io, og_client_ping->ms);
 
 	client_ping->ms = og_client_ping->ms;
 	client_ping->player_id = source_client->player->id;
 
-	GHT_FOREACH(client_t* client, clients, {
-		if (client != source_client)
-			ssp_io_push_ref(&client->udp_io, NET_UDP_PLAYER_PING, sizeof(net_udp_player_ping_t), client_ping);
-	});
+	/* The source gets its own ping back too, same value it measured. */
+	server_add_shared_udp(room, NET_UDP_PLAYER_PING, client_ping, sizeof(net_udp_player_ping_t));
 }
 
 void 
@@ -310,39 +652,44 @@ want_server_stats(const ssp_segment_t* segment, UNUSED server_t* server, client_
 void 
 chat_msg(const ssp_segment_t* segment, server_t* server, client_t* source_client)
 {
-	ght_t* clients = &server->clients;
+	server_room_t* room = source_client->room;
+	ght_t* clients;
 	const net_tcp_chat_msg_t* src_msg = (const void*)segment->data;
-	net_tcp_chat_msg_t new_msg = {
-		.player_id = source_client->player->id
-	};
+	net_tcp_chat_msg_t new_msg = {0};
+	if (room == NULL || source_client->player == NULL)
+		return;
+
+	clients = &room->clients;
+	new_msg.player_id = source_client->player->id;
 	strncpy(new_msg.msg, src_msg->msg, CHAT_MSG_MAX);
 
 	GHT_FOREACH(client_t* client, clients, {
 		if (client->player)
 		{
 			ssp_io_push_ref(&client->tcp_io, NET_TCP_CHAT_MSG, sizeof(net_tcp_chat_msg_t), &new_msg);
-			ssp_tcp_send_io(&client->tcp_sock, &client->tcp_io);
+			client_tcp_queue(server, client);
 		}
 	});
 }
 
 void 
-player_gun_id(const ssp_segment_t* segment, server_t* server, client_t* source_client)
+player_gun_id(const ssp_segment_t* segment, UNUSED server_t* server, client_t* source_client)
 {
-	ght_t* clients = &server->clients;
+	server_room_t* room = source_client->room;
+	ght_t* clients = &room->clients;
 	const net_udp_player_gun_id_t* player_gun_id = (const net_udp_player_gun_id_t*)segment->data;
 	net_udp_player_gun_id_t* udp_player_gun_id;
 
-	udp_player_gun_id = mmframes_alloc(&server->mmf, sizeof(net_udp_player_gun_id_t));
+	udp_player_gun_id = mmframes_alloc(&room->mmf, sizeof(net_udp_player_gun_id_t));
 	udp_player_gun_id->player_id = source_client->player->id;
 
-	if (coregame_player_change_gun(&server->game, source_client->player, player_gun_id->gun_id))
+	if (coregame_player_change_gun(&room->game, source_client->player, player_gun_id->gun_id))
 	{
 		udp_player_gun_id->gun_id = player_gun_id->gun_id;
 
 		GHT_FOREACH(client_t* client, clients, {
 			if (client->player)
-				ssp_io_push_ref_i(&client->udp_io, NET_UDP_PLAYER_GUN_ID, sizeof(net_udp_player_gun_id_t), udp_player_gun_id);
+				netdef_push_ref_i(&room->codec, &client->udp_io, NET_UDP_PLAYER_GUN_ID, sizeof(net_udp_player_gun_id_t), udp_player_gun_id);
 		});
 	}
 	else
@@ -350,18 +697,19 @@ player_gun_id(const ssp_segment_t* segment, server_t* server, client_t* source_c
 		/* If changing gun failed, the the source client know */
 		udp_player_gun_id->gun_id = source_client->player->gun->spec->id;
 
-		ssp_io_push_ref_i(&source_client->udp_io, NET_UDP_PLAYER_GUN_ID, sizeof(net_udp_player_gun_id_t), udp_player_gun_id);
+		netdef_push_ref_i(&room->codec, &source_client->udp_io, NET_UDP_PLAYER_GUN_ID, sizeof(net_udp_player_gun_id_t), udp_player_gun_id);
 	}
 }
 
 void 
-player_input(const ssp_segment_t* segment, server_t* server, client_t* source_client)
+player_input(const ssp_segment_t* segment, UNUSED server_t* server, client_t* source_client)
 {
-	ght_t* clients = &server->clients;
+	server_room_t* room = source_client->room;
+	ght_t* clients = &room->clients;
 	const net_udp_player_input_t* input_in = (void*)segment->data;
-	net_udp_player_input_t* input_out = mmframes_alloc(&server->mmf, sizeof(net_udp_player_input_t));
+	net_udp_player_input_t* input_out = mmframes_alloc(&room->mmf, sizeof(net_udp_player_input_t));
 
-	coregame_set_player_input_t(&server->game, source_client->player, input_in->flags, input_in->timestamp);
+	coregame_set_player_input_t(&room->game, source_client->player, input_in->flags, input_in->timestamp);
 
 	input_out->player_id = source_client->player->id;
 	input_out->flags = input_in->flags;
@@ -369,24 +717,25 @@ player_input(const ssp_segment_t* segment, server_t* server, client_t* source_cl
 
 	GHT_FOREACH(client_t* client, clients, 
 	{
-		if (client->player && client != source_client)
-			ssp_io_push_ref_i(&client->udp_io, NET_UDP_PLAYER_INPUT, sizeof(net_udp_player_input_t), input_out);
+		if (client->player && client != source_client && client_sees(client, source_client->player))
+			netdef_push_ref_i(&room->codec, &client->udp_io, NET_UDP_PLAYER_INPUT, sizeof(net_udp_player_input_t), input_out);
 	});
 }
 
 void 
-player_reload(UNUSED const ssp_segment_t* segment, server_t* server, client_t* source_client)
+player_reload(UNUSED const ssp_segment_t* segment, UNUSED server_t* server, client_t* source_client)
 {
 	source_client->player->gun->ammo = 0;
 
-	server_on_player_reload(source_client->player, server);
+	server_on_player_reload(source_client->player, source_client->room);
 }
 
 void 
 bot_mode(const ssp_segment_t* segment, server_t* server, client_t* source_client)
 {
+	server_room_t* room = source_client->room;
 	const net_tcp_bot_mode_t* mode = (const void*)segment->data;
-	if (mode->is_bot == source_client->bot)
+	if (source_client->player == NULL || mode->is_bot == source_client->bot)
 		return;
 
 	source_client->bot = mode->is_bot;
@@ -408,38 +757,70 @@ bot_mode(const ssp_segment_t* segment, server_t* server, client_t* source_client
 	username_out.player_id = source_client->player->id;
 	strncpy(username_out.username, source_client->player->username, PLAYER_NAME_MAX);
 
-	ght_t* clients = &server->clients;
+	ght_t* clients = &room->clients;
 	GHT_FOREACH(client_t* client, clients, 
 	{
 		if (client->player)
 		{
 			ssp_io_push_ref(&client->tcp_io, NET_TCP_USERNAME_CHANGE, sizeof(net_tcp_username_change_t), &username_out);
-			ssp_tcp_send_io(&client->tcp_sock, &client->tcp_io);
+			client_tcp_queue(server, client);
 		}
 	});
 }
 
 void 
-move_bot(const ssp_segment_t* segment, server_t* server, client_t* source_client)
+move_bot(const ssp_segment_t* segment, UNUSED server_t* server, client_t* source_client)
 {
+	server_room_t* room = source_client->room;
 	if (source_client->bot)
 		return;
 
 	const net_udp_move_bot_t* move_bot = (const void*)segment->data;
 
-	ght_t* clients = &server->clients;
+	ght_t* clients = &room->clients;
 	GHT_FOREACH(client_t* client, clients, 
 	{
 		if (client->player && client->bot)
 		{
-			client->player->pos = move_bot->pos;
+			coregame_set_player_pos(&room->game, client->player, move_bot->pos);
 
-			net_udp_player_move_t* move_out = mmframes_alloc(&server->mmf, sizeof(net_udp_player_move_t));
+			net_udp_player_move_t* move_out = mmframes_alloc(&room->mmf, sizeof(net_udp_player_move_t));
 			move_out->player_id = client->player->id;
-			move_out->pos = client->player->pos;
+			move_out->pos = CG_PLAYER_POS(client->player);
 			move_out->absolute = true;
 
-			server_add_data_all_udp_clients_i(server, NET_UDP_PLAYER_MOVE, move_out, sizeof(net_udp_player_move_t), 0);
+			server_add_data_all_udp_clients_i(room, NET_UDP_PLAYER_MOVE, move_out, sizeof(net_udp_player_move_t), 
+											  client->player, 0);
 		}
 	});
 }
+
+void 
+snapshot_ack(const ssp_segment_t* segment, UNUSED server_t* server, client_t* source_client)
+{
+	const net_udp_snapshot_ack_t* ack = (const void*)segment->data;
+
+	/* Acks can arrive out of order, only move the baseline forward. */
+	if (net_snapshot_ring_get(&source_client->snapshots, ack->seq) == NULL)
+		return;
+	if (source_client->snapshot_acked != NET_SNAPSHOT_NONE && ack->seq <= source_client->snapshot_acked)
+		return;
+
+	source_client->snapshot_acked = ack->seq;
+}
+
+void 
+player_view(const ssp_segment_t* segment, UNUSED server_t* server, client_t* source_client)
+{
+	const net_udp_player_view_t* view = (const void*)segment->data;
+	const cg_runtime_map_t* map;
+
+	if (source_client->room == NULL ||
+		view->size.x < 0 || view->size.y < 0 || isnan(view->size.x) || isnan(view->size.y))
+		return;
+
+	/* From twice the map size on the window covers all of it, capping keeps the cell math finite. */
+	map = source_client->room->game.map;
+	source_client->aoi.view.x = fminf(view->size.x, map->w * map->grid_size * 2);
+	source_client->aoi.view.y = fminf(view->size.y, map->h * map->grid_size * 2);
+}
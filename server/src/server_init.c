@@ -1,6 +1,7 @@
 #include "server.h"
 #include "server_game.h"
 #define TICKRATE 64.0
+#define TCP_QUEUE_MAX_DEFAULT (1024 * 1024)
 
 static i32
 server_init_tcp(server_t* server)
@@ -32,6 +33,22 @@ server_init_udp(server_t* server)
 	}
 
 	server->tcp_sock.addr.sockaddr.in.sin_port = htons(server->udp_port);
+
+	/* The workers' sockets receive, the first also sends for the tick thread. */
+	if (server->udp_worker_count)
+	{
+		close(server->udp_fd);
+		if (udp_workers_init(&server->udp_workers, server->udp_worker_count, 
+							 (struct sockaddr*)&server->tcp_sock.addr.sockaddr, 
+							 server->tcp_sock.addr.addr_len) == -1)
+		{
+			server->udp_fd = -1;
+			return -1;
+		}
+		server->udp_fd = server->udp_workers.workers[0].fd;
+		return 0;
+	}
+
 	if (bind(server->udp_fd, (struct sockaddr*)&server->tcp_sock.addr.sockaddr, server->tcp_sock.addr.addr_len) == -1)
 	{
 		perror("bind UDP");
@@ -98,6 +115,24 @@ server_print_help(const char* exe_path)
 		"  -t, --tickrate=TICKRATE\tTickrate. (Default 64)\n"
 		"  -r, --routine-time=SECONDS\tRoutine checks in seconds. (Default 20s)\n"
 		"  -c, --client-timeout=SECONDS\tTime in seconds before a client is disconnected due to inactivity (no packets received). (Default 15s)\n"
+		"  -b, --bullet-pool=COUNT\tPreallocate bullet pool for COUNT bullets. (Default 0, grows on demand)\n"
+		"  -j, --jobs=COUNT\t\tThreads used to simulate the game, or rooms side by side when there's more than one. (Default 1)\n"
+		"  --room=MAP[:TICKRATE]\t\tAdd a room (a match with its own game and clients) on MAP. Repeatable,\n"
+		"\t\t\t\tnew clients join the room with the fewest. (Default one room, -m and -t)\n"
+		"  --rooms=COUNT\t\t\tCOUNT rooms on -m's map and -t's tickrate, when no --room is given.\n"
+		"  --tcp-queue=KB\t\tClose clients that stay more than KB behind on TCP. (Default 1024)\n"
+		"  --netcode=MODE\t\tHow late inputs are handled: 'rollback' resimulates the world,\n"
+		"\t\t\t\t'lagcomp' rewinds only hit targets to the shooter's view. (Default rollback)\n"
+		"  --rollback-window=MS\t\tHow late an input can be and still get rolled back. (Default 250ms)\n"
+		"  --replication=MODE\t\tHow player state is sent: 'events' pushes each change,\n"
+		"\t\t\t\t'snapshot' sends deltas against the last acked snapshot. (Default events)\n"
+		"  --codec-report\t\tPrint raw vs bit-packed bytes of every UDP segment at startup.\n"
+		"  --udp-workers=COUNT\t\tReceive UDP on COUNT SO_REUSEPORT sockets, each with its own thread,\n"
+		"\t\t\t\tprocessed at the start of every tick. (Default 0, read in the event loop)\n"
+		"  --io-uring\t\t\tUse io_uring instead of epoll for the event loop and UDP sends.\n"
+		"  --tick-spin=US\t\tWake up US microseconds before each tick and spin to its deadline. (Default 0)\n"
+		"  --cpu=CPU\t\t\tPin the tick thread to CPU.\n"
+		"  --realtime[=PRIORITY]\t\tRun the tick thread as SCHED_FIFO at PRIORITY. (Default 10, needs CAP_SYS_NICE)\n"
 		"  -h, --help\t\t\tPrint this message\n\n"
 	, exe_path);
 }
@@ -116,6 +151,37 @@ server_set_port(u16* dest_port, const char* str)
 	return 0;
 }
 
+/* MAP[:TICKRATE] */
+static i32
+server_add_room_spec(server_t* server, char* arg)
+{
+	server_room_spec_t* spec;
+	char* tickrate_str = strrchr(arg, ':');
+	char* endptr;
+	f64 tickrate = 0;	// -t's, once all options are in
+
+	if (tickrate_str)
+	{
+		*tickrate_str++ = 0x00;
+		tickrate = strtol(tickrate_str, &endptr, 10);
+		if (endptr == tickrate_str || *endptr != 0x00 || tickrate >= INT16_MAX || tickrate <= 0)
+		{
+			fprintf(stderr, "Invalid room tickrate.\n");
+			return -1;
+		}
+	}
+	if (*arg == 0x00)
+	{
+		fprintf(stderr, "Invalid room map.\n");
+		return -1;
+	}
+
+	spec = array_add_into(&server->room_specs);
+	spec->map_path = arg;
+	spec->tickrate = tickrate;
+	return 0;
+}
+
 static i32
 server_argv(server_t* server, i32 argc, char* const* argv)
 {
@@ -126,16 +192,30 @@ server_argv(server_t* server, i32 argc, char* const* argv)
 		{"map",			required_argument,	0, 'm'},
 		{"udp-port",	required_argument,	0,  0 },
 		{"tcp-port",	required_argument,	0,  0 },
+		{"netcode",		required_argument,	0,  0 },
+		{"rollback-window",	required_argument,	0,  0 },
+		{"replication",	required_argument,	0,  0 },
+		{"codec-report",	no_argument,	0,  0 },
+		{"udp-workers",	required_argument,	0,  0 },
+		{"io-uring",	no_argument,		0,  0 },
+		{"tick-spin",	required_argument,	0,  0 },
+		{"cpu",			required_argument,	0,  0 },
+		{"realtime",	optional_argument,	0,  0 },
+		{"room",		required_argument,	0,  0 },
+		{"rooms",		required_argument,	0,  0 },
+		{"tcp-queue",	required_argument,	0,  0 },
 		{"tickrate",	required_argument,	0, 't'},
 		{"routine-time",	required_argument,	0, 'r'},
 		{"client-timeout",	required_argument,	0, 'c'},
+		{"bullet-pool",	required_argument,	0, 'b'},
+		{"jobs",		required_argument,	0, 'j'},
 		{"help",		no_argument,		0, 'h'},
 		{0, 0, 0, 0}
 	};
 	char* endptr;
 	i32 opt_idx;
 
-	while ((opt = getopt_long(argc, argv, "p:m:t:h:r:c:", long_options, &opt_idx)) != -1)
+	while ((opt = getopt_long(argc, argv, "p:m:t:h:r:c:b:j:", long_options, &opt_idx)) != -1)
 	{
 		switch (opt) 
 		{
@@ -169,6 +249,110 @@ server_argv(server_t* server, i32 argc, char* const* argv)
 					server_set_port(&server->udp_port, optarg);
 				else if (strcmp(long_options[opt_idx].name, "tcp-port") == 0)
 					server_set_port(&server->port, optarg);
+				else if (strcmp(long_options[opt_idx].name, "netcode") == 0)
+				{
+					if (strcmp(optarg, "rollback") == 0)
+						server->netcode = CG_NETCODE_ROLLBACK;
+					else if (strcmp(optarg, "lagcomp") == 0)
+						server->netcode = CG_NETCODE_LAG_COMP;
+					else
+					{
+						fprintf(stderr, "Invalid netcode mode.\n");
+						return -1;
+					}
+				}
+				else if (strcmp(long_options[opt_idx].name, "rollback-window") == 0)
+				{
+					i32 window = strtoll(optarg, &endptr, 10);
+					if (endptr == optarg || *endptr != 0x00 || window > 10000 || window <= 0)
+					{
+						fprintf(stderr, "Invalid rollback window.\n");
+						return -1;
+					}
+					server->rollback_window_ms = window;
+				}
+				else if (strcmp(long_options[opt_idx].name, "codec-report") == 0)
+					server->codec_report = true;
+				else if (strcmp(long_options[opt_idx].name, "io-uring") == 0)
+					server->io_uring = true;
+				else if (strcmp(long_options[opt_idx].name, "room") == 0)
+				{
+					if (server_add_room_spec(server, optarg) == -1)
+						return -1;
+				}
+				else if (strcmp(long_options[opt_idx].name, "rooms") == 0)
+				{
+					i32 count = strtoll(optarg, &endptr, 10);
+					if (endptr == optarg || *endptr != 0x00 || count > 4096 || count < 1)
+					{
+						fprintf(stderr, "Invalid room count.\n");
+						return -1;
+					}
+					server->rooms_default = count;
+				}
+				else if (strcmp(long_options[opt_idx].name, "tcp-queue") == 0)
+				{
+					i32 queue_kb = strtoll(optarg, &endptr, 10);
+					if (endptr == optarg || *endptr != 0x00 || queue_kb > 1024 * 1024 || queue_kb < 64)
+					{
+						fprintf(stderr, "Invalid TCP queue size.\n");
+						return -1;
+					}
+					server->tcp_queue_max = (u32)queue_kb * 1024;
+				}
+				else if (strcmp(long_options[opt_idx].name, "tick-spin") == 0)
+				{
+					i32 spin_us = strtoll(optarg, &endptr, 10);
+					if (endptr == optarg || *endptr != 0x00 || spin_us > 10000 || spin_us < 0)
+					{
+						fprintf(stderr, "Invalid tick spin.\n");
+						return -1;
+					}
+					server->tick_spin_ns = (i64)spin_us * 1000;
+				}
+				else if (strcmp(long_options[opt_idx].name, "cpu") == 0)
+				{
+					i32 cpu = strtoll(optarg, &endptr, 10);
+					if (endptr == optarg || *endptr != 0x00 || cpu >= INT16_MAX || cpu < 0)
+					{
+						fprintf(stderr, "Invalid CPU.\n");
+						return -1;
+					}
+					server->cpu = cpu;
+				}
+				else if (strcmp(long_options[opt_idx].name, "realtime") == 0)
+				{
+					i32 prio = (optarg) ? strtoll(optarg, &endptr, 10) : 10;
+					if (optarg && (endptr == optarg || *endptr != 0x00 || 
+						prio < sched_get_priority_min(SCHED_FIFO) || prio > sched_get_priority_max(SCHED_FIFO)))
+					{
+						fprintf(stderr, "Invalid realtime priority.\n");
+						return -1;
+					}
+					server->realtime_prio = prio;
+				}
+				else if (strcmp(long_options[opt_idx].name, "udp-workers") == 0)
+				{
+					i32 count = strtoll(optarg, &endptr, 10);
+					if (endptr == optarg || *endptr != 0x00 || count > 64 || count < 0)
+					{
+						fprintf(stderr, "Invalid UDP worker count.\n");
+						return -1;
+					}
+					server->udp_worker_count = count;
+				}
+				else if (strcmp(long_options[opt_idx].name, "replication") == 0)
+				{
+					if (strcmp(optarg, "events") == 0)
+						server->replication = SERVER_REPLICATION_EVENTS;
+					else if (strcmp(optarg, "snapshot") == 0)
+						server->replication = SERVER_REPLICATION_SNAPSHOT;
+					else
+					{
+						fprintf(stderr, "Invalid replication mode.\n");
+						return -1;
+					}
+				}
 				break;
 			}
 			case 'r':
@@ -193,6 +377,28 @@ server_argv(server_t* server, i32 argc, char* const* argv)
 				server->client_timeout_threshold = (f64)time;
 				break;
 			}
+			case 'b':
+			{
+				i32 count = strtoll(optarg, &endptr, 10);
+				if (endptr == optarg || *endptr != 0x00 || count >= INT32_MAX || count < 0)
+				{
+					fprintf(stderr, "Invalid bullet pool count.\n");
+					return -1;
+				}
+				server->bullet_pool_reserve = count;
+				break;
+			}
+			case 'j':
+			{
+				i32 count = strtoll(optarg, &endptr, 10);
+				if (endptr == optarg || *endptr != 0x00 || count > 256 || count < 1)
+				{
+					fprintf(stderr, "Invalid job count.\n");
+					return -1;
+				}
+				server->sim_threads = count;
+				break;
+			}
 			default:
 				return -1;
 				break;
@@ -207,6 +413,7 @@ server_init_netdef(server_t* server)
 {
 	ssp_segment_callback_t callbacks[NET_SEGTYPES_LEN] = {0};
 	callbacks[NET_TCP_CONNECT] = (ssp_segment_callback_t)client_tcp_connect;
+	callbacks[NET_TCP_CG_MAP_REQUEST] = (ssp_segment_callback_t)client_tcp_map_request;
 	callbacks[NET_TCP_WANT_SERVER_STATS] = (ssp_segment_callback_t)want_server_stats;
 	callbacks[NET_UDP_PLAYER_CURSOR] = (ssp_segment_callback_t)player_cursor;
 	callbacks[NET_UDP_PING] = (ssp_segment_callback_t)udp_ping;
@@ -217,88 +424,50 @@ server_init_netdef(server_t* server)
 	callbacks[NET_UDP_PLAYER_RELOAD] = (ssp_segment_callback_t)player_reload;
 	callbacks[NET_TCP_BOT_MODE] = (ssp_segment_callback_t)bot_mode;
 	callbacks[NET_UDP_MOVE_BOT] = (ssp_segment_callback_t)move_bot;
+	callbacks[NET_UDP_SNAPSHOT_ACK] = (ssp_segment_callback_t)snapshot_ack;
+	callbacks[NET_UDP_PLAYER_VIEW] = (ssp_segment_callback_t)player_view;
 
 	netdef_init(&server->netdef, NULL, callbacks);
 	server->netdef.ssp_ctx.user_data = server;
 	server->netdef.ssp_ctx.verify_session = (ssp_session_verify_callback_t)server_verify_session;
+	server->netdef.codec_of = (netdef_codec_func_t)server_client_codec;
 }
 
-static void
-server_init_coregame_gun_specs(server_t* server)
+/**
+ *	One room per --room, or --rooms of them (default 1) on -m's map and
+ *	-t's tickrate. With more than one, the -j pool ticks rooms side by side.
+ */
+static i32 
+server_init_rooms(server_t* server)
 {
-	const cg_gun_spec_t small_gun_spec = {
-		.id = CG_GUN_ID_SMALL,
-		.bps = 5.0,
-		.dmg = 7.0,
-		.knockback_force = 0.0,
-		.bullet_speed = 7000,
-		.autocharge = true,
-		.initial_charge_time = 0,
-		.reload_time = 1.5,
-		.max_ammo = 20
-	};
-
-	const cg_gun_spec_t big_gun_spec = {
-		.id = CG_GUN_ID_BIG,
-		.bps = 0.75,
-		.dmg = 95.0,
-		.knockback_force = 10000.0,
-		.bullet_speed = 10000,
-		.autocharge = false,
-		.initial_charge_time = 0,
-		.reload_time = 2.0,
-		.max_ammo = 6
-	};
-
-	const cg_gun_spec_t mini_gun_spec = {
-		.id = CG_GUN_ID_MINI_GUN,
-		.bps = 100.0,
-		.dmg = 1.2,
-		.knockback_force = 200.0,
-		.bullet_speed = 9000,
-		.autocharge = false,
-		.initial_charge_time = 1.0,
-		.reload_time = 5,
-		.max_ammo = 1000
+	const server_room_spec_t default_spec = {
+		.map_path = server->cgmap_path,
+		.tickrate = server->tickrate
 	};
+	server_room_spec_t* specs = (server_room_spec_t*)server->room_specs.buf;
+	u32 count = server->room_specs.count;
 
-	coregame_add_gun_spec(&server->game, &small_gun_spec);
-	coregame_add_gun_spec(&server->game, &big_gun_spec);
-	coregame_add_gun_spec(&server->game, &mini_gun_spec);
-}
+	for (u32 i = 0; i < server->room_specs.count; i++)
+		if (specs[i].tickrate == 0)
+			specs[i].tickrate = server->tickrate;
 
-static i32 
-server_init_coregame(server_t* server)
-{
-	cg_runtime_map_t* map = cg_map_load(server->cgmap_path, &server->disk_map, &server->disk_map_size);
-	if (map == NULL)
-	{
-		fprintf(stderr, "Failed to load map: %s\n", server->cgmap_path);
-		return -1;
-	}
+	if (count == 0)
+		count = (server->rooms_default) ? server->rooms_default : 1;
 
-	coregame_server_init(&server->game, map, server->tickrate);
-	server->game.user_data = server;
-	server->game.player_changed = (cg_player_changed_callback_t)on_player_changed;
-	server->game.player_damaged = (cg_player_damaged_callback_t)on_player_damaged;
-	server->game.player_reload = (cg_player_reload_callback_t)server_on_player_reload;
-	server->game.player_gun_changed = (cg_player_changed_callback_t)server_on_player_gun_changed;
-	server->game.on_bullet_create = (cg_bullet_create_callback_t)server_on_bullet_create;
+	if (server->sim_threads > 1)
+		server->jobs = cg_jobs_create(server->sim_threads - 1);
 
-	array_init(&server->spawn_points, sizeof(cg_runtime_cell_t**), 10);
-	cg_runtime_cell_t* cell;
+	server->rooms = calloc(count, sizeof(server_room_t));
+	server->due_rooms = calloc(count, sizeof(server_room_t*));
+	server->room_count = count;
 
-	for (u16 x = 0; x < map->w; x++)
+	for (u32 i = 0; i < count; i++)
 	{
-		for (u16 y = 0; y < map->h; y++)
-		{
-			cell = cg_runtime_map_at(map, x, y);
-			if (cell->type == CG_CELL_SPAWN)
-				array_add_voidp(&server->spawn_points, cell);
-		}
-	}
+		const server_room_spec_t* spec = (server->room_specs.count) ? specs + i : &default_spec;
 
-	server_init_coregame_gun_specs(server);
+		if (server_room_init(server->rooms + i, server, i, spec) == -1)
+			return -1;
+	}
 
 	return 0;
 }
@@ -306,18 +475,53 @@ server_init_coregame(server_t* server)
 static i32
 server_init_epoll(server_t* server)
 {
-	if ((server->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+	if (server->io_uring)
+	{
+		/* Arms UDP receive itself, with provided buffers instead of an event. */
+		if (server_uring_init(server) == -1)
+			return -1;
+	}
+	else if ((server->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
 	{
 		perror("epoll_create1");
 		return -1;
 	}
 
 	server_add_event(server, server->tcp_sock.sockfd, NULL, server_handle_new_connection, NULL);
-	server_add_event(server, server->udp_fd, NULL, server_read_udp_packet, NULL);
+	if (server->udp_worker_count == 0 && server->uring == NULL)
+		server_add_event(server, server->udp_fd, NULL, server_read_udp_packet, NULL);
 
 	return 0;
 }
 
+static i32
+server_init_tick(server_t* server)
+{
+	if (server->uring)
+		return 0;
+
+	/* io_uring waits with an absolute timeout on the same deadline instead. */
+	if ((server->tick_fd = server_tick_timer_create()) == -1)
+		return -1;
+	server_add_event(server, server->tick_fd, NULL, server_tick_timeout, NULL);
+
+	return 0;
+}
+
+/**
+ *	Done last, so job threads and UDP workers created before don't
+ *	inherit the pinning or priority. Not fatal, it's a tuning knob.
+ */
+static void
+server_init_sched(server_t* server)
+{
+	if (server->cpu >= 0 && server_tick_pin_cpu(server->cpu) == 0)
+		printf("Tick thread pinned to CPU %d.\n", server->cpu);
+
+	if (server->realtime_prio && server_tick_realtime(server->realtime_prio) == 0)
+		printf("Tick thread running SCHED_FIFO at priority %d.\n", server->realtime_prio);
+}
+
 i32 
 server_init(server_t* server, i32 argc, char* const* argv)
 {
@@ -325,12 +529,16 @@ server_init(server_t* server, i32 argc, char* const* argv)
 	server->udp_port = DEFAULT_PORT + 1;
 	server->routine_time = 20.0;
 	server->client_timeout_threshold = 15.0;
+	server->cpu = -1;
+	server->tcp_queue_max = TCP_QUEUE_MAX_DEFAULT;
 	server_set_tickrate(server, TICKRATE);
+	array_init(&server->room_specs, sizeof(server_room_spec_t), 4);
 
 	if (server_argv(server, argc, argv) == -1)
 		return -1;
 
 	ght_init(&server->clients, 10, free);
+	array_init(&server->tcp_pending, sizeof(client_t*), 16);
 
 	if (server_init_tcp(server) == -1)
 		goto err;
@@ -340,18 +548,21 @@ server_init(server_t* server, i32 argc, char* const* argv)
 		goto err;
 	if (server_init_signalfd(server) == -1)
 		goto err;
-	if (server_init_coregame(server) == -1)
+	if (server_init_rooms(server) == -1)
 		goto err;
 	if (server_init_timerfd(server) == -1)
 		goto err;
+	if (server_init_tick(server) == -1)
+		goto err;
 	server_init_netdef(server);
-	mmframes_init2(&server->mmf, MMF_DEFAULT_FRAME_SIZE * 4);
+	if (server->codec_report)
+		netdef_codec_report(stdout, &server->rooms[0].codec);
 	ssp_io_init(&server->io, &server->netdef.ssp_ctx, 0);
 
-	array_init(&server->packet_tx_buf, sizeof(const ssp_packet_t**), 10);
-	array_init(&server->tx_msgs, sizeof(struct mmsghdr), 10);
+	server_init_udp_rx(server);
 
 	nano_timer_init(&server->timer);
+	server_init_sched(server);
 
 	server->running = true;
 
@@ -0,0 +1,290 @@
+#include "server.h"
+
+/* Same guns in every room, each game derives its own copy with coregame_add_gun_spec(). */
+static const cg_gun_spec_t server_gun_specs[] = {
+	{
+		.id = CG_GUN_ID_SMALL,
+		.bps = 5.0,
+		.dmg = 7.0,
+		.knockback_force = 0.0,
+		.bullet_speed = 7000,
+		.autocharge = true,
+		.initial_charge_time = 0,
+		.reload_time = 1.5,
+		.max_ammo = 20
+	},
+	{
+		.id = CG_GUN_ID_BIG,
+		.bps = 0.75,
+		.dmg = 95.0,
+		.knockback_force = 10000.0,
+		.bullet_speed = 10000,
+		.autocharge = false,
+		.initial_charge_time = 0,
+		.reload_time = 2.0,
+		.max_ammo = 6
+	},
+	{
+		.id = CG_GUN_ID_MINI_GUN,
+		.bps = 100.0,
+		.dmg = 1.2,
+		.knockback_force = 200.0,
+		.bullet_speed = 9000,
+		.autocharge = false,
+		.initial_charge_time = 1.0,
+		.reload_time = 5,
+		.max_ammo = 1000
+	},
+};
+
+/* Shares the disk blob of an already loaded map, `runtime` is always a fresh copy. */
+static server_map_t*
+server_map_get(server_t* server, const char* path, cg_runtime_map_t** runtime)
+{
+	server_map_t* map;
+
+	for (map = server->maps; map; map = map->next)
+	{
+		if (strcmp(map->path, path) == 0)
+		{
+			if ((*runtime = cg_map_load_disk(map->disk, map->disk_size)) == NULL)
+				return NULL;
+			map->refs++;
+			return map;
+		}
+	}
+
+	map = calloc(1, sizeof(server_map_t));
+	if ((*runtime = cg_map_load(path, &map->disk, &map->disk_size)) == NULL)
+	{
+		free(map);
+		return NULL;
+	}
+	map->path = path;
+	map->hash = cg_map_hash(map->disk, map->disk_size);
+	map->refs = 1;
+	map->next = server->maps;
+	server->maps = map;
+
+	return map;
+}
+
+static void
+server_map_put(server_t* server, server_map_t* map)
+{
+	server_map_t** link = &server->maps;
+
+	if (--map->refs)
+		return;
+
+	while (*link != map)
+		link = &(*link)->next;
+	*link = map->next;
+
+	cg_map_free_disk(map->disk, map->disk_size);
+	free(map);
+}
+
+i32
+server_room_init(server_room_t* room, server_t* server, u32 id, const server_room_spec_t* spec)
+{
+	cg_runtime_map_t* map;
+
+	room->id = id;
+	room->server = server;
+	room->tickrate = spec->tickrate;
+	room->interval = 1.0 / spec->tickrate;
+
+	if ((room->map = server_map_get(server, spec->map_path, &map)) == NULL)
+	{
+		fprintf(stderr, "Failed to load map: %s\n", spec->map_path);
+		return -1;
+	}
+
+	coregame_server_init(&room->game, map, room->tickrate);
+	if (server->rollback_window_ms)
+		coregame_set_rollback_window(&room->game, server->rollback_window_ms);
+	cg_bullet_pool_reserve(&room->game.bullet_pool, server->bullet_pool_reserve);
+
+	/* With more rooms the pool ticks rooms instead, a job can't fan out on it again. */
+	if (server->jobs && server->room_count == 1)
+		coregame_set_jobs(&room->game, server->jobs);
+	coregame_set_netcode(&room->game, server->netcode);
+	room->game.user_data = room;
+
+	for (u32 i = 0; i < sizeof(server_gun_specs) / sizeof(cg_gun_spec_t); i++)
+		coregame_add_gun_spec(&room->game, server_gun_specs + i);
+
+	ght_init(&room->clients, 10, NULL);
+	server_tick_init(&room->tick, room->interval * 1e9, server->tick_spin_ns);
+	nano_timer_init(&room->timer);
+	mmframes_init2(&room->mmf, MMF_DEFAULT_FRAME_SIZE * 4);
+	net_codec_init(&room->codec, &room->mmf);
+	net_codec_set_world(&room->codec, map);
+	array_init(&room->packet_tx_buf, sizeof(const ssp_packet_t**), 10);
+	array_init(&room->tx_msgs, sizeof(struct mmsghdr), 10);
+
+	printf("Room %u: %s at %.1f ticks/s.\n", id, spec->map_path, room->tickrate);
+
+	return 0;
+}
+
+void
+server_room_cleanup(server_room_t* room)
+{
+	if (room->map == NULL)
+		return;
+
+	coregame_cleanup(&room->game);
+	ght_destroy(&room->clients);
+	mmframes_free(&room->mmf);
+	array_del(&room->packet_tx_buf);
+	array_del(&room->tx_msgs);
+	server_map_put(room->server, room->map);
+	room->map = NULL;
+}
+
+/* Room a newly connected client joins, the one with the fewest clients. */
+server_room_t*
+server_room_pick(server_t* server)
+{
+	server_room_t* pick = server->rooms;
+
+	for (u32 i = 1; i < server->room_count; i++)
+	{
+		if (server->rooms[i].clients.count < pick->clients.count)
+			pick = server->rooms + i;
+	}
+	return pick;
+}
+
+/* Fills the room's stats for its clients, process-wide RX counters included. */
+void
+server_room_publish_stats(server_room_t* room)
+{
+	const server_t* server = room->server;
+	const cg_bullet_pool_stats_t* pool_stats = &room->game.bullet_pool.stats;
+	const cg_sbsm_resim_stats_t* resim_stats = &room->game.sbsm->resim_stats;
+	server_stats_t* stats = &room->stats;
+
+	stats->room_id = room->id;
+	stats->rooms = server->room_count;
+	stats->tcp_connections = server->clients.count;
+	stats->players = room->game.players.count;
+
+	stats->udp_pps_in = server->stats.udp_pps_in;
+	stats->udp_pps_in_bytes = server->stats.udp_pps_in_bytes;
+	stats->udp_pps_in_bytes_highest = server->stats.udp_pps_in_bytes_highest;
+	stats->udp_rx = server->stats.udp_rx;
+
+	stats->bullet_pool.in_use = pool_stats->in_use;
+	stats->bullet_pool.highest = pool_stats->highest;
+	stats->bullet_pool.capacity = pool_stats->capacity;
+	stats->rollback.rollbacks = resim_stats->rollbacks;
+	stats->rollback.resimulated = resim_stats->resimulated;
+	stats->rollback.skipped = resim_stats->skipped;
+
+	stats->tick_lateness.p50 = server_tick_percentile(&room->tick, 0.5);
+	stats->tick_lateness.p99 = server_tick_percentile(&room->tick, 0.99);
+	stats->tick_lateness.p999 = server_tick_percentile(&room->tick, 0.999);
+	stats->tick_lateness.max = room->tick.max_ns;
+	server_tick_reset_histogram(&room->tick);
+
+	room->send_stats = true;
+}
+
+/**
+ *	Before waiting: when the earliest room wants to wake up, 0 if no room
+ *	has clients. A room that just got its first client has no deadline
+ *	yet, it ticks right away.
+ */
+i64
+server_rooms_schedule(server_t* server)
+{
+	i64 wakeup_ns = 0;
+	i64 room_wakeup_ns;
+
+	server->tick_deadline_ns = 0;
+
+	for (u32 i = 0; i < server->room_count; i++)
+	{
+		server_tick_t* tick = &server->rooms[i].tick;
+
+		if (server->rooms[i].clients.count == 0)
+		{
+			tick->deadline_ns = 0;
+			tick->scheduled = false;
+			continue;
+		}
+
+		if (tick->deadline_ns == 0)
+			room_wakeup_ns = 1;
+		else
+		{
+			tick->scheduled = true;
+			room_wakeup_ns = server_tick_wakeup_ns(tick);
+			if (server->tick_deadline_ns == 0 || tick->deadline_ns < server->tick_deadline_ns)
+				server->tick_deadline_ns = tick->deadline_ns;
+		}
+
+		if (wakeup_ns == 0 || room_wakeup_ns < wakeup_ns)
+			wakeup_ns = room_wakeup_ns;
+	}
+	return wakeup_ns;
+}
+
+/* A room got its first client during the wait. */
+bool
+server_rooms_woke(const server_t* server)
+{
+	for (u32 i = 0; i < server->room_count; i++)
+	{
+		if (server->rooms[i].clients.count && server->rooms[i].tick.deadline_ns == 0)
+			return true;
+	}
+	return false;
+}
+
+/* Collects the rooms whose deadline passed into `due_rooms`. */
+u32
+server_rooms_due(server_t* server, i64 now_ns)
+{
+	u32 count = 0;
+
+	for (u32 i = 0; i < server->room_count; i++)
+	{
+		server_room_t* room = server->rooms + i;
+
+		if (room->clients.count && room->tick.deadline_ns <= now_ns)
+			server->due_rooms[count++] = room;
+	}
+	return count;
+}
+
+static void
+server_rooms_update_job(void* ctx, u32 begin, u32 end, UNUSED u32 worker)
+{
+	server_room_t** rooms = ctx;
+
+	for (u32 i = begin; i < end; i++)
+	{
+		server_room_t* room = rooms[i];
+
+		nano_start_time(&room->timer);
+		server_tick_begin(&room->tick, &room->timer.start_time);
+		room->current_time = room->timer.start_time_s;
+
+		coregame_tick(&room->game);
+
+		nano_end_time(&room->timer);
+	}
+}
+
+/* Simulates the first `count` due rooms, one room per job. */
+void
+server_rooms_update(server_t* server, u32 count)
+{
+	cg_jobs_t* jobs = (server->room_count > 1) ? server->jobs : NULL;
+
+	cg_jobs_parallel_for(jobs, count, 1, server_rooms_update_job, server->due_rooms);
+}
@@ -0,0 +1,181 @@
+#define _GNU_SOURCE
+#include "server_tick.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/timerfd.h>
+
+/* Further behind than this and the schedule restarts from now. */
+#define TICK_RESYNC_NS 1000000000
+
+static u32
+server_tick_bucket(i64 ns)
+{
+	u64 v = (ns > 0) ? (u64)ns : 0;
+	u32 msb;
+	u32 idx;
+
+	if (v < TICK_HIST_SUB)
+		return v;
+
+	msb = 63 - __builtin_clzll(v);
+	idx = TICK_HIST_SUB + (msb - 2) * TICK_HIST_SUB + ((v >> (msb - 2)) & (TICK_HIST_SUB - 1));
+	return (idx < TICK_HIST_BUCKETS) ? idx : TICK_HIST_BUCKETS - 1;
+}
+
+/* Highest lateness that lands in bucket `idx`. */
+static i64
+server_tick_bucket_max(u32 idx)
+{
+	u32 shift;
+	u32 sub;
+
+	if (idx < TICK_HIST_SUB)
+		return idx;
+
+	shift = (idx - TICK_HIST_SUB) / TICK_HIST_SUB;
+	sub = (idx - TICK_HIST_SUB) % TICK_HIST_SUB;
+	return ((i64)(TICK_HIST_SUB + sub + 1) << shift) - 1;
+}
+
+void
+server_tick_init(server_tick_t* tick, i64 interval_ns, i64 spin_ns)
+{
+	memset(tick, 0, sizeof(server_tick_t));
+	tick->interval_ns = interval_ns;
+	tick->spin_ns = (spin_ns < interval_ns) ? spin_ns : 0;
+}
+
+/* When the wait should end, `spin_ns` ahead of the deadline. */
+i64
+server_tick_wakeup_ns(const server_tick_t* tick)
+{
+	return tick->deadline_ns - tick->spin_ns;
+}
+
+i32
+server_tick_timer_create(void)
+{
+	i32 fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+
+	if (fd == -1)
+		perror("timerfd_create tick");
+	return fd;
+}
+
+void
+server_tick_timer_arm(i32 fd, i64 wakeup_ns)
+{
+	struct itimerspec timer = {0};
+
+	/* A zero it_value disarms, a deadline in the past fires right away. */
+	if (wakeup_ns <= 0)
+		wakeup_ns = 1;
+	timer.it_value.tv_sec = wakeup_ns / 1000000000;
+	timer.it_value.tv_nsec = wakeup_ns % 1000000000;
+
+	if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &timer, NULL) == -1)
+		perror("timerfd_settime tick");
+}
+
+void
+server_tick_spin_until(i64 deadline_ns)
+{
+	hr_time_t current_time;
+
+	do {
+		nano_gettime(&current_time);
+	} while (nano_time_ns(&current_time) < deadline_ns);
+}
+
+/**
+ *	Records how late the tick starting at `start` is and moves the
+ *	deadline one interval ahead. Ticks after an idle wait (no clients)
+ *	had no deadline, they restart the schedule instead.
+ */
+void
+server_tick_begin(server_tick_t* tick, const hr_time_t* start)
+{
+	const i64 start_ns = nano_time_ns(start);
+	i64 lateness_ns;
+
+	if (tick->scheduled && tick->deadline_ns)
+	{
+		lateness_ns = start_ns - tick->deadline_ns;
+		if (lateness_ns < 0)
+			lateness_ns = 0;
+
+		tick->histogram[server_tick_bucket(lateness_ns)]++;
+		tick->samples++;
+		if (lateness_ns > tick->max_ns)
+			tick->max_ns = lateness_ns;
+	}
+
+	if (tick->scheduled == false || tick->deadline_ns == 0 ||
+		start_ns - tick->deadline_ns > TICK_RESYNC_NS)
+		tick->deadline_ns = start_ns + tick->interval_ns;
+	else
+		tick->deadline_ns += tick->interval_ns;
+
+	tick->scheduled = false;
+}
+
+/* Upper bound of the bucket holding the `p` quantile (0.0 - 1.0). */
+i64
+server_tick_percentile(const server_tick_t* tick, f64 p)
+{
+	const u64 target = (u64)(p * tick->samples + 0.5);
+	u64 count = 0;
+
+	if (tick->samples == 0)
+		return 0;
+
+	for (u32 i = 0; i < TICK_HIST_BUCKETS; i++)
+	{
+		count += tick->histogram[i];
+		if (count >= target && count)
+		{
+			const i64 max_ns = server_tick_bucket_max(i);
+			return (max_ns < tick->max_ns) ? max_ns : tick->max_ns;
+		}
+	}
+	return tick->max_ns;
+}
+
+void
+server_tick_reset_histogram(server_tick_t* tick)
+{
+	memset(tick->histogram, 0, sizeof(tick->histogram));
+	tick->samples = 0;
+	tick->max_ns = 0;
+}
+
+i32
+server_tick_pin_cpu(i32 cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &set) == -1)
+	{
+		perror("sched_setaffinity");
+		return -1;
+	}
+	return 0;
+}
+
+i32
+server_tick_realtime(i32 priority)
+{
+	const struct sched_param param = { .sched_priority = priority };
+
+	if (sched_setscheduler(0, SCHED_FIFO, &param) == -1)
+	{
+		perror("sched_setscheduler SCHED_FIFO");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,426 @@
+#include "server.h"
+#include "server_uring.h"
+
+#ifdef SERVER_IO_URING
+
+#include <liburing.h>
+#include <poll.h>
+
+#define URING_ENTRIES		256
+#define URING_TX_ENTRIES	256
+#define URING_RX_BUFS		256	// Power of two
+#define URING_RX_PAYLOAD	4096	// Largest datagram, same as the plain recv paths
+/* Multishot recvmsg puts its header and the source address in front of the payload. */
+#define URING_RX_BUF_SIZE	(sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + URING_RX_PAYLOAD)
+#define URING_RX_BGID		0
+
+/* What a completion is for, in the low bits of its user data. */
+enum server_uring_tag
+{
+	URING_TAG_EVENT		= 0,	// Poll on an event_t fd
+	URING_TAG_REMOVE	= 1,	// Poll removal of a closed event_t
+	URING_TAG_UDP		= 2,	// Multishot UDP recvmsg
+	URING_TAG_TIMEOUT	= 3,	// Tick deadline
+	URING_TAG_MASK		= 3,
+};
+
+struct server_uring
+{
+	struct io_uring ring;		// Polls, UDP receive and the tick timeout
+	struct io_uring tx_ring;	// Sends only, submitted and reaped once per tick
+
+	struct io_uring_buf_ring*	buf_ring;
+	void*			bufs[URING_RX_BUFS];
+	struct msghdr	rx_msg;
+	bool			rx_armed;
+	f64				rx_time_s;
+
+	struct __kernel_timespec deadline;
+	bool			timeout_armed;	// One tick timeout in flight, moved instead of re-added
+	event_t*		graveyard;	// Closed events waiting for their poll removal
+};
+
+static struct io_uring_sqe*
+server_uring_sqe(struct io_uring* ring)
+{
+	struct io_uring_sqe* sqe;
+
+	while ((sqe = io_uring_get_sqe(ring)) == NULL)
+		io_uring_submit(ring);
+	return sqe;
+}
+
+static void
+server_uring_arm_poll(server_uring_t* uring, event_t* event)
+{
+	struct io_uring_sqe* sqe = server_uring_sqe(&uring->ring);
+
+	/* One-shot, re-armed after each read so it behaves level-triggered like epoll. */
+	io_uring_prep_poll_add(sqe, event->fd, POLLIN | POLLRDHUP | ((event->want_write) ? POLLOUT : 0));
+	io_uring_sqe_set_data64(sqe, (u64)event | URING_TAG_EVENT);
+}
+
+static void
+server_uring_arm_udp(server_t* server)
+{
+	server_uring_t* uring = server->uring;
+	struct io_uring_sqe* sqe = server_uring_sqe(&uring->ring);
+
+	io_uring_prep_recvmsg_multishot(sqe, server->udp_fd, &uring->rx_msg, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_RX_BGID;
+	io_uring_sqe_set_data64(sqe, URING_TAG_UDP);
+	uring->rx_armed = true;
+}
+
+/**
+ *	Wakes up when the earliest room wants to, its deadline less the spin.
+ *	A timeout still in flight is moved to the new deadline, a poll that
+ *	ended on server_rooms_woke() would otherwise leave it to fire later.
+ */
+static void
+server_uring_arm_timeout(server_t* server)
+{
+	server_uring_t* uring = server->uring;
+	struct io_uring_sqe* sqe = server_uring_sqe(&uring->ring);
+	const i64 deadline_ns = server->tick_wakeup_ns;
+
+	uring->deadline.tv_sec = deadline_ns / 1000000000;
+	uring->deadline.tv_nsec = deadline_ns % 1000000000;
+
+	if (uring->timeout_armed)
+		io_uring_prep_timeout_update(sqe, &uring->deadline, URING_TAG_TIMEOUT, IORING_TIMEOUT_ABS);
+	else
+		io_uring_prep_timeout(sqe, &uring->deadline, 0, IORING_TIMEOUT_ABS);
+	io_uring_sqe_set_data64(sqe, URING_TAG_TIMEOUT);
+	uring->timeout_armed = true;
+}
+
+/* No rooms ticking, nothing to wake up for. */
+static void
+server_uring_disarm_timeout(server_uring_t* uring)
+{
+	struct io_uring_sqe* sqe;
+
+	if (uring->timeout_armed == false)
+		return;
+
+	sqe = server_uring_sqe(&uring->ring);
+	io_uring_prep_timeout_remove(sqe, URING_TAG_TIMEOUT, 0);
+	io_uring_sqe_set_data64(sqe, URING_TAG_TIMEOUT);
+	uring->timeout_armed = false;
+}
+
+static void
+server_uring_recycle(server_uring_t* uring, u16 bid)
+{
+	io_uring_buf_ring_add(uring->buf_ring, uring->bufs[bid], URING_RX_BUF_SIZE, bid,
+						  io_uring_buf_ring_mask(URING_RX_BUFS), 0);
+	io_uring_buf_ring_advance(uring->buf_ring, 1);
+}
+
+static void
+server_uring_udp(server_t* server, const struct io_uring_cqe* cqe)
+{
+	server_uring_t* uring = server->uring;
+	struct io_uring_recvmsg_out* out;
+	udp_addr_t info;
+	u8* buf;
+	u32 size;
+	u16 bid;
+
+	if ((cqe->flags & IORING_CQE_F_MORE) == 0)
+		uring->rx_armed = false;
+
+	if (cqe->res < 0)
+	{
+		if (cqe->res != -ENOBUFS)
+			fprintf(stderr, "io_uring UDP recvmsg: %s\n", strerror(-cqe->res));
+		return;
+	}
+	if ((cqe->flags & IORING_CQE_F_BUFFER) == 0)
+		return;
+
+	bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	buf = uring->bufs[bid];
+
+	out = io_uring_recvmsg_validate(buf, cqe->res, &uring->rx_msg);
+	if (out == NULL || (out->flags & MSG_TRUNC))
+	{
+		server_uring_recycle(uring, bid);
+		return;
+	}
+
+	memcpy(&info.addr, io_uring_recvmsg_name(out), sizeof(struct sockaddr_in));
+	info.addr_len = out->namelen;
+	info.ipaddr[0] = 0x00;
+	size = io_uring_recvmsg_payload_length(out, cqe->res, &uring->rx_msg);
+
+	/* ssp frees buffers it keeps, so the payload has to start the allocation. */
+	memmove(buf, io_uring_recvmsg_payload(out, &uring->rx_msg), size);
+
+	if (server_process_udp_packet(server, buf, size, &info, uring->rx_time_s) == SSP_BUFFERED)
+	{
+		uring->bufs[bid] = malloc(URING_RX_BUF_SIZE);
+		server->stats.udp_rx.allocs++;
+	}
+	server_uring_recycle(uring, bid);
+}
+
+static void
+server_uring_bury(server_uring_t* uring, event_t* event)
+{
+	event_t** link = &uring->graveyard;
+
+	while (*link && *link != event)
+		link = &(*link)->next;
+	if (*link)
+		*link = event->next;
+	free(event);
+}
+
+/* Returns true once it's time to tick. */
+static bool
+server_uring_complete(server_t* server, const struct io_uring_cqe* cqe)
+{
+	const u64 data = io_uring_cqe_get_data64(cqe);
+	event_t* event = (event_t*)(data & ~(u64)URING_TAG_MASK);
+
+	switch (data & URING_TAG_MASK)
+	{
+		case URING_TAG_EVENT:
+			if (cqe->res == -ECANCELED || event->closed)
+				break;
+			if (cqe->res < 0)
+			{
+				fprintf(stderr, "io_uring poll fd %d: %s\n", event->fd, strerror(-cqe->res));
+				server_close_event(server, event);
+				break;
+			}
+			server_handle_event(server, event, cqe->res);
+			if (event->closed == false)
+				server_uring_arm_poll(server->uring, event);
+			break;
+		case URING_TAG_REMOVE:
+			server_uring_bury(server->uring, event);
+			break;
+		case URING_TAG_UDP:
+			server_uring_udp(server, cqe);
+			break;
+		case URING_TAG_TIMEOUT:
+			/* Updates and removals complete under the same tag, only expiry ticks. */
+			if (cqe->res != -ETIME)
+				break;
+			server->uring->timeout_armed = false;
+			return true;
+	}
+	return false;
+}
+
+i32
+server_uring_init(server_t* server)
+{
+	server_uring_t* uring = calloc(1, sizeof(server_uring_t));
+	i32 ret;
+
+	server->uring = uring;
+
+	if ((ret = io_uring_queue_init(URING_ENTRIES, &uring->ring, 0)) < 0 ||
+		(ret = io_uring_queue_init(URING_TX_ENTRIES, &uring->tx_ring, 0)) < 0)
+	{
+		fprintf(stderr, "io_uring_queue_init: %s\n", strerror(-ret));
+		goto err;
+	}
+
+	uring->buf_ring = io_uring_setup_buf_ring(&uring->ring, URING_RX_BUFS, URING_RX_BGID, 0, &ret);
+	if (uring->buf_ring == NULL)
+	{
+		fprintf(stderr, "io_uring_setup_buf_ring: %s\n", strerror(-ret));
+		goto err;
+	}
+	for (u16 i = 0; i < URING_RX_BUFS; i++)
+	{
+		uring->bufs[i] = malloc(URING_RX_BUF_SIZE);
+		io_uring_buf_ring_add(uring->buf_ring, uring->bufs[i], URING_RX_BUF_SIZE, i,
+							  io_uring_buf_ring_mask(URING_RX_BUFS), i);
+	}
+	io_uring_buf_ring_advance(uring->buf_ring, URING_RX_BUFS);
+
+	uring->rx_msg.msg_namelen = sizeof(struct sockaddr_in);
+
+	/* UDP workers receive on their own sockets. */
+	if (server->udp_worker_count == 0)
+		server_uring_arm_udp(server);
+
+	return 0;
+err:
+	server_uring_destroy(server);
+	return -1;
+}
+
+void
+server_uring_add_event(server_t* server, event_t* event)
+{
+	server_uring_arm_poll(server->uring, event);
+}
+
+/* `event` is freed once the removal completes, a poll completion could still name it until then. */
+void
+server_uring_del_event(server_t* server, event_t* event)
+{
+	server_uring_t* uring = server->uring;
+	struct io_uring_sqe* sqe = server_uring_sqe(&uring->ring);
+
+	io_uring_prep_poll_remove(sqe, (u64)event | URING_TAG_EVENT);
+	io_uring_sqe_set_data64(sqe, (u64)event | URING_TAG_REMOVE);
+
+	event->closed = true;
+	event->next = uring->graveyard;
+	uring->graveyard = event;
+}
+
+/**
+ *	Submits whatever got queued since the last call and handles
+ *	completions until the earliest room's deadline. Without clients
+ *	there's no deadline, it waits for anything to happen, like epoll does.
+ */
+void
+server_uring_poll(server_t* server)
+{
+	server_uring_t* uring = server->uring;
+	struct io_uring_cqe* cqe;
+	hr_time_t current_time;
+	bool tick = false;
+	u32 head;
+	u32 count;
+	i32 ret;
+
+	if (server->tick_wakeup_ns)
+		server_uring_arm_timeout(server);
+	else
+		server_uring_disarm_timeout(uring);
+
+	while (tick == false && server->running)
+	{
+		if ((ret = io_uring_submit_and_wait(&uring->ring, 1)) < 0)
+		{
+			if (ret == -EINTR)
+				continue;
+			fprintf(stderr, "io_uring_submit_and_wait: %s\n", strerror(-ret));
+			server->running = false;
+			break;
+		}
+
+		nano_gettime(&current_time);
+		uring->rx_time_s = nano_time_s(&current_time);
+
+		count = 0;
+		io_uring_for_each_cqe(&uring->ring, head, cqe)
+		{
+			if (server_uring_complete(server, cqe))
+				tick = server->tick_due = true;
+			count++;
+		}
+		io_uring_cq_advance(&uring->ring, count);
+
+		if (uring->rx_armed == false && server->udp_worker_count == 0)
+			server_uring_arm_udp(server);
+
+		/* A room got its first client, start ticking it right away. */
+		if (server_rooms_woke(server))
+			tick = true;
+	}
+}
+
+/* All of a tick's sends in one submit, and their buffers free to reuse on return. */
+i32
+server_uring_sendmmsg(server_t* server, struct mmsghdr* msgs, u32 count)
+{
+	struct io_uring* tx = &server->uring->tx_ring;
+	struct io_uring_sqe* sqe;
+	struct io_uring_cqe* cqe;
+	u32 queued = 0;
+	u32 done = 0;
+	i32 sent = 0;
+	u32 head;
+	u32 reaped;
+	i32 ret;
+
+	while (done < count)
+	{
+		while (queued < count && (sqe = io_uring_get_sqe(tx)))
+		{
+			io_uring_prep_sendmsg(sqe, server->udp_fd, &msgs[queued].msg_hdr, 0);
+			io_uring_sqe_set_data64(sqe, queued);
+			queued++;
+		}
+
+		if ((ret = io_uring_submit_and_wait(tx, queued - done)) < 0)
+		{
+			if (ret == -EINTR)
+				continue;
+			fprintf(stderr, "io_uring sendmsg submit: %s\n", strerror(-ret));
+			return -1;
+		}
+
+		reaped = 0;
+		io_uring_for_each_cqe(tx, head, cqe)
+		{
+			if (cqe->res >= 0)
+			{
+				msgs[io_uring_cqe_get_data64(cqe)].msg_len = cqe->res;
+				sent++;
+			}
+			reaped++;
+		}
+		io_uring_cq_advance(tx, reaped);
+		done += reaped;
+	}
+	return sent;
+}
+
+void
+server_uring_destroy(server_t* server)
+{
+	server_uring_t* uring = server->uring;
+	event_t* next;
+
+	if (uring == NULL)
+		return;
+
+	if (uring->buf_ring)
+		io_uring_free_buf_ring(&uring->ring, uring->buf_ring, URING_RX_BUFS, URING_RX_BGID);
+	if (uring->ring.ring_fd > 0)
+		io_uring_queue_exit(&uring->ring);
+	if (uring->tx_ring.ring_fd > 0)
+		io_uring_queue_exit(&uring->tx_ring);
+
+	for (u32 i = 0; i < URING_RX_BUFS; i++)
+		free(uring->bufs[i]);
+
+	for (event_t* event = uring->graveyard; event; event = next)
+	{
+		next = event->next;
+		free(event);
+	}
+
+	free(uring);
+	server->uring = NULL;
+}
+
+#else
+
+i32
+server_uring_init(UNUSED server_t* server)
+{
+	fprintf(stderr, "Server was built without io_uring support.\n");
+	return -1;
+}
+
+void server_uring_add_event(UNUSED server_t* server, UNUSED event_t* event) {}
+void server_uring_del_event(UNUSED server_t* server, UNUSED event_t* event) {}
+void server_uring_poll(UNUSED server_t* server) {}
+i32	 server_uring_sendmmsg(UNUSED server_t* server, UNUSED struct mmsghdr* msgs, UNUSED u32 count) { return -1; }
+void server_uring_destroy(UNUSED server_t* server) {}
+
+#endif // SERVER_IO_URING
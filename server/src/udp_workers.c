@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+#include "udp_workers.h"
+#include "nano_timer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* How often a blocked worker wakes up to check if it should quit. */
+#define UDP_WORKER_WAKEUP_US 100000
+
+/* The slot at `head` to read into, NULL while the tick thread hasn't freed one up. */
+static udp_datagram_t*
+udp_worker_slot(udp_worker_t* worker)
+{
+	const u32 head = atomic_load_explicit(&worker->head, memory_order_relaxed);
+	const u32 tail = atomic_load_explicit(&worker->tail, memory_order_acquire);
+
+	if (head - tail >= UDP_WORKER_QUEUE_SIZE)
+		return NULL;
+	return worker->queue + (head & (UDP_WORKER_QUEUE_SIZE - 1));
+}
+
+static void*
+udp_worker_thread(void* arg)
+{
+	udp_worker_t* worker = arg;
+	udp_datagram_t overflow = { .buf = worker->overflow };
+	hr_time_t current_time;
+	i64 bytes_read;
+
+	while (atomic_load_explicit(worker->quit, memory_order_relaxed) == false)
+	{
+		udp_datagram_t* slot = udp_worker_slot(worker);
+		udp_datagram_t* datagram = (slot) ? slot : &overflow;
+
+		datagram->addr.addr_len = sizeof(struct sockaddr_in);
+
+		bytes_read = recvfrom(worker->fd, datagram->buf, UDP_WORKER_BUFFER_SIZE, 0,
+							  (struct sockaddr*)&datagram->addr.addr, &datagram->addr.addr_len);
+		if (bytes_read == -1)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				perror("udp worker recvfrom");
+			continue;
+		}
+
+		/* Tick thread is behind, UDP would've lost it in the socket buffer anyway. */
+		if (slot == NULL)
+		{
+			atomic_fetch_add_explicit(&worker->dropped, 1, memory_order_relaxed);
+			continue;
+		}
+
+		nano_gettime(&current_time);
+		datagram->timestamp_s = nano_time_s(&current_time);
+		datagram->size = bytes_read;
+		datagram->addr.ipaddr[0] = 0x00;
+		atomic_fetch_add_explicit(&worker->head, 1, memory_order_release);
+	}
+	return NULL;
+}
+
+static i32
+udp_worker_socket(const struct sockaddr* addr, socklen_t addr_len)
+{
+	const struct timeval timeout = { .tv_usec = UDP_WORKER_WAKEUP_US };
+	const i32 on = 1;
+	i32 fd;
+
+	if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+	{
+		perror("socket UDP worker");
+		return -1;
+	}
+
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1 ||
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1)
+	{
+		perror("setsockopt UDP worker");
+		close(fd);
+		return -1;
+	}
+
+	if (bind(fd, addr, addr_len) == -1)
+	{
+		perror("bind UDP worker");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Binds `count` SO_REUSEPORT sockets to `addr` and starts a receive thread on each. */
+i32
+udp_workers_init(udp_workers_t* workers, u32 count, const struct sockaddr* addr, socklen_t addr_len)
+{
+	workers->count = 0;
+	atomic_init(&workers->quit, false);
+	workers->workers = aligned_alloc(_Alignof(udp_worker_t), sizeof(udp_worker_t) * count);
+	memset(workers->workers, 0, sizeof(udp_worker_t) * count);
+
+	for (u32 i = 0; i < count; i++)
+	{
+		udp_worker_t* worker = workers->workers + i;
+
+		if ((worker->fd = udp_worker_socket(addr, addr_len)) == -1)
+		{
+			udp_workers_destroy(workers);
+			return -1;
+		}
+		worker->quit = &workers->quit;
+		worker->overflow = malloc(UDP_WORKER_BUFFER_SIZE);
+		for (u32 j = 0; j < UDP_WORKER_QUEUE_SIZE; j++)
+			worker->queue[j].buf = malloc(UDP_WORKER_BUFFER_SIZE);
+		workers->count++;
+	}
+
+	for (u32 i = 0; i < count; i++)
+	{
+		udp_worker_t* worker = workers->workers + i;
+
+		if ((errno = pthread_create(&worker->thread, NULL, udp_worker_thread, worker)))
+		{
+			perror("pthread_create UDP worker");
+			udp_workers_destroy(workers);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ *	Hands every queued datagram to `func`. Each slot keeps its buffer,
+ *	unless `func` keeps it (returns true), then the slot gets a fresh one.
+ */
+void
+udp_workers_drain(udp_workers_t* workers, udp_datagram_func_t func, void* ctx)
+{
+	for (u32 i = 0; i < workers->count; i++)
+	{
+		udp_worker_t* worker = workers->workers + i;
+		const u32 head = atomic_load_explicit(&worker->head, memory_order_acquire);
+		u32 tail = atomic_load_explicit(&worker->tail, memory_order_relaxed);
+
+		while (tail != head)
+		{
+			udp_datagram_t* datagram = worker->queue + (tail & (UDP_WORKER_QUEUE_SIZE - 1));
+
+			if (func(ctx, datagram))
+				datagram->buf = malloc(UDP_WORKER_BUFFER_SIZE);
+			tail++;
+		}
+		atomic_store_explicit(&worker->tail, tail, memory_order_release);
+	}
+}
+
+u32
+udp_workers_dropped(const udp_workers_t* workers)
+{
+	u32 dropped = 0;
+
+	for (u32 i = 0; i < workers->count; i++)
+		dropped += atomic_load_explicit(&workers->workers[i].dropped, memory_order_relaxed);
+	return dropped;
+}
+
+void
+udp_workers_destroy(udp_workers_t* workers)
+{
+	if (workers->workers == NULL)
+		return;
+
+	atomic_store(&workers->quit, true);
+
+	for (u32 i = 0; i < workers->count; i++)
+	{
+		udp_worker_t* worker = workers->workers + i;
+
+		if (worker->thread)
+			pthread_join(worker->thread, NULL);
+		close(worker->fd);
+
+		free(worker->overflow);
+		for (u32 j = 0; j < UDP_WORKER_QUEUE_SIZE; j++)
+			free(worker->queue[j].buf);
+	}
+
+	free(workers->workers);
+	workers->workers = NULL;
+	workers->count = 0;
+}